@@ -0,0 +1,505 @@
+/**
+ * Micro-benchmarks for cprime.h
+ * 
+ * Build and run:
+ *   cc -O2 -o bench bench.c && ./bench [filter...] [--json results.json] [--samples N] [--sample-ms MS]
+ */
+#define CPRIME_IMPLEMENTATION
+#include "cprime.h"
+#include <sys/wait.h>
+
+#define BENCH_LINES 100000
+
+static char bench_input[] = "/tmp/cprime_bench_XXXXXX";
+static pid_t bench_feeder = -1;
+
+/* Reopen the input when a reader reaches the end so every iteration does real work */
+static FileReader* bench_reader(bool restart) {
+    static FileReader* fr = NULL;
+    if (fr == NULL || restart) {
+        close_FileReader(fr);
+        fr = new_FileReader(bench_input);
+    }
+    return fr;
+}
+
+static FileReader* bench_cold_reader(bool restart) {
+    static FileReader* fr = NULL;
+    if (fr == NULL || restart) {
+        close_FileReader(fr);
+        fr = new_FileReader(bench_input, true);
+    }
+    return fr;
+}
+
+static FileWriter* bench_writer(void) {
+    static FileWriter* fw = NULL;
+    if (fw == NULL) fw = new_FileWriter("/dev/null");
+    return fw;
+}
+
+static char bench_mapped_output[] = "/tmp/cprime_bench_mapped_XXXXXX";
+
+static FileWriter* bench_mapped_writer(void) {
+    static FileWriter* fw = NULL;
+    if (fw == NULL) {
+        int fd = mkstemp(bench_mapped_output);
+        if (fd >= 0) close(fd);
+        fw = new_MappedFileWriter(bench_mapped_output);
+    }
+    return fw;
+}
+
+static char bench_text[] = "The quick brown fox jumps over the lazy dog; Pack my box with five dozen liquor jugs.";
+
+
+/* FileReader */
+
+BENCH(FileReader_nextLine) {
+    string line = FileReader_nextLine(bench_reader(false));
+    if (line == NULL) line = FileReader_nextLine(bench_reader(true));
+    do_not_optimize(line);
+    cprime_free(line);
+}
+
+BENCH(FileReader_nextLine_cold) {
+    string line = FileReader_nextLine(bench_cold_reader(false));
+    if (line == NULL) line = FileReader_nextLine(bench_cold_reader(true));
+    do_not_optimize(line);
+    cprime_free(line);
+}
+
+BENCH(FileReader_nextString) {
+    string word = FileReader_nextString(bench_reader(false));
+    if (word == NULL) word = FileReader_nextString(bench_reader(true));
+    do_not_optimize(word);
+}
+
+BENCH(FileReader_nextInt) {
+    int n = FileReader_nextInt(bench_reader(false));
+    if (n == INT_MAX && !FileReader_hasNext(bench_reader(false))) n = FileReader_nextInt(bench_reader(true));
+    do_not_optimize(n);
+}
+
+BENCH(FileReader_nextDouble) {
+    double d = FileReader_nextDouble(bench_reader(false));
+    if (d == DBL_MAX && !FileReader_hasNext(bench_reader(false))) d = FileReader_nextDouble(bench_reader(true));
+    do_not_optimize(d);
+}
+
+BENCH(FileReader_nextChar) {
+    char c = FileReader_nextChar(bench_reader(false));
+    if (c == CHAR_MAX) c = FileReader_nextChar(bench_reader(true));
+    do_not_optimize(c);
+}
+
+BENCH(FileReader_seekLine) {
+    static size_t line = 0;
+    FileReader* fr = bench_reader(false);
+    line = (line + 7919) % BENCH_LINES;
+    FileReader_seekLine(fr, line);
+    string s = FileReader_nextLine(fr);
+    do_not_optimize(s);
+    cprime_free(s);
+}
+
+
+/* Iterators */
+
+/* Lines whose first number ends in 0 (a tenth of them) */
+static bool bench_ends_in_zero(const char* line, size_t length, any arg) {
+    (void) arg;
+    const char* space = (const char*) memchr(line, ' ', length);
+    return space != NULL && space > line && space[-1] == '0';
+}
+
+/* Lines pulled through a pipeline over the shared reader, restarted with it */
+static Iter* bench_iter(bool restart, bool filtered) {
+    static Iter* iters[2] = { NULL, NULL };
+    if (iters[filtered] == NULL || restart) {
+        delete_Iter(iters[filtered]);
+        iters[filtered] = iter_lines(bench_reader(true));
+        if (filtered) iters[filtered] = iter_filter(iters[filtered], bench_ends_in_zero);
+    }
+    return iters[filtered];
+}
+
+BENCH(Iter_next_lines) {
+    string line = Iter_next(bench_iter(false, false));
+    if (line == NULL) line = Iter_next(bench_iter(true, false));
+    do_not_optimize(line);
+}
+
+BENCH(Iter_next_filtered) {
+    string line = Iter_next(bench_iter(false, true));
+    if (line == NULL) line = Iter_next(bench_iter(true, true));
+    do_not_optimize(line);
+}
+
+
+/* CSV */
+
+/* The input lines are space-separated: an int, a double, then three words */
+static CsvReader* bench_csv(bool restart) {
+    static CsvReader* csv = NULL;
+    if (csv == NULL || restart) {
+        delete_CsvReader(csv);
+        csv = new_CsvReader(bench_reader(true), ' ');
+    }
+    return csv;
+}
+
+BENCH(CsvReader_next) {
+    if (!CsvReader_next(bench_csv(false))) CsvReader_next(bench_csv(true));
+    do_not_optimize(CsvReader_count(bench_csv(false)));
+}
+
+BENCH(csv_double) {
+    if (!CsvReader_next(bench_csv(false))) CsvReader_next(bench_csv(true));
+    do_not_optimize(csv_double(bench_csv(false), 1));
+}
+
+
+/* FileWriter */
+
+BENCH(FileWriter_writeLine)   { FileWriter_writeLine(bench_writer(), bench_text); }
+BENCH(FileWriter_writeString) { FileWriter_writeString(bench_writer(), "token"); }
+BENCH(FileWriter_writeChar)   { FileWriter_writeChar(bench_writer(), 'x'); }
+BENCH(FileWriter_writeInt)    { FileWriter_writeInt(bench_writer(), 1234567); }
+BENCH(FileWriter_writeLong)   { FileWriter_writeLong(bench_writer(), 1234567890123L); }
+BENCH(FileWriter_writeFloat)  { FileWriter_writeFloat(bench_writer(), 3.14159f); }
+BENCH(FileWriter_writeDouble) { FileWriter_writeDouble(bench_writer(), 2.718281828459045); }
+
+BENCH(MappedFileWriter_writeInt)    { FileWriter_writeInt(bench_mapped_writer(), 1234567); }
+BENCH(MappedFileWriter_writeDouble) { FileWriter_writeDouble(bench_mapped_writer(), 2.718281828459045); }
+
+
+/* JSON */
+
+static JsonWriter* bench_json(void) {
+    static JsonWriter* json = NULL;
+    if (json == NULL) json = new_JsonWriter(bench_writer());
+    return json;
+}
+
+BENCH(JsonWriter_record) {
+    JsonWriter* json = bench_json();
+    JsonWriter_beginObject(json);
+    JsonWriter_writeKey(json, "id");
+    JsonWriter_writeInt(json, 1234567);
+    JsonWriter_writeKey(json, "price");
+    JsonWriter_writeDouble(json, 19.99);
+    JsonWriter_writeKey(json, "text");
+    JsonWriter_writeString(json, bench_text);
+    JsonWriter_endObject(json);
+}
+
+
+/* Compression */
+
+static unsigned char bench_block[LZ_BLOCK_SIZE], bench_packed[LZ_BLOCK_SIZE + LZ_BLOCK_SIZE / 255 + 16];
+static size_t bench_packed_size = 0;
+
+/* A block of log-like text: repetitive, but not trivially so */
+static void bench_fill_block(void) {
+    size_t used = 0;
+    for (int i = 0; used + 64 < sizeof bench_block; i++)
+        used += (size_t) snprintf((char*) bench_block + used, 64, "%d INFO served /api/items/%d in %dms\n", i, i % 97, i % 13);
+    bench_packed_size = lz_compress(bench_block, sizeof bench_block, bench_packed, sizeof bench_packed);
+}
+
+BENCH(lz_compress_block) {
+    if (bench_packed_size == 0) bench_fill_block();
+    do_not_optimize(lz_compress(bench_block, sizeof bench_block, bench_packed, sizeof bench_packed));
+}
+
+BENCH(lz_decompress_block) {
+    static unsigned char out[LZ_BLOCK_SIZE];
+    if (bench_packed_size == 0) bench_fill_block();
+    do_not_optimize(lz_decompress(bench_packed, bench_packed_size, out, sizeof out));
+}
+
+
+/* Input */
+
+/* Feed stdin from a child process that writes lines forever */
+static void bench_pipe_stdin(void) {
+    int fds[2];
+    if (pipe(fds) != 0) exit(EXIT_FAILURE);
+    bench_feeder = fork();
+    if (bench_feeder == 0) {
+        close(fds[0]);
+        char block[4096];
+        size_t used = 0;
+        while (used + 16 < sizeof block) used += (size_t) snprintf(block + used, 16, "input %d\n", (int) used);
+        while (write(fds[1], block, used) > 0) {}
+        _exit(0);
+    }
+    close(fds[1]);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+}
+
+BENCH(get_string_pipe) {
+    if (bench_feeder < 0) bench_pipe_stdin();
+    string line = get_string(NULL, NULL);
+    do_not_optimize(line);
+}
+
+
+/* Strings */
+
+BENCH(hash_bytes_short) { do_not_optimize(hash_bytes("liquor", 6)); }
+BENCH(hash_bytes_long)  { do_not_optimize(hash_bytes(bench_text, sizeof bench_text - 1)); }
+
+static Interner* bench_interner(void) {
+    static Interner* interner = NULL;
+    if (interner == NULL) {
+        interner = new_Interner();
+        char word[16];
+        fori (i, 1000) {
+            snprintf(word, sizeof word, "word%d", i);
+            Interner_id(interner, word);
+        }
+    }
+    return interner;
+}
+
+BENCH(Interner_id_hit) {
+    static const char* words[] = { "word7", "word512", "word999", "word42" };
+    static size_t next = 0;
+    do_not_optimize(Interner_id(bench_interner(), words[next++ & 3]));
+}
+
+BENCH(FileReader_nextString_interned) {
+    const char* word = FileReader_nextString(bench_reader(false), bench_interner());
+    if (word == NULL) word = FileReader_nextString(bench_reader(true), bench_interner());
+    do_not_optimize(word);
+}
+
+BENCH(substr_range) {
+    string s = substr(bench_text, 4, 40);
+    do_not_optimize(s);
+    cprime_free(s);
+}
+
+BENCH(substr_suffix) {
+    string s = substr(bench_text, 10);
+    do_not_optimize(s);
+    cprime_free(s);
+}
+
+BENCH(strindex_hit)  { do_not_optimize(strindex(bench_text, "liquor")); }
+BENCH(strindex_miss) { do_not_optimize(strindex(bench_text, "absent")); }
+BENCH(strindex_char) { do_not_optimize(strindex_char(bench_text, ';')); }
+
+BENCH(strtoupper) {
+    string s = strtoupper(bench_text);
+    do_not_optimize(s);
+    cprime_free(s);
+}
+
+
+/* Sorting */
+
+#define BENCH_SORT_N 4096
+
+static int bench_keys[BENCH_SORT_N], bench_sorted[BENCH_SORT_N];
+
+/* The same pseudo-random keys for every iteration */
+static int* bench_unsorted(void) {
+    static uint32_t state = 0;
+    if (state == 0) {
+        state = 2463534242u;
+        fori (i, BENCH_SORT_N) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            bench_keys[i] = (int) (state >> 1);
+        }
+    }
+    memcpy(bench_sorted, bench_keys, sizeof bench_keys);
+    return bench_sorted;
+}
+
+static int bench_compare_int(const void* a, const void* b) {
+    int x = *(const int*) a, y = *(const int*) b;
+    return (x > y) - (x < y);
+}
+
+BENCH(qsort_int_4096)      { qsort(bench_unsorted(), BENCH_SORT_N, sizeof (int), bench_compare_int); }
+BENCH(sort_int_4096)       { sort(int, bench_unsorted(), BENCH_SORT_N); }
+BENCH(radix_sort_int_4096) { radix_sort(int, bench_unsorted(), BENCH_SORT_N); }
+
+
+/* Guarded buffers */
+
+BENCH(malloc_free_4k) {
+    char* buffer = (char*) malloc(4096);
+    do_not_optimize(buffer);
+    free(buffer);
+}
+
+BENCH(guarded_alloc_free_4k) {
+    char* buffer = (char*) guarded_alloc(4096);
+    do_not_optimize(buffer);
+    guarded_free(buffer);
+}
+
+
+/* Deadlines */
+
+BENCH(try_block) {
+    try {
+        do_not_optimize(ex_frame__);
+    } catch (TIMEOUT_EXCEPTION) {
+    } etry;
+}
+
+BENCH(try_deadline_block) {
+    try_deadline(1000) {
+        do_not_optimize(ex_frame__);
+    } catch (TIMEOUT_EXCEPTION) {
+    } etry;
+}
+
+BENCH(deadline_check_armed) {
+    try_deadline(1000) {
+        for (int i = 0; i < 1000; i++) deadline_check();
+    } catch (TIMEOUT_EXCEPTION) {
+    } etry;
+}
+
+/* Bitsets */
+
+#define BENCH_BITS (1u << 20)
+
+/* Two bitsets of 1M bits: every third bit set, and a sparse pseudo-random 1 in 64 */
+static Bitset* bench_bitset(int which) {
+    static Bitset* bitsets[2] = { NULL, NULL };
+    if (bitsets[0] == NULL) {
+        bitsets[0] = new_Bitset(BENCH_BITS);
+        bitsets[1] = new_Bitset(BENCH_BITS);
+        uint32_t state = 2463534242u;
+        for (size_t i = 0; i < BENCH_BITS; i++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            if (i % 3 == 0) Bitset_set(bitsets[0], i);
+            if (state % 64 == 0) Bitset_set(bitsets[1], i);
+        }
+    }
+    return bitsets[which];
+}
+
+BENCH(Bitset_and_1M) {
+    Bitset_and(bench_bitset(0), bench_bitset(0));
+    do_not_optimize(bench_bitset(0)->words[0]);
+}
+
+BENCH(Bitset_count_1M) { do_not_optimize(Bitset_count(bench_bitset(0))); }
+
+BENCH(Bitset_test_loop_sparse_1M) {
+    size_t sum = 0;
+    for (size_t i = 0; i < BENCH_BITS; i++) if (Bitset_test(bench_bitset(1), i)) sum += i;
+    do_not_optimize(sum);
+}
+
+BENCH(foreach_set_bit_sparse_1M) {
+    size_t sum = 0;
+    foreach_set_bit (i, bench_bitset(1)) sum += i;
+    do_not_optimize(sum);
+}
+
+
+/* Array kernels */
+
+#define BENCH_ARRAY_N (1 << 16)
+
+static double bench_doubles[BENCH_ARRAY_N];
+static int bench_ints[BENCH_ARRAY_N];
+
+static void bench_fill_arrays(void) {
+    if (bench_doubles[1] != 0) return;
+    fori (i, BENCH_ARRAY_N) {
+        bench_doubles[i] = (i * 7919 % 1000) / 7.0;
+        bench_ints[i] = i * 7919 % 1000003 - 500000;
+    }
+}
+
+BENCH(sum_loop_double_64k) {
+    bench_fill_arrays();
+    double sum = 0;
+    fori (i, BENCH_ARRAY_N) sum += bench_doubles[i];
+    do_not_optimize(sum);
+}
+
+BENCH(arr_sum_double_64k) {
+    bench_fill_arrays();
+    do_not_optimize(arr_sum(bench_doubles));
+}
+
+BENCH(min_loop_int_64k) {
+    bench_fill_arrays();
+    int smallest = INT_MAX;
+    fori (i, BENCH_ARRAY_N) smallest = min(smallest, bench_ints[i]);
+    do_not_optimize(smallest);
+}
+
+BENCH(arr_min_int_64k) {
+    bench_fill_arrays();
+    do_not_optimize(arr_min(bench_ints));
+}
+
+BENCH(arr_dot_double_64k) {
+    bench_fill_arrays();
+    do_not_optimize(arr_dot(bench_doubles, bench_doubles));
+}
+
+/* Enums */
+
+#define BENCH_METHODS(X) X(GET) X(HEAD) X(POST) X(PUT) X(DELETE) X(CONNECT) X(OPTIONS) X(TRACE) X(PATCH)
+enum_to_str(BenchMethod, BENCH_METHODS)
+
+static const char* bench_method_names[] = { "PATCH", "GET", "OPTIONS", "DELETE", "BREW" };
+
+BENCH(enum_strcmp_chain) {
+    static size_t next = 0;
+    const char* name = bench_method_names[next++ % arrlen(bench_method_names)];
+    size_t value = BenchMethod_COUNT;
+    fori (i, BenchMethod_COUNT) if (strcmp(name, BenchMethod_str[i]) == 0) { value = i; break; }
+    do_not_optimize(value);
+}
+
+BENCH(enum_from_str) {
+    static size_t next = 0;
+    do_not_optimize(enum_from_str(BenchMethod, bench_method_names[next++ % arrlen(bench_method_names)]));
+}
+
+
+int main(int argc, char** argv) {
+    int fd = mkstemp(bench_input);
+    if (fd < 0) return EXIT_FAILURE;
+    close(fd);
+    FileWriter* fw = new_FileWriter(bench_input);
+    fori (i, BENCH_LINES) {
+        FileWriter_writeInt(fw, i * 7919 % 1000003);
+        FileWriter_writeChar(fw, ' ');
+        FileWriter_writeDouble(fw, i / 7.0);
+        FileWriter_writeLine(fw, " lorem ipsum dolor");
+    }
+    close_FileWriter(fw, false);
+
+    int status = bench_main(argc, argv);
+
+    if (bench_feeder > 0) {
+        kill(bench_feeder, SIGKILL);
+        waitpid(bench_feeder, NULL, 0);
+    }
+    remove(bench_input);
+    remove(bench_mapped_output);
+    char sidecar[sizeof bench_input + 4];
+    snprintf(sidecar, sizeof sidecar, "%s.idx", bench_input);
+    remove(sidecar);
+    return status;
+}
@@ -11,11 +11,40 @@
  *  - String functions (substring, index, toupper/tolower, etc.)
  *  - Foreach, fori, and arrlen macros
  *  - File Reader and File Writer classes
+ *  - Compact binary records (varint/zigzag integers, raw IEEE floats, length-prefixed strings)
+ *  - Streaming CSV reader (RFC 4180) with SIMD field splitting, column projection, and zero-copy fields
+ *  - Streaming JSON/NDJSON writer with SIMD string escaping and allocation-free number formatting
+ *  - Optional LZ block compression for FileWriter output, detected and decompressed by FileReader
+ *  - Durable append-only logs with CRC32C-framed records, group commit, and torn-tail recovery
+ *  - Tail/follow mode for FileReader (inotify on Linux) that survives truncation and log rotation
+ *  - Persistent line-offset index (parallel build, sidecar file) for seeking and range reads by line number
+ *  - External merge sort of files larger than memory (parallel runs, loser-tree merge, key comparators, dedup)
+ *  - Zero-copy file copies and byte-range transfers (copy_file_range/sendfile/splice)
+ *  - Memory-mapped FileWriter with preallocated, on-demand growing output
+ *  - Cold-scan FileReader mode (O_DIRECT or drop-behind fadvise) that leaves the page cache untouched
+ *  - wyhash string hashing and an Interner mapping repeated strings to canonical pointers and small IDs
+ *  - Type-specialized sorting: inlined introsort, LSD radix sort, multikey string quicksort, and parallel sort
+ *  - X-macro enums with name tables and perfect-hash reverse lookup (`enum_to_str`/`enum_from_str`)
+ *  - Dynamic Bitset with SIMD AND/OR/XOR/ANDNOT, hardware popcount, and ctz-based set-bit iteration
+ *  - SIMD array kernels (`arr_sum`/`arr_min`/`arr_max`/`arr_dot`/`arr_scale`/`arr_fill`) with compensated float sums
+ *  - Guard-page buffers (`guarded_alloc`) whose overruns raise `OUT_OF_BOUNDS_EXCEPTION`, and catchable stack overflows
+ *  - Deadlines (`try_deadline`) that throw `TIMEOUT_EXCEPTION` from a per-thread timer, with cooperative checks in `FileReader`
+ *  - STB-style `CPRIME_IMPLEMENTATION` split for programs built from several files, with `static inline` hot paths
+ *  - Lazy iterator pipelines (`iter_lines`, `iter_filter`, `iter_map`, `iter_take`, `iter_batch`) over FileReader lines and tokens that read only as far as needed
+ *  - Lock-free SPSC/MPMC queues with blocking (futex) wrappers
+ *  - Fibers (stackful coroutines) with an epoll-driven scheduler and yielding file I/O
+ *  - Micro-benchmark harness (`BENCH`) with median/p99/MAD statistics and JSON output
+ *  - Scoped profiling (`PROFILE_SCOPE`/`PROFILE_FUNC`) with Chrome trace/Perfetto export
+ *  - Pluggable allocator with per-call-site allocation accounting and a leak report
  *  - Etc.
  * 
  * This header file is intended to be a drop-in replacement for much of the C standard library 
  * and is designed to be used alongside the standard C library headers.
  * 
+ * Define `CPRIME_IMPLEMENTATION` in exactly one source file before including this header to compile the
+ * library there; every other file includes it as is and gets the declarations, the macros, and the small hot
+ * functions as `static inline`, so programs split across several files link and still inline the hot paths.
+ * 
  * @author Daniel J. Szelogowski
  * @date September 2024
  * @license: MIT
@@ -23,6 +52,11 @@
 #ifndef _CPRIME_H_
 #define _CPRIME_H_
 
+/* GNU extensions (fopencookie, etc.) are only picked up if cprime.h is included before other headers */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <setjmp.h>
 #include <float.h>
@@ -38,6 +72,40 @@
 #include <string.h>
 #include <signal.h>
 #include <iso646.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <unistd.h>
+    #include <sched.h>
+    #include <pthread.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+
+    /* Missing when another header was included first under strict ISO C */
+    #ifndef O_CLOEXEC
+        #define O_CLOEXEC 0
+    #endif
+#endif
+
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #include <sys/epoll.h>
+    #include <linux/futex.h>
+    #include <sys/inotify.h>
+    #include <sys/sendfile.h>
+#endif
+
+#if !defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+    #include <ucontext.h>
+#endif
+
+/* Custom FILE* streams (fopencookie) are available */
+#if defined(__USE_GNU) || (defined(_GNU_SOURCE) && defined(__linux__) && !defined(__GLIBC__))
+    #define CPRIME_COOKIE_STREAMS 1
+#endif
 
 
 
@@ -47,17 +115,95 @@
 #define GET_MACRO3(_1, _2, _3, NAME, ...) NAME
 #define GET_MACRO4(_1, _2, _3, _4, NAME, ...) NAME
 #define GET_MACRO5(_1, _2, _3, _4, _5, NAME, ...) NAME
+#define GET_MACRO6(_1, _2, _3, _4, _5, _6, NAME, ...) NAME
 
 
 
 
 /* Exception handling */
-static jmp_buf ex_buf__;
-#define try do { switch( setjmp(ex_buf__) ) { case 0: while(1) {
+
+/* Throws may come from signal handlers, so frames use sigsetjmp (without saving the signal mask) where available */
+#if defined(__unix__) || defined(__APPLE__)
+    typedef sigjmp_buf __ex_jmp_buf;
+    #define __ex_setjmp(buf) sigsetjmp(buf, 0)
+    #define __ex_longjmp(buf, code) siglongjmp(buf, code)
+#else
+    typedef jmp_buf __ex_jmp_buf;
+    #define __ex_setjmp(buf) setjmp(buf)
+    #define __ex_longjmp(buf, code) longjmp(buf, code)
+#endif
+
+typedef struct __Deadline __Deadline;
+struct __Deadline {
+    uint64_t at;                // Monotonic time in ns, never later than the enclosing deadline
+    __Deadline* prev;
+};
+
+typedef struct __ExFrame __ExFrame;
+struct __ExFrame {
+    __ex_jmp_buf buf;
+    __ExFrame* prev;
+    __Deadline* deadline;       // Innermost deadline when the frame was entered
+    unsigned no_async_throw;    // Depth of sections holding off asynchronous throws when the frame was entered
+};
+extern _Thread_local __ExFrame* ex_frame__;        // Innermost active try frame
+extern _Thread_local __Deadline* __deadline_top;   // Innermost active deadline (see Deadlines)
+extern _Thread_local volatile unsigned __no_async_throw;            // Depth of sections holding off async throws
+extern _Thread_local volatile sig_atomic_t __async_throw_pending;   // A throw was held off by such a section
+
+void __deadline_restore(__Deadline* deadline);
+
+static inline void __ex_push(__ExFrame* frame) {
+    frame->prev = ex_frame__;
+    frame->deadline = __deadline_top;
+    frame->no_async_throw = __no_async_throw;
+    ex_frame__ = frame;
+}
+/* Leave a frame that was exited without a throw (a throw pops the frame before jumping) */
+static inline void __ex_pop(__ExFrame* frame) { if (ex_frame__ == frame) ex_frame__ = frame->prev; }
+
+void __ex_throw(int code);
+
+#define try do { __ExFrame ex_local__ __attribute__((__cleanup__(__ex_pop))); __ex_push(&ex_local__); \
+    switch( __ex_setjmp(ex_local__.buf) ) { case 0: while(1) {
 #define catch(x) break; case x:
 #define finally break; } default: {
 #define etry break; } } }while(0)
-#define throw(x) longjmp(ex_buf__, x)
+#define throw(x) __ex_throw(x)
+
+static inline void __async_throw_resume(const unsigned* depth) { __no_async_throw = *depth; }
+
+/*
+ * Hold off asynchronous throws (deadline timeouts raised by a signal) for the rest of the enclosing scope. Used at the
+ * top of library functions that take locks (stdio streams, malloc) or update shared state, which a throw from a signal
+ * handler would leave locked or half-updated; a timeout arriving meanwhile is left pending for `deadline_check`.
+ */
+#define __NO_ASYNC_THROW() \
+    const unsigned __async_depth __attribute__((__cleanup__(__async_throw_resume), unused)) = __no_async_throw++
+
+#ifdef CPRIME_IMPLEMENTATION
+_Thread_local __ExFrame* ex_frame__ = NULL;        // Innermost active try frame
+static _Thread_local int ex_code__ = 0;                   // Code of the most recent throw
+_Thread_local __Deadline* __deadline_top = NULL;   // Innermost active deadline (see Deadlines)
+_Thread_local volatile unsigned __no_async_throw = 0;
+_Thread_local volatile sig_atomic_t __async_throw_pending = 0;
+
+/* Unwind to the innermost try frame; an exception outside of any try block ends the program */
+void __ex_throw(int code) {
+    __no_async_throw++;  // A timeout must not land between popping the frame and restoring its deadline
+    __ExFrame* frame = ex_frame__;
+    ex_code__ = code;
+    if (frame == NULL) {
+        fprintf(stderr, "Uncaught exception %d\n", code);
+        exit(code);
+    }
+    ex_frame__ = frame->prev;
+    if (__deadline_top != frame->deadline)
+        __deadline_restore(frame->deadline);  // Leave the deadlines set inside the frame
+    __no_async_throw = frame->no_async_throw;   // Sections the jump leaves are over
+    __ex_longjmp(frame->buf, code);
+}
+#endif  // CPRIME_IMPLEMENTATION
 
 
 /* Exception codes */
@@ -95,23 +241,54 @@ static jmp_buf ex_buf__;
 #define IO_ERROR_EXCEPTION (33)
 #define EOF_EXCEPTION (34)
 #define NOT_FOUND_EXCEPTION (35)
+#define STACK_OVERFLOW_EXCEPTION (37)
+
+
+
+
+#if defined(__unix__) || defined(__APPLE__)
+/*
+ * Memory faults are told apart by address: inside a registered guard region (the guard pages of guarded buffers
+ * and fiber stacks) they raise the region's exception, on or just below the thread's stack they are a stack
+ * overflow, and anything else is a null or wild pointer. The table is read with plain atomic loads, so the signal
+ * handler can search it; it is only searched when a fault happens.
+ */
+
+/* Most guard regions registered at once */
+#define __GUARD_SLOTS 8192
 
+/* Faults this far below the lowest stack address still count as overflowing it (the kernel's guard gap) */
+#define __STACK_GUARD_GAP (1u << 20)
 
+/* Size of the alternate stack signal handlers run on, so a stack overflow can still be handled */
+#define __SIGNAL_STACK_SIZE (64u << 10)
 
+typedef struct __GuardSlot __GuardSlot;
+struct __GuardSlot {
+    atomic_uintptr_t start;     // 0 when free, 1 while being filled in
+    atomic_size_t length;
+    atomic_int code;            // Exception raised by a fault in [start, start + length)
+};
+
+/**
+ * @brief Give the calling thread an alternate signal stack and record its stack bounds, so that overflowing its
+ *        stack raises `STACK_OVERFLOW_EXCEPTION` instead of killing the process
+ * @return Whether the thread now has an alternate signal stack
+ * @note Done for the main thread at startup; other threads call it once before running code that could overflow.
+ *       The stack is released when the thread exits
+ */
+bool signal_stack_init(void);
+#endif
 
+#ifdef CPRIME_IMPLEMENTATION
 /* Exception signals */
 static void __handle_sigfpe(int sig)  { if (sig == SIGFPE)  throw(FLOATING_POINT_EXCEPTION); }
-static void __handle_sigsegv(int sig) { if (sig == SIGSEGV) throw(NULL_POINTER_EXCEPTION); }
 static void __handle_sigabrt(int sig) { if (sig == SIGABRT) throw(MEMORY_ALLOCATION_EXCEPTION); }
 static void __handle_sigill(int sig)  { if (sig == SIGILL)  throw(ILLEGAL_ARGUMENT_EXCEPTION); }
 static void __handle_sigterm(int sig) { if (sig == SIGTERM) throw(TIMEOUT_EXCEPTION); }
 static void __handle_sigint(int sig)  { if (sig == SIGINT)  throw(TIMEOUT_EXCEPTION); }
 
 #ifdef __unix__  // Or __APPLE__ for macOS, __linux__ for Linux
-    #ifdef SIGBUS
-        static void __handle_sigbus(int sig)  { if (sig == SIGBUS)  throw(BUS_ERROR_EXCEPTION); }
-    #endif 
-
     #ifdef SIGPIPE
         static void __handle_sigpipe(int sig) { if (sig == SIGPIPE) throw(PIPE_ERROR_EXCEPTION); }
     #endif
@@ -125,30 +302,151 @@ static void __handle_sigint(int sig)  { if (sig == SIGINT)  throw(TIMEOUT_EXCEPT
     #endif
 #endif  // __unix__
 
+#if defined(__unix__) || defined(__APPLE__)
+static __GuardSlot __guard_slots[__GUARD_SLOTS];
+static atomic_size_t __guard_used = 0;      // Slots claimed so far; the handler searches no further
+static atomic_size_t __guard_hint = 0;      // Where the next registration starts looking
+
+static _Thread_local uintptr_t __stack_low = 0, __stack_high = 0;
+
+/* Register a guard region; returns its slot, or -1 if the table is full */
+static long __guard_register(const void* start, size_t length, int code) {
+    size_t hint = atomic_load_explicit(&__guard_hint, memory_order_relaxed);
+    for (size_t k = 0; k < __GUARD_SLOTS; k++) {
+        size_t i = (hint + k) % __GUARD_SLOTS;
+        uintptr_t expected = 0;
+        if (!atomic_compare_exchange_strong(&__guard_slots[i].start, &expected, 1)) continue;
+        atomic_store_explicit(&__guard_slots[i].length, length, memory_order_relaxed);
+        atomic_store_explicit(&__guard_slots[i].code, code, memory_order_relaxed);
+        size_t used = atomic_load(&__guard_used);
+        while (used <= i && !atomic_compare_exchange_weak(&__guard_used, &used, i + 1)) {}
+        atomic_store_explicit(&__guard_slots[i].start, (uintptr_t) start, memory_order_release);
+        atomic_store_explicit(&__guard_hint, i + 1, memory_order_relaxed);
+        return (long) i;
+    }
+    return -1;
+}
+
+static void __guard_unregister(long slot) {
+    if (slot >= 0) atomic_store_explicit(&__guard_slots[slot].start, 0, memory_order_release);
+}
+
+/* Exception for a fault at `address`, or 0 if it is not in a guard region or near the stack */
+static int __guard_fault(uintptr_t address) {
+    size_t used = atomic_load_explicit(&__guard_used, memory_order_acquire);
+    for (size_t i = 0; i < used; i++) {
+        uintptr_t start = atomic_load_explicit(&__guard_slots[i].start, memory_order_acquire);
+        if (start > 1 && address - start < atomic_load_explicit(&__guard_slots[i].length, memory_order_relaxed))
+            return atomic_load_explicit(&__guard_slots[i].code, memory_order_relaxed);
+    }
+    if (__stack_high != 0 && address < __stack_high && address + __STACK_GUARD_GAP >= __stack_low)
+        return STACK_OVERFLOW_EXCEPTION;
+    return 0;
+}
+
+/* SIGSEGV and SIGBUS (which macOS raises for guard pages), run on the alternate stack */
+static void __handle_fault(int sig, siginfo_t* info, void* context) {
+    (void) context;
+    int code = __guard_fault((uintptr_t) info->si_addr);
+    if (code == 0) code = (sig == SIGSEGV) ? NULL_POINTER_EXCEPTION : BUS_ERROR_EXCEPTION;
+    throw(code);
+}
+
+static pthread_key_t __signal_stack_key;
+static pthread_once_t __signal_stack_once = PTHREAD_ONCE_INIT;
+
+static void __signal_stack_release(void* stack) {
+    stack_t disable = { .ss_flags = SS_DISABLE };
+    sigaltstack(&disable, NULL);
+    munmap(stack, __SIGNAL_STACK_SIZE);
+}
+
+static void __signal_stack_key_create(void) {
+    pthread_key_create(&__signal_stack_key, __signal_stack_release);
+}
+
+bool signal_stack_init(void) {
+    stack_t current;
+    if (sigaltstack(NULL, &current) == 0 && !(current.ss_flags & SS_DISABLE)) return true;
+    void* memory = mmap(NULL, __SIGNAL_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    stack_t stack = { .ss_sp = memory, .ss_size = __SIGNAL_STACK_SIZE, .ss_flags = 0 };
+    if (sigaltstack(&stack, NULL) != 0) {
+        munmap(memory, __SIGNAL_STACK_SIZE);
+        return false;
+    }
+    pthread_once(&__signal_stack_once, __signal_stack_key_create);
+    pthread_setspecific(__signal_stack_key, memory);
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+        void* low;
+        size_t size;
+        if (pthread_attr_getstack(&attributes, &low, &size) == 0) {
+            __stack_low = (uintptr_t) low;
+            __stack_high = (uintptr_t) low + size;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+#elif defined(__APPLE__)
+    __stack_high = (uintptr_t) pthread_get_stackaddr_np(pthread_self());
+    __stack_low = __stack_high - pthread_get_stacksize_np(pthread_self());
+#endif
+    return true;
+}
+#else
+static void __handle_sigsegv(int sig) { if (sig == SIGSEGV) throw(NULL_POINTER_EXCEPTION); }
+#endif
+
+/* Install a handler that may throw; the signal is left unblocked so it can be raised again after the jump */
+static void __install_handler(int sig, void (*handler)(int)) {
+#if defined(__unix__) || defined(__APPLE__)
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = handler;
+    action.sa_flags = SA_NODEFER | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(sig, &action, NULL);
+#else
+    signal(sig, handler);
+#endif
+}
+#endif  // CPRIME_IMPLEMENTATION
+
 
+#ifdef CPRIME_IMPLEMENTATION
 /* Register signal handlers */
 static void __setup_signal_handlers(void) {
-    signal(SIGFPE,  __handle_sigfpe);
-    signal(SIGSEGV, __handle_sigsegv);
-    signal(SIGABRT, __handle_sigabrt);
-    signal(SIGILL,  __handle_sigill);
-    signal(SIGTERM, __handle_sigterm);
-    signal(SIGINT,  __handle_sigint);
+    __install_handler(SIGFPE,  __handle_sigfpe);
+    __install_handler(SIGABRT, __handle_sigabrt);
+    __install_handler(SIGILL,  __handle_sigill);
+    __install_handler(SIGTERM, __handle_sigterm);
+    __install_handler(SIGINT,  __handle_sigint);
+    #if defined(__unix__) || defined(__APPLE__)
+        struct sigaction fault;
+        memset(&fault, 0, sizeof fault);
+        fault.sa_sigaction = __handle_fault;
+        fault.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+        sigemptyset(&fault.sa_mask);
+        sigaction(SIGSEGV, &fault, NULL);
+        sigaction(SIGBUS, &fault, NULL);
+        signal_stack_init();
+    #else
+        __install_handler(SIGSEGV, __handle_sigsegv);
+    #endif
     #ifdef __unix__
-        #ifdef SIGBUS
-            signal(SIGBUS,  __handle_sigbus);
-        #endif
         #ifdef SIGPIPE
-            signal(SIGPIPE, __handle_sigpipe);
+            __install_handler(SIGPIPE, __handle_sigpipe);
         #endif
         #ifdef SIGHUP
-            signal(SIGHUP,  __handle_sighup);
+            __install_handler(SIGHUP,  __handle_sighup);
         #endif
         #ifdef SIGQUIT
-            signal(SIGQUIT, __handle_sigquit);
+            __install_handler(SIGQUIT, __handle_sigquit);
         #endif
     #endif  // __unix__
 }
+#endif  // CPRIME_IMPLEMENTATION
 
 
 
@@ -172,9 +470,468 @@ static void __setup_signal_handlers(void) {
 #endif
 
 
+/* Memory management */
+
+/*
+ * Every allocation the library makes goes through `cprime_malloc`/`cprime_realloc`/`cprime_free`, which use the
+ * allocator installed with `set_allocator`. Setting `CPRIME_ALLOC_REPORT` in the environment (or calling
+ * `alloc_tracking(true)`) attributes each allocation to its call site; the sites that still own memory at exit
+ * are printed to stderr by the teardown. Release library results with `cprime_free`, or define
+ * `CPRIME_REDIRECT_FREE` before including the header so that plain `free` does so.
+ */
+
+/* Size of a cache line; used to keep fields written by different threads apart */
+#define CPRIME_CACHE_LINE 64
+
+/**
+ * @brief Pluggable allocator used for every allocation the library hands out or keeps
+ * @note Install it with `set_allocator` before the first allocation; `ctx` is passed back to each function
+ */
+typedef struct Allocator Allocator;
+struct Allocator {
+    void* (*allocate)(size_t size, void* ctx);
+    void* (*reallocate)(void* ptr, size_t size, void* ctx);
+    void (*release)(void* ptr, void* ctx);
+    void* ctx;
+};
+
+/**
+ * @brief Per-call-site allocation counters (collected while allocation tracking is enabled)
+ */
+typedef struct AllocSite AllocSite;
+struct AllocSite {
+    const char* file;
+    int line;
+    const char* function;
+    atomic_size_t count;       // Allocations made
+    atomic_size_t bytes;       // Bytes allocated in total
+    atomic_size_t live;        // Allocations not yet freed
+    atomic_size_t live_bytes;
+    atomic_size_t peak_bytes;  // Highest `live_bytes` seen
+    atomic_bool registered;
+    AllocSite* next;
+};
+
+/* Live allocations while tracking: pointer -> (site, size), sharded open-addressing tables */
+#define __ALLOC_SHARDS 16
+typedef struct __AllocEntry __AllocEntry;
+struct __AllocEntry {
+    void* ptr;
+    AllocSite* site;
+    size_t size;
+};
+typedef struct __AllocShard __AllocShard;
+struct __AllocShard {
+    _Alignas(CPRIME_CACHE_LINE) atomic_flag lock;
+    __AllocEntry* entries;
+    size_t capacity;           // Power of two
+    size_t count;
+};
+
+void* __cprime_malloc(AllocSite* site, size_t size);
+void* __cprime_calloc(AllocSite* site, size_t count, size_t size);
+void* __cprime_realloc(AllocSite* site, void* ptr, size_t size);
+
+/**
+ * @brief Free memory returned by the library (or by `cprime_malloc`, `cprime_calloc`, `cprime_realloc`)
+ * @param ptr The memory to free (NULL is ignored)
+ */
+void cprime_free(void* ptr);
+
+void* __cprime_aligned_alloc(AllocSite* site, size_t alignment, size_t size);
+
+/**
+ * @brief Free memory returned by `cprime_aligned_alloc`
+ * @param ptr The memory to free (NULL is ignored)
+ */
+void cprime_aligned_free(void* ptr);
+
+#define __ALLOC_SITE() ({ static AllocSite __alloc_site = { .file = __FILE__, .line = __LINE__, .function = __func__ }; &__alloc_site; })
+
+/* Allocation functions that go through the installed allocator and are attributed to the calling line */
+#define cprime_malloc(size) __cprime_malloc(__ALLOC_SITE(), (size))
+#define cprime_calloc(count, size) __cprime_calloc(__ALLOC_SITE(), (count), (size))
+#define cprime_realloc(ptr, size) __cprime_realloc(__ALLOC_SITE(), (ptr), (size))
+#define cprime_aligned_alloc(alignment, size) __cprime_aligned_alloc(__ALLOC_SITE(), (alignment), (size))
+
+/**
+ * @brief Replace the allocator used by the library (NULL restores malloc/realloc/free)
+ * @param allocator The allocator (copied)
+ */
+void set_allocator(const Allocator* allocator);
+
+/**
+ * @brief Enable or disable allocation tracking (also enabled at startup by the `CPRIME_ALLOC_REPORT` environment variable)
+ * @param enabled Whether to track allocations by call site
+ * @note Memory allocated while tracking was off is not attributed to any site
+ * @note Once tracking has been enabled, the sites that still own memory are reported to stderr at exit
+ */
+void alloc_tracking(bool enabled);
+
+/**
+ * @brief Print the allocation counters of every call site, largest live allocations first
+ * @param out The stream to print to
+ * @return The number of live (not yet freed) tracked allocations
+ */
+size_t alloc_report(FILE* out);
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Spin-wait hint */
+static inline void __cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void* __libc_allocate(size_t size, void* ctx) { (void) ctx; return malloc(size); }
+static void* __libc_reallocate(void* ptr, size_t size, void* ctx) { (void) ctx; return realloc(ptr, size); }
+static void __libc_release(void* ptr, void* ctx) { (void) ctx; free(ptr); }
+
+static Allocator __allocator = { __libc_allocate, __libc_reallocate, __libc_release, NULL };
+static atomic_bool __alloc_tracking = false;
+static atomic_bool __alloc_exit_report = false;   // Tracking was enabled at some point: report at exit
+static _Atomic(AllocSite*) __alloc_sites = NULL;
+static __AllocShard __alloc_shards[__ALLOC_SHARDS] = { [0 ... __ALLOC_SHARDS - 1] = { .lock = ATOMIC_FLAG_INIT } };
+
+static inline size_t __alloc_hash(void* ptr) {
+    uint64_t h = (uint64_t) (uintptr_t) ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (size_t) h;
+}
+
+static inline void __alloc_lock(__AllocShard* shard) {
+    while (atomic_flag_test_and_set_explicit(&shard->lock, memory_order_acquire)) __cpu_relax();
+}
+static inline void __alloc_unlock(__AllocShard* shard) {
+    atomic_flag_clear_explicit(&shard->lock, memory_order_release);
+}
+
+/* Add `ptr` to the live table; returns false if the table cannot grow (the allocation is then not tracked) */
+static bool __alloc_insert(void* ptr, AllocSite* site, size_t size) {
+    size_t hash = __alloc_hash(ptr);
+    __AllocShard* shard = &__alloc_shards[hash % __ALLOC_SHARDS];
+    __alloc_lock(shard);
+    if ((shard->count + 1) * 2 > shard->capacity) {
+        size_t capacity = shard->capacity ? shard->capacity * 2 : 1024;
+        __AllocEntry* entries = (__AllocEntry*) calloc(capacity, sizeof (__AllocEntry));
+        if (entries == NULL) {
+            __alloc_unlock(shard);
+            return false;
+        }
+        for (size_t i = 0; i < shard->capacity; i++) {
+            if (shard->entries[i].ptr == NULL) continue;
+            size_t j = (__alloc_hash(shard->entries[i].ptr) / __ALLOC_SHARDS) & (capacity - 1);
+            while (entries[j].ptr != NULL) j = (j + 1) & (capacity - 1);
+            entries[j] = shard->entries[i];
+        }
+        free(shard->entries);
+        shard->entries = entries;
+        shard->capacity = capacity;
+    }
+    size_t i = (hash / __ALLOC_SHARDS) & (shard->capacity - 1);
+    while (shard->entries[i].ptr != NULL) i = (i + 1) & (shard->capacity - 1);
+    shard->entries[i] = (__AllocEntry) { ptr, site, size };
+    shard->count++;
+    __alloc_unlock(shard);
+    return true;
+}
+
+/* Remove `ptr` from the live table; returns false if it was not allocated while tracking */
+static bool __alloc_remove(void* ptr, __AllocEntry* removed) {
+    size_t hash = __alloc_hash(ptr);
+    __AllocShard* shard = &__alloc_shards[hash % __ALLOC_SHARDS];
+    __alloc_lock(shard);
+    if (shard->capacity == 0) {
+        __alloc_unlock(shard);
+        return false;
+    }
+    size_t mask = shard->capacity - 1;
+    size_t i = (hash / __ALLOC_SHARDS) & mask;
+    while (shard->entries[i].ptr != ptr) {
+        if (shard->entries[i].ptr == NULL) {
+            __alloc_unlock(shard);
+            return false;
+        }
+        i = (i + 1) & mask;
+    }
+    *removed = shard->entries[i];
+    // Backward-shift deletion keeps every probe chain contiguous without tombstones
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (shard->entries[j].ptr == NULL) break;
+        size_t home = (__alloc_hash(shard->entries[j].ptr) / __ALLOC_SHARDS) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            shard->entries[i] = shard->entries[j];
+            i = j;
+        }
+    }
+    shard->entries[i].ptr = NULL;
+    shard->count--;
+    __alloc_unlock(shard);
+    return true;
+}
+
+static void __alloc_record(AllocSite* site, void* ptr, size_t size) {
+    if (!atomic_load_explicit(&site->registered, memory_order_acquire)
+        && !atomic_exchange_explicit(&site->registered, true, memory_order_acq_rel)) {
+        site->next = atomic_load_explicit(&__alloc_sites, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&__alloc_sites, &site->next, site,
+                                                      memory_order_release, memory_order_relaxed)) {}
+    }
+    atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->live, 1, memory_order_relaxed);
+    size_t live = atomic_fetch_add_explicit(&site->live_bytes, size, memory_order_relaxed) + size;
+    size_t peak = atomic_load_explicit(&site->peak_bytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(&site->peak_bytes, &peak, live,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {}
+    // Counted before the entry is visible, so a racing free never takes the counters below zero
+    if (!__alloc_insert(ptr, site, size)) {
+        atomic_fetch_sub_explicit(&site->count, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&site->bytes, size, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&site->live, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&site->live_bytes, size, memory_order_relaxed);
+    }
+}
+
+static void __alloc_release(const __AllocEntry* entry) {
+    atomic_fetch_sub_explicit(&entry->site->live, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&entry->site->live_bytes, entry->size, memory_order_relaxed);
+}
+
+static bool __alloc_forget(void* ptr) {
+    __AllocEntry entry;
+    if (!__alloc_remove(ptr, &entry)) return false;
+    __alloc_release(&entry);
+    return true;
+}
+
+void* __cprime_malloc(AllocSite* site, size_t size) {
+    __NO_ASYNC_THROW();
+    void* ptr = __allocator.allocate(size, __allocator.ctx);
+    if (ptr != NULL && atomic_load_explicit(&__alloc_tracking, memory_order_relaxed))
+        __alloc_record(site, ptr, size);
+    return ptr;
+}
+
+void* __cprime_calloc(AllocSite* site, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    void* ptr = __cprime_malloc(site, count * size);
+    if (ptr != NULL) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void* __cprime_realloc(AllocSite* site, void* ptr, size_t size) {
+    __NO_ASYNC_THROW();
+    if (ptr == NULL) return __cprime_malloc(site, size);
+    bool tracking = atomic_load_explicit(&__alloc_tracking, memory_order_relaxed);
+    // The old entry goes before `ptr` is freed, since another thread may be handed (and record) the same address
+    __AllocEntry entry;
+    bool known = tracking && __alloc_remove(ptr, &entry);
+    void* result = __allocator.reallocate(ptr, size, __allocator.ctx);
+    if (result == NULL) {
+        if (known && !__alloc_insert(ptr, entry.site, entry.size)) __alloc_release(&entry);
+        return NULL;
+    }
+    if (known) __alloc_release(&entry);
+    if (tracking) __alloc_record(site, result, size);
+    return result;
+}
+
+void cprime_free(void* ptr) {
+    __NO_ASYNC_THROW();
+    if (ptr == NULL) return;
+    if (atomic_load_explicit(&__alloc_tracking, memory_order_relaxed))
+        __alloc_forget(ptr);
+    __allocator.release(ptr, __allocator.ctx);
+}
+
+void* __cprime_aligned_alloc(AllocSite* site, size_t alignment, size_t size) {
+    char* raw = (char*) __cprime_malloc(site, size + alignment + sizeof (void*));
+    if (raw == NULL) return NULL;
+    uintptr_t aligned = ((uintptr_t) (raw + sizeof (void*)) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    ((void**) aligned)[-1] = raw;
+    return (void*) aligned;
+}
+
+void cprime_aligned_free(void* ptr) {
+    if (ptr != NULL) cprime_free(((void**) ptr)[-1]);
+}
+
+void set_allocator(const Allocator* allocator) {
+    if (allocator == NULL || allocator->allocate == NULL || allocator->reallocate == NULL || allocator->release == NULL)
+        __allocator = (Allocator) { __libc_allocate, __libc_reallocate, __libc_release, NULL };
+    else
+        __allocator = *allocator;
+}
+
+void alloc_tracking(bool enabled) {
+    if (enabled) atomic_store(&__alloc_exit_report, true);
+    atomic_store(&__alloc_tracking, enabled);
+}
+
+static int __alloc_site_compare(const void* a, const void* b) {
+    size_t x = atomic_load(&(*(AllocSite* const*) a)->live_bytes);
+    size_t y = atomic_load(&(*(AllocSite* const*) b)->live_bytes);
+    return (x < y) - (x > y);
+}
+
+size_t alloc_report(FILE* out) {
+    __NO_ASYNC_THROW();
+    size_t sites = 0, live = 0, live_bytes = 0;
+    for (AllocSite* site = atomic_load(&__alloc_sites); site != NULL; site = site->next) {
+        sites++;
+        live += atomic_load(&site->live);
+        live_bytes += atomic_load(&site->live_bytes);
+    }
+    AllocSite** sorted = (AllocSite**) malloc((sites ? sites : 1) * sizeof (AllocSite*));
+    if (sorted == NULL) return live;
+    size_t n = 0;
+    for (AllocSite* site = atomic_load(&__alloc_sites); site != NULL; site = site->next) sorted[n++] = site;
+    qsort(sorted, n, sizeof (AllocSite*), __alloc_site_compare);
+    fprintf(out, "cprime allocation report: %zu live allocations (%zu bytes)\n", live, live_bytes);
+    fprintf(out, "%10s %12s %10s %14s %12s  %s\n", "live", "live bytes", "count", "bytes", "peak bytes", "site");
+    for (size_t i = 0; i < n; i++) {
+        AllocSite* site = sorted[i];
+        fprintf(out, "%10zu %12zu %10zu %14zu %12zu  %s:%d (%s)\n",
+                atomic_load(&site->live), atomic_load(&site->live_bytes), atomic_load(&site->count),
+                atomic_load(&site->bytes), atomic_load(&site->peak_bytes), site->file, site->line, site->function);
+    }
+    free(sorted);
+    return live;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Guarded allocations */
+
+/*
+ * A guarded buffer gets a mapping of its own, with its last byte at the end of a page followed by an inaccessible
+ * guard page (and another guard page in front). Accesses inside the buffer cost nothing extra, while reading or
+ * writing even one byte past the end faults, and the fault handler raises `OUT_OF_BOUNDS_EXCEPTION` where the
+ * access happened. The start of the buffer is only protected from runs past the page it begins in. Each buffer
+ * costs at least three pages and a few system calls, so guard buffers that hold untrusted input, not every
+ * allocation.
+ */
+
+/* Bookkeeping stored in front of each guarded buffer */
+typedef struct __GuardHeader __GuardHeader;
+struct __GuardHeader {
+    char* base;                 // The mapping, guard pages included
+    size_t length;
+    size_t size;                // Bytes requested
+    long slot;                  // Registration of the mapping
+};
+
+/**
+ * @brief Allocate a buffer that ends right against a guard page, so overruns raise `OUT_OF_BOUNDS_EXCEPTION`
+ * @param size The number of bytes
+ * @return The buffer, aligned to the largest power of two (up to 16) dividing `size`, or NULL if it cannot be
+ *         allocated; release it with `guarded_free`
+ * @note Without mmap (outside of Unix-like systems) this is a plain `cprime_malloc` with no guard
+ */
+void* guarded_alloc(size_t size);
+
+/**
+ * @brief Free a buffer returned by `guarded_alloc` or `guarded_realloc`
+ * @param ptr The buffer (NULL is ignored)
+ * @throw `OUT_OF_BOUNDS_EXCEPTION` if a write before the start of the buffer overwrote its bookkeeping
+ */
+void guarded_free(void* ptr);
+
+/**
+ * @brief Resize a guarded buffer; the contents move to a new mapping so the end stays against its guard page
+ * @param ptr The buffer (NULL allocates a new one)
+ * @param size The new number of bytes
+ * @return The resized buffer, or NULL (leaving `ptr` untouched) if it cannot be allocated
+ */
+void* guarded_realloc(void* ptr, size_t size);
+
+/**
+ * @brief Allocator that guards every library allocation; install it with `set_allocator(&guarded_allocator)`
+ *        before the first allocation, e.g. while fuzzing or testing a parser
+ */
+extern const Allocator guarded_allocator;
+
+#ifdef CPRIME_IMPLEMENTATION
+void* guarded_alloc(size_t size) {
+    __NO_ASYNC_THROW();
+#if defined(__unix__) || defined(__APPLE__)
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - 4 * page) return NULL;
+    size_t data = (size + sizeof (__GuardHeader) + page - 1) / page * page;
+    char* base = (char*) mmap(NULL, data + 2 * page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    __GuardHeader header = { base, data + 2 * page, size, -1 };
+    if (mprotect(base + page, data, PROT_READ | PROT_WRITE) != 0
+        || (header.slot = __guard_register(base, header.length, OUT_OF_BOUNDS_EXCEPTION)) < 0) {
+        munmap(base, header.length);
+        return NULL;
+    }
+    char* buffer = base + page + data - size;
+    memcpy(buffer - sizeof header, &header, sizeof header);
+    return buffer;
+#else
+    return cprime_malloc(size);
+#endif
+}
+
+void guarded_free(void* ptr) {
+    __NO_ASYNC_THROW();
+    if (ptr == NULL) return;
+#if defined(__unix__) || defined(__APPLE__)
+    __GuardHeader header;
+    memcpy(&header, (char*) ptr - sizeof header, sizeof header);
+    if (header.slot < 0 || header.slot >= __GUARD_SLOTS
+        || atomic_load(&__guard_slots[header.slot].start) != (uintptr_t) header.base
+        || atomic_load(&__guard_slots[header.slot].length) != header.length
+        || (char*) ptr + header.size != header.base + header.length - (size_t) sysconf(_SC_PAGESIZE)) {
+        throw(OUT_OF_BOUNDS_EXCEPTION);
+        return;
+    }
+    __guard_unregister(header.slot);
+    munmap(header.base, header.length);
+#else
+    cprime_free(ptr);
+#endif
+}
+
+void* guarded_realloc(void* ptr, size_t size) {
+    __NO_ASYNC_THROW();
+    if (ptr == NULL) return guarded_alloc(size);
+#if defined(__unix__) || defined(__APPLE__)
+    __GuardHeader header;
+    memcpy(&header, (char*) ptr - sizeof header, sizeof header);
+    void* resized = guarded_alloc(size);
+    if (resized == NULL) return NULL;
+    memcpy(resized, ptr, (header.size < size) ? header.size : size);
+    guarded_free(ptr);
+    return resized;
+#else
+    return cprime_realloc(ptr, size);
+#endif
+}
+
+static void* __guarded_allocate(size_t size, void* ctx) { (void) ctx; return guarded_alloc(size); }
+static void* __guarded_reallocate(void* ptr, size_t size, void* ctx) { (void) ctx; return guarded_realloc(ptr, size); }
+static void __guarded_release(void* ptr, void* ctx) { (void) ctx; guarded_free(ptr); }
+
+const Allocator guarded_allocator = { __guarded_allocate, __guarded_reallocate, __guarded_release, NULL };
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
 /* Attribute definitions */
 
-void autofree_impl(void *p) { free(*((void **)p)); }
+static inline void autofree_impl(void *p) { cprime_free(*((void **)p)); }
 /* Automatically frees a value at the end of scope */
 #define autofree __attribute__((__cleanup__(autofree_impl)))
 
@@ -195,11 +952,37 @@ typedef void* any;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-security"
 
+extern string* strings;
+
+#ifdef CPRIME_IMPLEMENTATION
 static size_t allocations = 0;
-static string* strings = NULL;
+string* strings = NULL;
+#endif  // CPRIME_IMPLEMENTATION
 
 #undef get_string
+string get_string(va_list* args, const char* format, ...);
+char get_char(const char* format, ...);
+double get_double(const char* format, ...);
+float get_float(const char* format, ...);
+int get_int(const char* format, ...);
+long get_long(const char* format, ...);
+long long get_long_long(const char* format, ...);
+
+/* Macro to abstract get_X as `input(int, "Enter an int: ")` */
+#define input(type, prompt) \
+    _Generic((type)0, \
+        int: get_int, \
+        float: get_float, \
+        double: get_double, \
+        long: get_long, \
+        long long: get_long_long, \
+        char: get_char, \
+        string: get_string \
+    )(prompt)
+
+#ifdef CPRIME_IMPLEMENTATION
 string get_string(va_list* args, const char* format, ...) {
+    __NO_ASYNC_THROW();
     if (allocations == SIZE_MAX / sizeof (string))
         return NULL;
     string buffer = NULL;
@@ -222,12 +1005,12 @@ string get_string(va_list* args, const char* format, ...) {
             if (capacity < SIZE_MAX) {
                 capacity++;
             } else {
-                free(buffer);
+                cprime_free(buffer);
                 return NULL;
             }
-            string temp = (string) realloc(buffer, capacity);
+            string temp = (string) cprime_realloc(buffer, capacity);
             if (temp == NULL) {
-                free(buffer);
+                cprime_free(buffer);
                 return NULL;
             }
             buffer = temp;
@@ -239,28 +1022,28 @@ string get_string(va_list* args, const char* format, ...) {
         return NULL;
     
     if (size == SIZE_MAX) {
-        free(buffer);
+        cprime_free(buffer);
         return NULL;
     }
 
     if (c == '\r' && (c = fgetc(stdin)) != '\n') {
         if (c != EOF && ungetc(c, stdin) == EOF) {
-            free(buffer);
+            cprime_free(buffer);
             return NULL;
         }
     }
 
-    string s = (string) realloc(buffer, size + 1);
+    string s = (string) cprime_realloc(buffer, size + 1);
     if (s == NULL) {
-        free(buffer);
+        cprime_free(buffer);
         return NULL;
     }
     
     s[size] = '\0';
     
-    string* tmp = (string*) realloc(strings, sizeof (string)* (allocations + 1));
+    string* tmp = (string*) cprime_realloc(strings, sizeof (string)* (allocations + 1));
     if (tmp == NULL) {
-        free(s);
+        cprime_free(s);
         return NULL;
     }
     strings = tmp;
@@ -272,6 +1055,7 @@ string get_string(va_list* args, const char* format, ...) {
 }
 
 char get_char(const char* format, ...) {
+    __NO_ASYNC_THROW();
     va_list ap;
     va_start(ap, format);
 
@@ -291,6 +1075,7 @@ char get_char(const char* format, ...) {
 }
 
 double get_double(const char* format, ...) {
+    __NO_ASYNC_THROW();
     va_list ap;
     va_start(ap, format);
     
@@ -316,6 +1101,7 @@ double get_double(const char* format, ...) {
 }
 
 float get_float(const char* format, ...) {
+    __NO_ASYNC_THROW();
     va_list ap;
     va_start(ap, format);
 
@@ -341,6 +1127,7 @@ float get_float(const char* format, ...) {
 }
 
 int get_int(const char* format, ...) {
+    __NO_ASYNC_THROW();
     va_list ap;
     va_start(ap, format);
 
@@ -364,6 +1151,7 @@ int get_int(const char* format, ...) {
 }
 
 long get_long(const char* format, ...) {
+    __NO_ASYNC_THROW();
     va_list ap;
     va_start(ap, format);
     
@@ -387,6 +1175,7 @@ long get_long(const char* format, ...) {
 }
 
 long long get_long_long(const char* format, ...) {
+    __NO_ASYNC_THROW();
     va_list ap;
     va_start(ap, format);
     while (true) {
@@ -407,30 +1196,23 @@ long long get_long_long(const char* format, ...) {
         }
     }
 }
-
-/* Macro to abstract get_X as `input(int, "Enter an int: ")` */
-#define input(type, prompt) \
-    _Generic((type)0, \
-        int: get_int, \
-        float: get_float, \
-        double: get_double, \
-        long: get_long, \
-        long long: get_long_long, \
-        char: get_char, \
-        string: get_string \
-    )(prompt)
+#endif  // CPRIME_IMPLEMENTATION
 
 
 
 
-/* Free allocated memory from user-input strings */
+#ifdef CPRIME_IMPLEMENTATION
+/* Free allocated memory from user-input strings and print the allocation report if requested */
 static void __teardown(void) {
     if (strings != NULL) {
         for (size_t i = 0; i < allocations; i++)
-            free(strings[i]);
-        free(strings);
+            cprime_free(strings[i]);
+        cprime_free(strings);
     }
+    if (atomic_load(&__alloc_exit_report))
+        alloc_report(stderr);
 }
+#endif  // CPRIME_IMPLEMENTATION
 
 
 /* Initialization function */
@@ -454,728 +1236,8898 @@ static void __teardown(void) {
     #error Some compiler-specific features missing.
 #endif
 
+#ifdef CPRIME_IMPLEMENTATION
 /* Setup signal handlers and buffer for stdout */
 INITIALIZER(setup) {
+    if (getenv("CPRIME_ALLOC_REPORT") != NULL)
+        alloc_tracking(true);
     setvbuf(stdout, NULL, _IONBF, 0);
     __setup_signal_handlers();
     atexit(__teardown);
 }
+#endif  // CPRIME_IMPLEMENTATION
 
 
 
 
-/* File Reader */
+/* Clocks */
+
+/* Monotonic clock in nanoseconds */
+static inline uint64_t __monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+#ifdef CPRIME_IMPLEMENTATION
+/* CPU timestamp counter (0 where unavailable) */
+static inline uint64_t __cycle_count(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Deadlines */
+
+/*
+ * Deadlines belong to the thread (or fiber) that sets them and nest: an inner deadline never outlasts the one around
+ * it. On Linux each thread gets a POSIX timer on first use that signals only that thread at its innermost deadline,
+ * and the handler throws TIMEOUT_EXCEPTION into the innermost try frame. After the deadline the timer repeats every
+ * millisecond, so a timeout swallowed by an inner try without a matching catch is raised again. Library functions
+ * that take locks or allocate hold the throw off until they return (see `__NO_ASYNC_THROW`); it is then raised by
+ * the next `deadline_check` (every FileReader read starts with one) or by the timer's next repeat. Elsewhere
+ * deadlines are only honoured by `deadline_check` and the loops that call it (such as the FileReader functions).
+ */
+
+#if defined(__linux__) && defined(SIGEV_THREAD_ID)
+    #define __DEADLINE_TIMER 1
+    /* Real-time signal the deadline timers raise; define before including cprime.h to use another */
+    #ifndef CPRIME_DEADLINE_SIGNAL
+        #define CPRIME_DEADLINE_SIGNAL (SIGRTMAX - 2)
+    #endif
+#endif
+
+/* Interval at which a passed deadline is raised again */
+#define __DEADLINE_REPEAT_NS 1000000l
 
 /**
- * @brief File reader structure; reads from a file line-by-line or word-by-word
- * @note You must call `close_FileReader(FileReader*)` to free the memory after use
- * @param file The file to read from
- * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
- * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
- * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
- * 
- * ### Methods
- * 
- * - `new_FileReader(string filename)`
- * 
- * - `close_FileReader(FileReader*)`
- * 
- * - `FileReader_nextLine(FileReader*)`
- * 
- * - `FileReader_nextString(FileReader*)`
- * 
+ * @brief Throw `TIMEOUT_EXCEPTION` if the innermost deadline has passed
+ * @note Only a thread-local load when no deadline is set; loops that may run past a deadline call it so deadlines
+ *       are honoured where the timer is unavailable, and so a timeout held off by a library call is raised promptly
+ * @throw `TIMEOUT_EXCEPTION` if the innermost deadline has passed
+ */
+static inline void deadline_check(void) {
+    if (__deadline_top != NULL && (__async_throw_pending || __monotonic_ns() >= __deadline_top->at))
+        throw(TIMEOUT_EXCEPTION);
+}
+
+/**
+ * @brief Get the time left until the innermost deadline
+ * @return The milliseconds left (rounded up, 0 once it has passed), or -1 if there is no deadline
+ */
+long deadline_remaining(void);
+
+void __deadline_restore(__Deadline* deadline);
+void __deadline_enter(__Deadline* deadline, long ms);
+
+/* Leave a deadline whose block ended without a throw (a throw restores the deadline of the frame it unwinds to) */
+static inline void __deadline_leave(__Deadline* deadline) {
+    if (__deadline_top == deadline)
+        __deadline_restore(deadline->prev);
+}
+
+/**
+ * @brief A try block that throws `TIMEOUT_EXCEPTION` into the innermost try frame if it runs for longer than `ms`
+ *        milliseconds; used like `try`, ending with `etry`
+ * @param ms The time limit in milliseconds, capped by any enclosing deadline
+ * @note On Linux the timeout interrupts the block wherever it is, like the other signal-raised exceptions, except
+ *       inside library functions that take locks or allocate, which hold it off until they return. Your own code
+ *       interrupted inside `malloc`, with a lock held, or halfway through updating a structure is left that way, so
+ *       keep such work outside the block or call `deadline_check` between its steps instead. Elsewhere the block
+ *       only times out at `deadline_check` and the FileReader functions
+ * @note The catch blocks run without the deadline; a deadline set in a fiber is only raised while that fiber runs
+ */
+#define try_deadline(ms) do { __ExFrame ex_local__ __attribute__((__cleanup__(__ex_pop))); __ex_push(&ex_local__); \
+    __Deadline ex_deadline__ __attribute__((__cleanup__(__deadline_leave))); \
+    switch( __ex_setjmp(ex_local__.buf) ) { case 0: __deadline_enter(&ex_deadline__, (ms)); while(1) {
+
+#ifdef CPRIME_IMPLEMENTATION
+long deadline_remaining(void) {
+    if (__deadline_top == NULL)
+        return -1;
+    uint64_t now = __monotonic_ns();
+    return (now >= __deadline_top->at) ? 0 : (long) ((__deadline_top->at - now + 999999) / 1000000);
+}
+
+#ifdef __DEADLINE_TIMER
+static _Thread_local timer_t __deadline_timer;
+static _Thread_local int __deadline_timer_state = 0;     // 1 once created, -1 if it could not be
+static _Thread_local uint64_t __deadline_armed = 0;      // Expiry the timer is set to, 0 when disarmed
+static pthread_key_t __deadline_key;
+static pthread_once_t __deadline_once = PTHREAD_ONCE_INIT;
+
+/* A signal sent before the deadline was left or moved may still arrive, so the deadline is checked again */
+static void __handle_deadline(int sig, siginfo_t* info, void* context) {
+    (void) sig; (void) info; (void) context;
+    if (__deadline_top == NULL || __monotonic_ns() < __deadline_top->at)
+        return;
+    if (__no_async_throw > 0)
+        __async_throw_pending = 1;  // Raised by the next deadline_check, or by the timer once the section ends
+    else
+        throw(TIMEOUT_EXCEPTION);
+}
+
+static void __deadline_timer_release(void* timer) { timer_delete(*(timer_t*) timer); }
+
+static void __deadline_setup(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_sigaction = __handle_deadline;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(CPRIME_DEADLINE_SIGNAL, &action, NULL);
+    pthread_key_create(&__deadline_key, __deadline_timer_release);
+}
+
+/* Set the calling thread's timer to fire at `at` (0 disarms it), creating the timer on first use */
+static void __deadline_arm(uint64_t at) {
+    if (at == __deadline_armed || __deadline_timer_state < 0)
+        return;
+    if (__deadline_timer_state == 0) {
+        pthread_once(&__deadline_once, __deadline_setup);
+        struct sigevent event;
+        memset(&event, 0, sizeof event);
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = CPRIME_DEADLINE_SIGNAL;
+    #ifdef sigev_notify_thread_id
+        event.sigev_notify_thread_id = (pid_t) syscall(SYS_gettid);
+    #else
+        event._sigev_un._tid = (pid_t) syscall(SYS_gettid);
+    #endif
+        if (timer_create(CLOCK_MONOTONIC, &event, &__deadline_timer) != 0) {
+            __deadline_timer_state = -1;  // Out of timers: deadlines are only checked cooperatively
+            return;
+        }
+        __deadline_timer_state = 1;
+        pthread_setspecific(__deadline_key, &__deadline_timer);
+    }
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    if (at != 0) {
+        spec.it_value.tv_sec = (time_t) (at / 1000000000ull);
+        spec.it_value.tv_nsec = (long) (at % 1000000000ull);
+        spec.it_interval.tv_nsec = __DEADLINE_REPEAT_NS;
+    }
+    if (timer_settime(__deadline_timer, TIMER_ABSTIME, &spec, NULL) == 0)
+        __deadline_armed = at;
+}
+#else
+static inline void __deadline_arm(uint64_t at) { (void) at; }
+#endif
+
+/* Make `deadline` (or none) the innermost deadline */
+void __deadline_restore(__Deadline* deadline) {
+    __async_throw_pending = 0;
+    __deadline_top = deadline;
+    __deadline_arm(deadline != NULL ? deadline->at : 0);
+}
+
+/* Enter a deadline `ms` milliseconds from now, or at the enclosing deadline if that is sooner */
+void __deadline_enter(__Deadline* deadline, long ms) {
+    uint64_t at = __monotonic_ns() + (uint64_t) (ms > 0 ? ms : 0) * 1000000ull;
+    if (__deadline_top != NULL && __deadline_top->at < at)
+        at = __deadline_top->at;
+    deadline->at = at;
+    deadline->prev = __deadline_top;
+    __deadline_restore(deadline);
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* SIMD support */
+
+/* x86-64 always has SSE2; AVX2 code paths are compiled with a target attribute and chosen at runtime */
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+    #include <immintrin.h>
+    #define CPRIME_SSE2 1
+#elif defined(__aarch64__)
+    #include <arm_neon.h>
+    #define CPRIME_NEON 1
+#endif
+
+/* Whether the running CPU supports AVX2 (checked once) */
+static inline bool __cpu_has_avx2(void) {
+#ifdef CPRIME_SSE2
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+#else
+    return false;
+#endif
+}
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Whether the running CPU supports SSE4.2 (checked once) */
+static inline bool __cpu_has_sse42(void) {
+#ifdef CPRIME_SSE2
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    }
+    return cached;
+#else
+    return false;
+#endif
+}
+
+/* Whether the running CPU has the POPCNT instruction (checked once) */
+static inline bool __cpu_has_popcnt(void) {
+#ifdef CPRIME_SSE2
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("popcnt") ? 1 : 0;
+    }
+    return cached;
+#else
+    return false;
+#endif
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Profiling */
+
+/**
+ * @brief Scoped profiling; compile with `-DCPRIME_PROFILE` to record, otherwise the macros compile to nothing
+ * 
+ * Each scope records its begin/end time into a per-thread buffer (no locks on the hot path). At exit the
+ * events are written as Chrome trace JSON to `$CPRIME_PROFILE_FILE` (default `cprime_trace.json`), which
+ * can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ * 
+ * @code
+ * void parse(FileReader* fr) {
+ *     PROFILE_FUNC();
+ *     { PROFILE_SCOPE("tokenize"); ... }
+ * }
+ * @endcode
+ */
+#ifdef CPRIME_PROFILE
+/* Events per buffer chunk, and the cap on recorded events per thread (later events are dropped) */
+#define CPRIME_PROFILE_CHUNK 4096
+#ifndef CPRIME_PROFILE_MAX_EVENTS
+    #define CPRIME_PROFILE_MAX_EVENTS (1 << 22)
+#endif
+
+typedef struct __ProfileEvent __ProfileEvent;
+struct __ProfileEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+typedef struct __ProfileChunk __ProfileChunk;
+struct __ProfileChunk {
+    __ProfileEvent events[CPRIME_PROFILE_CHUNK];
+    atomic_size_t count;     // Published with release so the exit dump can read other threads' chunks
+    long tid;
+    __ProfileChunk* next;    // Global list of every chunk
+};
+
+typedef struct __ProfileScope __ProfileScope;
+struct __ProfileScope {
+    const char* name;
+    uint64_t begin;
+};
+
+static inline __ProfileScope __profile_begin(const char* name) {
+    __ProfileScope scope = { name, __monotonic_ns() };
+    return scope;
+}
+
+void __profile_end(__ProfileScope* scope);
+
+/**
+ * @brief Write every event recorded so far as Chrome trace JSON
+ * @param path The output file
+ * @return True on success, or false otherwise
+ */
+bool profile_dump(const char* path);
+
+#define __PROFILE_VAR2(line) __profile_scope_##line
+#define __PROFILE_VAR(line) __PROFILE_VAR2(line)
+
+/* Profile the rest of the enclosing scope under `name` (a string with static storage) */
+#define PROFILE_SCOPE(name) \
+    __ProfileScope __PROFILE_VAR(__LINE__) __attribute__((__cleanup__(__profile_end))) = __profile_begin(name)
+#else
+#define PROFILE_SCOPE(name) ((void) 0)
+#endif  // CPRIME_PROFILE
+
+/* Profile the rest of the enclosing function under its name */
+#define PROFILE_FUNC() PROFILE_SCOPE(__func__)
+
+#ifdef CPRIME_IMPLEMENTATION
+#ifdef CPRIME_PROFILE
+static _Atomic(__ProfileChunk*) __profile_chunks = NULL;
+static _Thread_local __ProfileChunk* __profile_chunk = NULL;
+static _Thread_local size_t __profile_recorded = 0;
+static atomic_size_t __profile_dropped = 0;
+static uint64_t __profile_epoch = 0;
+
+static long __profile_tid(void) {
+#ifdef __linux__
+    return (long) syscall(SYS_gettid);
+#else
+    static atomic_long next_tid = 1;
+    return atomic_fetch_add(&next_tid, 1);
+#endif
+}
+
+void __profile_end(__ProfileScope* scope) {
+    __NO_ASYNC_THROW();
+    uint64_t end = __monotonic_ns();
+    __ProfileChunk* chunk = __profile_chunk;
+    size_t count = (chunk != NULL) ? atomic_load_explicit(&chunk->count, memory_order_relaxed) : 0;
+    if (chunk == NULL || count == CPRIME_PROFILE_CHUNK) {
+        if (__profile_recorded >= CPRIME_PROFILE_MAX_EVENTS
+            || (chunk = (__ProfileChunk*) malloc(sizeof (__ProfileChunk))) == NULL) {
+            atomic_fetch_add_explicit(&__profile_dropped, 1, memory_order_relaxed);
+            return;
+        }
+        atomic_init(&chunk->count, 0);
+        chunk->tid = (__profile_chunk != NULL) ? __profile_chunk->tid : __profile_tid();
+        chunk->next = atomic_load_explicit(&__profile_chunks, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&__profile_chunks, &chunk->next, chunk,
+                                                      memory_order_release, memory_order_relaxed)) {}
+        __profile_chunk = chunk;
+        count = 0;
+    }
+    __ProfileEvent* event = &chunk->events[count];
+    event->name = scope->name;
+    event->begin = scope->begin;
+    event->end = end;
+    atomic_store_explicit(&chunk->count, count + 1, memory_order_release);
+    __profile_recorded++;
+}
+
+bool profile_dump(const char* path) {
+    __NO_ASYNC_THROW();
+    FILE* out = (path != NULL) ? fopen(path, "w") : NULL;
+    if (out == NULL) return false;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":%zu},\"traceEvents\":[",
+            atomic_load(&__profile_dropped));
+    bool first = true;
+    long pid = (long) getpid();
+    for (__ProfileChunk* chunk = atomic_load_explicit(&__profile_chunks, memory_order_acquire);
+         chunk != NULL; chunk = chunk->next) {
+        size_t count = atomic_load_explicit(&chunk->count, memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            __ProfileEvent* event = &chunk->events[i];
+            fprintf(out, "%s\n{\"name\":\"", first ? "" : ",");
+            for (const char* c = event->name; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', out);
+                fputc(*c, out);
+            }
+            fprintf(out, "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                    (event->begin - __profile_epoch) / 1e3, (event->end - event->begin) / 1e3, pid, chunk->tid);
+            first = false;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+}
+
+static void __profile_teardown(void) {
+    const char* path = getenv("CPRIME_PROFILE_FILE");
+    if (!profile_dump((path != NULL) ? path : "cprime_trace.json"))
+        fprintf(stderr, "cprime: could not write the profile trace\n");
+}
+
+INITIALIZER(__profile_setup) {
+    __profile_epoch = __monotonic_ns();
+    atexit(__profile_teardown);
+}
+#endif  // CPRIME_PROFILE
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Hashing */
+
+/*
+ * 64-bit multiply-mix hashing after wyhash (public domain, Wang Yi); values are stable across runs and platforms
+ * but are not promised to match other wyhash releases. Keys up to 16 bytes take a branch-light path of
+ * overlapping loads; longer keys run three independent lanes over 48-byte stripes so the multiplies pipeline,
+ * and fold the remaining 16-byte words into the first lane.
+ */
+
+static const uint64_t __wyp[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+/* Full 64x64 -> 128-bit product, low half into `a` and high half into `b` */
+static inline void __wymum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32), hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t __wymix(uint64_t a, uint64_t b) {
+    __wymum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t __wyr8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t __wyr4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+/**
+ * @brief Hash bytes with wyhash (fast and well distributed, but not for adversarial or cryptographic use)
+ * @param data The bytes to hash
+ * @param length The number of bytes
+ * @param seed The seed; different seeds give independent hash functions
+ * @return The 64-bit hash
+ */
+static inline uint64_t hash_bytes_seed(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*) data;
+    uint64_t a, b;
+    seed ^= __wymix(seed ^ __wyp[0], __wyp[1]);
+    if (__builtin_expect(length <= 16, 1)) {
+        if (length >= 4) {
+            a = (__wyr4(p) << 32) | __wyr4(p + ((length >> 3) << 2));
+            b = (__wyr4(p + length - 4) << 32) | __wyr4(p + length - 4 - ((length >> 3) << 2));
+        } else if (length > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = __wymix(__wyr8(p) ^ __wyp[1], __wyr8(p + 8) ^ seed);
+                see1 = __wymix(__wyr8(p + 16) ^ __wyp[2], __wyr8(p + 24) ^ see1);
+                see2 = __wymix(__wyr8(p + 32) ^ __wyp[3], __wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = __wymix(__wyr8(p) ^ __wyp[1], __wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = __wyr8(p + i - 16);
+        b = __wyr8(p + i - 8);
+    }
+    a ^= __wyp[1];
+    b ^= seed;
+    __wymum(&a, &b);
+    return __wymix(a ^ __wyp[0] ^ length, b ^ __wyp[1]);
+}
+static inline uint64_t __hash_bytes(const void* data, size_t length) { return hash_bytes_seed(data, length, 0); }
+
+/**
+ * @brief Hash bytes with wyhash (fast and well distributed, but not for adversarial or cryptographic use)
+ * @param data The bytes to hash
+ * @param length The number of bytes
+ * @param seed [optional] The seed (default is 0)
+ * @return The 64-bit hash
+ */
+#define hash_bytes(...) GET_MACRO3(__VA_ARGS__, hash_bytes_seed, __hash_bytes)(__VA_ARGS__)
+
+/**
+ * @brief Hash a null-terminated string with wyhash
+ * @param str The string to hash
+ * @return The 64-bit hash (the same as `hash_bytes(str, strlen(str))`), or 0 for NULL
+ */
+static inline uint64_t hash_string(const char* str) {
+    return (str == NULL) ? 0 : hash_bytes_seed(str, strlen(str), 0);
+}
+
+
+
+
+/* String interning */
+
+/* ID returned when a string cannot be interned */
+#define INTERNER_NONE UINT32_MAX
+
+/* Bytes per arena block holding canonical strings (longer strings get a block of their own) */
+#define __INTERNER_BLOCK (64u << 10)
+
+/* Canonical strings are stored as [u32 id][u32 length][bytes][\0] in arena blocks that never move */
+#define __INTERNED_HEADER 8
+
+/* Table slot: the ID plus one (0 marks an empty slot) and the folded hash of the string */
+typedef struct __InternSlot __InternSlot;
+struct __InternSlot {
+    uint32_t id;
+    uint32_t hash;
+};
+
+/**
+ * @brief String interner; maps each distinct string to a canonical copy and a small dense ID (0, 1, 2, ...)
+ * @note You must call `delete_Interner(Interner*)` to free the memory after use
+ * @note Canonical strings stay valid and unchanged until the interner is deleted, so interned strings can be
+ *       compared by pointer or by ID instead of with `strcmp`
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * 
+ * ### Methods
+ * 
+ * - `new_Interner()`
+ * 
+ * - `delete_Interner(Interner*)`
+ * 
+ * - `Interner_intern(Interner*, const char* str, size_t length=strlen(str))` returns the canonical string
+ * 
+ * - `Interner_id(Interner*, const char* str, size_t length=strlen(str))` returns the ID
+ * 
+ * - `Interner_find(Interner*, const char* str, size_t length=strlen(str))` looks up without interning
+ * 
+ * - `Interner_string(Interner*, uint32_t id)`
+ * 
+ * - `Interner_idOf(Interner*, const char* canonical)`
+ * 
+ * - `Interner_size(Interner*)`
+ */
+typedef struct Interner Interner;
+struct Interner {
+    __InternSlot* slots;    // Open-addressing table with linear probing, at most half full
+    size_t mask;
+    const char** strings;   // Canonical string of each ID
+    size_t count;
+    size_t capacity;
+    char* block;            // Arena block being filled; each block starts with the address of the previous one
+    size_t used;            // Bytes used in `block`
+    size_t available;       // Size of `block`
+};
+
+/**
+ * @brief Create a new string interner
+ * @return The interner
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof Interner
+ */
+Interner* new_Interner(void);
+
+/**
+ * @brief Delete a string interner, invalidating its canonical strings
+ * @param interner The interner
+ * @memberof Interner
+ */
+void delete_Interner(Interner* interner);
+
+const char* __Interner_intern(Interner* interner, const char* str, size_t length);
+
+static inline const char* __Interner_intern_string(Interner* interner, const char* str) {
+    return (str == NULL) ? NULL : __Interner_intern(interner, str, strlen(str));
+}
+
+/**
+ * @brief Intern a string
+ * @param interner The interner
+ * @param str The string (need not be null-terminated when a length is given)
+ * @param length [optional] The length of the string (default is `strlen(str)`)
+ * @return The canonical copy of the string, or NULL if memory runs out
+ * @note Equal strings get the same canonical pointer; it is owned by the interner and must not be freed
+ * @memberof Interner
+ */
+#define Interner_intern(...) GET_MACRO3(__VA_ARGS__, __Interner_intern, __Interner_intern_string)(__VA_ARGS__)
+
+/**
+ * @brief Get the ID of an interned string
+ * @param interner The interner
+ * @param canonical A string returned by the interner (not merely an equal one)
+ * @return The ID, or `INTERNER_NONE` for NULL
+ * @memberof Interner
+ */
+static inline uint32_t Interner_idOf(Interner* interner, const char* canonical) {
+    if (interner == NULL || canonical == NULL) return INTERNER_NONE;
+    uint32_t id;
+    memcpy(&id, canonical - __INTERNED_HEADER, 4);
+    return id;
+}
+
+uint32_t __Interner_id(Interner* interner, const char* str, size_t length);
+
+static inline uint32_t __Interner_id_string(Interner* interner, const char* str) {
+    return Interner_idOf(interner, __Interner_intern_string(interner, str));
+}
+
+/**
+ * @brief Intern a string and get its ID
+ * @param interner The interner
+ * @param str The string (need not be null-terminated when a length is given)
+ * @param length [optional] The length of the string (default is `strlen(str)`)
+ * @return The ID (IDs are handed out densely from 0 in order of first appearance), or `INTERNER_NONE` if
+ *         memory runs out
+ * @memberof Interner
+ */
+#define Interner_id(...) GET_MACRO3(__VA_ARGS__, __Interner_id, __Interner_id_string)(__VA_ARGS__)
+
+uint32_t __Interner_find(Interner* interner, const char* str, size_t length);
+
+static inline uint32_t __Interner_find_string(Interner* interner, const char* str) {
+    return (str == NULL) ? INTERNER_NONE : __Interner_find(interner, str, strlen(str));
+}
+
+/**
+ * @brief Look up the ID of a string without interning it
+ * @param interner The interner
+ * @param str The string (need not be null-terminated when a length is given)
+ * @param length [optional] The length of the string (default is `strlen(str)`)
+ * @return The ID, or `INTERNER_NONE` if the string has not been interned
+ * @memberof Interner
+ */
+#define Interner_find(...) GET_MACRO3(__VA_ARGS__, __Interner_find, __Interner_find_string)(__VA_ARGS__)
+
+/**
+ * @brief Get the canonical string with an ID
+ * @param interner The interner
+ * @param id The ID
+ * @return The canonical string, or NULL if no string has that ID
+ * @memberof Interner
+ */
+static inline const char* Interner_string(Interner* interner, uint32_t id) {
+    return (interner != NULL && id < interner->count) ? interner->strings[id] : NULL;
+}
+
+/**
+ * @brief Get the number of distinct strings interned
+ * @param interner The interner
+ * @return The number of strings, which is also the next ID
+ * @memberof Interner
+ */
+static inline size_t Interner_size(Interner* interner) {
+    return (interner != NULL) ? interner->count : 0;
+}
+
+#ifdef CPRIME_IMPLEMENTATION
+Interner* new_Interner(void) {
+    PROFILE_FUNC();
+    Interner* interner = (Interner*) cprime_calloc(1, sizeof (Interner));
+    if (interner != NULL) {
+        interner->mask = 255;
+        interner->slots = (__InternSlot*) cprime_calloc(interner->mask + 1, sizeof (__InternSlot));
+    }
+    if (interner == NULL || interner->slots == NULL) {
+        cprime_free(interner);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    return interner;
+}
+
+void delete_Interner(Interner* interner) {
+    PROFILE_FUNC();
+    if (interner == NULL) return;
+    char* block = interner->block;
+    while (block != NULL) {
+        char* previous;
+        memcpy(&previous, block, sizeof previous);
+        cprime_free(block);
+        block = previous;
+    }
+    cprime_free(interner->strings);
+    cprime_free(interner->slots);
+    cprime_free(interner);
+}
+
+static inline uint32_t __Interner_hash(const char* str, size_t length) {
+    uint64_t hash = hash_bytes_seed(str, length, 0);
+    return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static inline size_t __interned_length(const char* canonical) {
+    uint32_t length;
+    memcpy(&length, canonical - 4, 4);
+    return length;
+}
+
+/* Slot holding `str`, or the empty slot where it belongs */
+static __InternSlot* __Interner_slot(Interner* interner, const char* str, size_t length, uint32_t hash) {
+    size_t i = hash & interner->mask;
+    while (true) {
+        __InternSlot* slot = &interner->slots[i];
+        if (slot->id == 0) return slot;
+        if (slot->hash == hash) {
+            const char* canonical = interner->strings[slot->id - 1];
+            if (__interned_length(canonical) == length && memcmp(canonical, str, length) == 0) return slot;
+        }
+        i = (i + 1) & interner->mask;
+    }
+}
+
+/* Double the table; false if memory runs out (the table is left as it was) */
+static bool __Interner_grow(Interner* interner) {
+    size_t mask = interner->mask * 2 + 1;
+    __InternSlot* slots = (__InternSlot*) cprime_calloc(mask + 1, sizeof (__InternSlot));
+    if (slots == NULL) return false;
+    for (size_t i = 0; i <= interner->mask; i++) {
+        __InternSlot slot = interner->slots[i];
+        if (slot.id == 0) continue;
+        size_t j = slot.hash & mask;
+        while (slots[j].id != 0) j = (j + 1) & mask;
+        slots[j] = slot;
+    }
+    cprime_free(interner->slots);
+    interner->slots = slots;
+    interner->mask = mask;
+    return true;
+}
+
+/* Copy a new string into the arena and give it the next ID; NULL if memory runs out */
+static const char* __Interner_store(Interner* interner, const char* str, size_t length, uint32_t hash) {
+    if (length > UINT32_MAX - __INTERNED_HEADER - 1 || interner->count >= INTERNER_NONE - 1) return NULL;
+    if ((interner->count + 1) * 2 > interner->mask + 1 && !__Interner_grow(interner)) return NULL;
+    if (interner->count == interner->capacity) {
+        size_t capacity = (interner->capacity == 0) ? 64 : interner->capacity * 2;
+        const char** strings = (const char**) cprime_realloc(interner->strings, capacity * sizeof (const char*));
+        if (strings == NULL) return NULL;
+        interner->strings = strings;
+        interner->capacity = capacity;
+    }
+    size_t needed = __INTERNED_HEADER + length + 1;
+    size_t offset = (interner->used + 3) & ~(size_t) 3;
+    if (interner->block == NULL || offset + needed > interner->available) {
+        size_t size = sizeof (char*) + needed;
+        if (size < __INTERNER_BLOCK) size = __INTERNER_BLOCK;
+        char* block = (char*) cprime_malloc(size);
+        if (block == NULL) return NULL;
+        memcpy(block, &interner->block, sizeof (char*));
+        interner->block = block;
+        interner->available = size;
+        offset = sizeof (char*);
+    }
+    char* canonical = interner->block + offset + __INTERNED_HEADER;
+    uint32_t id = (uint32_t) interner->count, stored = (uint32_t) length;
+    memcpy(canonical - 8, &id, 4);
+    memcpy(canonical - 4, &stored, 4);
+    memcpy(canonical, str, length);
+    canonical[length] = '\0';
+    interner->used = offset + needed;
+    interner->strings[interner->count++] = canonical;
+    __InternSlot* slot = __Interner_slot(interner, str, length, hash);
+    slot->id = id + 1;
+    slot->hash = hash;
+    return canonical;
+}
+
+const char* __Interner_intern(Interner* interner, const char* str, size_t length) {
+    __NO_ASYNC_THROW();
+    if (interner == NULL || str == NULL) return NULL;
+    uint32_t hash = __Interner_hash(str, length);
+    __InternSlot* slot = __Interner_slot(interner, str, length, hash);
+    if (slot->id != 0) return interner->strings[slot->id - 1];
+    return __Interner_store(interner, str, length, hash);
+}
+
+uint32_t __Interner_id(Interner* interner, const char* str, size_t length) {
+    return Interner_idOf(interner, __Interner_intern(interner, str, length));
+}
+
+uint32_t __Interner_find(Interner* interner, const char* str, size_t length) {
+    if (interner == NULL || str == NULL) return INTERNER_NONE;
+    __InternSlot* slot = __Interner_slot(interner, str, length, __Interner_hash(str, length));
+    return (slot->id != 0) ? slot->id - 1 : INTERNER_NONE;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Bitsets */
+
+/* Index returned when there is no set bit */
+#define BITSET_NONE SIZE_MAX
+
+/**
+ * @brief Dynamically sized bitset; bits are numbered from 0 and packed 64 to a word
+ * @note You must call `delete_Bitset(Bitset*)` to free the memory after use
+ * @note Whole-set operations work on a word or SIMD vector of words at a time (SSE2/AVX2/NEON, chosen at runtime),
+ *       counting uses the hardware popcount, and `foreach_set_bit` jumps between set bits with count-trailing-zeros,
+ *       so filtering and iterating cost per word rather than per bit
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * 
+ * ### Methods
+ * 
+ * - `new_Bitset(size_t size)` with all bits clear
+ * 
+ * - `delete_Bitset(Bitset*)`
+ * 
+ * - `Bitset_set(Bitset*, size_t index)` / `Bitset_toggle(Bitset*, size_t index)` grow the set past its end
+ * 
+ * - `Bitset_clear(Bitset*, size_t index)` / `Bitset_test(Bitset*, size_t index)`
+ * 
+ * - `Bitset_size(Bitset*)` / `Bitset_resize(Bitset*, size_t size)`
+ * 
+ * - `Bitset_fill(Bitset*, bool value)`
+ * 
+ * - `Bitset_and(Bitset* dst, const Bitset* src)`, `Bitset_or`, `Bitset_xor`, and `Bitset_andNot` (dst &= ~src)
+ * 
+ * - `Bitset_count(Bitset*)`
+ * 
+ * - `Bitset_findFirst(Bitset*)` / `Bitset_findNext(Bitset*, size_t from)`
+ * 
+ * - `foreach_set_bit(var, Bitset*)`
+ */
+typedef struct Bitset Bitset;
+struct Bitset {
+    uint64_t* words;        // Bits at and past `size` are always clear
+    size_t size;            // Number of bits
+    size_t capacity;        // Number of words allocated
+};
+
+static inline size_t __bitset_words(size_t size) {
+    return size / 64 + (size % 64 != 0);
+}
+
+bool __Bitset_reserve(Bitset* bitset, size_t size);
+
+/**
+ * @brief Create a new bitset
+ * @param size The number of bits, all clear
+ * @return The bitset
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof Bitset
+ */
+Bitset* new_Bitset(size_t size);
+
+/**
+ * @brief Delete a bitset
+ * @param bitset The bitset
+ * @memberof Bitset
+ */
+void delete_Bitset(Bitset* bitset);
+
+/**
+ * @brief Get the number of bits in a bitset
+ * @param bitset The bitset
+ * @return The number of bits, set or not
+ * @memberof Bitset
+ */
+static inline size_t Bitset_size(const Bitset* bitset) {
+    return bitset->size;
+}
+
+/**
+ * @brief Grow or shrink a bitset; bits added are clear, and bits cut off stay clear if it grows again
+ * @param bitset The bitset
+ * @param size The new number of bits
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails, leaving the bitset unchanged
+ * @memberof Bitset
+ */
+void Bitset_resize(Bitset* bitset, size_t size);
+
+/**
+ * @brief Set a bit, growing the bitset if `index` is past the end
+ * @param bitset The bitset
+ * @param index The bit
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if the bitset has to grow and memory allocation fails
+ * @memberof Bitset
+ */
+static inline void Bitset_set(Bitset* bitset, size_t index) {
+    if (index >= bitset->size) {
+        if (!__Bitset_reserve(bitset, index + 1)) return;
+        bitset->size = index + 1;
+    }
+    bitset->words[index / 64] |= (uint64_t) 1 << (index % 64);
+}
+
+/**
+ * @brief Clear a bit (nothing to do past the end)
+ * @param bitset The bitset
+ * @param index The bit
+ * @memberof Bitset
+ */
+static inline void Bitset_clear(Bitset* bitset, size_t index) {
+    if (index < bitset->size) bitset->words[index / 64] &= ~((uint64_t) 1 << (index % 64));
+}
+
+/**
+ * @brief Flip a bit, growing the bitset if `index` is past the end
+ * @param bitset The bitset
+ * @param index The bit
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if the bitset has to grow and memory allocation fails
+ * @memberof Bitset
+ */
+static inline void Bitset_toggle(Bitset* bitset, size_t index) {
+    if (index >= bitset->size) {
+        if (!__Bitset_reserve(bitset, index + 1)) return;
+        bitset->size = index + 1;
+    }
+    bitset->words[index / 64] ^= (uint64_t) 1 << (index % 64);
+}
+
+/**
+ * @brief Check a bit
+ * @param bitset The bitset
+ * @param index The bit
+ * @return Whether the bit is set (false past the end)
+ * @memberof Bitset
+ */
+static inline bool Bitset_test(const Bitset* bitset, size_t index) {
+    return index < bitset->size && ((bitset->words[index / 64] >> (index % 64)) & 1) != 0;
+}
+
+/**
+ * @brief Set or clear every bit
+ * @param bitset The bitset
+ * @param value Whether to set the bits
+ * @memberof Bitset
+ */
+void Bitset_fill(Bitset* bitset, bool value);
+
+/*
+ * Word kernels dst[i] = dst[i] op src[i], given as the same expression of `a` (dst) and `b` (src) for plain words,
+ * SSE2, AVX2, and NEON vectors
+ */
+#if defined(CPRIME_SSE2)
+#define __BITSET_KERNEL(name, scalar, sse2, avx2, neon) \
+    static void __bitset_##name##_sse2(uint64_t* dst, const uint64_t* src, size_t n) { \
+        size_t i = 0; \
+        for (; i + 2 <= n; i += 2) { \
+            __m128i a = _mm_loadu_si128((const __m128i*) (dst + i)); \
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + i)); \
+            _mm_storeu_si128((__m128i*) (dst + i), sse2); \
+        } \
+        for (; i < n; i++) { \
+            uint64_t a = dst[i], b = src[i]; \
+            dst[i] = scalar; \
+        } \
+    } \
+    __attribute__((target("avx2"))) \
+    static void __bitset_##name##_avx2(uint64_t* dst, const uint64_t* src, size_t n) { \
+        size_t i = 0; \
+        for (; i + 4 <= n; i += 4) { \
+            __m256i a = _mm256_loadu_si256((const __m256i*) (dst + i)); \
+            __m256i b = _mm256_loadu_si256((const __m256i*) (src + i)); \
+            _mm256_storeu_si256((__m256i*) (dst + i), avx2); \
+        } \
+        for (; i < n; i++) { \
+            uint64_t a = dst[i], b = src[i]; \
+            dst[i] = scalar; \
+        } \
+    } \
+    static void __bitset_##name(uint64_t* dst, const uint64_t* src, size_t n) { \
+        if (__cpu_has_avx2()) __bitset_##name##_avx2(dst, src, n); \
+        else __bitset_##name##_sse2(dst, src, n); \
+    }
+#elif defined(CPRIME_NEON)
+#define __BITSET_KERNEL(name, scalar, sse2, avx2, neon) \
+    static void __bitset_##name(uint64_t* dst, const uint64_t* src, size_t n) { \
+        size_t i = 0; \
+        for (; i + 2 <= n; i += 2) { \
+            uint64x2_t a = vld1q_u64(dst + i), b = vld1q_u64(src + i); \
+            vst1q_u64(dst + i, neon); \
+        } \
+        for (; i < n; i++) { \
+            uint64_t a = dst[i], b = src[i]; \
+            dst[i] = scalar; \
+        } \
+    }
+#else
+#define __BITSET_KERNEL(name, scalar, sse2, avx2, neon) \
+    static void __bitset_##name(uint64_t* dst, const uint64_t* src, size_t n) { \
+        for (size_t i = 0; i < n; i++) { \
+            uint64_t a = dst[i], b = src[i]; \
+            dst[i] = scalar; \
+        } \
+    }
+#endif
+
+/**
+ * @brief Intersect a bitset with another (`dst &= src`); bits past the end of `src` count as clear
+ * @param dst The bitset to update
+ * @param src The other bitset (may be `dst`)
+ * @memberof Bitset
+ */
+void Bitset_and(Bitset* dst, const Bitset* src);
+
+/**
+ * @brief Unite a bitset with another (`dst |= src`); bits of `src` past the end of `dst` are ignored
+ * @param dst The bitset to update
+ * @param src The other bitset (may be `dst`)
+ * @memberof Bitset
+ */
+void Bitset_or(Bitset* dst, const Bitset* src);
+
+/**
+ * @brief Flip the bits of a bitset that are set in another (`dst ^= src`); bits of `src` past the end of `dst` are
+ *        ignored
+ * @param dst The bitset to update
+ * @param src The other bitset (may be `dst`)
+ * @memberof Bitset
+ */
+void Bitset_xor(Bitset* dst, const Bitset* src);
+
+/**
+ * @brief Clear the bits of a bitset that are set in another (`dst &= ~src`)
+ * @param dst The bitset to update
+ * @param src The other bitset (may be `dst`)
+ * @memberof Bitset
+ */
+void Bitset_andNot(Bitset* dst, const Bitset* src);
+
+/* Population count of `n` words in four independent sums, so popcount latency overlaps */
+#define __BITSET_COUNT(name, attributes) \
+    attributes static size_t name(const uint64_t* words, size_t n) { \
+        size_t a = 0, b = 0, c = 0, d = 0, i = 0; \
+        for (; i + 4 <= n; i += 4) { \
+            a += (size_t) __builtin_popcountll(words[i]); \
+            b += (size_t) __builtin_popcountll(words[i + 1]); \
+            c += (size_t) __builtin_popcountll(words[i + 2]); \
+            d += (size_t) __builtin_popcountll(words[i + 3]); \
+        } \
+        for (; i < n; i++) a += (size_t) __builtin_popcountll(words[i]); \
+        return a + b + c + d; \
+    }
+
+/**
+ * @brief Count the set bits
+ * @param bitset The bitset
+ * @return The number of set bits
+ * @memberof Bitset
+ */
+size_t Bitset_count(const Bitset* bitset);
+
+/**
+ * @brief Find the first set bit at or after an index
+ * @param bitset The bitset
+ * @param from The first bit to consider
+ * @return The index of the bit, or `BITSET_NONE` if there is none
+ * @memberof Bitset
+ */
+static inline size_t Bitset_findNext(const Bitset* bitset, size_t from) {
+    if (from >= bitset->size) return BITSET_NONE;
+    size_t word = from / 64, words = __bitset_words(bitset->size);
+    uint64_t bits = bitset->words[word] & (~(uint64_t) 0 << (from % 64));
+    while (bits == 0) {
+        if (++word == words) return BITSET_NONE;
+        bits = bitset->words[word];
+    }
+    return word * 64 + (size_t) __builtin_ctzll(bits);
+}
+
+/**
+ * @brief Find the first set bit
+ * @param bitset The bitset
+ * @return The index of the bit, or `BITSET_NONE` if no bit is set
+ * @memberof Bitset
+ */
+static inline size_t Bitset_findFirst(const Bitset* bitset) {
+    return Bitset_findNext(bitset, 0);
+}
+
+/* Position of a `foreach_set_bit` loop: the bits of the current word not yet visited */
+typedef struct __BitsetCursor __BitsetCursor;
+struct __BitsetCursor {
+    const uint64_t* words;
+    size_t count;           // Words to visit
+    size_t word;
+    uint64_t bits;
+    bool active;            // Cleared when the loop ends, or by the outer loop after a `break`
+};
+
+static inline __BitsetCursor __Bitset_cursor(const Bitset* bitset) {
+    return (__BitsetCursor) { bitset->words, __bitset_words(bitset->size), SIZE_MAX, 0, true };
+}
+
+static inline bool __BitsetCursor_next(__BitsetCursor* cursor, size_t* index) {
+    while (cursor->bits == 0) {
+        if (++cursor->word >= cursor->count) return false;
+        cursor->bits = cursor->words[cursor->word];
+    }
+    *index = cursor->word * 64 + (size_t) __builtin_ctzll(cursor->bits);
+    cursor->bits &= cursor->bits - 1;
+    return true;
+}
+
+/**
+ * @brief Loop over the indexes of the set bits in increasing order, skipping clear bits a word at a time
+ * @param var The name of the `size_t` loop variable
+ * @param bitset The bitset, which must not be resized inside the loop; each word is read when the loop reaches it,
+ *        so changes to the word holding `var` are not seen by the loop
+ * 
+ * ```
+ * foreach_set_bit (row, selected) printf("%zu\n", row);
+ * ```
+ */
+#define foreach_set_bit(var, bitset) \
+    for (__BitsetCursor var##__cursor = __Bitset_cursor(bitset); var##__cursor.active; var##__cursor.active = false) \
+        for (size_t var; __BitsetCursor_next(&var##__cursor, &var); )
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Make room for `size` bits, clearing the new words */
+bool __Bitset_reserve(Bitset* bitset, size_t size) {
+    __NO_ASYNC_THROW();
+    size_t words = __bitset_words(size);
+    if (words <= bitset->capacity) return true;
+    size_t capacity = (bitset->capacity * 2 > words) ? bitset->capacity * 2 : words;
+    uint64_t* grown = (uint64_t*) cprime_realloc(bitset->words, capacity * sizeof (uint64_t));
+    if (grown == NULL) {
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return false;
+    }
+    memset(grown + bitset->capacity, 0, (capacity - bitset->capacity) * sizeof (uint64_t));
+    bitset->words = grown;
+    bitset->capacity = capacity;
+    return true;
+}
+
+/* Clear the bits of the last word that lie past the end */
+static inline void __Bitset_trim(Bitset* bitset) {
+    if (bitset->size % 64 != 0) bitset->words[bitset->size / 64] &= ~(~(uint64_t) 0 << (bitset->size % 64));
+}
+
+Bitset* new_Bitset(size_t size) {
+    Bitset* bitset = (Bitset*) cprime_calloc(1, sizeof (Bitset));
+    if (bitset == NULL) {
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    if (!__Bitset_reserve(bitset, size)) {
+        cprime_free(bitset);
+        return NULL;
+    }
+    bitset->size = size;
+    return bitset;
+}
+
+void delete_Bitset(Bitset* bitset) {
+    if (bitset == NULL) return;
+    cprime_free(bitset->words);
+    cprime_free(bitset);
+}
+
+void Bitset_resize(Bitset* bitset, size_t size) {
+    __NO_ASYNC_THROW();
+    if (size > bitset->size) {
+        if (__Bitset_reserve(bitset, size)) bitset->size = size;
+        return;
+    }
+    size_t words = __bitset_words(size);
+    memset(bitset->words + words, 0, (__bitset_words(bitset->size) - words) * sizeof (uint64_t));
+    bitset->size = size;
+    __Bitset_trim(bitset);
+}
+
+void Bitset_fill(Bitset* bitset, bool value) {
+    memset(bitset->words, value ? 0xFF : 0, __bitset_words(bitset->size) * sizeof (uint64_t));
+    __Bitset_trim(bitset);
+}
+
+__BITSET_KERNEL(and,    a & b,  _mm_and_si128(a, b),    _mm256_and_si256(a, b),    vandq_u64(a, b))
+__BITSET_KERNEL(or,     a | b,  _mm_or_si128(a, b),     _mm256_or_si256(a, b),     vorrq_u64(a, b))
+__BITSET_KERNEL(xor,    a ^ b,  _mm_xor_si128(a, b),    _mm256_xor_si256(a, b),    veorq_u64(a, b))
+__BITSET_KERNEL(andnot, a & ~b, _mm_andnot_si128(b, a), _mm256_andnot_si256(b, a), vbicq_u64(a, b))
+
+/* Apply a kernel over the words both sets have; with `clear_rest`, words only `dst` has are cleared */
+static void __Bitset_combine(Bitset* dst, const Bitset* src, void (*kernel)(uint64_t*, const uint64_t*, size_t),
+                             bool clear_rest) {
+    size_t words = __bitset_words(dst->size), common = __bitset_words(src->size);
+    if (common > words) common = words;
+    kernel(dst->words, src->words, common);
+    if (clear_rest) memset(dst->words + common, 0, (words - common) * sizeof (uint64_t));
+    __Bitset_trim(dst);
+}
+
+void Bitset_and(Bitset* dst, const Bitset* src) {
+    __Bitset_combine(dst, src, __bitset_and, true);
+}
+
+void Bitset_or(Bitset* dst, const Bitset* src) {
+    __Bitset_combine(dst, src, __bitset_or, false);
+}
+
+void Bitset_xor(Bitset* dst, const Bitset* src) {
+    __Bitset_combine(dst, src, __bitset_xor, false);
+}
+
+void Bitset_andNot(Bitset* dst, const Bitset* src) {
+    __Bitset_combine(dst, src, __bitset_andnot, false);
+}
+
+__BITSET_COUNT(__bitset_count, )
+#if defined(CPRIME_SSE2)
+__BITSET_COUNT(__bitset_count_popcnt, __attribute__((target("popcnt"))))
+#endif
+
+size_t Bitset_count(const Bitset* bitset) {
+    size_t words = __bitset_words(bitset->size);
+#if defined(CPRIME_SSE2)
+    if (__cpu_has_popcnt()) return __bitset_count_popcnt(bitset->words, words);
+#endif
+    return __bitset_count(bitset->words, words);
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Compression */
+
+/*
+ * Dependency-free LZ77 block codec in the LZ4 style: greedy matching through a hash table of 4-byte sequences,
+ * and sequences of (literal run, 16-bit back offset, match length) with 4-bit lengths extended by 255-chains.
+ * Compressed files are frames: a 4-byte magic, then blocks of up to LZ_BLOCK_SIZE bytes, each prefixed by its
+ * stored size as a little-endian u32 (the high bit marks a block kept uncompressed), then a zero-size block.
+ * Appending to a compressed file adds another frame, and readers continue through consecutive frames.
+ */
+
+#define LZ_BLOCK_SIZE (1 << 16)
+#define LZ_MAGIC "\xC7LZ1"
+
+#define __LZ_HASH_BITS 13
+#define __LZ_MIN_MATCH 4
+#define __LZ_RAW_BLOCK 0x80000000u
+
+/**
+ * @brief Get the largest compressed size of `size` bytes
+ * @param size The uncompressed size
+ * @return The size a destination buffer needs so `lz_compress` never fails
+ */
+static inline size_t lz_compress_bound(size_t size) { return size + size / 255 + 16; }
+
+/**
+ * @brief Compress a block of at most LZ_BLOCK_SIZE bytes
+ * @param src The data to compress
+ * @param size The number of bytes (at most LZ_BLOCK_SIZE)
+ * @param dst The destination buffer
+ * @param capacity The destination size
+ * @return The compressed size, or 0 if it would not fit in `capacity` (or `size` is too large)
+ */
+size_t lz_compress(const void* src, size_t size, void* dst, size_t capacity);
+
+/**
+ * @brief Decompress a block produced by `lz_compress`
+ * @param src The compressed data
+ * @param size The compressed size
+ * @param dst The destination buffer
+ * @param capacity The destination size
+ * @return The decompressed size, or SIZE_MAX if the data is corrupt or does not fit in `capacity`
+ */
+size_t lz_decompress(const void* src, size_t size, void* dst, size_t capacity);
+
+#ifdef CPRIME_IMPLEMENTATION
+static inline uint32_t __lz_load32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline uint64_t __lz_load64(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline uint32_t __lz_hash(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - __LZ_HASH_BITS); }
+
+/* Write a length that did not fit in its 4-bit token field */
+static inline unsigned char* __lz_put_length(unsigned char* out, size_t length) {
+    for (; length >= 255; length -= 255) *out++ = 255;
+    *out++ = (unsigned char) length;
+    return out;
+}
+
+size_t lz_compress(const void* src, size_t size, void* dst, size_t capacity) {
+    if (size > LZ_BLOCK_SIZE) return 0;
+    const unsigned char* in = (const unsigned char*) src;
+    unsigned char* out = (unsigned char*) dst;
+    unsigned char* out_end = out + capacity;
+    uint16_t table[1 << __LZ_HASH_BITS];
+    memset(table, 0, sizeof table);
+    size_t anchor = 0, pos = 0;
+    // Matches neither start in the last 12 bytes nor reach into the last 5 (they are always literals)
+    const size_t match_limit = (size > 12) ? size - 12 : 0, extend_limit = (size > 5) ? size - 5 : 0;
+    while (pos < match_limit) {
+        uint32_t sequence = __lz_load32(in + pos);
+        uint32_t h = __lz_hash(sequence);
+        size_t ref = table[h];
+        table[h] = (uint16_t) pos;
+        if (ref >= pos || __lz_load32(in + ref) != sequence) {
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        size_t length = __LZ_MIN_MATCH;
+        while (pos + length + 8 <= extend_limit) {
+            uint64_t diff = __lz_load64(in + pos + length) ^ __lz_load64(in + ref + length);
+            if (diff != 0) {
+                length += (size_t) __builtin_ctzll(diff) >> 3;
+                goto matched;
+            }
+            length += 8;
+        }
+        while (pos + length < extend_limit && in[pos + length] == in[ref + length]) length++;
+    matched:
+        while (pos > anchor && ref > 0 && in[pos - 1] == in[ref - 1]) {
+            pos--;
+            ref--;
+            length++;
+        }
+        size_t literals = pos - anchor;
+        if ((size_t) (out_end - out) < literals + literals / 255 + length / 255 + 8) return 0;
+        unsigned char* token = out++;
+        *token = (unsigned char) (((literals < 15) ? literals : 15) << 4);
+        if (literals >= 15) out = __lz_put_length(out, literals - 15);
+        memcpy(out, in + anchor, literals);
+        out += literals;
+        size_t offset = pos - ref;
+        *out++ = (unsigned char) offset;
+        *out++ = (unsigned char) (offset >> 8);
+        size_t extra = length - __LZ_MIN_MATCH;
+        *token |= (unsigned char) ((extra < 15) ? extra : 15);
+        if (extra >= 15) out = __lz_put_length(out, extra - 15);
+        pos += length;
+        anchor = pos;
+        if (pos < match_limit) table[__lz_hash(__lz_load32(in + pos - 2))] = (uint16_t) (pos - 2);
+    }
+    size_t literals = size - anchor;
+    if ((size_t) (out_end - out) < literals + literals / 255 + 2) return 0;
+    *out = (unsigned char) (((literals < 15) ? literals : 15) << 4);
+    out++;
+    if (literals >= 15) out = __lz_put_length(out, literals - 15);
+    memcpy(out, in + anchor, literals);
+    out += literals;
+    return (size_t) (out - (unsigned char*) dst);
+}
+
+size_t lz_decompress(const void* src, size_t size, void* dst, size_t capacity) {
+    const unsigned char* in = (const unsigned char*) src;
+    const unsigned char* in_end = in + size;
+    unsigned char* out = (unsigned char*) dst;
+    unsigned char* out_end = out + capacity;
+    while (in < in_end) {
+        unsigned token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            unsigned char byte;
+            do {
+                if (in == in_end) return SIZE_MAX;
+                byte = *in++;
+                literals += byte;
+            } while (byte == 255);
+        }
+        if ((size_t) (in_end - in) < literals || (size_t) (out_end - out) < literals) return SIZE_MAX;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == in_end) break;
+        if (in_end - in < 2) return SIZE_MAX;
+        size_t offset = (size_t) in[0] | ((size_t) in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t) (out - (unsigned char*) dst)) return SIZE_MAX;
+        size_t length = token & 15;
+        if (length == 15) {
+            unsigned char byte;
+            do {
+                if (in == in_end) return SIZE_MAX;
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        length += __LZ_MIN_MATCH;
+        if ((size_t) (out_end - out) < length) return SIZE_MAX;
+        const unsigned char* ref = out - offset;
+        if (offset >= 8 && (size_t) (out_end - out) >= length + 8) {
+            // Copy 8 bytes at a time; may write up to 7 bytes past the match, which later output overwrites
+            unsigned char* end = out + length;
+            for (unsigned char* p = out; p < end; p += 8, ref += 8) memcpy(p, ref, 8);
+            out = end;
+        } else {
+            for (size_t i = 0; i < length; i++) out[i] = ref[i];
+            out += length;
+        }
+    }
+    return (size_t) (out - (unsigned char*) dst);
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+#ifdef CPRIME_COOKIE_STREAMS
+/* Compressing or decompressing stream layered over a file; the file is closed with the stream */
+typedef struct __LzStream __LzStream;
+struct __LzStream {
+    FILE* origin;
+    unsigned char* block;       /* Uncompressed data */
+    unsigned char* packed;      /* Compressed data */
+    size_t size;                /* Bytes in `block` */
+    size_t pos;                 /* Read position in `block` */
+    bool magic;                 /* Reading: a frame magic (or the end of the file) comes next */
+    bool writing;
+};
+
+#define __COLD_BLOCK (8u << 20)
+#define __COLD_ALIGN ((off_t) 4096)
+
+/* Pages behind one block of a buffered cold scan, and which of them were cached before the scan got there */
+typedef struct __ColdPages __ColdPages;
+struct __ColdPages {
+    off_t start;        /* Offset of the block */
+    off_t first;        /* Offset of its first page */
+    size_t pages;
+    unsigned char resident[__COLD_BLOCK / 4096 + 2];
+};
+
+/* Stream for one-pass scans that leaves the page cache as it found it; the file is closed with the stream */
+typedef struct __ColdStream __ColdStream;
+struct __ColdStream {
+    FILE* origin;
+    int fd;
+    bool direct;        /* O_DIRECT reads; otherwise buffered reads whose newly cached pages are dropped */
+    char* memory;       /* Allocation holding the aligned `block` */
+    char* block;
+    size_t size;        /* Bytes in `block` */
+    size_t pos;         /* Read position in `block` */
+    off_t offset;       /* File offset of `block[0]` */
+    off_t page;         /* Buffered reads: page size */
+    __ColdPages behind[2];  /* Buffered reads: the block being read and the one after it */
+    int current;
+};
+#endif  // CPRIME_COOKIE_STREAMS
+
+#ifdef CPRIME_IMPLEMENTATION
+#ifdef CPRIME_COOKIE_STREAMS
+static bool __lz_read_u32(FILE* file, uint32_t* value, bool* eof) {
+    unsigned char bytes[4];
+    size_t n = fread(bytes, 1, 4, file);
+    *eof = (n == 0);
+    if (n != 4) return false;
+    *value = (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+    return true;
+}
+
+/* Load the next block; false at the end of the input or with errno set if the data is corrupt */
+static bool __lz_stream_load(__LzStream* stream) {
+    while (true) {
+        bool eof;
+        if (stream->magic) {
+            unsigned char magic[4];
+            size_t n = fread(magic, 1, 4, stream->origin);
+            if (n == 0) return false;
+            if (n != 4 || memcmp(magic, LZ_MAGIC, 4) != 0) {
+                errno = EILSEQ;
+                return false;
+            }
+            stream->magic = false;
+        }
+        uint32_t header;
+        if (!__lz_read_u32(stream->origin, &header, &eof)) {
+            // A frame cut off at a block boundary (the writer never closed it) just ends the data
+            if (!eof) errno = EILSEQ;
+            return false;
+        }
+        if (header == 0) {
+            stream->magic = true;
+            continue;
+        }
+        size_t stored = header & ~__LZ_RAW_BLOCK;
+        if ((header & __LZ_RAW_BLOCK) != 0) {
+            if (stored > LZ_BLOCK_SIZE || fread(stream->block, 1, stored, stream->origin) != stored) {
+                errno = EILSEQ;
+                return false;
+            }
+            stream->size = stored;
+        } else {
+            if (stored > lz_compress_bound(LZ_BLOCK_SIZE) || fread(stream->packed, 1, stored, stream->origin) != stored) {
+                errno = EILSEQ;
+                return false;
+            }
+            stream->size = lz_decompress(stream->packed, stored, stream->block, LZ_BLOCK_SIZE);
+            if (stream->size == SIZE_MAX) {
+                stream->size = 0;
+                errno = EILSEQ;
+                return false;
+            }
+        }
+        stream->pos = 0;
+        if (stream->size > 0) return true;
+    }
+}
+
+static ssize_t __lz_stream_read(void* cookie, char* buffer, size_t size) {
+    __LzStream* stream = (__LzStream*) cookie;
+    if (stream->pos == stream->size) {
+        errno = 0;
+        if (!__lz_stream_load(stream)) return (errno != 0) ? -1 : 0;
+    }
+    size_t n = stream->size - stream->pos;
+    if (n > size) n = size;
+    memcpy(buffer, stream->block + stream->pos, n);
+    stream->pos += n;
+    return (ssize_t) n;
+}
+
+/* Compress and write out the buffered block */
+static bool __lz_stream_emit(__LzStream* stream) {
+    if (stream->size == 0) return true;
+    size_t packed = lz_compress(stream->block, stream->size, stream->packed, lz_compress_bound(LZ_BLOCK_SIZE));
+    bool raw = (packed == 0 || packed >= stream->size);
+    uint32_t header = raw ? (uint32_t) stream->size | __LZ_RAW_BLOCK : (uint32_t) packed;
+    unsigned char bytes[4] = {
+        (unsigned char) header, (unsigned char) (header >> 8), (unsigned char) (header >> 16), (unsigned char) (header >> 24)
+    };
+    size_t length = raw ? stream->size : packed;
+    if (fwrite(bytes, 1, 4, stream->origin) != 4
+        || fwrite(raw ? stream->block : stream->packed, 1, length, stream->origin) != length)
+        return false;
+    stream->size = 0;
+    return true;
+}
+
+static ssize_t __lz_stream_write(void* cookie, const char* buffer, size_t size) {
+    __LzStream* stream = (__LzStream*) cookie;
+    size_t done = 0;
+    while (done < size) {
+        size_t n = LZ_BLOCK_SIZE - stream->size;
+        if (n > size - done) n = size - done;
+        memcpy(stream->block + stream->size, buffer + done, n);
+        stream->size += n;
+        done += n;
+        if (stream->size == LZ_BLOCK_SIZE && !__lz_stream_emit(stream)) return -1;
+    }
+    return (ssize_t) done;
+}
+
+static int __lz_stream_close(void* cookie) {
+    __LzStream* stream = (__LzStream*) cookie;
+    int result = 0;
+    if (stream->writing) {
+        // Flush the last block and end the frame
+        static const unsigned char end[4] = { 0, 0, 0, 0 };
+        if (!__lz_stream_emit(stream) || fwrite(end, 1, 4, stream->origin) != 4) result = EOF;
+    }
+    if (fclose(stream->origin) != 0) result = EOF;
+    cprime_free(stream->block);
+    cprime_free(stream->packed);
+    cprime_free(stream);
+    return result;
+}
+
+/* Wrap `origin` in a compressing ("w") or decompressing ("r") stream; NULL on failure (origin is left open) */
+static FILE* __lz_stream_open(FILE* origin, const char* mode) {
+    __LzStream* stream = (__LzStream*) cprime_calloc(1, sizeof (__LzStream));
+    if (stream == NULL) return NULL;
+    stream->origin = origin;
+    stream->block = (unsigned char*) cprime_malloc(LZ_BLOCK_SIZE);
+    stream->packed = (unsigned char*) cprime_malloc(lz_compress_bound(LZ_BLOCK_SIZE));
+    bool reading = (mode[0] == 'r');
+    stream->magic = reading;
+    stream->writing = !reading;
+    cookie_io_functions_t io = { reading ? __lz_stream_read : NULL, reading ? NULL : __lz_stream_write, NULL, __lz_stream_close };
+    FILE* file = NULL;
+    if (stream->block != NULL && stream->packed != NULL && (reading || fwrite(LZ_MAGIC, 1, 4, origin) == 4))
+        file = fopencookie(stream, mode, io);
+    if (file == NULL) {
+        cprime_free(stream->block);
+        cprime_free(stream->packed);
+        cprime_free(stream);
+    }
+    return file;
+}
+
+/* Whether a file starts with a compressed frame (checked without moving its position) */
+static bool __lz_detect(FILE* file) {
+    unsigned char magic[4];
+    if (fileno(file) >= 0)
+        return pread(fileno(file), magic, 4, 0) == 4 && memcmp(magic, LZ_MAGIC, 4) == 0;
+    // Custom streams at their start: peek through the stream and rewind
+    bool found = fread(magic, 1, 4, file) == 4 && memcmp(magic, LZ_MAGIC, 4) == 0;
+    rewind(file);
+    return found;
+}
+
+/* Buffered reads: drop the pages that were not cached before the scan read them */
+static void __cold_stream_release(__ColdStream* stream, __ColdPages* block) {
+    size_t i = 0;
+    while (i < block->pages) {
+        if (block->resident[i] & 1) {
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < block->pages && !(block->resident[j] & 1)) j++;
+        posix_fadvise(stream->fd, block->first + (off_t) i * stream->page, (off_t) (j - i) * stream->page,
+                      POSIX_FADV_DONTNEED);
+        i = j;
+    }
+    block->pages = 0;
+}
+
+/* Buffered reads: note which pages behind the block at `start` are cached already */
+static void __cold_stream_probe(__ColdStream* stream, __ColdPages* block, off_t start) {
+    block->start = start;
+    block->first = start & ~(stream->page - 1);
+    block->pages = (size_t) ((start + (off_t) __COLD_BLOCK - block->first + stream->page - 1) / stream->page);
+    size_t length = block->pages * (size_t) stream->page;
+    // Mapping without touching faults nothing in; unknown pages count as cold
+    void* view = mmap(NULL, length, PROT_READ, MAP_SHARED, stream->fd, block->first);
+    if (view == MAP_FAILED || mincore(view, length, block->resident) != 0)
+        memset(block->resident, 0, block->pages);
+    if (view != MAP_FAILED) munmap(view, length);
+}
+
+/* Buffered reads: release the block just consumed, and probe the block after the one at `start` before
+   reading it ahead ourselves (kernel read-ahead is off, as it could cache pages before they are probed) */
+static void __cold_stream_track(__ColdStream* stream, off_t start) {
+    __ColdPages* done = &stream->behind[stream->current];
+    __ColdPages* next = &stream->behind[stream->current ^ 1];
+    __cold_stream_release(stream, done);
+    if (next->pages == 0 || next->start != start) {
+        // First read, or a seek: the block was not probed ahead
+        __cold_stream_release(stream, next);
+        __cold_stream_probe(stream, next, start);
+    }
+    __cold_stream_probe(stream, done, start + (off_t) __COLD_BLOCK);
+    posix_fadvise(stream->fd, start + (off_t) __COLD_BLOCK, (off_t) __COLD_BLOCK, POSIX_FADV_WILLNEED);
+    stream->current ^= 1;
+}
+
+/* Refill the block from the current position; 1 if data is available, 0 at the end of the file, -1 on error */
+static int __cold_stream_load(__ColdStream* stream) {
+    off_t position = stream->offset + (off_t) stream->pos;
+    off_t start = stream->direct ? position & ~(__COLD_ALIGN - 1) : position;
+    if (!stream->direct)
+        __cold_stream_track(stream, start);
+    ssize_t n;
+    do n = pread(stream->fd, stream->block, __COLD_BLOCK, start);
+    while (n < 0 && errno == EINTR);
+    if (n < 0 && errno == EINVAL && stream->direct) {
+        // The filesystem accepted O_DIRECT at open but refuses the read: continue buffered
+        fcntl(stream->fd, F_SETFL, fcntl(stream->fd, F_GETFL) & ~O_DIRECT);
+        posix_fadvise(stream->fd, 0, 0, POSIX_FADV_RANDOM);
+        stream->direct = false;
+        return __cold_stream_load(stream);
+    }
+    if (n < 0) return -1;
+    stream->offset = start;
+    stream->size = (size_t) n;
+    stream->pos = (size_t) (position - start);
+    if (stream->pos > stream->size) stream->pos = stream->size;  // The file shrank
+    return (stream->pos < stream->size) ? 1 : 0;
+}
+
+static ssize_t __cold_stream_read(void* cookie, char* buffer, size_t size) {
+    __ColdStream* stream = (__ColdStream*) cookie;
+    if (stream->pos == stream->size) {
+        int loaded = __cold_stream_load(stream);
+        if (loaded <= 0) return loaded;
+    }
+    size_t n = stream->size - stream->pos;
+    if (n > size) n = size;
+    memcpy(buffer, stream->block + stream->pos, n);
+    stream->pos += n;
+    return (ssize_t) n;
+}
+
+static int __cold_stream_seek(void* cookie, off64_t* position, int whence) {
+    __ColdStream* stream = (__ColdStream*) cookie;
+    off_t target = (off_t) *position;
+    struct stat info;
+    if (whence == SEEK_CUR) target += stream->offset + (off_t) stream->pos;
+    else if (whence == SEEK_END) target = (fstat(stream->fd, &info) == 0) ? target + info.st_size : -1;
+    if (target < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (target >= stream->offset && target <= stream->offset + (off_t) stream->size) {
+        stream->pos = (size_t) (target - stream->offset);
+    } else {
+        stream->offset = target;
+        stream->size = stream->pos = 0;
+    }
+    *position = (off64_t) target;
+    return 0;
+}
+
+static int __cold_stream_close(void* cookie) {
+    __ColdStream* stream = (__ColdStream*) cookie;
+    __cold_stream_release(stream, &stream->behind[0]);
+    __cold_stream_release(stream, &stream->behind[1]);
+    int result = fclose(stream->origin);
+    cprime_free(stream->memory);
+    cprime_free(stream);
+    return result;
+}
+
+/* Wrap a freshly opened `origin` for a cold scan: O_DIRECT where the filesystem supports it, otherwise
+   large buffered reads that drop whatever they brought into the cache; NULL on failure (origin is left open) */
+static FILE* __cold_stream_open(FILE* origin) {
+    __ColdStream* stream = (__ColdStream*) cprime_calloc(1, sizeof (__ColdStream));
+    if (stream == NULL) return NULL;
+    stream->memory = (char*) cprime_malloc(__COLD_BLOCK + (size_t) __COLD_ALIGN);
+    if (stream->memory == NULL) {
+        cprime_free(stream);
+        return NULL;
+    }
+    stream->block = stream->memory + (-(uintptr_t) stream->memory & (uintptr_t) (__COLD_ALIGN - 1));
+    stream->origin = origin;
+    stream->fd = fileno(origin);
+    stream->page = (off_t) sysconf(_SC_PAGESIZE);
+    int flags = fcntl(stream->fd, F_GETFL);
+    stream->direct = flags >= 0 && fcntl(stream->fd, F_SETFL, flags | O_DIRECT) == 0;
+    if (!stream->direct)
+        posix_fadvise(stream->fd, 0, 0, POSIX_FADV_RANDOM);
+    cookie_io_functions_t io = { __cold_stream_read, NULL, __cold_stream_seek, __cold_stream_close };
+    FILE* file = fopencookie(stream, "r", io);
+    if (file == NULL) {
+        if (stream->direct) fcntl(stream->fd, F_SETFL, flags);
+        cprime_free(stream->memory);
+        cprime_free(stream);
+    }
+    return file;
+}
+#endif  // CPRIME_COOKIE_STREAMS
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* File Reader */
+
+/* Character reads without per-call locking, for use while the stream is locked for the enclosing scope */
+#if defined(__unix__) || defined(__APPLE__)
+    #define __getc_fast(file) getc_unlocked(file)
+    static inline void __stream_unlock(FILE** file) { funlockfile(*file); }
+    #define __STREAM_LOCK(file) \
+        FILE* __locked_stream __attribute__((__cleanup__(__stream_unlock), unused)) = (flockfile(file), (file))
+#else
+    #define __getc_fast(file) getc(file)
+    #define __STREAM_LOCK(file) ((void) 0)
+#endif
+
+/**
+ * @brief File reader structure; reads from a file line-by-line or word-by-word
+ * @note You must call `close_FileReader(FileReader*)` to free the memory after use
+ * @param file The file to read from
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
+ * @throw `TIMEOUT_EXCEPTION` from the line, token and follow methods once an enclosing `try_deadline` has expired,
+ * also where the deadline timer is unavailable
+ * 
+ * ### Methods
+ * 
+ * - `new_FileReader(string filename, bool cold=false)`
+ * 
+ * - `close_FileReader(FileReader*)`
+ * 
+ * - `FileReader_nextLine(FileReader*)`
+ * 
+ * - `FileReader_nextString(FileReader*, Interner* interner=NULL)`
+ * 
  * - `FileReader_nextChar(FileReader*)`
  * 
- * - `FileReader_nextInt(FileReader*)`
+ * - `FileReader_nextInt(FileReader*)`
+ * 
+ * - `FileReader_nextLong(FileReader*)`
+ * 
+ * - `FileReader_nextFloat(FileReader*)`
+ * 
+ * - `FileReader_nextDouble(FileReader*)`
+ * 
+ * - `FileReader_hasNext(FileReader*)`
+ * 
+ * - `FileReader_follow(FileReader*, long timeout_ms)`
+ * 
+ * - `FileReader_seekLine(FileReader*, size_t line)`
+ * 
+ * - `FileReader_readLines(FileReader*, size_t first, size_t count)`
+ */
+typedef struct FileIndex FileIndex;
+void delete_FileIndex(FileIndex* index);
+
+typedef struct FileReader FileReader;
+struct FileReader {
+    FILE* file;
+    string buffer;
+    size_t capacity;
+    size_t size;
+    string filename;            // Kept to reopen the file after rotation
+    bool following;             // Set by `FileReader_follow`; incomplete last lines are left unread
+    bool draining;              // The file was rotated: return its incomplete last line as is
+    long long pending;          // End of the incomplete last line left unread, or -1
+    int notify;                 // inotify descriptor while following, or -1
+    int watch;                  // inotify watch on the opened file, or -1
+    FileIndex* index;           // Line index loaded by the first seek by line number, or NULL
+};
+
+/**
+ * @brief Read the next line from the file (up to the next newline or EOF)
+ * @param filereader The file reader to read from
+ * @return The line read from the file, or NULL if not found
+ * @note The caller owns the returned line and must release it with `cprime_free` (or `free` with the default allocator)
+ * @memberof FileReader
+ */
+string FileReader_nextLine(FileReader* filereader);
+
+string __FileReader_line(FileReader* filereader, size_t* size);
+
+string __FileReader_token(FileReader* filereader, size_t* size);
+
+static inline string __FileReader_nextString(FileReader* filereader) {
+    size_t size;
+    return __FileReader_token(filereader, &size);
+}
+
+const char* __FileReader_nextString_interned(FileReader* filereader, Interner* interner);
+
+/**
+ * @brief Read the next string from the file (up to the next space, newline, or EOF)
+ * @param filereader The file reader to read from
+ * @param interner [optional] An interner to intern the string with, straight from the reader's buffer
+ * @return The string read from the file, or NULL if not found; with an interner, the canonical string
+ * @note Without an interner, the returned string is owned by the reader and is only valid until the next read;
+ *       with one, it is owned by the interner and stays valid until the interner is deleted. Do not free it
+ * @memberof FileReader
+ */
+#define FileReader_nextString(...) \
+    GET_MACRO2(__VA_ARGS__, __FileReader_nextString_interned, __FileReader_nextString)(__VA_ARGS__)
+
+/**
+ * @brief Read the next character from the file (skipping whitespace)
+ * @param filereader The file reader to read from
+ * @return The character read from the file, or CHAR_MAX if not found
+ * @memberof FileReader
+ */
+char FileReader_nextChar(FileReader* filereader);
+
+/**
+ * @brief Read an integer from the file (up to the next space, newline, or EOF)
+ * @param filereader The file reader to read from
+ * @return The integer read from the file, or INT_MAX if not found
+ * @memberof FileReader
+ */
+int FileReader_nextInt(FileReader* filereader);
+
+/**
+ * @brief Read a long from the file (up to the next space, newline, or EOF)
+ * @param filereader The file reader to read from
+ * @return The long read from the file, or LONG_MAX if not found
+ * @memberof FileReader
+ */
+long FileReader_nextLong(FileReader* filereader);
+
+/**
+ * @brief Read a float from the file (up to the next space, newline, or EOF)
+ * @param filereader The file reader to read from
+ * @return The float read from the file, or FLT_MAX if not found
+ * @memberof FileReader
+ */
+float FileReader_nextFloat(FileReader* filereader);
+
+/**
+ * @brief Read a double from the file (up to the next space, newline, or EOF)
+ * @param filereader The file reader to read from
+ * @return The double read from the file, or DBL_MAX if not found
+ * @memberof FileReader
+ */
+double FileReader_nextDouble(FileReader* filereader);
+
+/**
+ * @brief Check if the file reader has more data to read
+ * @param filereader The file reader to check
+ * @return True if there is more data to read, or false otherwise
+ * @memberof FileReader
+ */
+bool FileReader_hasNext(FileReader* filereader);
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * @brief Wait at the end of the file until more data is available (like `tail -F`)
+ * @param filereader The file reader to wait on
+ * @param timeout_ms The maximum time to wait, 0 to only check, or -1 to wait indefinitely
+ * @return True if there is more data to read, or false on timeout or error
+ * @note Blocks on inotify on Linux and polls with a backoff of up to 100ms elsewhere
+ * @note If the file is truncated, reading restarts at its beginning; if it is replaced (rotated), the rest of the
+ * old file is read first and then the new file is opened under the same name
+ * @note Once following, `FileReader_nextLine` returns NULL for an incomplete last line and returns it in full
+ * after the writer finishes it
+ * @throw `TIMEOUT_EXCEPTION` if the deadline of an enclosing `try_deadline` passes while waiting
+ * @memberof FileReader
+ */
+bool FileReader_follow(FileReader* filereader, long timeout_ms);
+#endif
+
+FileReader* __new_FileReader_RC(const char* filename, bool cold);
+
+static inline FileReader* __new_FileReader_R(const char* filename) { return __new_FileReader_RC(filename, false); }
+
+/**
+ * @brief Create a new file reader
+ * @param filename The name of the file to read
+ * @param cold [optional] Whether this is a one-pass scan that should not disturb the page cache (default is
+ *        false); reads use O_DIRECT where the filesystem supports it, otherwise pages are dropped behind the
+ *        read position, and following, line seeks and zero-copy transfers are unavailable
+ * @return The file reader
+ * @note Files written with compression are detected from their header and decompressed transparently
+ * @note Without custom streams (see `CPRIME_COOKIE_STREAMS`) the cold flag is ignored
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
+ * @memberof FileReader
+ */
+#define new_FileReader(...) GET_MACRO2(__VA_ARGS__, __new_FileReader_RC, __new_FileReader_R)(__VA_ARGS__)
+
+/**
+ * @brief Close the file reader and free allocated memory
+ * @param filereader The file reader to close
+ * @memberof FileReader
+ */
+void close_FileReader(FileReader* filereader);
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Read the next line into the reader's buffer (kept between calls); its length goes to `size` */
+string __FileReader_line(FileReader* filereader, size_t* size) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL)
+        return NULL;
+    deadline_check();
+    if (filereader->capacity < 16) {
+        cprime_free(filereader->buffer);
+        filereader->buffer = (string) cprime_malloc(16);
+        filereader->capacity = (filereader->buffer != NULL) ? 16 : 0;
+        if (filereader->buffer == NULL)
+            return NULL;
+    }
+    size_t length = 0;
+    int c;
+    __STREAM_LOCK(filereader->file);
+#if defined(__unix__) || defined(__APPLE__)
+    off_t start = (filereader->following && !filereader->draining) ? ftello(filereader->file) : -1;
+#endif
+    while ((c = __getc_fast(filereader->file)) != '\r' && c != '\n' && c != EOF) {
+        if (length + 1 >= filereader->capacity) {
+            size_t capacity = filereader->capacity * 2;
+            string temp = (string) cprime_realloc(filereader->buffer, capacity);
+            if (temp == NULL) return NULL;
+            filereader->buffer = temp;
+            filereader->capacity = capacity;
+        }
+        filereader->buffer[length++] = c;
+    }
+    if (length == 0 && c == EOF)
+        return NULL;
+#if defined(__unix__) || defined(__APPLE__)
+    if (c == EOF && start >= 0) {
+        // The writer has not finished this line yet; read it again in full once it has
+        filereader->pending = ftello(filereader->file);
+        fseeko(filereader->file, start, SEEK_SET);
+        return NULL;
+    }
+#endif
+    if (c == '\r' && (c = __getc_fast(filereader->file)) != '\n')
+        if (c != EOF && ungetc(c, filereader->file) == EOF)
+            return NULL;
+    filereader->buffer[length] = '\0';
+    *size = length;
+    return filereader->buffer;
+}
+
+string FileReader_nextLine(FileReader* filereader) {
+    size_t size;
+    string line = __FileReader_line(filereader, &size);
+    if (line == NULL) return NULL;
+    string s = (string) cprime_malloc(size + 1);
+    if (s == NULL) return NULL;
+    memcpy(s, line, size + 1);
+    return s;
+}
+
+/* Read the next space-separated token into the reader's buffer (kept between calls); its length goes to `size` */
+string __FileReader_token(FileReader* filereader, size_t* size) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL)
+        return NULL;
+    deadline_check();
+    size_t length = 0;
+    int c;
+    __STREAM_LOCK(filereader->file);
+    do {
+        c = __getc_fast(filereader->file);
+    } while (c == ' ' || c == '\n' || c == '\r');
+    if (c == EOF)
+        return NULL;
+    if (filereader->capacity < 16) {
+        cprime_free(filereader->buffer);
+        filereader->buffer = (string) cprime_malloc(16);
+        filereader->capacity = (filereader->buffer != NULL) ? 16 : 0;
+        if (filereader->buffer == NULL)
+            return NULL;
+    }
+    while (c != ' ' && c != '\n' && c != '\r' && c != EOF) {
+        if (length + 1 >= filereader->capacity) {
+            size_t capacity = filereader->capacity * 2;
+            string temp = (string) cprime_realloc(filereader->buffer, capacity);
+            if (temp == NULL) {
+                cprime_free(filereader->buffer);
+                filereader->buffer = NULL;
+                filereader->capacity = 0;
+                return NULL;
+            }
+            filereader->buffer = temp;
+            filereader->capacity = capacity;
+        }
+        filereader->buffer[length++] = c;
+        c = __getc_fast(filereader->file);
+    }
+    filereader->buffer[length] = '\0';
+    if (c == '\r') {
+        c = __getc_fast(filereader->file);
+        if (c != '\n') ungetc(c, filereader->file);
+    }
+    *size = length;
+    return filereader->buffer;
+}
+
+const char* __FileReader_nextString_interned(FileReader* filereader, Interner* interner) {
+    size_t size;
+    string token = __FileReader_token(filereader, &size);
+    return (token == NULL) ? NULL : __Interner_intern(interner, token, size);
+}
+
+char FileReader_nextChar(FileReader* filereader) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL)
+        return CHAR_MAX;
+    int c;
+    do {
+        c = fgetc(filereader->file);
+    } while (isspace(c));
+    if (c == EOF) return CHAR_MAX;
+    return (char)c;
+}
+
+int FileReader_nextInt(FileReader* filereader) {
+    PROFILE_FUNC();
+    if (filereader == NULL || filereader->file == NULL)
+        return INT_MAX;
+    string line = FileReader_nextString(filereader);
+    if (line == NULL)
+        return INT_MAX;
+    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
+        char* tail;
+        errno = 0;
+        long n = strtol(line, &tail, 10);
+        if (errno == 0 && *tail == '\0' && n >= INT_MIN && n < INT_MAX)
+            return n;
+    }
+    return INT_MAX;
+}
+
+long FileReader_nextLong(FileReader* filereader) {
+    PROFILE_FUNC();
+    if (filereader == NULL || filereader->file == NULL)
+        return LONG_MAX;
+    string line = FileReader_nextString(filereader);
+    if (line == NULL)
+        return LONG_MAX;
+    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
+        char* tail;
+        errno = 0;
+        long n = strtol(line, &tail, 10);
+        if (errno == 0 && *tail == '\0' && n < LONG_MAX)
+            return n;
+    }
+    return LONG_MAX;
+}
+
+float FileReader_nextFloat(FileReader* filereader) {
+    PROFILE_FUNC();
+    if (filereader == NULL || filereader->file == NULL)
+        return FLT_MAX;
+    string line = FileReader_nextString(filereader);
+    if (line == NULL)
+        return FLT_MAX;
+    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
+        char* tail;
+        errno = 0;
+        float f = strtof(line, &tail);
+        if (errno == 0 && *tail == '\0' && isfinite(f) != 0 && f < FLT_MAX)
+            return f;
+    }
+    return FLT_MAX;
+}
+
+double FileReader_nextDouble(FileReader* filereader) {
+    PROFILE_FUNC();
+    if (filereader == NULL || filereader->file == NULL)
+        return DBL_MAX;
+    string line = FileReader_nextString(filereader);
+    if (line == NULL)
+        return DBL_MAX;
+    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
+        char* tail;
+        errno = 0;
+        double d = strtod(line, &tail);
+        if (errno == 0 && *tail == '\0' && isfinite(d) != 0 && d < DBL_MAX)
+            return d;
+    }
+    return DBL_MAX;
+}
+
+bool FileReader_hasNext(FileReader* filereader) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL)
+        return false;
+    int c = fgetc(filereader->file);
+    if (c != EOF && ungetc(c, filereader->file) == EOF)
+        return false;
+    return c != EOF;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Watch the opened file for growth and its directory for a replacement appearing under the same name */
+static void __FileReader_watch(FileReader* filereader) {
+#ifdef __linux__
+    if (filereader->notify < 0) {
+        filereader->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (filereader->notify < 0) return;
+        char directory[4096];
+        const char* slash = strrchr(filereader->filename, '/');
+        if (slash == NULL) strcpy(directory, ".");
+        else snprintf(directory, sizeof directory, "%.*s", (int) (slash == filereader->filename ? 1 : slash - filereader->filename), filereader->filename);
+        inotify_add_watch(filereader->notify, directory, IN_CREATE | IN_MOVED_TO);
+    }
+    if (filereader->watch >= 0)
+        inotify_rm_watch(filereader->notify, filereader->watch);
+    filereader->watch = inotify_add_watch(filereader->notify, filereader->filename,
+                                          IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#else
+    (void) filereader;
+#endif
+}
+
+bool FileReader_follow(FileReader* filereader, long timeout_ms) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL)
+        return false;
+    if (filereader->filename == NULL || fileno(filereader->file) < 0)
+        return FileReader_hasNext(filereader);  // Compressed or not backed by a file
+    if (!filereader->following) {
+        filereader->following = true;
+        __FileReader_watch(filereader);
+    }
+    uint64_t deadline = (timeout_ms > 0) ? __monotonic_ns() + (uint64_t) timeout_ms * 1000000ull : 0;
+    long backoff = 1;
+    while (true) {
+        deadline_check();
+        clearerr(filereader->file);
+        struct stat opened, named;
+        off_t position = ftello(filereader->file);
+        if (position < 0 || fstat(fileno(filereader->file), &opened) != 0)
+            return false;
+        off_t end = (filereader->pending > position) ? (off_t) filereader->pending : position;
+        if (opened.st_size > end)
+            return true;
+        if (opened.st_size < end) {
+            // Truncated in place (copytruncate)
+            if (fseeko(filereader->file, 0, SEEK_SET) != 0)
+                return false;
+            filereader->pending = -1;
+            if (opened.st_size > 0)
+                return true;
+        } else if (stat(filereader->filename, &named) == 0
+                   && (named.st_ino != opened.st_ino || named.st_dev != opened.st_dev)) {
+            // Rotated: finish the old file (including an incomplete last line), then continue with the new one
+            if (end > position) {
+                filereader->draining = true;
+                return true;
+            }
+            FILE* file = fopen(filereader->filename, "r");
+            if (file != NULL) {
+                fclose(filereader->file);
+                filereader->file = file;
+                filereader->draining = false;
+                filereader->pending = -1;
+                __FileReader_watch(filereader);
+                continue;
+            }
+        }
+        long wait = -1;
+        if (timeout_ms >= 0) {
+            uint64_t now = __monotonic_ns();
+            if (timeout_ms == 0 || now >= deadline)
+                return false;
+            wait = (long) ((deadline - now + 999999) / 1000000);
+        }
+        long remaining = deadline_remaining();
+        if (remaining >= 0 && (wait < 0 || remaining < wait))
+            wait = remaining;  // Wake up in time to throw at the deadline
+        if (filereader->notify >= 0) {
+            // Re-check at least once a second in case events are lost (e.g. on network filesystems)
+            struct pollfd pfd = { filereader->notify, POLLIN, 0 };
+            if (poll(&pfd, 1, (wait < 0 || wait > 1000) ? 1000 : (int) wait) > 0) {
+                char events[4096];
+                while (read(filereader->notify, events, sizeof events) > 0) {}
+            }
+        } else {
+            if (wait < 0 || wait > backoff) wait = backoff;
+            struct timespec pause = { wait / 1000, (wait % 1000) * 1000000 };
+            nanosleep(&pause, NULL);
+            if (backoff < 100) backoff *= 2;
+        }
+    }
+}
+#endif
+
+FileReader* __new_FileReader_RC(const char* filename, bool cold) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filename == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        throw(FILE_NOT_FOUND_EXCEPTION);
+        return NULL;
+    }
+#ifdef CPRIME_COOKIE_STREAMS
+    if (cold) {
+        FILE* scan = __cold_stream_open(file);
+        if (scan == NULL) {
+            fclose(file);
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return NULL;
+        }
+        file = scan;
+    }
+    if (__lz_detect(file)) {
+        FILE* decompressed = __lz_stream_open(file, "r");
+        if (decompressed == NULL) {
+            fclose(file);
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return NULL;
+        }
+        file = decompressed;
+    }
+#else
+    (void) cold;
+#endif
+    FileReader* filereader = (FileReader*) cprime_malloc(sizeof (FileReader));
+    if (filereader == NULL) {
+        fclose(file);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    filereader->file = file;
+    filereader->buffer = NULL;
+    filereader->capacity = 0;
+    filereader->size = 0;
+    filereader->filename = (string) cprime_malloc(strlen(filename) + 1);
+    if (filereader->filename == NULL) {
+        fclose(file);
+        cprime_free(filereader);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    strcpy(filereader->filename, filename);
+    filereader->following = false;
+    filereader->draining = false;
+    filereader->pending = -1;
+    filereader->notify = -1;
+    filereader->watch = -1;
+    filereader->index = NULL;
+    return filereader;
+}
+
+void close_FileReader(FileReader* filereader) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader != NULL) {
+        if (filereader->file != NULL)
+            fclose(filereader->file);
+        if (filereader->buffer != NULL)
+            cprime_free(filereader->buffer);
+        if (filereader->filename != NULL)
+            cprime_free(filereader->filename);
+        delete_FileIndex(filereader->index);
+#if defined(__unix__) || defined(__APPLE__)
+        if (filereader->notify >= 0)
+            close(filereader->notify);
+#endif
+        cprime_free(filereader);
+    }
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* File Writer */
+
+/**
+ * @brief File writer structure; writes to a file using various data types.
+ * @note You must call `close_FileWriter(FileWriter*, bool flush=true)` to free the memory after use
+ * @param file The file to write to
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
+ * 
+ * ### Methods
+ * 
+ * - `new_FileWriter(string filename, bool appendMode=false, bool compress=false)` 
+ * 
+ * - `new_MappedFileWriter(string filename, size_t expected_size=0)` writes into a memory mapping instead
+ * 
+ * - `close_FileWriter(FileWriter*, bool flush=true)` where `flush` adds a line break before closing
+ * 
+ * - `FileWriter_writeLine(FileWriter*, const char*)`
+ * 
+ * - `FileWriter_writeString(FileWriter*, const char*)`
+ * 
+ * - `FileWriter_writeChar(FileWriter*, char)`
+ * 
+ * - `FileWriter_writeInt(FileWriter*, int)`
+ * 
+ * - `FileWriter_writeLong(FileWriter*, long)`
+ * 
+ * - `FileWriter_writeFloat(FileWriter*, float)`
+ * 
+ * - `FileWriter_writeDouble(FileWriter*, double)`
+ * 
+ * - `FileWriter_writeFrom(FileWriter*, FileReader*, unsigned long long offset=0, unsigned long long length=all)`
+ */
+typedef struct __DurableLog __DurableLog;
+
+typedef struct FileWriter FileWriter;
+struct FileWriter {
+    FILE* file;
+    __DurableLog* log;  // Set for durable logs (see new_DurableFileWriter)
+    char* mapping;      // Set for mapped writers (see new_MappedFileWriter); output goes to mapping[size..capacity)
+    size_t size;
+    size_t capacity;
+    int fd;
+};
+
+/* Smallest and largest growth of a mapped writer's file */
+#define __MAPPED_MIN_GROWTH ((size_t) 64 << 20)
+#define __MAPPED_MAX_GROWTH ((size_t) 1 << 30)
+
+char* __FileWriter_grow(FileWriter* filewriter, size_t n);
+
+/* Room for `n` bytes at the end of a mapped writer's output, or NULL; advance `size` after filling it */
+static inline char* __FileWriter_reserve(FileWriter* filewriter, size_t n) {
+    if (filewriter->capacity - filewriter->size >= n) return filewriter->mapping + filewriter->size;
+    return __FileWriter_grow(filewriter, n);
+}
+
+/* Write raw bytes to the stream, or copy them into the mapping */
+static inline void __FileWriter_put(FileWriter* filewriter, const void* data, size_t n) {
+    if (filewriter->mapping == NULL) {
+        fwrite(data, 1, n, filewriter->file);
+        return;
+    }
+    char* out = __FileWriter_reserve(filewriter, n);
+    if (out == NULL) return;
+    memcpy(out, data, n);
+    filewriter->size += n;
+}
+
+/**
+ * @brief Write a line to the file and append a line break
+ * @param filewriter The file writer to write to
+ * @param line The string to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeLine(FileWriter* filewriter, const char* line);
+
+/**
+ * @brief Write a string to the file
+ * @param filewriter The file writer to write to
+ * @param s The string to write
+ * @memberof FileWriter
+ */
+static inline void FileWriter_writeString(FileWriter* filewriter, const char* s) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL || s == NULL) return;
+    if (filewriter->mapping != NULL) {
+        __FileWriter_put(filewriter, s, strlen(s));
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    fprintf(filewriter->file, "%s", s);
+}
+
+/**
+ * @brief Write a character to the file
+ * @param filewriter The file writer to write to
+ * @param c The character to write
+ * @memberof FileWriter
+ */
+static inline void FileWriter_writeChar(FileWriter* filewriter, char c) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL) return;
+    if (filewriter->mapping != NULL) {
+        char* out = __FileWriter_reserve(filewriter, 1);
+        if (out != NULL) {
+            *out = c;
+            filewriter->size++;
+        }
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    putc(c, filewriter->file);
+}
+
+/**
+ * @brief Write an integer to the file
+ * @param filewriter The file writer to write to
+ * @param n The integer to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeInt(FileWriter* filewriter, int n);
+
+/**
+ * @brief Write a long integer to the file
+ * @param filewriter The file writer to write to
+ * @param n The long integer to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeLong(FileWriter* filewriter, long n);
+
+/**
+ * @brief Write a float to the file
+ * @param filewriter The file writer to write to
+ * @param f The float to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeFloat(FileWriter* filewriter, float f);
+
+/**
+ * @brief Write a double to the file
+ * @param filewriter The file writer to write to
+ * @param d The double to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeDouble(FileWriter* filewriter, double d);
+
+FileWriter* __new_FileWriter_WAC(const char* filename, bool append, bool compress);
+
+static inline FileWriter* __new_FileWriter_WA(const char* filename, bool append) { return __new_FileWriter_WAC(filename, append, false); }
+static inline FileWriter* __new_FileWriter_W(const char* filename) { return __new_FileWriter_WAC(filename, false, false); }
+static inline FileWriter* __new_FileWriter_A(const char* filename) { return __new_FileWriter_WAC(filename, true, false); }
+
+/**
+ * @brief Create a new file writer
+ * @param filename The name of the file to write to
+ * @param append [optional] Whether to append open the file in append mode (default is false)
+ * @param compress [optional] Whether to LZ-compress the output in blocks (default is false); `new_FileReader`
+ *        detects and decompresses such files, and appending to one adds a new compressed frame
+ * @return The file writer
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
+ * @throw `INVALID_OPERATION_EXCEPTION` if compression is requested where custom streams are unavailable
+ * @memberof FileWriter
+ */
+#define new_FileWriter(...) \
+    GET_MACRO3(__VA_ARGS__, __new_FileWriter_WAC, __new_FileWriter_WA, __new_FileWriter_W)(__VA_ARGS__)
+
+#if defined(__unix__) || defined(__APPLE__)
+FileWriter* __new_MappedFileWriter_size(const char* filename, size_t expected_size);
+
+static inline FileWriter* __new_MappedFileWriter(const char* filename) { return __new_MappedFileWriter_size(filename, 0); }
+
+/**
+ * @brief Create a file writer that writes into a memory mapping of a preallocated file
+ * @param filename The name of the file to create or replace
+ * @param expected_size [optional] The expected size of the output in bytes, preallocated up front (default is 0:
+ *        start with 64MB); the file grows in steps of up to 1GB if the output is larger
+ * @return The file writer; every write method is a copy into the mapping, with no stream or system call
+ * @note `close_FileWriter` truncates the file to the size of the output
+ * @note The space is reserved with `posix_fallocate` on Linux so that running out of disk fails a write (which
+ *       is then dropped) instead of faulting on the mapping; elsewhere the file is extended sparsely
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file cannot be created
+ * @throw `IO_ERROR_EXCEPTION` if the space cannot be allocated or mapped
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
+ * @memberof FileWriter
+ */
+#define new_MappedFileWriter(...) \
+    GET_MACRO2(__VA_ARGS__, __new_MappedFileWriter_size, __new_MappedFileWriter)(__VA_ARGS__)
+#endif
+
+void __close_FileWriter(FileWriter* filewriter, bool flush);
+
+static inline void __close_FileWriter_flush(FileWriter* filewriter)   { __close_FileWriter(filewriter, true); }
+static inline void __close_FileWriter_noflush(FileWriter* filewriter) { __close_FileWriter(filewriter, false); }
+
+/**
+ * @brief Close a file writer
+ * @param filewriter The file writer to close
+ * @param flush [optional] Whether to flush the file (appends a line break; default is true)
+ * @memberof FileWriter
+ */
+#define close_FileWriter(...) GET_MACRO2(__VA_ARGS__, __close_FileWriter, __close_FileWriter_flush)(__VA_ARGS__)
+
+#ifdef CPRIME_IMPLEMENTATION
+static void __DurableLog_close(__DurableLog* log);
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Give the file `size` bytes of disk space (sparse where preallocation is unsupported) */
+static int __mapped_allocate(int fd, size_t size) {
+#ifdef __linux__
+    if (posix_fallocate(fd, 0, (off_t) size) == 0) return 0;
+#endif
+    return ftruncate(fd, (off_t) size);
+}
+
+/* Extend a mapped writer's file and mapping to fit `n` more bytes; NULL if the disk or address space is full */
+char* __FileWriter_grow(FileWriter* filewriter, size_t n) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t step = filewriter->capacity;
+    if (step < __MAPPED_MIN_GROWTH) step = __MAPPED_MIN_GROWTH;
+    if (step > __MAPPED_MAX_GROWTH) step = __MAPPED_MAX_GROWTH;
+    size_t capacity = filewriter->capacity + step;
+    if (capacity < filewriter->size + n) capacity = filewriter->size + n;
+    capacity = (capacity + page - 1) / page * page;
+    if (__mapped_allocate(filewriter->fd, capacity) != 0) return NULL;
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+    void* mapping = mremap(filewriter->mapping, filewriter->capacity, capacity, MREMAP_MAYMOVE);
+    if (mapping == MAP_FAILED) return NULL;
+#else
+    void* mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, filewriter->fd, 0);
+    if (mapping == MAP_FAILED) return NULL;
+    munmap(filewriter->mapping, filewriter->capacity);
+#endif
+    filewriter->mapping = (char*) mapping;
+    filewriter->capacity = capacity;
+    return filewriter->mapping + filewriter->size;
+}
+#else
+char* __FileWriter_grow(FileWriter* filewriter, size_t n) { (void) filewriter; (void) n; return NULL; }
+#endif
+
+/* Whether the writer takes text and binary output (durable logs take records only) */
+static inline bool __FileWriter_writable(FileWriter* filewriter) {
+    return filewriter != NULL && (filewriter->file != NULL || filewriter->mapping != NULL);
+}
+
+/* Format an unsigned integer two digits at a time; returns the number of characters (at most 20) */
+static inline size_t __format_uint64(uint64_t value, char* out) {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[20];
+    char* p = digits + sizeof digits;
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, pairs + 2 * (value % 100), 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, pairs + 2 * value, 2);
+    } else {
+        *--p = (char) ('0' + value);
+    }
+    size_t n = (size_t) (digits + sizeof digits - p);
+    memcpy(out, p, n);
+    return n;
+}
+
+/* Format an integer into a mapped writer */
+static void __FileWriter_mapInteger(FileWriter* filewriter, long long n) {
+    char* out = __FileWriter_reserve(filewriter, 21);
+    if (out == NULL) return;
+    size_t length = 0;
+    if (n < 0) out[length++] = '-';
+    length += __format_uint64((n < 0) ? 0 - (uint64_t) n : (uint64_t) n, out + length);
+    filewriter->size += length;
+}
+
+/* Format a double exactly as "%f" does (6 decimals, ties to even) if its magnitude is below 2^53; 0 otherwise */
+static size_t __format_fixed6(double d, char* out) {
+#ifdef __SIZEOF_INT128__
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    int exponent = (int) ((bits >> 52) & 0x7ff);
+    if (exponent == 0x7ff || exponent >= 1075 + 1) return 0;  // Not finite, or at least 2^53
+    size_t n = 0;
+    if (bits >> 63) out[n++] = '-';
+    // |d| = mantissa / 2^shift; scale by 10^6 exactly in 128 bits and round the shifted-out part
+    uint64_t mantissa = bits & ((1ull << 52) - 1);
+    int shift = 1075 - exponent;
+    if (exponent == 0) shift = 1074;
+    else mantissa |= 1ull << 52;
+    unsigned __int128 scaled = 0;
+    if (shift <= 0) {
+        scaled = (unsigned __int128) mantissa * 1000000;
+    } else if (shift < 127) {
+        unsigned __int128 product = (unsigned __int128) mantissa * 1000000;
+        unsigned __int128 half = (unsigned __int128) 1 << (shift - 1);
+        unsigned __int128 rest = product & ((half << 1) - 1);
+        scaled = product >> shift;
+        if (rest > half || (rest == half && (scaled & 1))) scaled++;
+    }
+    n += __format_uint64((uint64_t) (scaled / 1000000), out + n);
+    uint32_t fraction = (uint32_t) (scaled % 1000000);
+    out[n++] = '.';
+    for (int i = 5; i >= 0; i--) {
+        out[n + (size_t) i] = (char) ('0' + fraction % 10);
+        fraction /= 10;
+    }
+    return n + 6;
+#else
+    (void) d;
+    (void) out;
+    return 0;
+#endif
+}
+
+/* Format a double with "%f" into a mapped writer */
+static void __FileWriter_mapDouble(FileWriter* filewriter, double d) {
+    // Up to 309 integer digits, a sign, a point, and 6 decimals
+    char* out = __FileWriter_reserve(filewriter, 320);
+    if (out == NULL) return;
+    size_t length = __format_fixed6(d, out);
+    if (length == 0) {
+        int printed = snprintf(out, 320, "%f", d);
+        length = (printed > 0) ? (size_t) printed : 0;
+    }
+    filewriter->size += length;
+}
+
+void FileWriter_writeLine(FileWriter* filewriter, const char* line) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL || line == NULL) return;
+    if (filewriter->mapping != NULL) {
+        size_t length = strlen(line);
+        char* out = __FileWriter_reserve(filewriter, length + 1);
+        if (out == NULL) return;
+        memcpy(out, line, length);
+        out[length] = '\n';
+        filewriter->size += length + 1;
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    fprintf(filewriter->file, "%s\n", line);
+}
+
+void FileWriter_writeInt(FileWriter* filewriter, int n) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL) return;
+    if (filewriter->mapping != NULL) {
+        __FileWriter_mapInteger(filewriter, n);
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    fprintf(filewriter->file, "%d", n);
+}
+
+void FileWriter_writeLong(FileWriter* filewriter, long n) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL) return;
+    if (filewriter->mapping != NULL) {
+        __FileWriter_mapInteger(filewriter, n);
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    fprintf(filewriter->file, "%ld", n);
+}
+
+void FileWriter_writeFloat(FileWriter* filewriter, float f) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL) return;
+    if (filewriter->mapping != NULL) {
+        __FileWriter_mapDouble(filewriter, f);
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    fprintf(filewriter->file, "%f", f);
+}
+
+void FileWriter_writeDouble(FileWriter* filewriter, double d) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL) return;
+    if (filewriter->mapping != NULL) {
+        __FileWriter_mapDouble(filewriter, d);
+        return;
+    }
+    if (filewriter->file == NULL) return;
+    fprintf(filewriter->file, "%lf", d);
+}
+
+FileWriter* __new_FileWriter_WAC(const char* filename, bool append, bool compress) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filename == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+#ifndef CPRIME_COOKIE_STREAMS
+    if (compress) {
+        throw(INVALID_OPERATION_EXCEPTION);
+        return NULL;
+    }
+#endif
+    FILE* file = fopen(filename, (append) ? "a" : "w");
+    if (file == NULL) {
+        throw(FILE_NOT_FOUND_EXCEPTION);
+        return NULL;
+    }
+#ifdef CPRIME_COOKIE_STREAMS
+    if (compress) {
+        FILE* compressed = __lz_stream_open(file, "w");
+        if (compressed == NULL) {
+            fclose(file);
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return NULL;
+        }
+        file = compressed;
+    }
+#endif
+    FileWriter* filewriter = (FileWriter*) cprime_malloc(sizeof (FileWriter));
+    if (filewriter == NULL) {
+        fclose(file);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    filewriter->file = file;
+    filewriter->log = NULL;
+    filewriter->mapping = NULL;
+    filewriter->size = filewriter->capacity = 0;
+    filewriter->fd = -1;
+    return filewriter;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+FileWriter* __new_MappedFileWriter_size(const char* filename, size_t expected_size) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filename == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw(FILE_NOT_FOUND_EXCEPTION);
+        return NULL;
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t capacity = (expected_size > 0) ? (expected_size + page - 1) / page * page : __MAPPED_MIN_GROWTH;
+    void* mapping = MAP_FAILED;
+    if (__mapped_allocate(fd, capacity) == 0)
+        mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        if (ftruncate(fd, 0) != 0) {}
+        close(fd);
+        throw(IO_ERROR_EXCEPTION);
+        return NULL;
+    }
+    FileWriter* filewriter = (FileWriter*) cprime_malloc(sizeof (FileWriter));
+    if (filewriter == NULL) {
+        munmap(mapping, capacity);
+        if (ftruncate(fd, 0) != 0) {}
+        close(fd);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    filewriter->file = NULL;
+    filewriter->log = NULL;
+    filewriter->mapping = (char*) mapping;
+    filewriter->size = 0;
+    filewriter->capacity = capacity;
+    filewriter->fd = fd;
+    return filewriter;
+}
+#endif
+
+void __close_FileWriter(FileWriter* filewriter, bool flush) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (flush) FileWriter_writeChar(filewriter, '\n');
+    if (filewriter != NULL) {
+        if (filewriter->file != NULL)
+            fclose(filewriter->file);
+        if (filewriter->log != NULL)
+            __DurableLog_close(filewriter->log);
+#if defined(__unix__) || defined(__APPLE__)
+        if (filewriter->mapping != NULL) {
+            // Give back the preallocated space past the end of the output
+            munmap(filewriter->mapping, filewriter->capacity);
+            if (ftruncate(filewriter->fd, (off_t) filewriter->size) != 0) {}
+            close(filewriter->fd);
+        }
+#endif
+        cprime_free(filewriter);
+    }
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Binary records */
+
+/*
+ * Compact binary counterparts of the text methods. Integers are LEB128 varints (signed ones zigzag-encoded so
+ * small negative numbers stay short), floats are raw little-endian IEEE 754, and strings/bytes are prefixed with
+ * their varint length. A block may start with a header holding its record count and a schema string such as
+ * "id:i,price:d,name:s" (types: i = signed, u = unsigned, f = float, d = double, s = string, b = bytes).
+ * Close binary writers with `close_FileWriter(fw, false)` so no trailing line break is appended.
+ */
+
+/* First byte of a block header (never the first byte of a record written by FileWriter_writeRecord) */
+#define BINARY_BLOCK_MARKER (0xB7)
+
+/* Largest byte array read from a stream whose size is unknown (pipes, compressed files); arrays read from a
+   regular file are instead bounded by the bytes left in it */
+#define BINARY_MAX_BYTES (1u << 30)
+
+/**
+ * @brief Write an unsigned integer as a varint
+ * @param filewriter The file writer to write to
+ * @param n The integer to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeBinaryUnsigned(FileWriter* filewriter, unsigned long long n);
+
+/**
+ * @brief Write a signed integer as a zigzag varint
+ * @param filewriter The file writer to write to
+ * @param n The integer to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeBinaryInt(FileWriter* filewriter, long long n);
+
+/**
+ * @brief Write a double as 8 raw little-endian bytes (exact round trip)
+ * @param filewriter The file writer to write to
+ * @param d The double to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeBinaryDouble(FileWriter* filewriter, double d);
+
+/**
+ * @brief Write a float as 4 raw little-endian bytes (exact round trip)
+ * @param filewriter The file writer to write to
+ * @param f The float to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeBinaryFloat(FileWriter* filewriter, float f);
+
+/**
+ * @brief Write a byte array prefixed with its varint length
+ * @param filewriter The file writer to write to
+ * @param data The bytes to write
+ * @param length The number of bytes
+ * @memberof FileWriter
+ */
+void FileWriter_writeBinaryBytes(FileWriter* filewriter, const void* data, size_t length);
+
+/**
+ * @brief Write a string prefixed with its varint length (no terminator is stored)
+ * @param filewriter The file writer to write to
+ * @param s The string to write
+ * @memberof FileWriter
+ */
+void FileWriter_writeBinaryString(FileWriter* filewriter, const char* s);
+
+/**
+ * @brief Write a block header: the number of records that follow and the schema describing them
+ * @param filewriter The file writer to write to
+ * @param schema The schema, e.g. "id:i,price:d,name:s" (stored verbatim)
+ * @param records The number of records in the block
+ * @memberof FileWriter
+ */
+void FileWriter_writeBlockHeader(FileWriter* filewriter, const char* schema, size_t records);
+
+/**
+ * @brief Write one record field by field
+ * @param filewriter The file writer to write to
+ * @param types One type code per field: i (long long), u (unsigned long long), f/d (double), s (string),
+ *        b (const void* followed by size_t length)
+ * @param ... The field values
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if a type code is unknown
+ * @memberof FileWriter
+ */
+void FileWriter_writeRecord(FileWriter* filewriter, const char* types, ...);
+
+/**
+ * @brief Read a varint-encoded unsigned integer
+ * @param filereader The file reader to read from
+ * @return The integer, or ULLONG_MAX at the end of the file
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the value is truncated or malformed
+ * @memberof FileReader
+ */
+unsigned long long FileReader_nextBinaryUnsigned(FileReader* filereader);
+
+/**
+ * @brief Read a zigzag varint-encoded signed integer
+ * @param filereader The file reader to read from
+ * @return The integer, or LLONG_MAX at the end of the file
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the value is truncated or malformed
+ * @memberof FileReader
+ */
+long long FileReader_nextBinaryInt(FileReader* filereader);
+
+/**
+ * @brief Read a raw little-endian double
+ * @param filereader The file reader to read from
+ * @return The double, or DBL_MAX at the end of the file
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the value is truncated
+ * @memberof FileReader
+ */
+double FileReader_nextBinaryDouble(FileReader* filereader);
+
+/**
+ * @brief Read a raw little-endian float
+ * @param filereader The file reader to read from
+ * @return The float, or FLT_MAX at the end of the file
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the value is truncated
+ * @memberof FileReader
+ */
+float FileReader_nextBinaryFloat(FileReader* filereader);
+
+/**
+ * @brief Read a length-prefixed byte array
+ * @param filereader The file reader to read from
+ * @param length [out] The number of bytes read (may be NULL)
+ * @return The bytes (NUL-terminated for convenience), or NULL at the end of the file
+ * @note The returned buffer is owned by the reader and is only valid until the next read; do not free it
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the value is truncated or its length is larger than the rest of the
+ *        file (or than BINARY_MAX_BYTES when the stream's size is unknown)
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof FileReader
+ */
+bytes FileReader_nextBinaryBytes(FileReader* filereader, size_t* length);
+
+/**
+ * @brief Read a length-prefixed string
+ * @param filereader The file reader to read from
+ * @return The string, or NULL at the end of the file
+ * @note The returned string is owned by the reader and is only valid until the next read; do not free it
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the value is truncated
+ * @memberof FileReader
+ */
+string FileReader_nextBinaryString(FileReader* filereader);
+
+/**
+ * @brief Read a block header if one starts at the current position (otherwise nothing is consumed)
+ * @param filereader The file reader to read from
+ * @param records [out] The number of records in the block (may be NULL)
+ * @return The block's schema, or NULL if no block header follows
+ * @note The returned schema is owned by the reader and is only valid until the next read; do not free it
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the header is truncated
+ * @memberof FileReader
+ */
+string FileReader_nextBlockHeader(FileReader* filereader, size_t* records);
+
+/**
+ * @brief Read one record field by field (the counterpart of `FileWriter_writeRecord`)
+ * @param filereader The file reader to read from
+ * @param types One type code per field: i (long long*), u (unsigned long long*), f (float*), d (double*),
+ *        s (string*, copied; the caller frees it with `cprime_free`), b (bytes*, copied, followed by size_t*)
+ * @param ... Pointers receiving the field values
+ * @return True if a record was read, or false at the end of the file
+ * @throw `INVALID_FILE_FORMAT_EXCEPTION` if the record is truncated
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if a type code is unknown
+ * @memberof FileReader
+ */
+bool FileReader_nextRecord(FileReader* filereader, const char* types, ...);
+
+#ifdef CPRIME_IMPLEMENTATION
+static inline size_t __varint_encode(uint64_t value, unsigned char* out) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+static inline uint64_t __zigzag_encode(int64_t value) { return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63); }
+static inline int64_t __zigzag_decode(uint64_t value) { return (int64_t) (value >> 1) ^ -(int64_t) (value & 1); }
+
+static inline void __store_le64(unsigned char* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out[i] = (unsigned char) (value >> (8 * i));
+}
+
+static inline uint64_t __load_le64(const unsigned char* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t) in[i] << (8 * i);
+    return value;
+}
+
+void FileWriter_writeBinaryUnsigned(FileWriter* filewriter, unsigned long long n) {
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter)) return;
+    unsigned char buffer[10];
+    __FileWriter_put(filewriter, buffer, __varint_encode(n, buffer));
+}
+
+void FileWriter_writeBinaryInt(FileWriter* filewriter, long long n) {
+    __NO_ASYNC_THROW();
+    FileWriter_writeBinaryUnsigned(filewriter, __zigzag_encode(n));
+}
+
+void FileWriter_writeBinaryDouble(FileWriter* filewriter, double d) {
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter)) return;
+    uint64_t bits;
+    unsigned char buffer[8];
+    memcpy(&bits, &d, sizeof bits);
+    __store_le64(buffer, bits);
+    __FileWriter_put(filewriter, buffer, 8);
+}
+
+void FileWriter_writeBinaryFloat(FileWriter* filewriter, float f) {
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter)) return;
+    uint32_t bits;
+    unsigned char buffer[8];
+    memcpy(&bits, &f, sizeof bits);
+    __store_le64(buffer, bits);
+    __FileWriter_put(filewriter, buffer, 4);
+}
+
+void FileWriter_writeBinaryBytes(FileWriter* filewriter, const void* data, size_t length) {
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter) || (data == NULL && length > 0)) return;
+    FileWriter_writeBinaryUnsigned(filewriter, length);
+    if (length > 0) __FileWriter_put(filewriter, data, length);
+}
+
+void FileWriter_writeBinaryString(FileWriter* filewriter, const char* s) {
+    __NO_ASYNC_THROW();
+    if (s == NULL) return;
+    FileWriter_writeBinaryBytes(filewriter, s, strlen(s));
+}
+
+void FileWriter_writeBlockHeader(FileWriter* filewriter, const char* schema, size_t records) {
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter) || schema == NULL) return;
+    unsigned char marker = BINARY_BLOCK_MARKER;
+    __FileWriter_put(filewriter, &marker, 1);
+    FileWriter_writeBinaryUnsigned(filewriter, records);
+    FileWriter_writeBinaryString(filewriter, schema);
+}
+
+void FileWriter_writeRecord(FileWriter* filewriter, const char* types, ...) {
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL || types == NULL) return;
+    va_list ap;
+    va_start(ap, types);
+    for (const char* t = types; *t; t++) {
+        switch (*t) {
+            case 'i': FileWriter_writeBinaryInt(filewriter, va_arg(ap, long long)); break;
+            case 'u': FileWriter_writeBinaryUnsigned(filewriter, va_arg(ap, unsigned long long)); break;
+            case 'f': FileWriter_writeBinaryFloat(filewriter, (float) va_arg(ap, double)); break;
+            case 'd': FileWriter_writeBinaryDouble(filewriter, va_arg(ap, double)); break;
+            case 's': FileWriter_writeBinaryString(filewriter, va_arg(ap, const char*)); break;
+            case 'b': {
+                const void* data = va_arg(ap, const void*);
+                FileWriter_writeBinaryBytes(filewriter, data, va_arg(ap, size_t));
+                break;
+            }
+            default:
+                va_end(ap);
+                throw(ILLEGAL_ARGUMENT_EXCEPTION);
+                return;
+        }
+    }
+    va_end(ap);
+}
+
+/* Read a varint with the stream locked; 1 on success, 0 at a clean EOF before the first byte, -1 if malformed */
+static int __varint_read(FILE* file, uint64_t* value) {
+    __STREAM_LOCK(file);
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = __getc_fast(file);
+        if (c == EOF) return (shift == 0) ? 0 : -1;
+        result |= (uint64_t) (c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            *value = result;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/* Read a varint; false at a clean EOF before the first byte (throws only once the stream is unlocked) */
+static bool __FileReader_varint(FileReader* filereader, uint64_t* value) {
+    int status = __varint_read(filereader->file, value);
+    if (status < 0) throw(INVALID_FILE_FORMAT_EXCEPTION);
+    return status > 0;
+}
+
+/* Whether `size` more bytes can be read: bounded by the rest of a regular file, or by BINARY_MAX_BYTES */
+static bool __FileReader_has_bytes(FileReader* filereader, uint64_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat info;
+    int fd = fileno(filereader->file);
+    off_t position = (fd >= 0) ? ftello(filereader->file) : -1;
+    if (position >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+        return position <= info.st_size && size <= (uint64_t) (info.st_size - position);
+#endif
+    return size <= BINARY_MAX_BYTES;
+}
+
+static bool __FileReader_exact(FileReader* filereader, void* out, size_t size) {
+    size_t n = fread(out, 1, size, filereader->file);
+    if (n == size) return true;
+    if (n > 0) throw(INVALID_FILE_FORMAT_EXCEPTION);
+    return false;
+}
+
+unsigned long long FileReader_nextBinaryUnsigned(FileReader* filereader) {
+    __NO_ASYNC_THROW();
+    uint64_t value;
+    if (filereader == NULL || filereader->file == NULL || !__FileReader_varint(filereader, &value))
+        return ULLONG_MAX;
+    return value;
+}
+
+long long FileReader_nextBinaryInt(FileReader* filereader) {
+    __NO_ASYNC_THROW();
+    uint64_t value;
+    if (filereader == NULL || filereader->file == NULL || !__FileReader_varint(filereader, &value))
+        return LLONG_MAX;
+    return __zigzag_decode(value);
+}
+
+double FileReader_nextBinaryDouble(FileReader* filereader) {
+    __NO_ASYNC_THROW();
+    unsigned char buffer[8];
+    if (filereader == NULL || filereader->file == NULL || !__FileReader_exact(filereader, buffer, 8))
+        return DBL_MAX;
+    uint64_t bits = __load_le64(buffer);
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d;
+}
+
+float FileReader_nextBinaryFloat(FileReader* filereader) {
+    __NO_ASYNC_THROW();
+    unsigned char buffer[8] = { 0 };
+    if (filereader == NULL || filereader->file == NULL || !__FileReader_exact(filereader, buffer, 4))
+        return FLT_MAX;
+    uint32_t bits = (uint32_t) __load_le64(buffer);
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+bytes FileReader_nextBinaryBytes(FileReader* filereader, size_t* length) {
+    __NO_ASYNC_THROW();
+    uint64_t size;
+    if (filereader == NULL || filereader->file == NULL || !__FileReader_varint(filereader, &size))
+        return NULL;
+    if (size >= SIZE_MAX) {
+        throw(INVALID_FILE_FORMAT_EXCEPTION);
+        return NULL;
+    }
+    if (filereader->buffer == NULL || filereader->capacity < size + 1) {
+        // A corrupt length must not turn into a huge allocation
+        if (!__FileReader_has_bytes(filereader, size)) {
+            throw(INVALID_FILE_FORMAT_EXCEPTION);
+            return NULL;
+        }
+        cprime_free(filereader->buffer);
+        filereader->capacity = (size + 1 > 64) ? (size_t) size + 1 : 64;
+        filereader->buffer = (string) cprime_malloc(filereader->capacity);
+        if (filereader->buffer == NULL) {
+            filereader->capacity = 0;
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return NULL;
+        }
+    }
+    if (size > 0 && fread(filereader->buffer, 1, size, filereader->file) != size) {
+        throw(INVALID_FILE_FORMAT_EXCEPTION);
+        return NULL;
+    }
+    filereader->buffer[size] = '\0';
+    filereader->size = size;
+    if (length != NULL) *length = size;
+    return filereader->buffer;
+}
+
+string FileReader_nextBinaryString(FileReader* filereader) {
+    __NO_ASYNC_THROW();
+    return FileReader_nextBinaryBytes(filereader, NULL);
+}
+
+string FileReader_nextBlockHeader(FileReader* filereader, size_t* records) {
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL) return NULL;
+    int c = __getc_fast(filereader->file);
+    if (c != BINARY_BLOCK_MARKER) {
+        if (c != EOF) ungetc(c, filereader->file);
+        return NULL;
+    }
+    uint64_t count;
+    if (!__FileReader_varint(filereader, &count)) {
+        throw(INVALID_FILE_FORMAT_EXCEPTION);
+        return NULL;
+    }
+    string schema = FileReader_nextBinaryString(filereader);
+    if (schema == NULL) {
+        throw(INVALID_FILE_FORMAT_EXCEPTION);
+        return NULL;
+    }
+    if (records != NULL) *records = (size_t) count;
+    return schema;
+}
+
+bool FileReader_nextRecord(FileReader* filereader, const char* types, ...) {
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL || types == NULL) return false;
+    va_list ap;
+    va_start(ap, types);
+    for (const char* t = types; *t; t++) {
+        bool first = (t == types);
+        uint64_t value;
+        switch (*t) {
+            case 'i':
+            case 'u':
+                if (!__FileReader_varint(filereader, &value)) break;
+                if (*t == 'i') *va_arg(ap, long long*) = __zigzag_decode(value);
+                else *va_arg(ap, unsigned long long*) = value;
+                continue;
+            case 'f':
+            case 'd': {
+                unsigned char buffer[8] = { 0 };
+                if (!__FileReader_exact(filereader, buffer, (*t == 'f') ? 4 : 8)) break;
+                uint64_t bits = __load_le64(buffer);
+                if (*t == 'f') {
+                    uint32_t bits32 = (uint32_t) bits;
+                    memcpy(va_arg(ap, float*), &bits32, sizeof (float));
+                } else {
+                    memcpy(va_arg(ap, double*), &bits, sizeof (double));
+                }
+                continue;
+            }
+            case 's':
+            case 'b': {
+                size_t length;
+                bytes data = FileReader_nextBinaryBytes(filereader, &length);
+                if (data == NULL) break;
+                bytes copy = (bytes) cprime_malloc(length + 1);
+                if (copy == NULL) {
+                    va_end(ap);
+                    throw(MEMORY_ALLOCATION_EXCEPTION);
+                    return false;
+                }
+                memcpy(copy, data, length + 1);
+                *va_arg(ap, bytes*) = copy;
+                if (*t == 'b') *va_arg(ap, size_t*) = length;
+                continue;
+            }
+            default:
+                va_end(ap);
+                throw(ILLEGAL_ARGUMENT_EXCEPTION);
+                return false;
+        }
+        // EOF: clean only before the first field
+        va_end(ap);
+        if (!first) throw(INVALID_FILE_FORMAT_EXCEPTION);
+        return false;
+    }
+    va_end(ap);
+    return true;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Durable logs */
+
+/*
+ * Crash-safe append-only record logs. Each record is framed as its length (little-endian u32), the CRC32C of
+ * the length bytes and payload, then the payload. Appends from any number of threads are group-committed: an
+ * appender that finds no sync in flight becomes the leader, optionally waits out the commit window to gather
+ * more records, then writes the whole batch with one write and one fdatasync; records appended meanwhile form
+ * the next group. Opening a log truncates it at the first incomplete or corrupt record (a torn tail).
+ */
+
+/* Largest record payload accepted by durable logs */
+#define DURABLE_MAX_RECORD (1u << 30)
+
+/* Buffered records that make a non-waiting append commit anyway */
+#define __DURABLE_PENDING_LIMIT (1 << 20)
+
+/**
+ * @brief Compute a CRC32C (Castagnoli) checksum, using the SSE4.2 instruction when the CPU has it
+ * @param crc The checksum of the preceding data (0 to start)
+ * @param data The data
+ * @param size The number of bytes
+ * @return The checksum of everything so far
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+#if defined(__unix__) || defined(__APPLE__)
+struct __DurableLog {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t committed;
+    unsigned char* pending;     /* Framed records not yet written */
+    size_t size;
+    size_t capacity;
+    unsigned char* spare;       /* Buffer of the batch being (or last) written, swapped with `pending` */
+    size_t spare_capacity;
+    uint64_t appended;          /* Sequence number of the last appended record */
+    uint64_t durable;           /* Sequence number of the last record known to be on disk */
+    bool syncing;               /* A leader is writing and syncing a batch */
+    int error;                  /* errno of a failed write or sync; the log refuses further appends */
+    long window_us;
+};
+
+bool __FileWriter_appendRecord(FileWriter* filewriter, const void* data, size_t length, bool wait);
+bool __FileWriter_appendRecord_wait(FileWriter* filewriter, const void* data, size_t length);
+
+/**
+ * @brief Append a record to a durable log
+ * @param filewriter The file writer (opened with `new_DurableFileWriter`)
+ * @param data The record payload
+ * @param length The payload size in bytes (at most DURABLE_MAX_RECORD)
+ * @param wait [optional] Whether to return only once the record is on disk (default is true); records appended
+ *        without waiting are committed with a later group, by `FileWriter_sync`, or when the writer is closed
+ * @return True on success, or false if the log failed to write or sync (the failure is sticky)
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the writer is not a durable log or the record is too large
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @note Safe to call from multiple threads at once; concurrent waiting appends share one fdatasync
+ * @memberof FileWriter
+ */
+#define FileWriter_appendRecord(...) \
+    GET_MACRO4(__VA_ARGS__, __FileWriter_appendRecord, __FileWriter_appendRecord_wait, _, _)(__VA_ARGS__)
+
+/**
+ * @brief Make every record appended so far durable
+ * @param filewriter The file writer (opened with `new_DurableFileWriter`)
+ * @return True on success, or false if the log failed to write or sync
+ * @memberof FileWriter
+ */
+bool FileWriter_sync(FileWriter* filewriter);
+
+FileWriter* __new_DurableFileWriter_window(const char* filename, long window_us);
+
+static inline FileWriter* __new_DurableFileWriter(const char* filename) { return __new_DurableFileWriter_window(filename, 0); }
+
+/**
+ * @brief Open (or create) a durable append-only record log
+ * @param filename The name of the log file
+ * @param window_us [optional] Microseconds a commit leader waits for more records before syncing (default is 0:
+ *        records that arrive while a sync is in flight still share the next one)
+ * @return The file writer; write to it with `FileWriter_appendRecord` and read the log back with
+ *         `FileReader_nextLogRecord` (the text and binary write methods do nothing on a durable writer)
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file cannot be opened
+ * @throw `IO_ERROR_EXCEPTION` if the file cannot be scanned or its torn tail cannot be truncated
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL or the window is negative
+ * @note Close with `close_FileWriter(fw)`, which commits any records appended without waiting
+ * @memberof FileWriter
+ */
+#define new_DurableFileWriter(...) \
+    GET_MACRO2(__VA_ARGS__, __new_DurableFileWriter_window, __new_DurableFileWriter)(__VA_ARGS__)
+#endif  // __unix__ || __APPLE__
+
+/**
+ * @brief Read the next record of a durable log
+ * @param filereader The file reader to read from
+ * @param length [out] The payload size (may be NULL)
+ * @return The payload (NUL-terminated for convenience), or NULL at the end of the log or at a torn or corrupt
+ *         record (which a durable writer truncates when it next opens the log)
+ * @note The returned buffer is owned by the reader and is only valid until the next read; do not free it
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof FileReader
+ */
+bytes FileReader_nextLogRecord(FileReader* filereader, size_t* length);
+
+#ifdef CPRIME_IMPLEMENTATION
+static uint32_t __crc32c_table[8][256];
+
+static inline uint32_t __load_le32(const unsigned char* in) {
+    return (uint32_t) in[0] | (uint32_t) in[1] << 8 | (uint32_t) in[2] << 16 | (uint32_t) in[3] << 24;
+}
+
+/* Build the slicing-by-8 tables for the software CRC32C (Castagnoli polynomial, reflected) */
+INITIALIZER(__crc32c_init) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        __crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            __crc32c_table[t][i] = (__crc32c_table[t - 1][i] >> 8) ^ __crc32c_table[0][__crc32c_table[t - 1][i] & 0xFF];
+}
+
+static uint32_t __crc32c_software(uint32_t crc, const unsigned char* p, size_t n) {
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t low = crc ^ __load_le32(p);
+        crc = __crc32c_table[7][low & 0xFF] ^ __crc32c_table[6][(low >> 8) & 0xFF]
+            ^ __crc32c_table[5][(low >> 16) & 0xFF] ^ __crc32c_table[4][low >> 24]
+            ^ __crc32c_table[3][p[4]] ^ __crc32c_table[2][p[5]] ^ __crc32c_table[1][p[6]] ^ __crc32c_table[0][p[7]];
+    }
+    for (; n > 0; n--) crc = (crc >> 8) ^ __crc32c_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if defined(CPRIME_SSE2) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t __crc32c_sse42(uint32_t crc, const unsigned char* p, size_t n) {
+    uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof word);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; n > 0; n--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*) data;
+#if defined(CPRIME_SSE2) && defined(__x86_64__)
+    if (__cpu_has_sse42()) return ~__crc32c_sse42(~crc, p, size);
+#endif
+    return ~__crc32c_software(~crc, p, size);
+}
+
+/* Checksum stored in a record frame: covers the length bytes and the payload */
+static inline uint32_t __durable_checksum(const unsigned char* length_bytes, const void* data, size_t size) {
+    return crc32c(crc32c(0, length_bytes, 4), data, size);
+}
+
+/* Validate the frame at `p` (with `available` bytes); returns its total size, or 0 if it is torn or corrupt */
+static size_t __durable_frame(const unsigned char* p, size_t available) {
+    if (available < 8) return 0;
+    uint32_t length = __load_le32(p), stored = __load_le32(p + 4);
+    if (length > DURABLE_MAX_RECORD || available - 8 < length) return 0;
+    return (__durable_checksum(p, p + 8, length) == stored) ? 8 + (size_t) length : 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+static int __durable_sync(int fd) {
+#ifdef __APPLE__
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+/* Write and sync everything appended up to `target`; called with the lock held, returns with it held */
+static bool __DurableLog_commit(__DurableLog* log, uint64_t target) {
+    while (log->durable < target && log->error == 0) {
+        if (log->syncing) {
+            pthread_cond_wait(&log->committed, &log->lock);
+            continue;
+        }
+        log->syncing = true;
+        if (log->window_us > 0) {
+            // Let other appenders join this group
+            pthread_mutex_unlock(&log->lock);
+            struct timespec pause = { log->window_us / 1000000, (log->window_us % 1000000) * 1000 };
+            nanosleep(&pause, NULL);
+            pthread_mutex_lock(&log->lock);
+        }
+        unsigned char* batch = log->pending;
+        size_t size = log->size, capacity = log->capacity;
+        uint64_t last = log->appended;
+        log->pending = log->spare;
+        log->capacity = log->spare_capacity;
+        log->size = 0;
+        log->spare = batch;
+        log->spare_capacity = capacity;
+        pthread_mutex_unlock(&log->lock);
+
+        int error = 0;
+        for (size_t done = 0; done < size && error == 0;) {
+            ssize_t n = write(log->fd, batch + done, size - done);
+            if (n > 0) done += (size_t) n;
+            else if (n < 0 && errno != EINTR) error = errno;
+        }
+        if (error == 0 && __durable_sync(log->fd) != 0) error = errno;
+
+        pthread_mutex_lock(&log->lock);
+        if (error == 0) log->durable = last;
+        else log->error = error;
+        log->syncing = false;
+        pthread_cond_broadcast(&log->committed);
+    }
+    return log->error == 0;
+}
+
+static void __DurableLog_close(__DurableLog* log) {
+    pthread_mutex_lock(&log->lock);
+    __DurableLog_commit(log, log->appended);
+    pthread_mutex_unlock(&log->lock);
+    close(log->fd);
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->committed);
+    cprime_free(log->pending);
+    cprime_free(log->spare);
+    cprime_free(log);
+}
+
+bool __FileWriter_appendRecord(FileWriter* filewriter, const void* data, size_t length, bool wait) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL || filewriter->log == NULL || (data == NULL && length > 0) || length > DURABLE_MAX_RECORD) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return false;
+    }
+    __DurableLog* log = filewriter->log;
+    pthread_mutex_lock(&log->lock);
+    if (log->error != 0) {
+        pthread_mutex_unlock(&log->lock);
+        return false;
+    }
+    if (log->size + 8 + length > log->capacity) {
+        size_t capacity = (log->capacity == 0) ? 4096 : log->capacity;
+        while (capacity < log->size + 8 + length) capacity *= 2;
+        unsigned char* pending = (unsigned char*) cprime_realloc(log->pending, capacity);
+        if (pending == NULL) {
+            pthread_mutex_unlock(&log->lock);
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return false;
+        }
+        log->pending = pending;
+        log->capacity = capacity;
+    }
+    unsigned char* frame = log->pending + log->size;
+    for (int i = 0; i < 4; i++) frame[i] = (unsigned char) (length >> (8 * i));
+    uint32_t checksum = __durable_checksum(frame, data, length);
+    for (int i = 0; i < 4; i++) frame[4 + i] = (unsigned char) (checksum >> (8 * i));
+    if (length > 0) memcpy(frame + 8, data, length);
+    log->size += 8 + length;
+    uint64_t sequence = ++log->appended;
+    bool ok = true;
+    if (wait || log->size >= __DURABLE_PENDING_LIMIT) ok = __DurableLog_commit(log, sequence);
+    pthread_mutex_unlock(&log->lock);
+    return ok;
+}
+bool __FileWriter_appendRecord_wait(FileWriter* filewriter, const void* data, size_t length) {
+    return __FileWriter_appendRecord(filewriter, data, length, true);
+}
+
+bool FileWriter_sync(FileWriter* filewriter) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL || filewriter->log == NULL) return false;
+    __DurableLog* log = filewriter->log;
+    pthread_mutex_lock(&log->lock);
+    bool ok = __DurableLog_commit(log, log->appended);
+    pthread_mutex_unlock(&log->lock);
+    return ok;
+}
+
+/* Length of the valid record prefix of the log file, or -1 (with errno set) if the file could not be fully read */
+static off_t __durable_valid_length(int fd) {
+    size_t capacity = 1 << 20, have = 0;
+    unsigned char* buffer = (unsigned char*) cprime_malloc(capacity);
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    off_t valid = 0;
+    bool eof = false;
+    while (true) {
+        size_t used = 0, frame;
+        while ((frame = __durable_frame(buffer + used, have - used)) > 0) used += frame;
+        valid += (off_t) used;
+        memmove(buffer, buffer + used, have - used);
+        have -= used;
+        if (eof) break;
+        // A record larger than the buffer needs a bigger one
+        uint32_t length = (have >= 8) ? __load_le32(buffer) : 0;
+        if (length <= DURABLE_MAX_RECORD && 8 + (size_t) length > capacity) {
+            unsigned char* larger = (unsigned char*) cprime_realloc(buffer, 8 + (size_t) length);
+            // Stopping here would truncate durable records that were never checked
+            if (larger == NULL) {
+                errno = ENOMEM;
+                valid = -1;
+                break;
+            }
+            buffer = larger;
+            capacity = 8 + (size_t) length;
+        }
+        ssize_t n = pread(fd, buffer + have, capacity - have, valid + (off_t) have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            valid = -1;
+            break;
+        }
+        if (n == 0) eof = true;
+        else have += (size_t) n;
+    }
+    int error = errno;
+    cprime_free(buffer);
+    errno = error;
+    return valid;
+}
+
+/* Sync the directory holding `filename` so a newly created file survives a crash */
+static void __durable_sync_directory(const char* filename) {
+    const char* slash = strrchr(filename, '/');
+    char directory[4096];
+    if (slash == NULL) {
+        strcpy(directory, ".");
+    } else {
+        size_t length = (slash == filename) ? 1 : (size_t) (slash - filename);
+        if (length >= sizeof directory) return;
+        memcpy(directory, filename, length);
+        directory[length] = '\0';
+    }
+    int fd = open(directory, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+FileWriter* __new_DurableFileWriter_window(const char* filename, long window_us) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filename == NULL || window_us < 0) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    int fd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw(FILE_NOT_FOUND_EXCEPTION);
+        return NULL;
+    }
+    struct stat info;
+    off_t valid = __durable_valid_length(fd);
+    if (fstat(fd, &info) != 0 || valid < 0) {
+        int error = (valid < 0 && errno == ENOMEM) ? MEMORY_ALLOCATION_EXCEPTION : IO_ERROR_EXCEPTION;
+        close(fd);
+        throw(error);
+        return NULL;
+    }
+    if (info.st_size == 0) {
+        __durable_sync_directory(filename);
+    } else if (valid < info.st_size) {
+        // Drop the torn tail so new records follow the last good one
+        if (ftruncate(fd, valid) != 0 || __durable_sync(fd) != 0) {
+            close(fd);
+            throw(IO_ERROR_EXCEPTION);
+            return NULL;
+        }
+    }
+    FileWriter* filewriter = (FileWriter*) cprime_malloc(sizeof (FileWriter));
+    __DurableLog* log = (__DurableLog*) cprime_calloc(1, sizeof (__DurableLog));
+    if (filewriter == NULL || log == NULL) {
+        cprime_free(filewriter);
+        cprime_free(log);
+        close(fd);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    log->fd = fd;
+    log->window_us = window_us;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->committed, NULL);
+    filewriter->file = NULL;
+    filewriter->log = log;
+    filewriter->mapping = NULL;
+    filewriter->size = filewriter->capacity = 0;
+    filewriter->fd = -1;
+    return filewriter;
+}
+#else
+static void __DurableLog_close(__DurableLog* log) { (void) log; }
+#endif  // __unix__ || __APPLE__
+
+bytes FileReader_nextLogRecord(FileReader* filereader, size_t* length) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    unsigned char header[8];
+    if (filereader == NULL || filereader->file == NULL || fread(header, 1, 8, filereader->file) != 8)
+        return NULL;
+    uint32_t size = __load_le32(header), stored = __load_le32(header + 4);
+    if (size > DURABLE_MAX_RECORD) return NULL;
+    if (filereader->buffer == NULL || filereader->capacity < (size_t) size + 1) {
+        cprime_free(filereader->buffer);
+        filereader->capacity = ((size_t) size + 1 > 64) ? (size_t) size + 1 : 64;
+        filereader->buffer = (string) cprime_malloc(filereader->capacity);
+        if (filereader->buffer == NULL) {
+            filereader->capacity = 0;
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return NULL;
+        }
+    }
+    if (size > 0 && fread(filereader->buffer, 1, size, filereader->file) != size) return NULL;
+    if (__durable_checksum(header, filereader->buffer, size) != stored) return NULL;
+    filereader->buffer[size] = '\0';
+    filereader->size = size;
+    if (length != NULL) *length = size;
+    return filereader->buffer;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Line index */
+
+/*
+ * Line-start offsets of a text file, for seeking by line number. The index is built with one pass of memchr
+ * over a read-only mapping of the file, split across threads for large files, and is kept in a sidecar file
+ * (`<filename>.idx`) that is reused while the file's size and modification time still match. The sidecar holds
+ * a 40-byte header (magic, file size, mtime seconds and nanoseconds, line count) followed by the offsets as
+ * little-endian u64s, and is mapped rather than read when loaded.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+/* First bytes of a sidecar index file */
+#define FILE_INDEX_MAGIC "\xC7IX1\0\0\0"
+#define __FILE_INDEX_HEADER 40
+
+/* Bytes of input per indexing thread, at least */
+#define __FILE_INDEX_CHUNK (8u << 20)
+
+/**
+ * @brief Line-start offsets of a text file; lines end at '\n' (so "\r\n" line endings work as well)
+ * @note You must call `delete_FileIndex(FileIndex*)` to free the memory after use
+ * 
+ * ### Methods
+ * 
+ * - `new_FileIndex(string filename, bool sidecar=true)`
+ * 
+ * - `delete_FileIndex(FileIndex*)`
+ * 
+ * - `FileIndex_lines(FileIndex*)`
+ * 
+ * - `FileIndex_offset(FileIndex*, size_t line)`
+ */
+struct FileIndex {
+    uint64_t* offsets;              // Line starts of an index built in memory, or NULL
+    const unsigned char* table;     // Line starts in a mapped sidecar (little-endian), or NULL
+    void* mapping;
+    size_t mapping_size;
+    size_t lines;
+    uint64_t size;                  // Size of the file when it was indexed
+};
+
+typedef struct __FileIndexChunk __FileIndexChunk;
+struct __FileIndexChunk {
+    const char* data;
+    size_t begin, end;
+    uint64_t* offsets;              // Offsets just past each '\n' in [begin, end)
+    size_t count, capacity;
+    bool failed;
+};
+
+FileIndex* __new_FileIndex_sidecar(const char* filename, bool sidecar);
+
+static inline FileIndex* __new_FileIndex(const char* filename) { return __new_FileIndex_sidecar(filename, true); }
+
+/**
+ * @brief Index the line starts of a text file
+ * @param filename The name of the file to index
+ * @param sidecar [optional] Whether to reuse and keep the index in `<filename>.idx` (default is true); a sidecar
+ *        that no longer matches the file's size and modification time is rebuilt
+ * @return The index
+ * @note The index describes the file as it was when indexed; lines appended later are not included
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
+ * @throw `IO_ERROR_EXCEPTION` if the file cannot be read
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
+ * @memberof FileIndex
+ */
+#define new_FileIndex(...) GET_MACRO2(__VA_ARGS__, __new_FileIndex_sidecar, __new_FileIndex)(__VA_ARGS__)
+
+/**
+ * @brief Free a file index
+ * @param index The index to free
+ * @memberof FileIndex
+ */
+void delete_FileIndex(FileIndex* index);
+
+/**
+ * @brief Get the number of lines in the indexed file
+ * @param index The index
+ * @return The number of lines (a last line without a trailing newline counts)
+ * @memberof FileIndex
+ */
+size_t FileIndex_lines(FileIndex* index);
+
+/**
+ * @brief Get the byte offset at which a line starts
+ * @param index The index
+ * @param line The line number, from 0; `FileIndex_lines(index)` gives the end of the last line
+ * @return The offset, or UINT64_MAX if the line is out of range
+ * @memberof FileIndex
+ */
+uint64_t FileIndex_offset(FileIndex* index, size_t line);
+
+/**
+ * @brief Move the reader to the start of a line
+ * @param filereader The file reader
+ * @param line The line number, from 0
+ * @return True on success, or false if the line is out of range or the file is compressed
+ * @note The first call loads the file's sidecar index, or builds and saves it (see `new_FileIndex`)
+ * @throw `IO_ERROR_EXCEPTION` if the file cannot be indexed
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof FileReader
+ */
+bool FileReader_seekLine(FileReader* filereader, size_t line);
+
+/**
+ * @brief Read a range of lines in one read, without moving the reader
+ * @param filereader The file reader
+ * @param first The first line number, from 0
+ * @param count The number of lines (fewer are returned at the end of the file)
+ * @return The lines with their line endings, or NULL if `first` is out of range or the read fails
+ * @note The caller owns the returned text and must release it with `cprime_free` (or `free` with the default allocator)
+ * @throw `IO_ERROR_EXCEPTION` if the file cannot be indexed
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof FileReader
+ */
+string FileReader_readLines(FileReader* filereader, size_t first, size_t count);
+#else
+void delete_FileIndex(FileIndex* index);
+#endif  // __unix__ || __APPLE__
+
+#ifdef CPRIME_IMPLEMENTATION
+#if defined(__unix__) || defined(__APPLE__)
+static void* __FileIndex_scan(void* arg) {
+    __FileIndexChunk* chunk = (__FileIndexChunk*) arg;
+    const char* p = chunk->data + chunk->begin;
+    const char* end = chunk->data + chunk->end;
+    while (p < end && (p = (const char*) memchr(p, '\n', (size_t) (end - p))) != NULL) {
+        if (chunk->count == chunk->capacity) {
+            size_t capacity = (chunk->capacity == 0) ? 4096 : chunk->capacity * 2;
+            uint64_t* larger = (uint64_t*) cprime_realloc(chunk->offsets, capacity * sizeof (uint64_t));
+            if (larger == NULL) {
+                chunk->failed = true;
+                return NULL;
+            }
+            chunk->offsets = larger;
+            chunk->capacity = capacity;
+        }
+        chunk->offsets[chunk->count++] = (uint64_t) (++p - chunk->data);
+    }
+    return NULL;
+}
+
+/* Index `size` bytes of mapped data; false if memory allocation fails */
+static bool __FileIndex_build(FileIndex* index, const char* data, size_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = size / __FILE_INDEX_CHUNK + 1;
+    if (threads > (size_t) ((cpus > 1) ? cpus : 1)) threads = (size_t) ((cpus > 1) ? cpus : 1);
+    if (threads > 64) threads = 64;
+    __FileIndexChunk chunks[64];
+    pthread_t workers[64];
+    bool started[64] = { false };
+    for (size_t i = 0; i < threads; i++) {
+        chunks[i] = (__FileIndexChunk) { data, size / threads * i, (i + 1 == threads) ? size : size / threads * (i + 1),
+                                         NULL, 0, 0, false };
+        if (i > 0) started[i] = pthread_create(&workers[i], NULL, __FileIndex_scan, &chunks[i]) == 0;
+    }
+    for (size_t i = 0; i < threads; i++)
+        if (!started[i]) __FileIndex_scan(&chunks[i]);
+    size_t lines = (size > 0) ? 1 : 0;
+    bool failed = false;
+    for (size_t i = 0; i < threads; i++) {
+        if (started[i]) pthread_join(workers[i], NULL);
+        lines += chunks[i].count;
+        failed |= chunks[i].failed;
+    }
+    // A final '\n' ends the last line rather than starting an empty one
+    if (size > 0 && data[size - 1] == '\n') lines--;
+    index->offsets = failed ? NULL : (uint64_t*) cprime_malloc((lines + 1) * sizeof (uint64_t));
+    if (index->offsets != NULL) {
+        size_t n = 0;
+        if (lines > 0) index->offsets[n++] = 0;
+        for (size_t i = 0; i < threads && n < lines; i++) {
+            size_t count = (chunks[i].count > lines - n) ? lines - n : chunks[i].count;
+            if (count > 0) memcpy(index->offsets + n, chunks[i].offsets, count * sizeof (uint64_t));
+            n += count;
+        }
+        index->offsets[lines] = size;
+        index->lines = lines;
+    }
+    for (size_t i = 0; i < threads; i++)
+        cprime_free(chunks[i].offsets);
+    return index->offsets != NULL;
+}
+
+static inline long long __mtime_ns(const struct stat* info) {
+#ifdef __APPLE__
+    return (long long) info->st_mtimespec.tv_sec * 1000000000ll + info->st_mtimespec.tv_nsec;
+#else
+    return (long long) info->st_mtim.tv_sec * 1000000000ll + info->st_mtim.tv_nsec;
+#endif
+}
+
+static void __FileIndex_header(unsigned char* header, uint64_t size, long long mtime, size_t lines) {
+    memcpy(header, FILE_INDEX_MAGIC, 8);
+    __store_le64(header + 8, size);
+    __store_le64(header + 16, (uint64_t) (mtime / 1000000000ll));
+    __store_le64(header + 24, (uint64_t) (mtime % 1000000000ll));
+    __store_le64(header + 32, (uint64_t) lines);
+}
+
+/* Map the sidecar if it describes the file as it is now */
+static bool __FileIndex_load(FileIndex* index, const char* sidecar, const struct stat* info) {
+    int fd = open(sidecar, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat sidecar_info;
+    unsigned char header[__FILE_INDEX_HEADER], expected[__FILE_INDEX_HEADER];
+    bool valid = fstat(fd, &sidecar_info) == 0 && pread(fd, header, sizeof header, 0) == (ssize_t) sizeof header;
+    if (valid) {
+        size_t lines = (size_t) __load_le64(header + 32);
+        __FileIndex_header(expected, (uint64_t) info->st_size, __mtime_ns(info), lines);
+        valid = memcmp(header, expected, sizeof header) == 0
+             && (uint64_t) sidecar_info.st_size == __FILE_INDEX_HEADER + ((uint64_t) lines + 1) * 8;
+        if (valid) {
+            index->mapping_size = (size_t) sidecar_info.st_size;
+            index->mapping = mmap(NULL, index->mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+            valid = index->mapping != MAP_FAILED;
+            if (valid) {
+                index->table = (const unsigned char*) index->mapping + __FILE_INDEX_HEADER;
+                index->lines = lines;
+                index->size = (uint64_t) info->st_size;
+            }
+        }
+    }
+    close(fd);
+    return valid;
+}
+
+/* Write the sidecar next to the file (replaced atomically); failures leave the in-memory index usable */
+static void __FileIndex_save(const FileIndex* index, const char* sidecar, const struct stat* info) {
+    size_t length = strlen(sidecar);
+    char* temporary = (char*) cprime_malloc(length + 32);
+    if (temporary == NULL) return;
+    snprintf(temporary, length + 32, "%s.%ld.tmp", sidecar, (long) getpid());
+    FILE* file = fopen(temporary, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        unsigned char block[8192];
+        __FileIndex_header(block, index->size, __mtime_ns(info), index->lines);
+        ok = fwrite(block, 1, __FILE_INDEX_HEADER, file) == __FILE_INDEX_HEADER;
+        for (size_t i = 0; ok && i <= index->lines; ) {
+            size_t n = 0;
+            for (; n < sizeof block / 8 && i <= index->lines; n++, i++)
+                __store_le64(block + n * 8, index->offsets[i]);
+            ok = fwrite(block, 8, n, file) == n;
+        }
+        ok = (fclose(file) == 0) && ok;
+    }
+    if (ok) ok = rename(temporary, sidecar) == 0;
+    if (!ok) remove(temporary);
+    cprime_free(temporary);
+}
+
+FileIndex* __new_FileIndex_sidecar(const char* filename, bool sidecar) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filename == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw(FILE_NOT_FOUND_EXCEPTION);
+        return NULL;
+    }
+    struct stat info;
+    FileIndex* index = (FileIndex*) cprime_calloc(1, sizeof (FileIndex));
+    char* path = (char*) cprime_malloc(strlen(filename) + 5);
+    if (index == NULL || path == NULL) {
+        cprime_free(index);
+        cprime_free(path);
+        close(fd);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    if (fstat(fd, &info) != 0) {
+        cprime_free(index);
+        cprime_free(path);
+        close(fd);
+        throw(IO_ERROR_EXCEPTION);
+        return NULL;
+    }
+    sprintf(path, "%s.idx", filename);
+    if (!sidecar || !__FileIndex_load(index, path, &info)) {
+        size_t size = (size_t) info.st_size;
+        void* data = (size > 0) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        if (data == MAP_FAILED) {
+            cprime_free(index);
+            cprime_free(path);
+            close(fd);
+            throw(IO_ERROR_EXCEPTION);
+            return NULL;
+        }
+        if (data != NULL) posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+        bool built = __FileIndex_build(index, (const char*) data, size);
+        if (data != NULL) munmap(data, size);
+        if (!built) {
+            cprime_free(index);
+            cprime_free(path);
+            close(fd);
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return NULL;
+        }
+        index->size = (uint64_t) size;
+        if (sidecar) __FileIndex_save(index, path, &info);
+    }
+    cprime_free(path);
+    close(fd);
+    return index;
+}
+
+void delete_FileIndex(FileIndex* index) {
+    __NO_ASYNC_THROW();
+    if (index == NULL) return;
+    if (index->mapping != NULL) munmap(index->mapping, index->mapping_size);
+    cprime_free(index->offsets);
+    cprime_free(index);
+}
+
+size_t FileIndex_lines(FileIndex* index) {
+    return (index == NULL) ? 0 : index->lines;
+}
+
+uint64_t FileIndex_offset(FileIndex* index, size_t line) {
+    if (index == NULL || line > index->lines) return UINT64_MAX;
+    return (index->offsets != NULL) ? index->offsets[line] : __load_le64(index->table + line * 8);
+}
+
+/* The reader's line index, loaded (or built) on first use; NULL for compressed files */
+static FileIndex* __FileReader_index(FileReader* filereader) {
+    if (filereader == NULL || filereader->file == NULL || filereader->filename == NULL || fileno(filereader->file) < 0)
+        return NULL;
+    if (filereader->index == NULL)
+        filereader->index = new_FileIndex(filereader->filename);
+    return filereader->index;
+}
+
+bool FileReader_seekLine(FileReader* filereader, size_t line) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    FileIndex* index = __FileReader_index(filereader);
+    if (index == NULL || line > index->lines)
+        return false;
+    if (fseeko(filereader->file, (off_t) FileIndex_offset(index, line), SEEK_SET) != 0)
+        return false;
+    filereader->pending = -1;
+    return true;
+}
+
+string FileReader_readLines(FileReader* filereader, size_t first, size_t count) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    FileIndex* index = __FileReader_index(filereader);
+    if (index == NULL || first >= index->lines)
+        return NULL;
+    size_t last = (count > index->lines - first) ? index->lines : first + count;
+    uint64_t begin = FileIndex_offset(index, first);
+    size_t size = (size_t) (FileIndex_offset(index, last) - begin);
+    string text = (string) cprime_malloc(size + 1);
+    if (text == NULL) {
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    size_t have = 0;
+    while (have < size) {
+        ssize_t n = pread(fileno(filereader->file), text + have, size - have, (off_t) (begin + have));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += (size_t) n;
+    }
+    if (have < size) {
+        cprime_free(text);
+        return NULL;
+    }
+    text[size] = '\0';
+    return text;
+}
+#else
+void delete_FileIndex(FileIndex* index) { (void) index; }
+#endif  // __unix__ || __APPLE__
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Iterators */
+
+/**
+ * @brief Lazy pipeline over the lines or tokens of a FileReader; each stage pulls a record from its source only
+ *        when asked for one, so a pipeline reads no further than the records it has produced
+ * @note You must call `delete_Iter(Iter*)` on the last stage to free the pipeline after use (the reader is not closed)
+ * @note Records are passed between stages without copying: a record returned by `Iter_next` lives in the reader's
+ *       buffer (or the batch's, or wherever a map function put it) and is only valid until the next call
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the reader or source stage is NULL
+ * @throw `TIMEOUT_EXCEPTION` from `Iter_next` once an enclosing `try_deadline` has expired (as the reader does)
+ * 
+ * ### Methods
+ * 
+ * - `iter_lines(FileReader*)` / `iter_tokens(FileReader*)`
+ * 
+ * - `iter_map(Iter*, IterMap fn, void* arg=NULL)`
+ * 
+ * - `iter_filter(Iter*, IterFilter fn, void* arg=NULL)`
+ * 
+ * - `iter_take(Iter*, size_t n)`
+ * 
+ * - `iter_batch(Iter*, size_t n)`
+ * 
+ * - `delete_Iter(Iter*)`
+ * 
+ * - `Iter_next(Iter*)` / `Iter_length(Iter*)` / `Iter_count(Iter*)`
+ * 
+ * - `foreach_iter(var, Iter*)`
+ * 
+ * ```
+ * Iter* errors = iter_take(iter_filter(iter_lines(fr), is_error), 10);   // head -n 10 of grep
+ * foreach_iter (line, errors) puts(line);
+ * delete_Iter(errors);
+ * ```
+ */
+typedef struct Iter Iter;
+
+/* Map function: returns the new record (NUL-terminated, with its length stored in `*length`), or NULL to drop it;
+ * it may edit the record in place */
+typedef string (*IterMap)(string record, size_t* length, void* arg);
+
+/* Filter function: whether to keep the record */
+typedef bool (*IterFilter)(const char* record, size_t length, void* arg);
+
+typedef enum { __ITER_LINES, __ITER_TOKENS, __ITER_MAP, __ITER_FILTER, __ITER_TAKE, __ITER_BATCH } __IterKind;
+
+struct Iter {
+    __IterKind kind;
+    Iter* source;           // Stage this one pulls from (owned), or NULL for a reader
+    FileReader* reader;
+    IterMap map;
+    IterFilter filter;
+    void* arg;
+    size_t limit;           // Records left to take, or records per batch
+    size_t length;          // Length of the current record
+    size_t count;           // Records in the current batch
+    string buffer;          // Batch storage
+    size_t capacity;
+};
+
+Iter* __new_Iter(__IterKind kind, Iter* source, FileReader* reader, bool valid);
+
+/**
+ * @brief Iterate over the lines of a file, read into the reader's buffer one at a time
+ * @param filereader The file reader to read from (lines end at "\n", "\r\n" or "\r", which are not included)
+ * @return The first stage of a pipeline
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the reader is NULL
+ * @memberof Iter
+ */
+static inline Iter* iter_lines(FileReader* filereader) {
+    return __new_Iter(__ITER_LINES, NULL, filereader, true);
+}
+
+/**
+ * @brief Iterate over the space-separated tokens of a file, as `FileReader_nextString` reads them
+ * @param filereader The file reader to read from
+ * @return The first stage of a pipeline
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the reader is NULL
+ * @memberof Iter
+ */
+static inline Iter* iter_tokens(FileReader* filereader) {
+    return __new_Iter(__ITER_TOKENS, NULL, filereader, true);
+}
+
+static inline Iter* __iter_map_FA(Iter* source, IterMap map, void* arg) {
+    Iter* iter = __new_Iter(__ITER_MAP, source, NULL, map != NULL);
+    if (iter != NULL) {
+        iter->map = map;
+        iter->arg = arg;
+    }
+    return iter;
+}
+
+static inline Iter* __iter_map_F(Iter* source, IterMap map) { return __iter_map_FA(source, map, NULL); }
+
+/**
+ * @brief Transform each record of a stage (`cut`-style projections can return a slice of the record in place)
+ * @param source The stage to pull from; the new stage owns it
+ * @param fn The map function: `string fn(string record, size_t* length, void* arg)`, returning NULL to drop a record
+ * @param arg [optional] Passed to every call of `fn` (default is NULL)
+ * @return The new stage
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails (the source is deleted)
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the source or `fn` is NULL
+ * @memberof Iter
+ */
+#define iter_map(...) GET_MACRO3(__VA_ARGS__, __iter_map_FA, __iter_map_F)(__VA_ARGS__)
+
+static inline Iter* __iter_filter_FA(Iter* source, IterFilter filter, void* arg) {
+    Iter* iter = __new_Iter(__ITER_FILTER, source, NULL, filter != NULL);
+    if (iter != NULL) {
+        iter->filter = filter;
+        iter->arg = arg;
+    }
+    return iter;
+}
+
+static inline Iter* __iter_filter_F(Iter* source, IterFilter filter) { return __iter_filter_FA(source, filter, NULL); }
+
+/**
+ * @brief Keep only the records of a stage that pass a test
+ * @param source The stage to pull from; the new stage owns it
+ * @param fn The filter function: `bool fn(const char* record, size_t length, void* arg)`
+ * @param arg [optional] Passed to every call of `fn` (default is NULL)
+ * @return The new stage
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails (the source is deleted)
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the source or `fn` is NULL
+ * @memberof Iter
+ */
+#define iter_filter(...) GET_MACRO3(__VA_ARGS__, __iter_filter_FA, __iter_filter_F)(__VA_ARGS__)
+
+/**
+ * @brief Stop after the first `n` records of a stage, without pulling another record from it
+ * @param source The stage to pull from; the new stage owns it
+ * @param n The number of records
+ * @return The new stage
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails (the source is deleted)
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the source is NULL
+ * @memberof Iter
+ */
+static inline Iter* iter_take(Iter* source, size_t n) {
+    Iter* iter = __new_Iter(__ITER_TAKE, source, NULL, true);
+    if (iter != NULL) iter->limit = n;
+    return iter;
+}
+
+/**
+ * @brief Group the records of a stage `n` at a time into one buffer, each record followed by "\n"
+ * @param source The stage to pull from; the new stage owns it
+ * @param n The most records per batch (the last batch may have fewer); `Iter_count` gives the number
+ * @return The new stage
+ * @note The buffer is reused from batch to batch, so a batch costs no allocation once the buffer has grown
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails (the source is deleted)
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the source is NULL or `n` is 0
+ * @memberof Iter
+ */
+static inline Iter* iter_batch(Iter* source, size_t n) {
+    Iter* iter = __new_Iter(__ITER_BATCH, source, NULL, n > 0);
+    if (iter != NULL) iter->limit = n;
+    return iter;
+}
+
+/**
+ * @brief Delete a pipeline: the stage and every stage it pulls from
+ * @param iter The last stage of the pipeline
+ * @memberof Iter
+ */
+void delete_Iter(Iter* iter);
+
+/**
+ * @brief Pull the next record through the pipeline
+ * @param iter The last stage of the pipeline
+ * @return The record (NUL-terminated), valid until the next call, or NULL once the pipeline is exhausted
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if a batch cannot grow its buffer
+ * @memberof Iter
+ */
+string Iter_next(Iter* iter);
+
+/**
+ * @brief Get the length of the record last returned by `Iter_next`
+ * @param iter The stage
+ * @return The length in bytes, so records need no `strlen`
+ * @memberof Iter
+ */
+static inline size_t Iter_length(const Iter* iter) {
+    return iter->length;
+}
+
+/**
+ * @brief Get the number of records in the batch last returned by `Iter_next`
+ * @param iter A stage made by `iter_batch`
+ * @return The number of records
+ * @memberof Iter
+ */
+static inline size_t Iter_count(const Iter* iter) {
+    return iter->count;
+}
+
+/**
+ * @brief Loop over the records of a pipeline
+ * @param var The name of the `string` loop variable, valid for one iteration
+ * @param iter The last stage of the pipeline
+ * 
+ * ```
+ * Iter* words = iter_take(iter_tokens(fr), 3);
+ * foreach_iter (word, words) printf("%s\n", word);
+ * ```
+ */
+#define foreach_iter(var, iter) \
+    for (string var; (var = Iter_next(iter)) != NULL; )
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Allocate a stage; `valid` is false if the arguments besides the source are */
+Iter* __new_Iter(__IterKind kind, Iter* source, FileReader* reader, bool valid) {
+    if (!valid || (source == NULL && reader == NULL)) {
+        delete_Iter(source);
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    Iter* iter = (Iter*) cprime_calloc(1, sizeof (Iter));
+    if (iter == NULL) {
+        delete_Iter(source);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    iter->kind = kind;
+    iter->source = source;
+    iter->reader = reader;
+    return iter;
+}
+
+void delete_Iter(Iter* iter) {
+    while (iter != NULL) {
+        Iter* source = iter->source;
+        cprime_free(iter->buffer);
+        cprime_free(iter);
+        iter = source;
+    }
+}
+
+/* Append a record and its line break to the batch buffer */
+static bool __Iter_append(Iter* iter, const char* record, size_t length) {
+    size_t size = iter->length + length + 2;
+    if (size > iter->capacity) {
+        size_t capacity = (iter->capacity * 2 > size) ? iter->capacity * 2 : size;
+        string grown = (string) cprime_realloc(iter->buffer, capacity);
+        if (grown == NULL) {
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return false;
+        }
+        iter->buffer = grown;
+        iter->capacity = capacity;
+    }
+    memcpy(iter->buffer + iter->length, record, length);
+    iter->length += length;
+    iter->buffer[iter->length++] = '\n';
+    iter->buffer[iter->length] = '\0';
+    return true;
+}
+
+string Iter_next(Iter* iter) {
+    __NO_ASYNC_THROW();
+    if (iter == NULL) return NULL;
+    Iter* source = iter->source;
+    string record;
+    switch (iter->kind) {
+        case __ITER_LINES:
+            return __FileReader_line(iter->reader, &iter->length);
+        case __ITER_TOKENS:
+            return __FileReader_token(iter->reader, &iter->length);
+        case __ITER_MAP:
+            while ((record = Iter_next(source)) != NULL) {
+                iter->length = source->length;
+                if ((record = iter->map(record, &iter->length, iter->arg)) != NULL)
+                    return record;
+            }
+            return NULL;
+        case __ITER_FILTER:
+            while ((record = Iter_next(source)) != NULL) {
+                if (iter->filter(record, source->length, iter->arg)) {
+                    iter->length = source->length;
+                    return record;
+                }
+            }
+            return NULL;
+        case __ITER_TAKE:
+            if (iter->limit == 0 || (record = Iter_next(source)) == NULL) {
+                iter->limit = 0;   // Never pull from the source again
+                return NULL;
+            }
+            iter->limit--;
+            iter->length = source->length;
+            return record;
+        case __ITER_BATCH:
+            iter->length = 0;
+            iter->count = 0;
+            while (iter->count < iter->limit && (record = Iter_next(source)) != NULL) {
+                if (!__Iter_append(iter, record, source->length))
+                    return NULL;
+                iter->count++;
+            }
+            return (iter->count > 0) ? iter->buffer : NULL;
+    }
+    return NULL;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+
+/* External sort */
+
+/*
+ * Sorting of text files larger than memory. The input is read in runs that fit the memory budget; the lines of a
+ * run are split into one slice per thread, the slices are merge-sorted in parallel, then merged with a loser tree
+ * as the run is spilled to a temporary file next to the output. The runs are merged the same way (in several
+ * passes when there are more than FILE_SORT_FAN_IN). The sort is stable, and equal lines can be dropped.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Default memory budget of `file_sort` */
+#define FILE_SORT_BUDGET (256u << 20)
+
+/* Most runs merged at once */
+#define FILE_SORT_FAN_IN 128
+
+/**
+ * @brief Order of two lines for `file_sort`: negative, zero, or positive like `strcmp`
+ * @note Lines are passed without their line ending and are NUL-terminated (`a[a_length] == '\0'`)
+ */
+typedef int (*LineComparator)(const char* a, size_t a_length, const char* b, size_t b_length);
+
+/**
+ * @brief Compare two lines byte by byte (like `LC_ALL=C sort`); the default order of `file_sort`
+ */
+int compare_lines(const char* a, size_t a_length, const char* b, size_t b_length);
+
+/* Compare the numbers at the start of two strings (leading blanks skipped, no number counts as 0) */
+static inline int __compare_numbers(const char* a, const char* b) {
+    double x = strtod(a, NULL), y = strtod(b, NULL);
+    if (x != x || y != y) return (x == x) - (y == y);  // NaN first
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Compare two lines by the number they start with (like `sort -n`); lines without one count as 0
+ */
+int compare_lines_numeric(const char* a, size_t a_length, const char* b, size_t b_length);
+
+/**
+ * @brief Find a field of a delimited line
+ * @param line The line
+ * @param length The length of the line
+ * @param field The field number, from 0
+ * @param delimiter The field delimiter
+ * @param field_length [out] The length of the field (0 if the line has fewer fields)
+ * @return The start of the field
+ */
+const char* line_field(const char* line, size_t length, size_t field, char delimiter, size_t* field_length);
+
+/**
+ * @brief Define a `LineComparator` named `name` that orders lines by one delimited field (like `sort -t -k`)
+ * @param name The name of the comparator function
+ * @param field The field number, from 0
+ * @param delimiter The field delimiter
+ * @param numeric Whether to compare the fields as numbers instead of bytes
+ * @code
+ * FIELD_COMPARATOR(by_price, 2, ',', true)
+ * file_sort("items.csv", "by_price.csv", by_price);
+ * @endcode
+ */
+#define FIELD_COMPARATOR(name, field, delimiter, numeric) \
+    static int name(const char* a, size_t a_length, const char* b, size_t b_length) { \
+        size_t a_key, b_key; \
+        const char* a_field = line_field(a, a_length, (field), (delimiter), &a_key); \
+        const char* b_field = line_field(b, b_length, (field), (delimiter), &b_key); \
+        return (numeric) ? __compare_numbers(a_field, b_field) : compare_lines(a_field, a_key, b_field, b_key); \
+    }
+
+typedef struct __SortLine __SortLine;
+struct __SortLine {
+    const char* data;
+    size_t length;
+};
+
+typedef struct __SortSlice __SortSlice;
+struct __SortSlice {
+    __SortLine* lines;
+    __SortLine* scratch;
+    size_t count;
+    LineComparator compare;
+};
+
+/* Sorted input of a merge: a slice of lines in memory, or a spilled run read back in blocks */
+typedef struct __SortSource __SortSource;
+struct __SortSource {
+    __SortLine line;            // Current line
+    bool done;
+    const __SortLine* next;     // Slice
+    const __SortLine* end;
+    FileReader* reader;         // Run
+    char* buffer;
+    size_t capacity, start, used;
+    bool eof;
+};
+
+/* Destination of a merge, dropping lines equal to the previous one if `unique` */
+typedef struct __SortOutput __SortOutput;
+struct __SortOutput {
+    FileWriter* writer;
+    LineComparator compare;
+    bool unique;
+    char* last;
+    size_t last_length, last_capacity;
+    bool has_last;
+    size_t lines;
+    bool failed;
+};
+
+size_t __file_sort(const char* input, const char* output, LineComparator compare, size_t budget, int threads,
+                   bool unique);
+size_t __file_sort_threads(const char* input, const char* output, LineComparator compare, size_t budget, int threads);
+size_t __file_sort_budget(const char* input, const char* output, LineComparator compare, size_t budget);
+size_t __file_sort_compare(const char* input, const char* output, LineComparator compare);
+size_t __file_sort_default(const char* input, const char* output);
+
+/**
+ * @brief Sort the lines of a text file of any size (an external merge sort)
+ * @param input The file to sort (may be compressed)
+ * @param output The file to write (may be the input file)
+ * @param compare [optional] The line order (default is NULL: `compare_lines`); see also `compare_lines_numeric`
+ *        and `FIELD_COMPARATOR`
+ * @param budget [optional] Bytes of memory for the lines being sorted (default is `FILE_SORT_BUDGET`)
+ * @param threads [optional] Threads that sort each run (default is 0: one per CPU)
+ * @param unique [optional] Whether to keep only the first of lines that compare equal (default is false)
+ * @return The number of lines written
+ * @note The sort is stable; runs that do not fit the budget are spilled to temporary files next to the output
+ * @note Every output line ends with '\n', including a last input line that did not
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the input is not found or the output cannot be created
+ * @throw `IO_ERROR_EXCEPTION` if reading the input or writing a run or the output fails
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if a filename is NULL
+ */
+#define file_sort(...) GET_MACRO6(__VA_ARGS__, __file_sort, __file_sort_threads, __file_sort_budget, \
+                                  __file_sort_compare, __file_sort_default)(__VA_ARGS__)
+#endif  // __unix__ || __APPLE__
+
+#ifdef CPRIME_IMPLEMENTATION
+#if defined(__unix__) || defined(__APPLE__)
+int compare_lines(const char* a, size_t a_length, const char* b, size_t b_length) {
+    int order = memcmp(a, b, (a_length < b_length) ? a_length : b_length);
+    return (order != 0) ? order : (a_length > b_length) - (a_length < b_length);
+}
+
+int compare_lines_numeric(const char* a, size_t a_length, const char* b, size_t b_length) {
+    (void) a_length;
+    (void) b_length;
+    return __compare_numbers(a, b);
+}
+
+const char* line_field(const char* line, size_t length, size_t field, char delimiter, size_t* field_length) {
+    const char* end = line + length;
+    const char* p = line;
+    for (; field > 0; field--) {
+        const char* next = (const char*) memchr(p, delimiter, (size_t) (end - p));
+        if (next == NULL) {
+            *field_length = 0;
+            return end;
+        }
+        p = next + 1;
+    }
+    const char* stop = (const char*) memchr(p, delimiter, (size_t) (end - p));
+    *field_length = (size_t) (((stop != NULL) ? stop : end) - p);
+    return p;
+}
+
+/* Stable merge sort of `n` lines; `scratch` holds at least n / 2 lines */
+static void __sort_lines(__SortLine* lines, __SortLine* scratch, size_t n, LineComparator compare) {
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            __SortLine line = lines[i];
+            size_t j = i;
+            for (; j > 0 && compare(line.data, line.length, lines[j - 1].data, lines[j - 1].length) < 0; j--)
+                lines[j] = lines[j - 1];
+            lines[j] = line;
+        }
+        return;
+    }
+    size_t half = n / 2;
+    __sort_lines(lines, scratch, half, compare);
+    __sort_lines(lines + half, scratch, n - half, compare);
+    if (compare(lines[half - 1].data, lines[half - 1].length, lines[half].data, lines[half].length) <= 0)
+        return;
+    // Merge the left half (moved out of the way) with the right half in place
+    memcpy(scratch, lines, half * sizeof (__SortLine));
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < n)
+        lines[k++] = (compare(lines[j].data, lines[j].length, scratch[i].data, scratch[i].length) < 0)
+                   ? lines[j++] : scratch[i++];
+    while (i < half) lines[k++] = scratch[i++];
+}
+
+static void* __sort_slice(void* arg) {
+    __SortSlice* slice = (__SortSlice*) arg;
+    __sort_lines(slice->lines, slice->scratch, slice->count, slice->compare);
+    return NULL;
+}
+
+/* Move to the next line; false on a read or allocation failure */
+static bool __SortSource_advance(__SortSource* source) {
+    if (source->reader == NULL) {
+        source->done = source->next == source->end;
+        if (!source->done) source->line = *source->next++;
+        return true;
+    }
+    while (true) {
+        char* line = source->buffer + source->start;
+        char* newline = (char*) memchr(line, '\n', source->used - source->start);
+        if (newline != NULL || (source->eof && source->start < source->used)) {
+            if (newline == NULL) newline = source->buffer + source->used;
+            *newline = '\0';
+            source->line = (__SortLine) { line, (size_t) (newline - line) };
+            source->start = (size_t) (newline - source->buffer) + 1;
+            if (source->start > source->used) source->start = source->used;
+            return true;
+        }
+        if (source->eof) {
+            source->done = true;
+            return true;
+        }
+        memmove(source->buffer, line, source->used - source->start);
+        source->used -= source->start;
+        source->start = 0;
+        if (source->used + 1 >= source->capacity) {
+            // A line longer than the buffer
+            char* larger = (char*) cprime_realloc(source->buffer, source->capacity * 2);
+            if (larger == NULL) return false;
+            source->buffer = larger;
+            source->capacity *= 2;
+        }
+        size_t n = fread(source->buffer + source->used, 1, source->capacity - source->used - 1, source->reader->file);
+        if (n == 0) {
+            if (ferror(source->reader->file)) return false;
+            source->eof = true;
+        }
+        source->used += n;
+    }
+}
+
+static void __SortOutput_emit(__SortOutput* output, __SortLine line) {
+    if (output->unique) {
+        if (output->has_last && output->compare(output->last, output->last_length, line.data, line.length) == 0)
+            return;
+        if (line.length + 1 > output->last_capacity) {
+            size_t capacity = (line.length + 1 > 2 * output->last_capacity) ? line.length + 1 : 2 * output->last_capacity;
+            char* larger = (char*) cprime_realloc(output->last, capacity);
+            if (larger == NULL) {
+                output->failed = true;
+                return;
+            }
+            output->last = larger;
+            output->last_capacity = capacity;
+        }
+        memcpy(output->last, line.data, line.length + 1);
+        output->last_length = line.length;
+        output->has_last = true;
+    }
+    fwrite(line.data, 1, line.length, output->writer->file);
+    putc('\n', output->writer->file);
+    output->lines++;
+}
+
+/* Before `j` in the merge order (exhausted sources last, ties to the earlier source) */
+static inline bool __sort_before(__SortSource* sources, size_t i, size_t j, LineComparator compare) {
+    if (sources[i].done) return false;
+    if (sources[j].done) return true;
+    int order = compare(sources[i].line.data, sources[i].line.length, sources[j].line.data, sources[j].line.length);
+    return order < 0 || (order == 0 && i < j);
+}
+
+/* K-way merge with a loser tree: each internal node keeps the source that lost the match played there */
+static bool __sort_merge(__SortSource* sources, size_t k, LineComparator compare, __SortOutput* output) {
+    size_t* tree = (size_t*) cprime_malloc(3 * k * sizeof (size_t));
+    if (tree == NULL) return false;
+    size_t* winners = tree + k;  // Winner of the subtree under each node while building (leaves at k .. 2k - 1)
+    bool ok = true;
+    for (size_t i = 0; i < k && ok; i++) {
+        ok = __SortSource_advance(&sources[i]);
+        winners[k + i] = i;
+    }
+    for (size_t node = k - 1; node >= 1 && ok; node--) {
+        size_t a = winners[2 * node], b = winners[2 * node + 1];
+        bool first = __sort_before(sources, a, b, compare);
+        winners[node] = first ? a : b;
+        tree[node] = first ? b : a;
+    }
+    tree[0] = (k > 1) ? winners[1] : 0;
+    while (ok && !sources[tree[0]].done) {
+        size_t winner = tree[0];
+        __SortOutput_emit(output, sources[winner].line);
+        ok = !output->failed && __SortSource_advance(&sources[winner]);
+        // Replay the matches on the path from the winner's leaf to the root
+        for (size_t node = (winner + k) / 2; node >= 1; node /= 2) {
+            if (__sort_before(sources, tree[node], winner, compare)) {
+                size_t loser = winner;
+                winner = tree[node];
+                tree[node] = loser;
+            }
+        }
+        tree[0] = winner;
+    }
+    cprime_free(tree);
+    return ok;
+}
+
+/* Open a writer, or NULL instead of throwing */
+static FileWriter* __sort_open(const char* filename) {
+    FileWriter* volatile writer = NULL;
+    try {
+        writer = new_FileWriter(filename);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+    } catch (MEMORY_ALLOCATION_EXCEPTION) {
+    } etry;
+    return writer;
+}
+
+/* Open a run for merging, or NULL instead of throwing */
+static FileReader* __sort_open_run(const char* filename) {
+    FileReader* volatile reader = NULL;
+    try {
+        reader = new_FileReader(filename);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+    } catch (MEMORY_ALLOCATION_EXCEPTION) {
+    } etry;
+    return reader;
+}
+
+/* Close a merge's output; false if any write failed */
+static bool __sort_close(__SortOutput* output) {
+    bool ok = !output->failed && fflush(output->writer->file) == 0 && !ferror(output->writer->file);
+    close_FileWriter(output->writer, false);
+    output->writer = NULL;
+    return ok;
+}
+
+/* Sort the lines of one run in parallel slices and merge the slices into `output` */
+static bool __sort_run(__SortLine* lines, __SortLine* scratch, size_t count, int threads, LineComparator compare,
+                       __SortOutput* output) {
+    size_t slices = (size_t) threads;
+    if (slices > count / 4096 + 1) slices = count / 4096 + 1;
+    if (slices > 64) slices = 64;
+    __SortSlice work[64];
+    __SortSource sources[64];
+    pthread_t workers[64];
+    bool started[64] = { false };
+    for (size_t i = 0; i < slices; i++) {
+        size_t begin = count / slices * i, end = (i + 1 == slices) ? count : count / slices * (i + 1);
+        work[i] = (__SortSlice) { lines + begin, scratch + begin / 2, end - begin, compare };
+        sources[i] = (__SortSource) { .next = lines + begin, .end = lines + end };
+        if (i > 0) started[i] = pthread_create(&workers[i], NULL, __sort_slice, &work[i]) == 0;
+    }
+    for (size_t i = 0; i < slices; i++)
+        if (!started[i]) __sort_slice(&work[i]);
+    for (size_t i = 0; i < slices; i++)
+        if (started[i]) pthread_join(workers[i], NULL);
+    return __sort_merge(sources, slices, compare, output);
+}
+
+/* Merge `count` spilled runs into `output`; each run gets `buffer` bytes to read with */
+static bool __sort_merge_runs(char** runs, size_t count, size_t buffer, LineComparator compare, __SortOutput* output) {
+    __SortSource* sources = (__SortSource*) cprime_calloc(count, sizeof (__SortSource));
+    bool ok = sources != NULL;
+    for (size_t i = 0; i < count && ok; i++) {
+        FileReader* reader = __sort_open_run(runs[i]);
+        sources[i].reader = reader;
+        sources[i].capacity = buffer;
+        sources[i].buffer = (char*) cprime_malloc(buffer);
+        ok = reader != NULL && sources[i].buffer != NULL;
+    }
+    if (ok) ok = __sort_merge(sources, count, compare, output);
+    for (size_t i = 0; sources != NULL && i < count; i++) {
+        close_FileReader(sources[i].reader);
+        cprime_free(sources[i].buffer);
+    }
+    cprime_free(sources);
+    return ok;
+}
+
+/* Merge `count` runs into the file `target`, then delete them; returns 0 or the exception code of a failure */
+static int __sort_merge_group(char** runs, size_t count, const char* target, size_t budget, __SortOutput* output,
+                              int open_error) {
+    *output = (__SortOutput) { __sort_open(target), output->compare, output->unique, output->last, 0,
+                               output->last_capacity, false, 0, false };
+    int error = 0;
+    if (output->writer == NULL) {
+        error = open_error;
+    } else {
+        size_t buffer = budget / count;
+        if (buffer < (64u << 10)) buffer = 64u << 10;
+        bool ok = __sort_merge_runs(runs, count, buffer, output->compare, output);
+        if (!__sort_close(output) || !ok) error = IO_ERROR_EXCEPTION;
+    }
+    for (size_t i = 0; i < count; i++) {
+        remove(runs[i]);
+        cprime_free(runs[i]);
+        runs[i] = NULL;
+    }
+    return error;
+}
+
+size_t __file_sort(const char* input, const char* output, LineComparator compare, size_t budget, int threads,
+                   bool unique) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (input == NULL || output == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return 0;
+    }
+    if (compare == NULL) compare = compare_lines;
+    if (budget < (1u << 20)) budget = 1u << 20;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    FileReader* reader = new_FileReader(input);
+
+    // Half of the budget holds text and half the line table (plus the merge scratch)
+    size_t capacity = budget / 2, max_lines = budget / 2 / (sizeof (__SortLine) * 3 / 2);
+    char* data = (char*) cprime_malloc(capacity + 1);
+    __SortLine* lines = (__SortLine*) cprime_malloc(max_lines * sizeof (__SortLine));
+    __SortLine* scratch = (__SortLine*) cprime_malloc((max_lines / 2 + 1) * sizeof (__SortLine));
+    char** runs = NULL;
+    size_t run_count = 0, run_capacity = 0, written = 0;
+    size_t name_length = strlen(output) + 48;
+    __SortOutput result = { NULL, compare, unique, NULL, 0, 0, false, 0, false };
+    int error = (data == NULL || lines == NULL || scratch == NULL) ? MEMORY_ALLOCATION_EXCEPTION : 0;
+
+    size_t used = 0;
+    bool eof = false;
+    while (error == 0) {
+        // Fill the buffer with whole lines, keeping a partial last line for the next run
+        size_t count = 0, start = 0, scan = 0;
+        while (true) {
+            char* newline;
+            while (count < max_lines && (newline = (char*) memchr(data + scan, '\n', used - scan)) != NULL) {
+                *newline = '\0';
+                lines[count++] = (__SortLine) { data + start, (size_t) (newline - data) - start };
+                start = scan = (size_t) (newline - data) + 1;
+            }
+            scan = used;
+            if (count == max_lines) break;
+            if (eof) {
+                if (start < used) {
+                    data[used] = '\0';
+                    lines[count++] = (__SortLine) { data + start, used - start };
+                    start = used;
+                }
+                break;
+            }
+            if (used == capacity) {
+                if (count > 0) break;
+                // A single line longer than the buffer
+                char* larger = (char*) cprime_realloc(data, capacity * 2 + 1);
+                if (larger == NULL) {
+                    error = MEMORY_ALLOCATION_EXCEPTION;
+                    break;
+                }
+                data = larger;
+                capacity *= 2;
+            }
+            size_t n = fread(data + used, 1, capacity - used, reader->file);
+            if (n == 0) {
+                if (ferror(reader->file)) error = IO_ERROR_EXCEPTION;
+                eof = true;
+            }
+            used += n;
+        }
+        if (error != 0) break;
+        bool last = eof && start == used;
+        if (last && run_count == 0) {
+            // Everything fit in memory: sort straight into the output
+            close_FileReader(reader);
+            reader = NULL;
+            result.writer = __sort_open(output);
+            if (result.writer == NULL) {
+                error = FILE_NOT_FOUND_EXCEPTION;
+            } else {
+                bool ok = __sort_run(lines, scratch, count, threads, compare, &result);
+                if (!__sort_close(&result) || !ok) error = IO_ERROR_EXCEPTION;
+            }
+            written = result.lines;
+            break;
+        }
+        if (count > 0) {
+            if (run_count == run_capacity) {
+                run_capacity = (run_capacity == 0) ? 16 : run_capacity * 2;
+                char** larger = (char**) cprime_realloc(runs, run_capacity * sizeof (char*));
+                if (larger == NULL) {
+                    error = MEMORY_ALLOCATION_EXCEPTION;
+                    break;
+                }
+                runs = larger;
+            }
+            runs[run_count] = (char*) cprime_malloc(name_length);
+            if (runs[run_count] == NULL) {
+                error = MEMORY_ALLOCATION_EXCEPTION;
+                break;
+            }
+            snprintf(runs[run_count], name_length, "%s.sort%ld-%zu", output, (long) getpid(), run_count);
+            result = (__SortOutput) { __sort_open(runs[run_count++]), compare, unique, result.last, 0,
+                                      result.last_capacity, false, 0, false };
+            if (result.writer == NULL) {
+                error = IO_ERROR_EXCEPTION;
+            } else {
+                bool ok = __sort_run(lines, scratch, count, threads, compare, &result);
+                if (!__sort_close(&result) || !ok) error = IO_ERROR_EXCEPTION;
+            }
+        }
+        memmove(data, data + start, used - start);
+        used -= start;
+        if (last) break;
+    }
+    close_FileReader(reader);
+    cprime_free(lines);
+    cprime_free(scratch);
+    cprime_free(data);
+
+    // Merge groups of FILE_SORT_FAN_IN runs (in input order, to keep the sort stable) until one merge is left
+    size_t spilled = run_count, names = run_count;
+    while (error == 0 && run_count > FILE_SORT_FAN_IN) {
+        size_t merged = 0;
+        for (size_t first = 0; first < run_count && error == 0; first += FILE_SORT_FAN_IN) {
+            size_t group = (run_count - first < FILE_SORT_FAN_IN) ? run_count - first : FILE_SORT_FAN_IN;
+            char* name = (char*) cprime_malloc(name_length);
+            if (name == NULL) {
+                error = MEMORY_ALLOCATION_EXCEPTION;
+                break;
+            }
+            snprintf(name, name_length, "%s.sort%ld-%zu", output, (long) getpid(), names++);
+            error = __sort_merge_group(runs + first, group, name, budget, &result, IO_ERROR_EXCEPTION);
+            runs[merged++] = name;  // Its slot's run was consumed by the merge
+        }
+        run_count = merged;
+    }
+    if (error == 0 && run_count > 0) {
+        error = __sort_merge_group(runs, run_count, output, budget, &result, FILE_NOT_FOUND_EXCEPTION);
+        written = result.lines;
+    }
+    for (size_t i = 0; i < spilled; i++) {
+        if (runs[i] != NULL) {
+            remove(runs[i]);
+            cprime_free(runs[i]);
+        }
+    }
+    cprime_free(runs);
+    cprime_free(result.last);
+    if (error != 0) {
+        throw(error);
+        return 0;
+    }
+    return written;
+}
+size_t __file_sort_threads(const char* input, const char* output, LineComparator compare, size_t budget, int threads) {
+    return __file_sort(input, output, compare, budget, threads, false);
+}
+size_t __file_sort_budget(const char* input, const char* output, LineComparator compare, size_t budget) {
+    return __file_sort(input, output, compare, budget, 0, false);
+}
+size_t __file_sort_compare(const char* input, const char* output, LineComparator compare) {
+    return __file_sort(input, output, compare, FILE_SORT_BUDGET, 0, false);
+}
+size_t __file_sort_default(const char* input, const char* output) {
+    return __file_sort(input, output, NULL, FILE_SORT_BUDGET, 0, false);
+}
+#endif  // __unix__ || __APPLE__
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* File transfer */
+
+/*
+ * Copies between file descriptors that stay in the kernel where the platform allows it: copy_file_range between
+ * files (which also clones blocks on filesystems that support it), sendfile to any output, and splice into pipes,
+ * falling back to a loop over a large buffer.
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Buffer of the read/write fallback */
+#define __TRANSFER_BUFFER (1u << 20)
+
+/**
+ * @brief Copy a file, or write it to standard output, without passing its contents through user space
+ * @param source The file to copy
+ * @param destination The file to create or replace (with the source's permissions), or NULL for standard output
+ * @return The number of bytes copied
+ * @throw `FILE_NOT_FOUND_EXCEPTION` if the source is not found or the destination cannot be created
+ * @throw `IO_ERROR_EXCEPTION` if the copy fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the source is NULL
+ */
+unsigned long long file_copy(const char* source, const char* destination);
+
+unsigned long long __FileWriter_writeFrom(FileWriter* filewriter, FileReader* filereader, unsigned long long offset,
+                                          unsigned long long length);
+unsigned long long __FileWriter_writeFrom_offset(FileWriter* filewriter, FileReader* filereader,
+                                                 unsigned long long offset);
+unsigned long long __FileWriter_writeFrom_all(FileWriter* filewriter, FileReader* filereader);
+
+/**
+ * @brief Copy a byte range of a reader's file to a writer without passing it through user space where possible
+ * @param filewriter The file writer to write to
+ * @param filereader The file reader whose file is copied (its read position does not move)
+ * @param offset [optional] The first byte to copy (default is 0)
+ * @param length [optional] The number of bytes to copy (default is everything up to the end of the file)
+ * @return The number of bytes copied (fewer than `length` at the end of the file), or 0 if the reader's file is
+ *         compressed or the writer is a durable log
+ * @note Output to a compressed writer is copied through a buffer so that it is compressed
+ * @throw `IO_ERROR_EXCEPTION` if reading or writing fails
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof FileWriter
+ */
+#define FileWriter_writeFrom(...) GET_MACRO4(__VA_ARGS__, __FileWriter_writeFrom, __FileWriter_writeFrom_offset, \
+                                             __FileWriter_writeFrom_all)(__VA_ARGS__)
+#endif  // __unix__ || __APPLE__
+
+#ifdef CPRIME_IMPLEMENTATION
+#if defined(__unix__) || defined(__APPLE__)
+/*
+ * Copy up to `length` bytes of `in` starting at `offset` to `out` at its current position (or its end in append
+ * mode), without moving `in`; returns the bytes copied (fewer at the end of the input) or -1 with errno set
+ */
+static long long __file_transfer(int in, long long offset, int out, unsigned long long length) {
+    PROFILE_FUNC();
+    unsigned long long done = 0;
+    int flags = fcntl(out, F_GETFL);
+    // 0: copy_file_range, 1: sendfile, 2: splice, 3: read/write (the only one that honors O_APPEND)
+    int method = (flags >= 0 && (flags & O_APPEND)) ? 3 : 0;
+#ifdef __linux__
+    while (done < length && method < 3) {
+        size_t chunk = (length - done > (1u << 30)) ? (1u << 30) : (size_t) (length - done);
+        long long position = offset + (long long) done;
+        ssize_t n;
+        if (method == 0) {
+    #ifdef SYS_copy_file_range
+            n = (ssize_t) syscall(SYS_copy_file_range, in, &position, out, NULL, chunk, 0);
+    #else
+            n = -1;
+            errno = ENOSYS;
+    #endif
+        } else if (method == 1) {
+            off_t start = (off_t) position;
+            n = sendfile(out, in, &start, chunk);
+        } else {
+            n = (ssize_t) syscall(SYS_splice, in, &position, out, NULL, chunk, 0);
+        }
+        if (n > 0) {
+            done += (unsigned long long) n;
+        } else if (n == 0) {
+            return (long long) done;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN) {
+            struct pollfd pfd = { out, POLLOUT, 0 };
+            poll(&pfd, 1, -1);
+        } else if (done == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EBADF
+                                 || errno == EOPNOTSUPP || errno == ETXTBSY || errno == EPERM)) {
+            method++;  // Not supported for this pair of files
+        } else {
+            return -1;
+        }
+    }
+    if (method < 3) return (long long) done;
+#else
+    (void) method;
+#endif
+    char* buffer = (char*) cprime_malloc(__TRANSFER_BUFFER);
+    if (buffer == NULL) return -1;
+    while (done < length) {
+        size_t chunk = (length - done > __TRANSFER_BUFFER) ? __TRANSFER_BUFFER : (size_t) (length - done);
+        ssize_t n = pread(in, buffer, chunk, (off_t) (offset + (long long) done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            cprime_free(buffer);
+            return -1;
+        }
+        if (n == 0) break;
+        for (ssize_t written = 0; written < n; ) {
+            ssize_t w = write(out, buffer + written, (size_t) (n - written));
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && errno == EAGAIN) {
+                struct pollfd pfd = { out, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            if (w <= 0) {
+                cprime_free(buffer);
+                return -1;
+            }
+            written += w;
+        }
+        done += (unsigned long long) n;
+    }
+    cprime_free(buffer);
+    return (long long) done;
+}
+
+unsigned long long file_copy(const char* source, const char* destination) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (source == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return 0;
+    }
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (in < 0 || fstat(in, &info) != 0) {
+        if (in >= 0) close(in);
+        throw(FILE_NOT_FOUND_EXCEPTION);
+        return 0;
+    }
+    int out = STDOUT_FILENO;
+    if (destination != NULL) {
+        out = open(destination, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 0777);
+        if (out < 0) {
+            close(in);
+            throw(FILE_NOT_FOUND_EXCEPTION);
+            return 0;
+        }
+    } else {
+        fflush(stdout);
+    }
+    // Copy to the end even if the file is still growing; a size of 0 may also be a special file
+    long long copied = __file_transfer(in, 0, out, ULLONG_MAX);
+    close(in);
+    if (destination != NULL && close(out) != 0) copied = -1;
+    if (copied < 0) {
+        throw(IO_ERROR_EXCEPTION);
+        return 0;
+    }
+    return (unsigned long long) copied;
+}
+
+unsigned long long __FileWriter_writeFrom(FileWriter* filewriter, FileReader* filereader, unsigned long long offset,
+                                          unsigned long long length) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter) || filereader == NULL || filereader->file == NULL
+        || fileno(filereader->file) < 0)
+        return 0;
+    int out = (filewriter->file != NULL) ? fileno(filewriter->file) : -1;
+    long long copied;
+    if (filewriter->mapping != NULL) {
+        // Mapped output: read straight into the mapping
+        copied = 0;
+        while ((unsigned long long) copied < length) {
+            size_t chunk = (length - (unsigned long long) copied > __TRANSFER_BUFFER)
+                         ? __TRANSFER_BUFFER : (size_t) (length - (unsigned long long) copied);
+            char* target = __FileWriter_reserve(filewriter, chunk);
+            if (target == NULL) {
+                copied = -1;
+                break;
+            }
+            ssize_t n = pread(fileno(filereader->file), target, chunk, (off_t) (offset + (unsigned long long) copied));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) copied = -1;
+            if (n <= 0) break;
+            filewriter->size += (size_t) n;
+            copied += n;
+        }
+    } else if (out < 0) {
+        // Compressed output: the data has to pass through the compressor
+        char* buffer = (char*) cprime_malloc(__TRANSFER_BUFFER);
+        if (buffer == NULL) {
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return 0;
+        }
+        copied = 0;
+        while ((unsigned long long) copied < length) {
+            size_t chunk = (length - (unsigned long long) copied > __TRANSFER_BUFFER)
+                         ? __TRANSFER_BUFFER : (size_t) (length - (unsigned long long) copied);
+            ssize_t n = pread(fileno(filereader->file), buffer, chunk, (off_t) (offset + (unsigned long long) copied));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 || (n > 0 && fwrite(buffer, 1, (size_t) n, filewriter->file) != (size_t) n)) {
+                copied = -1;
+                break;
+            }
+            if (n == 0) break;
+            copied += n;
+        }
+        cprime_free(buffer);
+    } else {
+        // Hand the descriptor over at the stream's position, then move the stream past the copied data
+        if (fflush(filewriter->file) != 0) {
+            throw(IO_ERROR_EXCEPTION);
+            return 0;
+        }
+        copied = __file_transfer(fileno(filereader->file), (long long) offset, out, length);
+        off_t position = lseek(out, 0, SEEK_CUR);
+        if (position >= 0) fseeko(filewriter->file, position, SEEK_SET);
+    }
+    if (copied < 0) {
+        throw(IO_ERROR_EXCEPTION);
+        return 0;
+    }
+    return (unsigned long long) copied;
+}
+unsigned long long __FileWriter_writeFrom_offset(FileWriter* filewriter, FileReader* filereader,
+                                                 unsigned long long offset) {
+    return __FileWriter_writeFrom(filewriter, filereader, offset, ULLONG_MAX);
+}
+unsigned long long __FileWriter_writeFrom_all(FileWriter* filewriter, FileReader* filereader) {
+    return __FileWriter_writeFrom(filewriter, filereader, 0, ULLONG_MAX);
+}
+#endif  // __unix__ || __APPLE__
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* CSV */
+
+/*
+ * Streaming RFC 4180 reader on top of a FileReader. Input is read in large blocks and each 64-byte stretch is
+ * classified at once (SSE2, AVX2 when the CPU has it, or NEON) into a bitmask of quotes, delimiters and line
+ * breaks, so the parser jumps between structural characters instead of testing every byte. Fields are slices of
+ * the block buffer (not NUL-terminated) that stay valid until the next `CsvReader_next`; quoted fields are
+ * unescaped in place. Both \n and \r\n end a record, and blank lines are skipped.
+ */
+
+/* Initial block size; the buffer grows when a single record does not fit */
+#ifndef CSV_BLOCK_SIZE
+    #define CSV_BLOCK_SIZE (1 << 16)
+#endif
+
+/* Zeroed bytes after the data so classification may always read whole 64-byte stretches */
+#define __CSV_PADDING 64
+
+typedef struct CsvField CsvField;
+struct CsvField {
+    const char* data;
+    size_t length;
+};
+
+typedef struct CsvReader CsvReader;
+struct CsvReader {
+    FileReader* reader;
+    char delimiter;
+    char* buffer;
+    size_t capacity;        /* Bytes of input the buffer can hold (a multiple of 64) */
+    size_t start;           /* Offset of the next unparsed record */
+    size_t end;             /* Offset past the last byte read */
+    bool eof;
+    CsvField* fields;
+    size_t count;           /* Columns in the current record */
+    size_t fields_capacity;
+    bool* projection;       /* Columns to keep, or NULL to keep all of them */
+    size_t projection_size;
+    size_t records;         /* Records read so far */
+    uint64_t (*classify)(const char*, char);
+    size_t block;           /* Classification cached across records (see __CsvScan) */
+    uint64_t mask;
+};
+
+/* Cursor over the classified buffer, kept in locals while a record is parsed */
+typedef struct __CsvScan __CsvScan;
+struct __CsvScan {
+    const char* buffer;
+    size_t end;
+    size_t block;           /* Offset of the classified 64-byte stretch in `mask` */
+    uint64_t mask;
+    uint64_t (*classify)(const char*, char);
+    char delimiter;
+};
+
+/**
+ * @brief Read the next record
+ * @param csv The CSV reader
+ * @return True if a record was read, or false at the end of the input
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if a record does not fit in memory
+ * @note Field slices of the previous record are invalidated
+ * @memberof CsvReader
+ */
+bool CsvReader_next(CsvReader* csv);
+
+/**
+ * @brief Get the number of columns in the current record
+ * @param csv The CSV reader
+ * @return The number of columns
+ * @memberof CsvReader
+ */
+static inline size_t CsvReader_count(CsvReader* csv) {
+    return (csv != NULL) ? csv->count : 0;
+}
+
+/**
+ * @brief Get a field of the current record without copying it
+ * @param csv The CSV reader
+ * @param column The zero-based column index
+ * @return The field slice (not NUL-terminated), or { NULL, 0 } if the column is missing or not projected
+ * @note The slice is valid until the next call to `CsvReader_next`
+ * @memberof CsvReader
+ */
+static inline CsvField CsvReader_field(CsvReader* csv, size_t column) {
+    CsvField field = { NULL, 0 };
+    if (csv != NULL && column < csv->count) field = csv->fields[column];
+    return field;
+}
+
+/**
+ * @brief Find a column by name in the current record (typically the header)
+ * @param csv The CSV reader
+ * @param name The column name
+ * @return The column index, or -1 if not found
+ * @memberof CsvReader
+ */
+int CsvReader_find(CsvReader* csv, const char* name);
+
+/**
+ * @brief Only keep the given columns; the others are still delimited but never stored, unescaped or converted
+ * @param csv The CSV reader
+ * @param columns The zero-based column indices to keep (NULL keeps every column again)
+ * @param count The number of indices
+ * @return True on success
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @memberof CsvReader
+ */
+bool CsvReader_select(CsvReader* csv, const size_t* columns, size_t count);
+
+/**
+ * @brief Copy a field of the current record into a new string
+ * @param csv The CSV reader
+ * @param column The zero-based column index
+ * @return The string, or NULL if the column is missing or not projected
+ * @note The caller owns the result and frees it with `cprime_free`
+ * @memberof CsvReader
+ */
+string csv_string(CsvReader* csv, size_t column);
+
+/**
+ * @brief Parse a field of the current record as an integer
+ * @param csv The CSV reader
+ * @param column The zero-based column index
+ * @return The integer, or LLONG_MAX if the column is missing, empty, not an integer, or out of range
+ * @memberof CsvReader
+ */
+long long csv_int(CsvReader* csv, size_t column);
+
+/**
+ * @brief Parse a field of the current record as a double
+ * @param csv The CSV reader
+ * @param column The zero-based column index
+ * @return The double, or DBL_MAX if the column is missing, empty, not a finite number, or out of range
+ * @memberof CsvReader
+ */
+double csv_double(CsvReader* csv, size_t column);
+
+CsvReader* __new_CsvReader_delimiter(FileReader* filereader, char delimiter);
+
+static inline CsvReader* __new_CsvReader(FileReader* filereader) { return __new_CsvReader_delimiter(filereader, ','); }
+
+/**
+ * @brief Create a CSV reader over a file reader
+ * @param filereader The file reader to parse (it stays owned by the caller)
+ * @param delimiter [optional] The field delimiter (default is ',')
+ * @return The CSV reader
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the file reader is NULL or the delimiter is a quote or line break
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @note The CSV reader reads ahead, so the file reader should not be used directly while it is open
+ * @memberof CsvReader
+ */
+#define new_CsvReader(...) GET_MACRO2(__VA_ARGS__, __new_CsvReader_delimiter, __new_CsvReader)(__VA_ARGS__)
+
+/**
+ * @brief Free a CSV reader (the underlying file reader is left open)
+ * @param csv The CSV reader to free
+ * @memberof CsvReader
+ */
+void delete_CsvReader(CsvReader* csv);
+
+#ifdef CPRIME_IMPLEMENTATION
+static uint64_t __csv_classify_scalar(const char* data, char delimiter) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++) {
+        char c = data[i];
+        if (c == delimiter || c == '"' || c == '\n' || c == '\r') mask |= (uint64_t) 1 << i;
+    }
+    return mask;
+}
+
+#if defined(CPRIME_SSE2)
+static uint64_t __csv_classify_sse2(const char* data, char delimiter) {
+    const __m128i d = _mm_set1_epi8(delimiter), q = _mm_set1_epi8('"');
+    const __m128i n = _mm_set1_epi8('\n'), r = _mm_set1_epi8('\r');
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + 16 * i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, q)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, n), _mm_cmpeq_epi8(v, r)));
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(hit) << (16 * i);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t __csv_classify_avx2(const char* data, char delimiter) {
+    const __m256i d = _mm256_set1_epi8(delimiter), q = _mm256_set1_epi8('"');
+    const __m256i n = _mm256_set1_epi8('\n'), r = _mm256_set1_epi8('\r');
+    uint64_t mask = 0;
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + 32 * i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, d), _mm256_cmpeq_epi8(v, q)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, n), _mm256_cmpeq_epi8(v, r)));
+        mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(hit) << (32 * i);
+    }
+    return mask;
+}
+#elif defined(CPRIME_NEON)
+static uint64_t __csv_classify_neon(const char* data, char delimiter) {
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t w = vld1q_u8(weights);
+    const uint8x16_t d = vdupq_n_u8((uint8_t) delimiter), q = vdupq_n_u8('"');
+    const uint8x16_t n = vdupq_n_u8('\n'), r = vdupq_n_u8('\r');
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        uint8x16_t v = vld1q_u8((const uint8_t*) data + 16 * i);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, d), vceqq_u8(v, q)), vorrq_u8(vceqq_u8(v, n), vceqq_u8(v, r)));
+        hit = vandq_u8(hit, w);
+        uint64_t bits = (uint64_t) vaddv_u8(vget_low_u8(hit)) | ((uint64_t) vaddv_u8(vget_high_u8(hit)) << 8);
+        mask |= bits << (16 * i);
+    }
+    return mask;
+}
+#endif
+
+/* Offset of the first structural character at or after `pos`, or `end` if none is buffered */
+static inline size_t __csv_special(__CsvScan* scan, size_t pos) {
+    while (pos < scan->end) {
+        size_t block = pos & ~(size_t) 63;
+        if (block != scan->block) {
+            scan->block = block;
+            scan->mask = scan->classify(scan->buffer + block, scan->delimiter);
+        }
+        uint64_t bits = scan->mask >> (pos - block);
+        if (bits != 0) {
+            size_t found = pos + (size_t) __builtin_ctzll(bits);
+            return (found < scan->end) ? found : scan->end;
+        }
+        pos = block + 64;
+    }
+    return scan->end;
+}
+
+/* Move the unparsed tail to the front (growing the buffer if it is full) and read more input */
+static void __CsvReader_fill(CsvReader* csv) {
+    if (csv->eof) return;
+    if (csv->start > 0) {
+        memmove(csv->buffer, csv->buffer + csv->start, csv->end - csv->start);
+        csv->end -= csv->start;
+        csv->start = 0;
+    }
+    if (csv->end == csv->capacity) {
+        char* buffer = (char*) cprime_realloc(csv->buffer, 2 * csv->capacity + __CSV_PADDING);
+        if (buffer == NULL) {
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return;
+        }
+        csv->buffer = buffer;
+        csv->capacity *= 2;
+    }
+    size_t n = fread(csv->buffer + csv->end, 1, csv->capacity - csv->end, csv->reader->file);
+    if (n == 0) csv->eof = true;
+    csv->end += n;
+    memset(csv->buffer + csv->end, 0, __CSV_PADDING);
+    csv->block = SIZE_MAX;
+}
+
+/* Store a field of the current record (only the projected columns keep their slice) */
+static inline bool __CsvReader_store(CsvReader* csv, size_t first, size_t last) {
+    size_t column = csv->count;
+    if (column == csv->fields_capacity) {
+        size_t capacity = (csv->fields_capacity == 0) ? 16 : 2 * csv->fields_capacity;
+        CsvField* fields = (CsvField*) cprime_realloc(csv->fields, capacity * sizeof (CsvField));
+        if (fields == NULL) return false;
+        csv->fields = fields;
+        csv->fields_capacity = capacity;
+    }
+    if (csv->projection == NULL || (column < csv->projection_size && csv->projection[column])) {
+        csv->fields[column].data = csv->buffer + first;
+        csv->fields[column].length = last - first;
+    } else {
+        csv->fields[column].data = NULL;
+        csv->fields[column].length = 0;
+    }
+    csv->count++;
+    return true;
+}
+
+/* Parse the record at `start`: 1 if one was parsed, 0 at the end of the input, -1 if more input is needed */
+static int __CsvReader_parse(CsvReader* csv) {
+    char* buffer = csv->buffer;
+    const size_t end = csv->end;
+    const bool eof = csv->eof;
+    size_t pos = csv->start;
+    __CsvScan scan = { buffer, end, csv->block, csv->mask, csv->classify, csv->delimiter };
+    csv->count = 0;
+    while (pos < end && (buffer[pos] == '\n' || buffer[pos] == '\r')) pos++;
+    if (pos >= end) {
+        if (!eof) return -1;
+        csv->start = pos;
+        return 0;
+    }
+    while (true) {
+        size_t first, last, next;
+        if (pos < end && buffer[pos] == '"') {
+            // Quoted: only quotes matter until the closing one ("" is an escaped quote)
+            first = pos + 1;
+            size_t q = first;
+            while ((q = __csv_special(&scan, q)) < end) {
+                if (buffer[q] != '"') {
+                    q++;
+                    continue;
+                }
+                if (q + 1 >= end && !eof) return -1;
+                if (q + 1 < end && buffer[q + 1] == '"') {
+                    q += 2;
+                    continue;
+                }
+                break;
+            }
+            if (q >= end) {
+                // An unterminated quote runs to the end of the input
+                if (!eof) return -1;
+                last = next = end;
+            } else {
+                // Anything between the closing quote and the next delimiter is dropped
+                last = q;
+                next = q + 1;
+                while ((next = __csv_special(&scan, next)) < end && buffer[next] == '"') next++;
+            }
+        } else {
+            // Unquoted: a stray quote is kept as a literal character
+            first = pos;
+            next = __csv_special(&scan, pos);
+            while (next < end && buffer[next] == '"') next = __csv_special(&scan, next + 1);
+            last = next;
+        }
+        if (next >= end && !eof) return -1;
+        if (!__CsvReader_store(csv, first, last)) {
+            throw(MEMORY_ALLOCATION_EXCEPTION);
+            return 0;
+        }
+        if (next >= end) {
+            pos = end;
+            break;
+        }
+        if (buffer[next] == scan.delimiter) {
+            pos = next + 1;
+            // A trailing delimiter still needs to know whether the record goes on
+            if (pos >= end && !eof) return -1;
+            continue;
+        }
+        if (buffer[next] == '\r') {
+            if (next + 1 >= end && !eof) return -1;
+            pos = next + 1;
+            if (pos < end && buffer[pos] == '\n') pos++;
+        } else {
+            pos = next + 1;
+        }
+        break;
+    }
+    csv->start = pos;
+    csv->block = scan.block;
+    csv->mask = scan.mask;
+    // Unescape "" in quoted fields now that the record will not be parsed again
+    for (size_t i = 0; i < csv->count; i++) {
+        char* data = (char*) csv->fields[i].data;
+        if (data == NULL || data == buffer || data[-1] != '"') continue;
+        char* quote = (char*) memchr(data, '"', csv->fields[i].length);
+        if (quote == NULL) continue;
+        size_t length = csv->fields[i].length, n = (size_t) (quote - data);
+        for (size_t j = n; j < length; j++) {
+            data[n++] = data[j];
+            if (data[j] == '"') j++;
+        }
+        csv->fields[i].length = n;
+    }
+    return 1;
+}
+
+bool CsvReader_next(CsvReader* csv) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (csv == NULL || csv->buffer == NULL) return false;
+    while (true) {
+        int status = __CsvReader_parse(csv);
+        if (status >= 0) {
+            if (status > 0) csv->records++;
+            return status > 0;
+        }
+        __CsvReader_fill(csv);
+    }
+}
+
+int CsvReader_find(CsvReader* csv, const char* name) {
+    if (csv == NULL || name == NULL) return -1;
+    size_t length = strlen(name);
+    for (size_t i = 0; i < csv->count; i++) {
+        CsvField field = csv->fields[i];
+        if (field.data != NULL && field.length == length && memcmp(field.data, name, length) == 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+bool CsvReader_select(CsvReader* csv, const size_t* columns, size_t count) {
+    __NO_ASYNC_THROW();
+    if (csv == NULL) return false;
+    cprime_free(csv->projection);
+    csv->projection = NULL;
+    csv->projection_size = 0;
+    if (columns == NULL) return true;
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++)
+        if (columns[i] + 1 > size) size = columns[i] + 1;
+    csv->projection = (bool*) cprime_calloc((size > 0) ? size : 1, sizeof (bool));
+    if (csv->projection == NULL) {
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) csv->projection[columns[i]] = true;
+    csv->projection_size = size;
+    return true;
+}
+
+string csv_string(CsvReader* csv, size_t column) {
+    __NO_ASYNC_THROW();
+    CsvField field = CsvReader_field(csv, column);
+    if (field.data == NULL) return NULL;
+    string copy = (string) cprime_malloc(field.length + 1);
+    if (copy == NULL) return NULL;
+    memcpy(copy, field.data, field.length);
+    copy[field.length] = '\0';
+    return copy;
+}
+
+long long csv_int(CsvReader* csv, size_t column) {
+    CsvField field = CsvReader_field(csv, column);
+    const char* p = field.data;
+    const char* end = p + field.length;
+    if (p == NULL || p == end) return LLONG_MAX;
+    bool negative = (*p == '-');
+    if (*p == '-' || *p == '+') p++;
+    if (p == end) return LLONG_MAX;
+    unsigned long long value = 0;
+    const unsigned long long limit = negative ? (unsigned long long) LLONG_MAX + 1 : (unsigned long long) LLONG_MAX;
+    for (; p < end; p++) {
+        unsigned digit = (unsigned) (*p - '0');
+        if (digit > 9 || value > (limit - digit) / 10) return LLONG_MAX;
+        value = value * 10 + digit;
+    }
+    if (!negative && value == (unsigned long long) LLONG_MAX) return LLONG_MAX;
+    return negative ? (long long) (0 - value) : (long long) value;
+}
+
+double csv_double(CsvReader* csv, size_t column) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    CsvField field = CsvReader_field(csv, column);
+    const char* p = field.data;
+    const char* end = p + field.length;
+    if (p == NULL || p == end) return DBL_MAX;
+    // Fast path: up to 15 digits and a small exponent convert exactly with one multiplication or division
+    bool negative = (*p == '-');
+    if (*p == '-' || *p == '+') p++;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;  // Significant digits kept in `mantissa`, and the power of ten applied to it
+    bool any = false, fraction = false;
+    for (; p < end; p++) {
+        if (*p == '.' && !fraction) {
+            fraction = true;
+            continue;
+        }
+        unsigned digit = (unsigned) (*p - '0');
+        if (digit > 9) break;
+        any = true;
+        if (digits < 16) {
+            mantissa = mantissa * 10 + digit;
+            if (mantissa != 0) digits++;
+            if (fraction) exponent--;
+        } else if (!fraction) {
+            exponent++;
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negative_exponent = (e < end && *e == '-');
+        if (e < end && (*e == '-' || *e == '+')) e++;
+        int value = 0;
+        bool exponent_digits = false;
+        for (; e < end && (unsigned) (*e - '0') <= 9; e++, exponent_digits = true)
+            if (value < 10000) value = value * 10 + (*e - '0');
+        if (exponent_digits) {
+            exponent += negative_exponent ? -value : value;
+            p = e;
+        }
+    }
+    if (any && p == end && digits <= 15 && exponent >= -22 && exponent <= 22) {
+        double d = (double) mantissa;
+        d = (exponent < 0) ? d / powers[-exponent] : d * powers[exponent];
+        return negative ? -d : d;
+    }
+    // Slow path: anything else goes through strtod
+    char buffer[128];
+    if (field.length >= sizeof buffer) return DBL_MAX;
+    memcpy(buffer, field.data, field.length);
+    buffer[field.length] = '\0';
+    char* tail;
+    errno = 0;
+    double d = strtod(buffer, &tail);
+    if (errno == 0 && *tail == '\0' && isfinite(d) != 0 && d < DBL_MAX) return d;
+    return DBL_MAX;
+}
+
+CsvReader* __new_CsvReader_delimiter(FileReader* filereader, char delimiter) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL || delimiter == '"' || delimiter == '\n' || delimiter == '\r'
+        || delimiter == '\0') {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    CsvReader* csv = (CsvReader*) cprime_calloc(1, sizeof (CsvReader));
+    char* buffer = (char*) cprime_malloc(CSV_BLOCK_SIZE + __CSV_PADDING);
+    if (csv == NULL || buffer == NULL) {
+        cprime_free(csv);
+        cprime_free(buffer);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    memset(buffer, 0, __CSV_PADDING);
+    csv->reader = filereader;
+    csv->delimiter = delimiter;
+    csv->buffer = buffer;
+    csv->capacity = CSV_BLOCK_SIZE;
+    csv->block = SIZE_MAX;
+    csv->classify = __csv_classify_scalar;
+#if defined(CPRIME_SSE2)
+    csv->classify = __cpu_has_avx2() ? __csv_classify_avx2 : __csv_classify_sse2;
+#elif defined(CPRIME_NEON)
+    csv->classify = __csv_classify_neon;
+#endif
+    return csv;
+}
+
+void delete_CsvReader(CsvReader* csv) {
+    __NO_ASYNC_THROW();
+    if (csv != NULL) {
+        cprime_free(csv->buffer);
+        cprime_free(csv->fields);
+        cprime_free(csv->projection);
+        cprime_free(csv);
+    }
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* JSON */
+
+/*
+ * Streaming JSON writer on top of a FileWriter: values go straight into a reusable buffer that is written out
+ * when full (no DOM, no per-value fprintf). Every top-level value ends with a line break, so a sequence of
+ * compact top-level objects is NDJSON. String escaping scans 16/32 bytes at a time for characters that need it
+ * and copies clean runs with memcpy. Doubles use the shortest decimal of at most 17 digits that reads back to
+ * the same value when it has a simple fixed-point form, and "%.17g" otherwise; NaN and infinities become null.
+ */
+
+#ifndef JSON_BUFFER_SIZE
+    #define JSON_BUFFER_SIZE (1 << 16)
+#endif
+
+/* Maximum nesting of objects and arrays */
+#define JSON_MAX_DEPTH (64)
+
+typedef struct JsonWriter JsonWriter;
+struct JsonWriter {
+    FileWriter* writer;
+    char* buffer;
+    size_t size;
+    bool pretty;
+    bool key;                                   /* A key was written and its value is pending */
+    int depth;
+    unsigned char scopes[JSON_MAX_DEPTH];       /* Per level: 1 = object, 2 = has items */
+};
+
+/**
+ * @brief Write the buffered output to the file writer
+ * @param json The JSON writer
+ * @memberof JsonWriter
+ */
+void JsonWriter_flush(JsonWriter* json);
+
+/**
+ * @brief Start an object (as a value, an array item, or after a key)
+ * @param json The JSON writer
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected or the nesting is deeper than JSON_MAX_DEPTH
+ * @memberof JsonWriter
+ */
+void JsonWriter_beginObject(JsonWriter* json);
+
+/**
+ * @brief Start an array (as a value, an array item, or after a key)
+ * @param json The JSON writer
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected or the nesting is deeper than JSON_MAX_DEPTH
+ * @memberof JsonWriter
+ */
+void JsonWriter_beginArray(JsonWriter* json);
+
+/**
+ * @brief End the current object
+ * @param json The JSON writer
+ * @throw `INVALID_STATE_EXCEPTION` if the current scope is not an object or a key has no value
+ * @memberof JsonWriter
+ */
+void JsonWriter_endObject(JsonWriter* json);
+
+/**
+ * @brief End the current array
+ * @param json The JSON writer
+ * @throw `INVALID_STATE_EXCEPTION` if the current scope is not an array
+ * @memberof JsonWriter
+ */
+void JsonWriter_endArray(JsonWriter* json);
+
+/**
+ * @brief Write an object key; the next value belongs to it
+ * @param json The JSON writer
+ * @param key The key (escaped as needed)
+ * @throw `INVALID_STATE_EXCEPTION` if the current scope is not an object or a key is already pending
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeKey(JsonWriter* json, const char* key);
+
+/**
+ * @brief Write a string value (NULL writes null)
+ * @param json The JSON writer
+ * @param s The string (escaped as needed)
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeString(JsonWriter* json, const char* s);
+
+/**
+ * @brief Write a string value of known length (it may contain NUL bytes)
+ * @param json The JSON writer
+ * @param s The characters
+ * @param length The number of characters
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeStringLength(JsonWriter* json, const char* s, size_t length);
+
+/**
+ * @brief Write an integer value
+ * @param json The JSON writer
+ * @param n The integer
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeInt(JsonWriter* json, long long n);
+
+/**
+ * @brief Write an unsigned integer value
+ * @param json The JSON writer
+ * @param n The integer
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeUnsigned(JsonWriter* json, unsigned long long n);
+
+/**
+ * @brief Write a number value (NaN and infinities are written as null)
+ * @param json The JSON writer
+ * @param d The number
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeDouble(JsonWriter* json, double d);
+
+/**
+ * @brief Write a boolean value
+ * @param json The JSON writer
+ * @param b The boolean
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeBool(JsonWriter* json, bool b);
+
+/**
+ * @brief Write a null value
+ * @param json The JSON writer
+ * @throw `INVALID_STATE_EXCEPTION` if a key is expected
+ * @memberof JsonWriter
+ */
+void JsonWriter_writeNull(JsonWriter* json);
+
+JsonWriter* __new_JsonWriter_pretty(FileWriter* filewriter, bool pretty);
+
+static inline JsonWriter* __new_JsonWriter(FileWriter* filewriter) { return __new_JsonWriter_pretty(filewriter, false); }
+
+/**
+ * @brief Create a JSON writer over a file writer
+ * @param filewriter The file writer to write to (it stays owned by the caller)
+ * @param pretty [optional] Whether to indent nested values by two spaces (default is false, i.e. compact/NDJSON)
+ * @return The JSON writer
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the file writer is NULL
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @note Close JSON files with `close_FileWriter(fw, false)`, since every top-level value already ends a line
+ * @memberof JsonWriter
+ */
+#define new_JsonWriter(...) GET_MACRO2(__VA_ARGS__, __new_JsonWriter_pretty, __new_JsonWriter)(__VA_ARGS__)
+
+/**
+ * @brief Write the buffered output and free a JSON writer (the underlying file writer is left open)
+ * @param json The JSON writer to free
+ * @memberof JsonWriter
+ */
+void delete_JsonWriter(JsonWriter* json);
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Write the buffered output to the file */
+static void __JsonWriter_drain(JsonWriter* json) {
+    if (json->size > 0 && __FileWriter_writable(json->writer)) __FileWriter_put(json->writer, json->buffer, json->size);
+    json->size = 0;
+}
+
+/* Make room for `n` bytes (n <= JSON_BUFFER_SIZE) */
+static inline char* __JsonWriter_reserve(JsonWriter* json, size_t n) {
+    if (json->size + n > JSON_BUFFER_SIZE) __JsonWriter_drain(json);
+    return json->buffer + json->size;
+}
+
+static inline void __JsonWriter_put(JsonWriter* json, const char* data, size_t n) {
+    while (n > 0) {
+        size_t room = JSON_BUFFER_SIZE - json->size;
+        if (room == 0) {
+            __JsonWriter_drain(json);
+            room = JSON_BUFFER_SIZE;
+        }
+        size_t chunk = (n < room) ? n : room;
+        memcpy(json->buffer + json->size, data, chunk);
+        json->size += chunk;
+        data += chunk;
+        n -= chunk;
+    }
+}
+
+static inline void __JsonWriter_char(JsonWriter* json, char c) {
+    *__JsonWriter_reserve(json, 1) = c;
+    json->size++;
+}
+
+static inline void __JsonWriter_indent(JsonWriter* json) {
+    size_t n = 1 + 2 * (size_t) json->depth;
+    char* out = __JsonWriter_reserve(json, n);
+    out[0] = '\n';
+    memset(out + 1, ' ', n - 1);
+    json->size += n;
+}
+
+/* Emit the separator that comes before a value (or key) at the current level */
+static bool __JsonWriter_before(JsonWriter* json, bool is_key) {
+    if (json->key) {
+        if (is_key) {
+            throw(INVALID_STATE_EXCEPTION);
+            return false;
+        }
+        json->key = false;
+        return true;
+    }
+    if (json->depth == 0) {
+        if (is_key) {
+            throw(INVALID_STATE_EXCEPTION);
+            return false;
+        }
+        return true;
+    }
+    unsigned char* scope = &json->scopes[json->depth - 1];
+    if ((*scope & 1) != is_key) {
+        // Objects need a key before each value, and arrays take no keys
+        throw(INVALID_STATE_EXCEPTION);
+        return false;
+    }
+    if (*scope & 2) __JsonWriter_char(json, ',');
+    *scope |= 2;
+    if (json->pretty) __JsonWriter_indent(json);
+    return true;
+}
+
+/* Finish a value; top-level values end with a line break */
+static inline void __JsonWriter_after(JsonWriter* json) {
+    if (json->depth == 0) __JsonWriter_char(json, '\n');
+}
+
+static inline size_t __json_clean_scalar(const char* s, size_t i, size_t n) {
+    for (; i < n; i++) {
+        unsigned char c = (unsigned char) s[i];
+        if (c < 0x20 || c == '"' || c == '\\') return i;
+    }
+    return n;
+}
+
+/* Length of the prefix of `s` that can be copied without escaping */
+static size_t __json_clean_prefix(const char* s, size_t n) {
+    size_t i = 0;
+#if defined(CPRIME_SSE2)
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), control = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                   _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) return i + (size_t) __builtin_ctz((unsigned) mask);
+    }
+#elif defined(CPRIME_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"'), backslash = vdupq_n_u8('\\'), control = vdupq_n_u8(0x20);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*) s + i);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)), vcltq_u8(v, control));
+        if (vmaxvq_u8(hit) != 0) break;
+    }
+#endif
+    return __json_clean_scalar(s, i, n);
+}
+
+#if defined(CPRIME_SSE2)
+__attribute__((target("avx2")))
+static size_t __json_clean_prefix_avx2(const char* s, size_t n) {
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (s + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                      _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(hit);
+        if (mask != 0) return i + (size_t) __builtin_ctz(mask);
+    }
+    // The tail stays in this function: calling SSE code with dirty upper AVX state stalls
+    return __json_clean_scalar(s, i, n);
+}
+#endif
+
+static void __JsonWriter_quoted(JsonWriter* json, const char* s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+#if defined(CPRIME_SSE2)
+    size_t (*clean_prefix)(const char*, size_t) = __cpu_has_avx2() ? __json_clean_prefix_avx2 : __json_clean_prefix;
+#else
+    size_t (*clean_prefix)(const char*, size_t) = __json_clean_prefix;
+#endif
+    __JsonWriter_char(json, '"');
+    while (n > 0) {
+        size_t clean = clean_prefix(s, n);
+        __JsonWriter_put(json, s, clean);
+        if (clean == n) break;
+        unsigned char c = (unsigned char) s[clean];
+        char* out = __JsonWriter_reserve(json, 6);
+        out[0] = '\\';
+        switch (c) {
+            case '"':  out[1] = '"';  json->size += 2; break;
+            case '\\': out[1] = '\\'; json->size += 2; break;
+            case '\n': out[1] = 'n';  json->size += 2; break;
+            case '\r': out[1] = 'r';  json->size += 2; break;
+            case '\t': out[1] = 't';  json->size += 2; break;
+            case '\b': out[1] = 'b';  json->size += 2; break;
+            case '\f': out[1] = 'f';  json->size += 2; break;
+            default:
+                memcpy(out + 1, "u00", 3);
+                out[4] = hex[c >> 4];
+                out[5] = hex[c & 15];
+                json->size += 6;
+        }
+        s += clean + 1;
+        n -= clean + 1;
+    }
+    __JsonWriter_char(json, '"');
+}
+
+/* Format a double as JSON; returns the number of characters (at most 32) */
+static size_t __format_json_double(double d, char* out) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    if (isfinite(d) == 0) {
+        memcpy(out, "null", 4);
+        return 4;
+    }
+    size_t n = 0;
+    double magnitude = d;
+    if (signbit(d)) {
+        out[n++] = '-';
+        magnitude = -d;
+    }
+    // Fewest fractional digits k such that mantissa / 10^k is exactly `magnitude` (mantissa below 2^53)
+    if (magnitude < 9007199254740992.0) {
+        for (int k = 0; k <= 17; k++) {
+            double scaled = magnitude * powers[k];
+            if (scaled >= 9007199254740992.0) break;
+            uint64_t mantissa = (uint64_t) (scaled + 0.5);
+            if ((double) mantissa / powers[k] != magnitude) continue;
+            char digits[24];
+            size_t length = __format_uint64(mantissa, digits);
+            if (k == 0) {
+                memcpy(out + n, digits, length);
+                return n + length;
+            }
+            if (length <= (size_t) k) {
+                // 0.000ddd
+                out[n++] = '0';
+                out[n++] = '.';
+                memset(out + n, '0', (size_t) k - length);
+                n += (size_t) k - length;
+                memcpy(out + n, digits, length);
+                return n + length;
+            }
+            memcpy(out + n, digits, length - (size_t) k);
+            n += length - (size_t) k;
+            out[n++] = '.';
+            memcpy(out + n, digits + length - k, (size_t) k);
+            return n + (size_t) k;
+        }
+    }
+    // Otherwise the fewest significant digits that read back exactly
+    for (int precision = 15; precision < 17; precision++) {
+        int length = snprintf(out + n, 32 - n, "%.*g", precision, magnitude);
+        if (strtod(out + n, NULL) == magnitude) return n + (size_t) length;
+    }
+    return n + (size_t) snprintf(out + n, 32 - n, "%.17g", magnitude);
+}
+
+void JsonWriter_flush(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json == NULL) return;
+    __JsonWriter_drain(json);
+    if (json->writer->file != NULL) fflush(json->writer->file);
+}
+
+void JsonWriter_beginObject(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    if (json->depth == JSON_MAX_DEPTH) {
+        throw(INVALID_STATE_EXCEPTION);
+        return;
+    }
+    __JsonWriter_char(json, '{');
+    json->scopes[json->depth++] = 1;
+}
+
+void JsonWriter_beginArray(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    if (json->depth == JSON_MAX_DEPTH) {
+        throw(INVALID_STATE_EXCEPTION);
+        return;
+    }
+    __JsonWriter_char(json, '[');
+    json->scopes[json->depth++] = 0;
+}
+
+static void __JsonWriter_end(JsonWriter* json, bool object) {
+    if (json->depth == 0 || json->key || (json->scopes[json->depth - 1] & 1) != object) {
+        throw(INVALID_STATE_EXCEPTION);
+        return;
+    }
+    bool items = (json->scopes[--json->depth] & 2) != 0;
+    if (json->pretty && items) __JsonWriter_indent(json);
+    __JsonWriter_char(json, object ? '}' : ']');
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_endObject(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json != NULL) __JsonWriter_end(json, true);
+}
+
+void JsonWriter_endArray(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json != NULL) __JsonWriter_end(json, false);
+}
+
+void JsonWriter_writeKey(JsonWriter* json, const char* key) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || key == NULL || !__JsonWriter_before(json, true)) return;
+    __JsonWriter_quoted(json, key, strlen(key));
+    char* out = __JsonWriter_reserve(json, 2);
+    *out = ':';
+    if (json->pretty) out[1] = ' ';
+    json->size += json->pretty ? 2 : 1;
+    json->key = true;
+}
+
+void JsonWriter_writeString(JsonWriter* json, const char* s) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    if (s == NULL) __JsonWriter_put(json, "null", 4);
+    else __JsonWriter_quoted(json, s, strlen(s));
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_writeStringLength(JsonWriter* json, const char* s, size_t length) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    __JsonWriter_quoted(json, s, length);
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_writeInt(JsonWriter* json, long long n) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    char* out = __JsonWriter_reserve(json, 21);
+    size_t length = 0;
+    if (n < 0) out[length++] = '-';
+    length += __format_uint64((n < 0) ? 0 - (uint64_t) n : (uint64_t) n, out + length);
+    json->size += length;
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_writeUnsigned(JsonWriter* json, unsigned long long n) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    char* out = __JsonWriter_reserve(json, 20);
+    json->size += __format_uint64(n, out);
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_writeDouble(JsonWriter* json, double d) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    char* out = __JsonWriter_reserve(json, 32);
+    json->size += __format_json_double(d, out);
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_writeBool(JsonWriter* json, bool b) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    if (b) __JsonWriter_put(json, "true", 4);
+    else __JsonWriter_put(json, "false", 5);
+    __JsonWriter_after(json);
+}
+
+void JsonWriter_writeNull(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json == NULL || !__JsonWriter_before(json, false)) return;
+    __JsonWriter_put(json, "null", 4);
+    __JsonWriter_after(json);
+}
+
+JsonWriter* __new_JsonWriter_pretty(FileWriter* filewriter, bool pretty) {
+    PROFILE_FUNC();
+    __NO_ASYNC_THROW();
+    if (!__FileWriter_writable(filewriter)) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
+        return NULL;
+    }
+    JsonWriter* json = (JsonWriter*) cprime_calloc(1, sizeof (JsonWriter));
+    char* buffer = (char*) cprime_malloc(JSON_BUFFER_SIZE);
+    if (json == NULL || buffer == NULL) {
+        cprime_free(json);
+        cprime_free(buffer);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
+        return NULL;
+    }
+    json->writer = filewriter;
+    json->buffer = buffer;
+    json->pretty = pretty;
+    return json;
+}
+
+void delete_JsonWriter(JsonWriter* json) {
+    __NO_ASYNC_THROW();
+    if (json != NULL) {
+        __JsonWriter_drain(json);
+        cprime_free(json->buffer);
+        cprime_free(json);
+    }
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* String functions */
+#define printfn(...) printf(__VA_ARGS__), putchar('\n')
+
+/**
+ * @brief Get a substring of a string from the starting index to the ending index
+ * @param str The string to get the substring from
+ * @param start The starting index of the substring
+ * @param end The ending index of the substring
+ * @return The substring of the string or NULL
+ * @throw `OUT_OF_BOUNDS_EXCEPTION` if the starting index is out of bounds
+ * @note The caller owns the returned string (release it with `cprime_free`)
+ */
+string substr_end(string str, int start, int end);
+
+/**
+ * @brief Get a substring of a string from the starting index to the end of the string
+ * @param str The string to get the substring from
+ * @param start The starting index of the substring
+ * @return The substring of the string or NULL
+ * @throw `OUT_OF_BOUNDS_EXCEPTION` if the starting index is out of bounds
+ */
+string substr_len(string str, int start);
+
+/**
+ * @brief Get a substring of a string
+ * @param str The string to get the substring from
+ * @param start The starting index of the substring
+ * @param end [optional] The ending index of the substring (default is end of string)
+ * @return The substring of the string or NULL
+ */
+#define substr(...) GET_MACRO3(__VA_ARGS__, substr_end, substr_len)(__VA_ARGS__)
+
+/**
+ * @brief Find the index of a substring in a string
+ * @param str The string to search
+ * @param substr The substring to find
+ * @return The index of the substring in the string, or -1 if not found
+ */
+static inline int strindex(string str, string substr) {
+    if (str == NULL || substr == NULL) return -1;
+    string found = strstr(str, substr);
+    if (found == NULL) return -1;
+    return found - str;
+}
+
+/**
+ * @brief Find the index of a character in a string
+ * @param str The string to search
+ * @param c The character to find
+ * @return The index of the character in the string, or -1 if not found
+ */
+static inline int strindex_char(string str, char c) {
+    if (str == NULL) return -1;
+    string found = strchr(str, c);
+    if (found == NULL) return -1;
+    return found - str;
+}
+
+/**
+ * @brief Convert a string to uppercase
+ * @param str The string to convert to uppercase
+ * @return The uppercase string
+ * @note The caller owns the returned string (release it with `cprime_free`)
+ */
+string strtoupper(string str);
+
+/**
+ * @brief Convert a string to lowercase
+ * @param str The string to convert to lowercase
+ * @return The lowercase string or NULL
+ * @note The caller owns the returned string (release it with `cprime_free`)
+ */
+string strtolower(string str);
+
+#ifdef CPRIME_IMPLEMENTATION
+string substr_end(string str, int start, int end) {
+    if (str == NULL) return NULL;
+    int len = strlen(str);
+    if (start < 0 || start >= len || end < 0 || end > len) throw(OUT_OF_BOUNDS_EXCEPTION);
+    if (start >= end) return NULL;
+    string sub = (string) cprime_malloc(end - start + 1);
+    if (sub == NULL) return NULL;
+    strncpy(sub, str + start, end - start);
+    sub[end - start] = '\0';
+    return sub;
+}
+
+string substr_len(string str, int start) {
+    if (str == NULL) return NULL;
+    int len = strlen(str);
+    return substr_end(str, start, len);
+}
+
+string strtoupper(string str) {
+    if (str == NULL) return NULL;
+    int len = strlen(str);
+    string upper = (string) cprime_malloc(len + 1);
+    if (upper == NULL) return NULL;
+    for (int i = 0; i < len; i++)
+        upper[i] = toupper(str[i]);
+    upper[len] = '\0';
+    return upper;
+}
+
+string strtolower(string str) {
+    if (str == NULL) return NULL;
+    int len = strlen(str);
+    string lower = (string) cprime_malloc(len + 1);
+    if (lower == NULL) return NULL;
+    for (int i = 0; i < len; i++)
+        lower[i] = tolower(str[i]);
+    lower[len] = '\0';
+    return lower;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Decision structure macros */
+
+/* @return The number of items in an array (does not work for array pointers) */
+#define arrlen(array) (sizeof(array) / sizeof(array[0]))
+#define __foreach_3(type, var, arr) \
+    for (type* var = (arr); var < (arr) + arrlen(arr); ++var)
+#define __foreach_4(type, var, arr, len) \
+    for (type* var = (arr); var < (arr) + (len); ++var)
+
+/**
+ * @brief Foreach loop macro with implicit or explicit length
+ * @param ... Arguments for the foreach loop (type, variable, array, length [optional; required for manually allocated arrays])
+ */
+#define foreach(...) GET_MACRO4(__VA_ARGS__, __foreach_4, __foreach_3)(__VA_ARGS__)
+
+#define __fori_2(var, stop) \
+    for (int var = 0; var < (stop); ++var)
+#define __fori_3(var, start, stop) \
+    for (int var = (start); var < (stop); ++var)
+#define __fori_4(var, start, stop, step) \
+    for (int var = (start); ((step) > 0) ? (var < (stop)) : (var > (stop)); var += (step))
+
+/**
+ * @brief For loop macro with implicit or explicit start, stop, and step
+ * @param ... Arguments for the for loop (loop variable, start=0, stop, step=1)
+ *
+ * @code 
+ * fori (i, 0, 10, 2) { printf("%d ", i); }  // 0 2 4 6 8
+ * @endcode
+ */
+#define fori(...) GET_MACRO4(__VA_ARGS__, __fori_4, __fori_3, __fori_2)(__VA_ARGS__)
+
+/**
+ * @brief Until loop macro with a condition (equivalent to `while (!cond)`)
+ * @param cond The condition to check
+ * 
+ * @code
+ * do { ... } until (cond);
+ * @endcode
+ * @code
+ * until (cond) { ... }
+ * @endcode
+ */
+#define until(cond) while(!(cond))
+
+
+/**
+ * @brief Unless clause macro (equivalent to `if (!cond)`)
+ * @param cond The condition to check
+ * 
+ * @code
+ * unless (cond) { ... }
+ * @endcode
+ */
+#define unless(cond) if(!(cond))
+
+
+/**
+ * @brief Repeat loop macro with a count (equivalent to `for (int _i = 0; _i < count; ++_i)`)
+ * @param count The number of times to repeat
+ * 
+ * @code
+ * repeat (5) { printf("%d ", _i); }  // 0 1 2 3 4
+ * @endcode
+ */
+#define repeat(count) for (int _i = 0; _i < (count); ++_i)
+
+
+
+
+/* Utility function macros */
+
+/* TODO: documentation and tests */
+#define swap(x, y) do { typeof(x) temp = (x); (x) = (y); (y) = temp; } while(0)
+
+#define concat(x, y) x ## y
+#define temp_var(n) concat(temp_var_, n)
+
+/* Each argument is evaluated once; arr_min and arr_max reduce whole arrays */
+#define min(a, b) ({ __typeof__(a) __min_a = (a); __typeof__(b) __min_b = (b); __min_a < __min_b ? __min_a : __min_b; })
+#define max(a, b) ({ __typeof__(a) __max_a = (a); __typeof__(b) __max_b = (b); __max_a > __max_b ? __max_a : __max_b; })
+
+#define is_null(ptr) ((ptr) == NULL)
+#define not_null(ptr) ((ptr) != NULL)
+
+#define tostring(x) #x
+#define tostr(x) tostring(x)
+
+#define defer(func) __attribute__((__cleanup__(func)))
+
+#define and_not(a, b) ((a) & ~(b))
+#define set_bit(var, pos) ((var) |= (1U << (pos)))
+#define clear_bit(var, pos) ((var) &= ~(1U << (pos)))
+#define toggle_bit(var, pos) ((var) ^= (1U << (pos)))
+#define check_bit(var, pos) (((var) & (1U << (pos))) ? 1 : 0)
+
+/* Fill `count` elements of `width` bytes from the first, doubling the filled prefix with each memcpy */
+static inline void __array_fill(void* arr, size_t width, size_t count, const void* value) {
+    if (count == 0) return;
+    memcpy(arr, value, width);
+    for (size_t filled = 1; filled < count; ) {
+        size_t copy = (filled < count - filled) ? filled : count - filled;
+        memcpy((char*) arr + filled * width, arr, copy * width);
+        filled += copy;
+    }
+}
+
+/* Set every element of a fixed-size array of any type to `value` (evaluated once); arr_fill also takes a length */
+#define array_init(arr, value) \
+    do { \
+        __typeof__((arr)[0]) __array_value = (value); \
+        __array_fill((arr), sizeof (arr)[0], arrlen(arr), &__array_value); \
+    } while (0)
+
+/* States of an enum's reverse lookup, built on first use */
+enum { __ENUM_UNBUILT, __ENUM_BUILDING, __ENUM_READY, __ENUM_FAILED };
+
+static inline uint64_t __enum_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+
+/* Slot of a name with `hash` whose bucket was given `displacement` */
+static inline size_t __enum_slot(uint64_t hash, uint32_t displacement, size_t slot_count) {
+    return (size_t) (((__enum_mix(hash + displacement * 0x9e3779b97f4a7c15ull) >> 32) * slot_count) >> 32);
+}
+
+/* Bucket of a name with `hash` (multiply-shift rather than a division) */
+static inline size_t __enum_bucket(uint64_t hash, size_t bucket_count) {
+    return (size_t) (((hash >> 32) * bucket_count) >> 32);
+}
+
+bool __enum_build(const char* const* names, const size_t* lengths, size_t count, uint32_t* slots,
+                  size_t slot_count, uint32_t* displacements, size_t bucket_count);
+
+/* Value of the name `s` (`length` bytes), or `count` if there is none; builds the perfect hash on first use */
+static inline size_t __enum_lookup(const char* const* names, const size_t* lengths, size_t count, uint32_t* slots,
+                                   size_t slot_count, uint32_t* displacements, size_t bucket_count,
+                                   atomic_int* state, const char* s, size_t length) {
+    int now = atomic_load_explicit(state, memory_order_acquire);
+    if (now == __ENUM_UNBUILT) {
+        int expected = __ENUM_UNBUILT;
+        if (atomic_compare_exchange_strong(state, &expected, __ENUM_BUILDING)) {
+            now = __enum_build(names, lengths, count, slots, slot_count, displacements, bucket_count)
+                ? __ENUM_READY : __ENUM_FAILED;
+            atomic_store_explicit(state, now, memory_order_release);
+        }
+    }
+    if (s == NULL) return count;
+    if (now == __ENUM_READY) {
+        uint64_t hash = hash_bytes_seed(s, length, 0);
+        uint32_t value = slots[__enum_slot(hash, displacements[__enum_bucket(hash, bucket_count)], slot_count)];
+        if (value != 0 && lengths[value - 1] == length && memcmp(names[value - 1], s, length) == 0)
+            return value - 1;
+        return count;
+    }
+    // Another thread is still building the hash (or building failed): scan
+    for (size_t i = 0; i < count; i++)
+        if (lengths[i] == length && memcmp(names[i], s, length) == 0) return i;
+    return count;
+}
+
+#define __ENUM_MEMBER(member) member,
+#define __ENUM_NAME(member) #member,
+#define __ENUM_LENGTH(member) sizeof #member - 1,
+
+/**
+ * @brief Define an enum from an X-macro list, with a table of its names and a reverse lookup by perfect hash
+ * @param name The enum is `name##_t`, with members numbered from 0 and `name##_COUNT` after the last one
+ * @param LIST A macro taking a macro `X` and applying it to each member: `#define COLORS(X) X(RED) X(GREEN)`
+ * @note Defines, at file scope, `name##_str` (the names, indexed by value), `name##_name(value)` (NULL when out of
+ *       range), and `name##_from_str(str)` / `name##_from_strn(str, length)` (`name##_COUNT` when unknown). The
+ *       perfect hash is built on the first lookup; after that a lookup is one hash and one comparison
+ * 
+ * ```
+ * #define COLORS(X) X(RED) X(GREEN) X(BLUE)
+ * enum_to_str(Color, COLORS)
+ * ...
+ * Color_t color = enum_from_str(Color, "GREEN");
+ * printf("%s\n", enum_get_name(Color, color));
+ * ```
+ */
+#define enum_to_str(name, LIST) \
+    typedef enum { LIST(__ENUM_MEMBER) name##_COUNT } name##_t; \
+    static const char* const name##_str[] = { LIST(__ENUM_NAME) }; \
+    static const size_t name##__lengths[] = { LIST(__ENUM_LENGTH) }; \
+    static uint32_t name##__slots[2 * name##_COUNT + 1]; \
+    static uint32_t name##__displacements[name##_COUNT / 2 + 1]; \
+    static atomic_int name##__state; \
+    static inline name##_t name##_from_strn(const char* str, size_t length) { \
+        return (name##_t) __enum_lookup(name##_str, name##__lengths, name##_COUNT, name##__slots, \
+                                        2 * name##_COUNT + 1, name##__displacements, name##_COUNT / 2 + 1, \
+                                        &name##__state, str, length); \
+    } \
+    static inline name##_t name##_from_str(const char* str) { \
+        return name##_from_strn(str, (str != NULL) ? strlen(str) : 0); \
+    } \
+    static inline const char* name##_name(name##_t value) { \
+        return ((size_t) value < name##_COUNT) ? name##_str[value] : NULL; \
+    }
+
+/* Name of an enum value defined with `enum_to_str`, or NULL if out of range */
+#define enum_get_name(name, val) name##_name(val)
+
+/* Value of an enum defined with `enum_to_str` by name, or `name##_COUNT` if unknown */
+#define enum_from_str(name, str) name##_from_str(str)
+
+#ifdef CPRIME_IMPLEMENTATION
+/*
+ * Build a perfect hash of `names` by hash and displace: names fall into buckets by hash, and the buckets, largest
+ * first, each get the smallest displacement that sends all of their names to free slots. `slots` receives
+ * value + 1 per slot (0 when free). False if memory runs out or a bucket cannot be placed.
+ */
+bool __enum_build(const char* const* names, const size_t* lengths, size_t count, uint32_t* slots,
+                  size_t slot_count, uint32_t* displacements, size_t bucket_count) {
+    __NO_ASYNC_THROW();
+    uint64_t* hashes = (uint64_t*) cprime_malloc(count * sizeof (uint64_t));
+    size_t* order = (size_t*) cprime_malloc(count * sizeof (size_t));
+    size_t* placed = (size_t*) cprime_malloc(count * sizeof (size_t));
+    size_t* start = (size_t*) cprime_calloc(bucket_count + 2, sizeof (size_t));
+    bool ok = hashes != NULL && order != NULL && placed != NULL && start != NULL;
+    size_t largest = 0;
+    if (ok) {
+        // Group the names by bucket: bucket b holds order[start[b]..start[b + 1])
+        for (size_t i = 0; i < count; i++) {
+            hashes[i] = hash_bytes_seed(names[i], lengths[i], 0);
+            start[__enum_bucket(hashes[i], bucket_count) + 2]++;
+        }
+        for (size_t b = 0; b < bucket_count; b++) start[b + 2] += start[b + 1];
+        for (size_t i = 0; i < count; i++) order[start[__enum_bucket(hashes[i], bucket_count) + 1]++] = i;
+        for (size_t b = 0; b < bucket_count; b++)
+            if (start[b + 1] - start[b] > largest) largest = start[b + 1] - start[b];
+    }
+    for (size_t size = largest; ok && size > 0; size--) {
+        for (size_t b = 0; ok && b < bucket_count; b++) {
+            size_t begin = start[b];
+            if (start[b + 1] - begin != size) continue;
+            bool fits = false;
+            for (uint32_t d = 0; !fits && d < (1u << 20); d++) {
+                fits = true;
+                for (size_t k = 0; fits && k < size; k++) {
+                    placed[k] = __enum_slot(hashes[order[begin + k]], d, slot_count);
+                    fits = slots[placed[k]] == 0;
+                    for (size_t q = 0; fits && q < k; q++) fits = placed[q] != placed[k];
+                }
+                if (fits) {
+                    for (size_t k = 0; k < size; k++) slots[placed[k]] = (uint32_t) order[begin + k] + 1;
+                    displacements[b] = d;
+                }
+            }
+            ok = fits;
+        }
+    }
+    cprime_free(hashes);
+    cprime_free(order);
+    cprime_free(placed);
+    cprime_free(start);
+    return ok;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+
+
+/* Sorting */
+
+/*
+ * Comparison sorts are generated per element type by SORT_DEFINE, so comparisons are inlined rather than made
+ * through a function pointer as with qsort: introsort (median-of-3 quicksort that switches to heapsort past
+ * 2 log2(n) levels, with insertion sort below 16 elements). `sort` picks the instance for a built-in type with
+ * _Generic, and strings get a multikey quicksort that never compares a shared prefix twice. Integers and floats
+ * also have a stable LSD radix sort, and every type has a parallel sort that sorts one slice per thread and then
+ * merges the slices with all threads, splitting each merge by co-ranking.
+ */
+
+/* Partitions at most this long are finished with insertion sort */
+#define __SORT_INSERTION 16
+
+/* Fewest elements per thread for a parallel sort */
+#define __SORT_PARALLEL_GRAIN (1u << 14)
+
+typedef void (*__SortErased)(void* data, size_t n);
+typedef void (*__MergeErased)(const void* x, size_t nx, const void* y, size_t ny, void* out);
+typedef bool (*__LessErased)(const void* a, const void* b);
+
+#if defined(__unix__) || defined(__APPLE__)
+/* One slice to sort, or one piece of a merge (a copy when `ny` is 0) */
+typedef struct __PsortJob __PsortJob;
+struct __PsortJob {
+    __SortErased sort;
+    __MergeErased merge;
+    const char* x;
+    size_t nx;
+    const char* y;
+    size_t ny;
+    char* out;
+};
+#endif
+
+void __parallel_sort(void* data, size_t n, size_t width, int threads, __SortErased sort, __MergeErased merge,
+                     __LessErased less);
+
+/**
+ * @brief Define an introsort for arrays of `type`, ordered by `less`
+ * @param name The name of the sort function, `void name(type* arr, size_t n)`; a parallel version,
+ *        `void name##_parallel(type* arr, size_t n, int threads)` (0 threads uses every core), is defined too
+ * @param type The element type
+ * @param less A function or function-like macro taking two elements by value, true if the first sorts before the
+ *        second; it must be a strict weak order
+ * @note The sort is not stable
+ * 
+ * ```
+ * #define by_age(a, b) ((a).age < (b).age)
+ * SORT_DEFINE(sort_people, Person, by_age)
+ * ...
+ * sort_people(people, count);
+ * ```
+ */
+#define SORT_DEFINE(name, type, less) \
+    static inline void name##__insertion(type* a, size_t n) { \
+        for (size_t i = 1; i < n; i++) { \
+            type item = a[i]; \
+            size_t j = i; \
+            for (; j > 0 && less(item, a[j - 1]); j--) a[j] = a[j - 1]; \
+            a[j] = item; \
+        } \
+    } \
+    static inline void name##__sift(type* a, size_t root, size_t n) { \
+        type item = a[root]; \
+        size_t child; \
+        while ((child = 2 * root + 1) < n) { \
+            if (child + 1 < n && less(a[child], a[child + 1])) child++; \
+            if (!less(item, a[child])) break; \
+            a[root] = a[child]; \
+            root = child; \
+        } \
+        a[root] = item; \
+    } \
+    static inline void name##__introsort(type* a, size_t n, int budget) { \
+        while (n > __SORT_INSERTION) { \
+            if (budget-- == 0) { \
+                for (size_t i = n / 2; i-- > 0;) name##__sift(a, i, n); \
+                for (size_t end = n; end-- > 1;) { \
+                    type top = a[0]; \
+                    a[0] = a[end]; \
+                    a[end] = top; \
+                    name##__sift(a, 0, end); \
+                } \
+                return; \
+            } \
+            /* Order the first, middle and last elements; they bound the scans below */ \
+            type* first = a; \
+            type* middle = a + n / 2; \
+            type* last = a + n - 1; \
+            type t; \
+            if (less(*middle, *first)) { t = *middle; *middle = *first; *first = t; } \
+            if (less(*last, *middle)) { \
+                t = *last; *last = *middle; *middle = t; \
+                if (less(*middle, *first)) { t = *middle; *middle = *first; *first = t; } \
+            } \
+            type pivot = *middle; \
+            size_t i = 0, j = n - 1; \
+            while (true) { \
+                do i++; while (less(a[i], pivot)); \
+                do j--; while (less(pivot, a[j])); \
+                if (i >= j) break; \
+                t = a[i]; a[i] = a[j]; a[j] = t; \
+            } \
+            /* Recurse into the smaller side and loop on the larger, so the stack stays logarithmic */ \
+            if (i < n - i) { \
+                name##__introsort(a, i, budget); \
+                a += i; \
+                n -= i; \
+            } else { \
+                name##__introsort(a + i, n - i, budget); \
+                n = i; \
+            } \
+        } \
+        name##__insertion(a, n); \
+    } \
+    static inline void name(type* a, size_t n) { \
+        if (a != NULL && n > 1) name##__introsort(a, n, 2 * (63 - __builtin_clzll((unsigned long long) n))); \
+    } \
+    static inline void name##__merge(const type* x, size_t nx, const type* y, size_t ny, type* out) { \
+        size_t i = 0, j = 0, k = 0; \
+        while (i < nx && j < ny) out[k++] = less(y[j], x[i]) ? y[j++] : x[i++]; \
+        while (i < nx) out[k++] = x[i++]; \
+        while (j < ny) out[k++] = y[j++]; \
+    } \
+    static inline void name##__erased(void* a, size_t n) { name((type*) a, n); } \
+    static inline void name##__erased_merge(const void* x, size_t nx, const void* y, size_t ny, void* out) { \
+        name##__merge((const type*) x, nx, (const type*) y, ny, (type*) out); \
+    } \
+    static inline bool name##__erased_less(const void* x, const void* y) { \
+        return less(*(const type*) x, *(const type*) y); \
+    } \
+    static inline void name##_parallel(type* a, size_t n, int threads) { \
+        if (a != NULL && n > 1) \
+            __parallel_sort(a, n, sizeof (type), threads, name##__erased, name##__erased_merge, name##__erased_less); \
+    }
+
+#define __SORT_LESS(a, b) ((a) < (b))
+/* NaNs sort after every number */
+#define __SORT_FLOAT_LESS(a, b) ((a) < (b) || ((b) != (b) && (a) == (a)))
+#define __SORT_STRING_LESS(a, b) (strcmp((a), (b)) < 0)
+
+SORT_DEFINE(sort_int, int, __SORT_LESS)
+SORT_DEFINE(sort_uint, unsigned int, __SORT_LESS)
+SORT_DEFINE(sort_long, long, __SORT_LESS)
+SORT_DEFINE(sort_ulong, unsigned long, __SORT_LESS)
+SORT_DEFINE(sort_llong, long long, __SORT_LESS)
+SORT_DEFINE(sort_ullong, unsigned long long, __SORT_LESS)
+SORT_DEFINE(sort_float, float, __SORT_FLOAT_LESS)
+SORT_DEFINE(sort_double, double, __SORT_FLOAT_LESS)
+SORT_DEFINE(__introsort_string, string, __SORT_STRING_LESS)
+
+void __mkqs(string* a, size_t n, size_t depth, int budget);
+
+/**
+ * @brief Sort strings in byte order (like `strcmp`) with a multikey quicksort
+ * @param arr The strings (none may be NULL)
+ * @param n The number of strings
+ */
+static inline void sort_string(string* arr, size_t n) {
+    if (arr != NULL && n > 1) __mkqs(arr, n, 0, 2 * (63 - __builtin_clzll((unsigned long long) n)));
+}
+
+static inline void __sort_string_erased(void* a, size_t n) { sort_string((string*) a, n); }
+
+/**
+ * @brief Sort strings in byte order on several threads
+ * @param arr The strings (none may be NULL)
+ * @param n The number of strings
+ * @param threads The number of threads (0 uses every core)
+ */
+static inline void sort_string_parallel(string* arr, size_t n, int threads) {
+    if (arr != NULL && n > 1)
+        __parallel_sort(arr, n, sizeof (string), threads, __sort_string_erased, __introsort_string__erased_merge,
+                        __introsort_string__erased_less);
+}
+
+#ifdef CPRIME_IMPLEMENTATION
+#if defined(__unix__) || defined(__APPLE__)
+static void* __psort_job(void* arg) {
+    __PsortJob* job = (__PsortJob*) arg;
+    if (job->sort != NULL) job->sort(job->out, job->nx);
+    else job->merge(job->x, job->nx, job->y, job->ny, job->out);
+    return NULL;
+}
+
+/* Run up to 64 jobs on their own threads (the caller takes the first, and any that cannot be started) */
+static void __psort_run(__PsortJob* jobs, size_t count) {
+    pthread_t workers[64];
+    bool started[64] = { false };
+    for (size_t i = 1; i < count; i++)
+        started[i] = pthread_create(&workers[i], NULL, __psort_job, &jobs[i]) == 0;
+    for (size_t i = 0; i < count; i++)
+        if (!started[i]) __psort_job(&jobs[i]);
+    for (size_t i = 1; i < count; i++)
+        if (started[i]) pthread_join(workers[i], NULL);
+}
+
+/* How many of the first `k` merged elements come from `x` (ties go to `x`, which keeps merges stable) */
+static size_t __psort_corank(size_t k, const char* x, size_t nx, const char* y, size_t ny, size_t width,
+                             __LessErased less) {
+    size_t lo = (k > ny) ? k - ny : 0, hi = (k < nx) ? k : nx;
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2, j = k - i;
+        if (j > 0 && !less(y + (j - 1) * width, x + i * width)) lo = i + 1;
+        else hi = i;
+    }
+    return lo;
+}
+#endif
+
+/* Sort slices on separate threads, then merge pairs of runs in rounds, every merge split across the threads */
+void __parallel_sort(void* data, size_t n, size_t width, int threads, __SortErased sort, __MergeErased merge,
+                     __LessErased less) {
+    __NO_ASYNC_THROW();
+#if defined(__unix__) || defined(__APPLE__)
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    size_t slices = (threads > 64) ? 64 : (threads > 1) ? (size_t) threads : 1;
+    if (slices > n / __SORT_PARALLEL_GRAIN) slices = n / __SORT_PARALLEL_GRAIN;
+    char* scratch = (slices > 1) ? (char*) cprime_malloc(n * width) : NULL;
+    if (scratch == NULL) {
+        sort(data, n);
+        return;
+    }
+    size_t bounds[65];
+    __PsortJob jobs[64];
+    for (size_t i = 0; i <= slices; i++) bounds[i] = n / slices * i;
+    bounds[slices] = n;
+    for (size_t i = 0; i < slices; i++)
+        jobs[i] = (__PsortJob) { sort, NULL, NULL, bounds[i + 1] - bounds[i], NULL, 0, (char*) data + bounds[i] * width };
+    __psort_run(jobs, slices);
+    char* source = (char*) data;
+    char* target = scratch;
+    for (size_t runs = slices; runs > 1; runs = (runs + 1) / 2) {
+        size_t pairs = runs / 2, pieces = (slices / pairs > 1) ? slices / pairs : 1, count = 0;
+        for (size_t r = 0; r + 1 < runs; r += 2) {
+            const char* x = source + bounds[r] * width;
+            const char* y = source + bounds[r + 1] * width;
+            size_t nx = bounds[r + 1] - bounds[r], ny = bounds[r + 2] - bounds[r + 1];
+            size_t i0 = 0, k0 = 0;
+            for (size_t p = 1; p <= pieces; p++) {
+                size_t k1 = (nx + ny) / pieces * p, i1;
+                if (p == pieces) k1 = nx + ny;
+                i1 = __psort_corank(k1, x, nx, y, ny, width, less);
+                jobs[count++] = (__PsortJob) { NULL, merge, x + i0 * width, i1 - i0, y + (k0 - i0) * width,
+                                               (k1 - i1) - (k0 - i0), target + (bounds[r] + k0) * width };
+                i0 = i1;
+                k0 = k1;
+            }
+        }
+        if (runs % 2 == 1) {
+            size_t r = runs - 1;
+            jobs[count++] = (__PsortJob) { NULL, merge, source + bounds[r] * width, bounds[r + 1] - bounds[r], NULL, 0,
+                                           target + bounds[r] * width };
+        }
+        __psort_run(jobs, count);
+        for (size_t r = 0; 2 * r < runs; r++) bounds[r] = bounds[2 * r];
+        bounds[(runs + 1) / 2] = n;
+        char* swapped = source;
+        source = target;
+        target = swapped;
+    }
+    if (source != (char*) data) memcpy(data, source, n * width);
+    cprime_free(scratch);
+#else
+    (void) width;
+    (void) threads;
+    (void) merge;
+    (void) less;
+    sort(data, n);
+#endif
+}
+
+/* Insertion sort of strings that all share their first `depth` characters */
+static inline void __mkqs_insertion(string* a, size_t n, size_t depth) {
+    for (size_t i = 1; i < n; i++) {
+        string item = a[i];
+        size_t j = i;
+        for (; j > 0 && strcmp(item + depth, a[j - 1] + depth) < 0; j--) a[j] = a[j - 1];
+        a[j] = item;
+    }
+}
+
+static inline int __mkqs_char(string s, size_t depth) { return (unsigned char) s[depth]; }
+
+/* Multikey quicksort (Bentley and Sedgewick) of strings that all share their first `depth` characters */
+void __mkqs(string* a, size_t n, size_t depth, int budget) {
+    while (n > __SORT_INSERTION) {
+        if (budget-- == 0) {
+            // Pivots keep missing: finish with whole-string comparisons
+            __introsort_string(a, n);
+            return;
+        }
+        int x = __mkqs_char(a[0], depth), y = __mkqs_char(a[n / 2], depth), z = __mkqs_char(a[n - 1], depth);
+        int pivot = (x < y) ? ((y < z) ? y : (x < z) ? z : x) : ((x < z) ? x : (y < z) ? z : y);
+        // Three-way partition on the character at `depth`: [0, lt) < pivot, [lt, gt) == pivot, [gt, n) > pivot
+        size_t lt = 0, gt = n, i = 0;
+        while (i < gt) {
+            int c = __mkqs_char(a[i], depth);
+            string t;
+            if (c < pivot) {
+                t = a[lt]; a[lt++] = a[i]; a[i++] = t;
+            } else if (c > pivot) {
+                t = a[--gt]; a[gt] = a[i]; a[i] = t;
+            } else {
+                i++;
+            }
+        }
+        size_t less = lt, equal = (pivot != 0) ? gt - lt : 0, greater = n - gt;
+        // Recurse into the two smaller parts and loop on the largest
+        if (equal >= less && equal >= greater) {
+            __mkqs(a, less, depth, budget);
+            __mkqs(a + gt, greater, depth, budget);
+            a += lt;
+            n = equal;
+            depth++;
+            budget = 2 * (63 - __builtin_clzll((unsigned long long) n | 1));
+        } else {
+            if (equal > 1) __mkqs(a + lt, equal, depth + 1, 2 * (63 - __builtin_clzll((unsigned long long) equal)));
+            if (less >= greater) {
+                __mkqs(a + gt, greater, depth, budget);
+                n = less;
+            } else {
+                __mkqs(a, less, depth, budget);
+                a += gt;
+                n = greater;
+            }
+        }
+    }
+    __mkqs_insertion(a, n, depth);
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+/**
+ * @brief Sort an array of a built-in type in ascending order
+ * @param type The element type: `int`, `unsigned int`, `long`, `unsigned long`, `long long`, `unsigned long long`,
+ *        `float`, `double` or `string` (use `SORT_DEFINE` for other types or orders)
+ * @param arr The array
+ * @param n The number of elements
+ * @note Numbers use introsort with NaNs last; strings use multikey quicksort in byte order. The sort is not stable
+ */
+#define sort(type, arr, n) \
+    _Generic((type*) 0, \
+        int*: sort_int, unsigned int*: sort_uint, long*: sort_long, unsigned long*: sort_ulong, \
+        long long*: sort_llong, unsigned long long*: sort_ullong, float*: sort_float, double*: sort_double, \
+        string*: sort_string)(arr, n)
+
+#define __parallel_sort_threads(type, arr, n, threads) \
+    _Generic((type*) 0, \
+        int*: sort_int_parallel, unsigned int*: sort_uint_parallel, long*: sort_long_parallel, \
+        unsigned long*: sort_ulong_parallel, long long*: sort_llong_parallel, \
+        unsigned long long*: sort_ullong_parallel, float*: sort_float_parallel, double*: sort_double_parallel, \
+        string*: sort_string_parallel)(arr, n, threads)
+#define __parallel_sort_all(type, arr, n) __parallel_sort_threads(type, arr, n, 0)
+
+/**
+ * @brief Sort an array of a built-in type on several threads (see `sort`)
+ * @param type The element type
+ * @param arr The array
+ * @param n The number of elements
+ * @param threads [optional] The number of threads (default is 0, every core)
+ * @note Arrays too small to split, or too large for a scratch copy to be allocated, are sorted on the calling thread
+ */
+#define parallel_sort(...) GET_MACRO4(__VA_ARGS__, __parallel_sort_threads, __parallel_sort_all)(__VA_ARGS__)
+
+/* Radix sorting works on keys mapped to unsigned order in place; the array's own type may differ */
+typedef uint32_t __attribute__((__may_alias__)) __radix_u32;
+typedef uint64_t __attribute__((__may_alias__)) __radix_u64;
+
+/* How keys map to unsigned order */
+enum { __RADIX_UNSIGNED, __RADIX_SIGNED, __RADIX_FLOAT };
+
+/* LSD radix sort with 8-bit digits, skipping digits every key shares; false if scratch memory cannot be had */
+#define __RADIX_DEFINE(bits) \
+    static inline uint##bits##_t __radix_in##bits(uint##bits##_t key, int kind) { \
+        const uint##bits##_t top = (uint##bits##_t) 1 << (bits - 1); \
+        if (kind == __RADIX_SIGNED) return key ^ top; \
+        if (kind == __RADIX_FLOAT) return (key & top) ? ~key : key | top; \
+        return key; \
+    } \
+    static inline uint##bits##_t __radix_out##bits(uint##bits##_t key, int kind) { \
+        const uint##bits##_t top = (uint##bits##_t) 1 << (bits - 1); \
+        if (kind == __RADIX_SIGNED) return key ^ top; \
+        if (kind == __RADIX_FLOAT) return (key & top) ? key & ~top : ~key; \
+        return key; \
+    } \
+    static bool __radix_sort##bits(void* data, size_t n, int kind) { \
+        __radix_u##bits* keys = (__radix_u##bits*) data; \
+        __radix_u##bits* buffer = (__radix_u##bits*) cprime_malloc(n * sizeof (uint##bits##_t)); \
+        if (buffer == NULL) return false; \
+        size_t counts[bits / 8][256] = { { 0 } }; \
+        for (size_t i = 0; i < n; i++) { \
+            uint##bits##_t key = __radix_in##bits(keys[i], kind); \
+            keys[i] = key; \
+            for (int d = 0; d < bits / 8; d++) counts[d][(key >> (8 * d)) & 255]++; \
+        } \
+        __radix_u##bits* source = keys; \
+        __radix_u##bits* target = buffer; \
+        for (int d = 0; d < bits / 8; d++) { \
+            if (counts[d][(source[0] >> (8 * d)) & 255] == n) continue; \
+            size_t offsets[256], total = 0; \
+            for (int b = 0; b < 256; b++) { \
+                offsets[b] = total; \
+                total += counts[d][b]; \
+            } \
+            for (size_t i = 0; i < n; i++) target[offsets[(source[i] >> (8 * d)) & 255]++] = source[i]; \
+            __radix_u##bits* swapped = source; \
+            source = target; \
+            target = swapped; \
+        } \
+        for (size_t i = 0; i < n; i++) keys[i] = __radix_out##bits(source[i], kind); \
+        cprime_free(buffer); \
+        return true; \
+    }
+
+__RADIX_DEFINE(32)
+__RADIX_DEFINE(64)
+
+/* Radix sorting pays off from a few hundred keys */
+#define __RADIX_MIN 256
+
+#define __RADIX_SORT(name, type, kind, fallback) \
+    static inline void name(type* arr, size_t n) { \
+        if (arr == NULL || n < 2) return; \
+        bool sorted = n >= __RADIX_MIN \
+            && ((sizeof (type) == 8) ? __radix_sort64(arr, n, kind) : __radix_sort32(arr, n, kind)); \
+        if (!sorted) fallback(arr, n); \
+    }
+
+__RADIX_SORT(radix_sort_int, int, __RADIX_SIGNED, sort_int)
+__RADIX_SORT(radix_sort_uint, unsigned int, __RADIX_UNSIGNED, sort_uint)
+__RADIX_SORT(radix_sort_long, long, __RADIX_SIGNED, sort_long)
+__RADIX_SORT(radix_sort_ulong, unsigned long, __RADIX_UNSIGNED, sort_ulong)
+__RADIX_SORT(radix_sort_llong, long long, __RADIX_SIGNED, sort_llong)
+__RADIX_SORT(radix_sort_ullong, unsigned long long, __RADIX_UNSIGNED, sort_ullong)
+__RADIX_SORT(radix_sort_float, float, __RADIX_FLOAT, sort_float)
+__RADIX_SORT(radix_sort_double, double, __RADIX_FLOAT, sort_double)
+
+/**
+ * @brief Sort an array of integers or floating-point numbers with a stable LSD radix sort
+ * @param type The element type: `int`, `unsigned int`, `long`, `unsigned long`, `long long`, `unsigned long long`,
+ *        `float` or `double`
+ * @param arr The array
+ * @param n The number of elements
+ * @note Takes a scratch copy of the array (small arrays, or a failed allocation, fall back to `sort`). Floats
+ *       are ordered by IEEE total order: -NaN, -inf, ..., -0, +0, ..., +inf, NaN
+ */
+#define radix_sort(type, arr, n) \
+    _Generic((type*) 0, \
+        int*: radix_sort_int, unsigned int*: radix_sort_uint, long*: radix_sort_long, \
+        unsigned long*: radix_sort_ulong, long long*: radix_sort_llong, unsigned long long*: radix_sort_ullong, \
+        float*: radix_sort_float, double*: radix_sort_double)(arr, n)
+
+
+
+
+/* Array kernels */
+
+/*
+ * Reductions and transforms over arrays of int, long, float, and double. Each kernel is written once with GCC vector
+ * extensions over 32-byte vectors and compiled twice on x86 (SSE2, and AVX2 chosen at runtime) and once elsewhere
+ * (NEON pairs on ARM), so the loops run several lanes wide without intrinsics per type. Floating-point sums and dot
+ * products add blocks of 256 elements across the vector lanes and combine the block totals with Neumaier's
+ * compensated summation, so the rounding error stays that of a 256-element sum however long the array is (unless
+ * -ffast-math reassociates the compensation away). Sums and dot products of int are widened to 64 bits, and integer
+ * arithmetic wraps.
+ */
+
+/* Bytes per vector, and elements per compensated block */
+#define __ARRAY_VECTOR 32
+#define __ARRAY_BLOCK 256
+
+#if defined(CPRIME_SSE2)
+    #define __ARRAY_AVX2 __attribute__((target("avx2")))
+#else
+    #define __ARRAY_AVX2
+#endif
+
+/* Add `x` to the compensated sum `*sum` + `*compensation` */
+static inline void __neumaier_add(double* sum, double* compensation, double x) {
+    double t = *sum + x;
+    if (fabs(*sum) >= fabs(x)) *compensation += (*sum - t) + x;
+    else *compensation += (x - t) + *sum;
+    *sum = t;
+}
+
+/* Blend two vectors lane by lane: `x` where `mask` is set, else `y` */
+#define __ARRAY_SELECT(V, M, mask, x, y) ((V) (((M) (x) & (mask)) | ((M) (y) & ~(mask))))
+
+/* Vector types of `type`: V (the elements), M (lane masks of the same width), U (unsigned lanes), W (wrapping sums) */
+#define __ARRAY_TYPES(name, type, mask_type, unsigned_type, sum_type) \
+    typedef type __##name##_V __attribute__((vector_size(__ARRAY_VECTOR))); \
+    typedef mask_type __##name##_M __attribute__((vector_size(__ARRAY_VECTOR))); \
+    typedef unsigned_type __##name##_U __attribute__((vector_size(__ARRAY_VECTOR))); \
+    typedef sum_type __##name##_W __attribute__((vector_size(__ARRAY_VECTOR / sizeof (type) * sizeof (sum_type))));
+
+/* Smallest (`op` <) or largest (`op` >) element, ignoring NaN; `identity` for an empty array */
+#define __ARRAY_EXTREME(kind, name, type, op, identity, suffix, attributes) \
+    attributes static type __arr_##kind##_##name##suffix(const type* arr, size_t n) { \
+        enum { L = __ARRAY_VECTOR / sizeof (type) }; \
+        __##name##_V m0 = (__##name##_V) {0} + (type) (identity), m1 = m0, x0, x1; \
+        size_t whole = n - n % (2 * L), i = 0; \
+        for (; i < whole; i += 2 * L) { \
+            memcpy(&x0, arr + i, sizeof x0); \
+            memcpy(&x1, arr + i + L, sizeof x1); \
+            __##name##_M k0 = (__##name##_M) (x0 op m0), k1 = (__##name##_M) (x1 op m1); \
+            m0 = __ARRAY_SELECT(__##name##_V, __##name##_M, k0, x0, m0); \
+            m1 = __ARRAY_SELECT(__##name##_V, __##name##_M, k1, x1, m1); \
+        } \
+        type result = (type) (identity); \
+        for (size_t k = 0; k < L; k++) { \
+            if (m0[k] op result) result = m0[k]; \
+            if (m1[k] op result) result = m1[k]; \
+        } \
+        for (; i < n; i++) \
+            if (arr[i] op result) result = arr[i]; \
+        return result; \
+    }
+
+/* Kernels every element type shares: min, max, and fill */
+#define __ARRAY_COMMON_KERNELS(name, type, low, high, suffix, attributes) \
+    __ARRAY_EXTREME(min, name, type, <, high, suffix, attributes) \
+    __ARRAY_EXTREME(max, name, type, >, low, suffix, attributes) \
+    attributes static void __arr_fill_##name##suffix(type* arr, size_t n, type value) { \
+        enum { L = __ARRAY_VECTOR / sizeof (type) }; \
+        __##name##_V v = (__##name##_V) {0} + value; \
+        size_t i = 0; \
+        for (; i + L <= n; i += L) memcpy(arr + i, &v, sizeof v); \
+        for (; i < n; i++) arr[i] = value; \
+    }
+
+/* Compensated sum (of the products with `other`, if not NULL) and scaling for floating-point elements */
+#define __ARRAY_FLOAT_KERNELS(name, type, suffix, attributes) \
+    attributes static double __arr_dot_##name##suffix(const type* arr, const type* other, size_t n) { \
+        enum { L = __ARRAY_VECTOR / sizeof (type) }; \
+        double sum = 0, compensation = 0; \
+        for (size_t i = 0; i < n; ) { \
+            size_t end = (n - i < __ARRAY_BLOCK) ? n : i + __ARRAY_BLOCK; \
+            __##name##_V s0 = {0}, s1 = {0}, s2 = {0}, s3 = {0}, x0, x1, x2, x3, y0, y1, y2, y3; \
+            if (other == NULL) { \
+                for (; i + 4 * L <= end; i += 4 * L) { \
+                    memcpy(&x0, arr + i, sizeof x0); \
+                    memcpy(&x1, arr + i + L, sizeof x1); \
+                    memcpy(&x2, arr + i + 2 * L, sizeof x2); \
+                    memcpy(&x3, arr + i + 3 * L, sizeof x3); \
+                    s0 += x0; \
+                    s1 += x1; \
+                    s2 += x2; \
+                    s3 += x3; \
+                } \
+            } else { \
+                for (; i + 4 * L <= end; i += 4 * L) { \
+                    memcpy(&x0, arr + i, sizeof x0); \
+                    memcpy(&x1, arr + i + L, sizeof x1); \
+                    memcpy(&x2, arr + i + 2 * L, sizeof x2); \
+                    memcpy(&x3, arr + i + 3 * L, sizeof x3); \
+                    memcpy(&y0, other + i, sizeof y0); \
+                    memcpy(&y1, other + i + L, sizeof y1); \
+                    memcpy(&y2, other + i + 2 * L, sizeof y2); \
+                    memcpy(&y3, other + i + 3 * L, sizeof y3); \
+                    s0 += x0 * y0; \
+                    s1 += x1 * y1; \
+                    s2 += x2 * y2; \
+                    s3 += x3 * y3; \
+                } \
+            } \
+            s0 = (s0 + s1) + (s2 + s3); \
+            type block = 0; \
+            for (size_t k = 0; k < L; k++) block += s0[k]; \
+            for (; i < end; i++) block += (other == NULL) ? arr[i] : arr[i] * other[i]; \
+            __neumaier_add(&sum, &compensation, block); \
+        } \
+        return sum + compensation; \
+    } \
+    attributes static void __arr_scale_##name##suffix(type* arr, size_t n, type factor) { \
+        enum { L = __ARRAY_VECTOR / sizeof (type) }; \
+        __##name##_V x; \
+        size_t i = 0; \
+        for (; i + L <= n; i += L) { \
+            memcpy(&x, arr + i, sizeof x); \
+            x *= factor; \
+            memcpy(arr + i, &x, sizeof x); \
+        } \
+        for (; i < n; i++) arr[i] *= factor; \
+    }
+
+/* Wrapping sum (of the products with `other`, if not NULL) in `sum_type` lanes, and scaling for integer elements */
+#define __ARRAY_INT_KERNELS(name, type, unsigned_type, sum_type, suffix, attributes) \
+    attributes static sum_type __arr_dot_##name##suffix(const type* arr, const type* other, size_t n) { \
+        enum { L = __ARRAY_VECTOR / sizeof (type) }; \
+        __##name##_W s0 = {0}, s1 = {0}; \
+        __##name##_V x0, x1, y0, y1; \
+        size_t i = 0; \
+        if (other == NULL) { \
+            for (; i + 2 * L <= n; i += 2 * L) { \
+                memcpy(&x0, arr + i, sizeof x0); \
+                memcpy(&x1, arr + i + L, sizeof x1); \
+                s0 += __builtin_convertvector(x0, __##name##_W); \
+                s1 += __builtin_convertvector(x1, __##name##_W); \
+            } \
+        } else { \
+            for (; i + 2 * L <= n; i += 2 * L) { \
+                memcpy(&x0, arr + i, sizeof x0); \
+                memcpy(&x1, arr + i + L, sizeof x1); \
+                memcpy(&y0, other + i, sizeof y0); \
+                memcpy(&y1, other + i + L, sizeof y1); \
+                s0 += __builtin_convertvector(x0, __##name##_W) * __builtin_convertvector(y0, __##name##_W); \
+                s1 += __builtin_convertvector(x1, __##name##_W) * __builtin_convertvector(y1, __##name##_W); \
+            } \
+        } \
+        s0 += s1; \
+        unsigned long long sum = 0; \
+        for (size_t k = 0; k < L; k++) sum += (unsigned long long) s0[k]; \
+        for (; i < n; i++) \
+            sum += (unsigned long long) arr[i] * ((other == NULL) ? 1 : (unsigned long long) other[i]); \
+        return (sum_type) sum; \
+    } \
+    attributes static void __arr_scale_##name##suffix(type* arr, size_t n, type factor) { \
+        enum { L = __ARRAY_VECTOR / sizeof (type) }; \
+        __##name##_U x; \
+        size_t i = 0; \
+        for (; i + L <= n; i += L) { \
+            memcpy(&x, arr + i, sizeof x); \
+            x *= (unsigned_type) factor; \
+            memcpy(arr + i, &x, sizeof x); \
+        } \
+        for (; i < n; i++) arr[i] = (type) ((unsigned_type) arr[i] * (unsigned_type) factor); \
+    }
+
+/* The public kernels for one element type, calling the AVX2 build when the CPU has it */
+#define __ARRAY_DEFINE(name, type, sum_type) \
+    static inline sum_type arr_sum_##name(const type* arr, size_t n) { \
+        return __cpu_has_avx2() ? __arr_dot_##name##_avx2(arr, NULL, n) : __arr_dot_##name(arr, NULL, n); \
+    } \
+    static inline sum_type arr_dot_##name(const type* arr, const type* other, size_t n) { \
+        return __cpu_has_avx2() ? __arr_dot_##name##_avx2(arr, other, n) : __arr_dot_##name(arr, other, n); \
+    } \
+    static inline type arr_min_##name(const type* arr, size_t n) { \
+        return __cpu_has_avx2() ? __arr_min_##name##_avx2(arr, n) : __arr_min_##name(arr, n); \
+    } \
+    static inline type arr_max_##name(const type* arr, size_t n) { \
+        return __cpu_has_avx2() ? __arr_max_##name##_avx2(arr, n) : __arr_max_##name(arr, n); \
+    } \
+    static inline void arr_scale_##name(type* arr, size_t n, type factor) { \
+        if (__cpu_has_avx2()) __arr_scale_##name##_avx2(arr, n, factor); \
+        else __arr_scale_##name(arr, n, factor); \
+    } \
+    static inline void arr_fill_##name(type* arr, size_t n, type value) { \
+        if (__cpu_has_avx2()) __arr_fill_##name##_avx2(arr, n, value); \
+        else __arr_fill_##name(arr, n, value); \
+    }
+
+__ARRAY_TYPES(int, int, int, unsigned int, unsigned long long)
+__ARRAY_COMMON_KERNELS(int, int, INT_MIN, INT_MAX, , )
+__ARRAY_COMMON_KERNELS(int, int, INT_MIN, INT_MAX, _avx2, __ARRAY_AVX2)
+__ARRAY_INT_KERNELS(int, int, unsigned int, long long, , )
+__ARRAY_INT_KERNELS(int, int, unsigned int, long long, _avx2, __ARRAY_AVX2)
+__ARRAY_DEFINE(int, int, long long)
+
+__ARRAY_TYPES(long, long, long, unsigned long, unsigned long)
+__ARRAY_COMMON_KERNELS(long, long, LONG_MIN, LONG_MAX, , )
+__ARRAY_COMMON_KERNELS(long, long, LONG_MIN, LONG_MAX, _avx2, __ARRAY_AVX2)
+__ARRAY_INT_KERNELS(long, long, unsigned long, long, , )
+__ARRAY_INT_KERNELS(long, long, unsigned long, long, _avx2, __ARRAY_AVX2)
+__ARRAY_DEFINE(long, long, long)
+
+__ARRAY_TYPES(float, float, int, unsigned int, float)
+__ARRAY_COMMON_KERNELS(float, float, -INFINITY, INFINITY, , )
+__ARRAY_COMMON_KERNELS(float, float, -INFINITY, INFINITY, _avx2, __ARRAY_AVX2)
+__ARRAY_FLOAT_KERNELS(float, float, , )
+__ARRAY_FLOAT_KERNELS(float, float, _avx2, __ARRAY_AVX2)
+__ARRAY_DEFINE(float, float, double)
+
+__ARRAY_TYPES(double, double, long long, unsigned long long, double)
+__ARRAY_COMMON_KERNELS(double, double, -INFINITY, INFINITY, , )
+__ARRAY_COMMON_KERNELS(double, double, -INFINITY, INFINITY, _avx2, __ARRAY_AVX2)
+__ARRAY_FLOAT_KERNELS(double, double, , )
+__ARRAY_FLOAT_KERNELS(double, double, _avx2, __ARRAY_AVX2)
+__ARRAY_DEFINE(double, double, double)
+
+/* Kernel for the element type of `arr` (read-only kernels also take const arrays) */
+#define __ARRAY_READ(kernel, arr) _Generic((arr) + 0, \
+    int*: kernel##_int, const int*: kernel##_int, long*: kernel##_long, const long*: kernel##_long, \
+    float*: kernel##_float, const float*: kernel##_float, double*: kernel##_double, const double*: kernel##_double)
+#define __ARRAY_WRITE(kernel, arr) _Generic((arr) + 0, \
+    int*: kernel##_int, long*: kernel##_long, float*: kernel##_float, double*: kernel##_double)
+
+#define __arr_sum_1(arr) __arr_sum_2(arr, arrlen(arr))
+#define __arr_sum_2(arr, n) __ARRAY_READ(arr_sum, arr)((arr), (n))
+
+/**
+ * @brief Sum an array of int, long, float, or double with SIMD
+ * @param ... Arguments (array, length=arrlen(array) [required for manually allocated arrays])
+ * @return The sum: `long long` for int, `long` for long (wrapping), and a compensated `double` for float and double
+ */
+#define arr_sum(...) GET_MACRO2(__VA_ARGS__, __arr_sum_2, __arr_sum_1)(__VA_ARGS__)
+
+#define __arr_dot_2(arr, other) __arr_dot_3(arr, other, arrlen(arr))
+#define __arr_dot_3(arr, other, n) __ARRAY_READ(arr_dot, arr)((arr), (other), (n))
+
+/**
+ * @brief Dot product of two arrays of the same element type (int, long, float, or double) with SIMD
+ * @param ... Arguments (array, other array, length=arrlen(array) [required for manually allocated arrays])
+ * @return The sum of the products, with the types and compensation of `arr_sum`
+ */
+#define arr_dot(...) GET_MACRO3(__VA_ARGS__, __arr_dot_3, __arr_dot_2)(__VA_ARGS__)
+
+#define __arr_min_1(arr) __arr_min_2(arr, arrlen(arr))
+#define __arr_min_2(arr, n) __ARRAY_READ(arr_min, arr)((arr), (n))
+
+/**
+ * @brief Smallest element of an array of int, long, float, or double with SIMD
+ * @param ... Arguments (array, length=arrlen(array) [required for manually allocated arrays])
+ * @return The smallest element, ignoring NaN; the type's maximum (INT_MAX, LONG_MAX, or INFINITY) if there is none
+ */
+#define arr_min(...) GET_MACRO2(__VA_ARGS__, __arr_min_2, __arr_min_1)(__VA_ARGS__)
+
+#define __arr_max_1(arr) __arr_max_2(arr, arrlen(arr))
+#define __arr_max_2(arr, n) __ARRAY_READ(arr_max, arr)((arr), (n))
+
+/**
+ * @brief Largest element of an array of int, long, float, or double with SIMD
+ * @param ... Arguments (array, length=arrlen(array) [required for manually allocated arrays])
+ * @return The largest element, ignoring NaN; the type's minimum (INT_MIN, LONG_MIN, or -INFINITY) if there is none
+ */
+#define arr_max(...) GET_MACRO2(__VA_ARGS__, __arr_max_2, __arr_max_1)(__VA_ARGS__)
+
+#define __arr_scale_2(arr, factor) __arr_scale_3(arr, arrlen(arr), factor)
+#define __arr_scale_3(arr, n, factor) __ARRAY_WRITE(arr_scale, arr)((arr), (n), (factor))
+
+/**
+ * @brief Multiply every element of an array of int, long, float, or double by a factor with SIMD
+ * @param ... Arguments (array, length=arrlen(array) [required for manually allocated arrays], factor)
+ */
+#define arr_scale(...) GET_MACRO3(__VA_ARGS__, __arr_scale_3, __arr_scale_2)(__VA_ARGS__)
+
+#define __arr_fill_2(arr, value) __arr_fill_3(arr, arrlen(arr), value)
+#define __arr_fill_3(arr, n, value) __ARRAY_WRITE(arr_fill, arr)((arr), (n), (value))
+
+/**
+ * @brief Set every element of an array of int, long, float, or double to a value with SIMD stores
+ * @param ... Arguments (array, length=arrlen(array) [required for manually allocated arrays], value)
+ */
+#define arr_fill(...) GET_MACRO3(__VA_ARGS__, __arr_fill_3, __arr_fill_2)(__VA_ARGS__)
+
+
+
+
+/* Class definition macros */
+
+/* Define a class structure */
+#define CLASS(name, fields) \
+    typedef struct name name; \
+    struct name fields; \
+    name* new_##name() { \
+        name* instance = (name*) cprime_malloc(sizeof(name)); \
+        if (!instance) { \
+            perror("Memory allocation failed"); \
+            exit(EXIT_FAILURE); \
+        } \
+        memset(instance, 0, sizeof(name)); \
+        return instance; \
+    } \
+    void delete_##name(name* instance) { \
+        if (instance) cprime_free(instance); \
+    }
+
+/* Define a method for the class */
+#define METHOD(return_type, class_name, method_name) \
+    return_type class_name##_##method_name(class_name* this)
+
+/* Define a getter */
+#define GETTER(class_name, field_type, field_name) \
+    field_type class_name##_get_##field_name(class_name* this) { \
+        return this->field_name; \
+    }
+
+/* Define a setter */
+#define SETTER(class_name, field_type, field_name) \
+    void class_name##_set_##field_name(class_name* this, field_type value) { \
+        this->field_name = value; \
+    }
+
+/* Define fields (helper to enable CLASS macro formatting) */
+#define FIELDS(...) { __VA_ARGS__ }
+
+
+
+
+/* Concurrent queues */
+
+/* Number of failed polls before a blocking queue operation sleeps on its futex */
+#define CPRIME_QUEUE_SPINS 256
+
+#ifdef CPRIME_IMPLEMENTATION
+/* Sleep until `*word` no longer equals `seen` (spurious wakeups are allowed) */
+static void __futex_wait(atomic_uint* word, unsigned int seen) {
+#ifdef __linux__
+    syscall(SYS_futex, (unsigned int*) word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#elif defined(__unix__) || defined(__APPLE__)
+    if (atomic_load_explicit(word, memory_order_acquire) == seen) sched_yield();
+#endif
+}
+
+/* Bump `*word` and wake every thread sleeping on it, but only if someone is waiting */
+static void __futex_wake(atomic_uint* word, atomic_uint* waiters) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) == 0) return;
+    atomic_fetch_add_explicit(word, 1, memory_order_release);
+#ifdef __linux__
+    syscall(SYS_futex, (unsigned int*) word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+static size_t __queue_round_capacity(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    return n;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
+/**
+ * @brief Bounded lock-free single-producer/single-consumer ring buffer of pointers
+ * @note You must call `delete_SPSCQueue(SPSCQueue*)` to free the memory after use
+ * @note Exactly one thread may push and exactly one thread may pop; NULL items cannot be queued
+ * @param capacity The number of slots (rounded up to a power of two)
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the capacity is zero
+ * 
+ * ### Methods
  * 
- * - `FileReader_nextLong(FileReader*)`
+ * - `new_SPSCQueue(size_t capacity)`
  * 
- * - `FileReader_nextFloat(FileReader*)`
+ * - `delete_SPSCQueue(SPSCQueue*)`
  * 
- * - `FileReader_nextDouble(FileReader*)`
+ * - `SPSCQueue_push(SPSCQueue*, any)` / `SPSCQueue_pushWait(SPSCQueue*, any)`
  * 
- * - `FileReader_hasNext(FileReader*)`
+ * - `SPSCQueue_pop(SPSCQueue*)` / `SPSCQueue_popWait(SPSCQueue*)`
+ * 
+ * - `SPSCQueue_pushBatch(SPSCQueue*, any*, size_t)` / `SPSCQueue_pushBatchWait(SPSCQueue*, any*, size_t)`
+ * 
+ * - `SPSCQueue_popBatch(SPSCQueue*, any*, size_t)` / `SPSCQueue_popBatchWait(SPSCQueue*, any*, size_t)`
+ * 
+ * - `SPSCQueue_close(SPSCQueue*)` marks the end of the stream; blocked consumers drain and return
+ * 
+ * - `SPSCQueue_size(SPSCQueue*)`
  */
-typedef struct FileReader FileReader;
-struct FileReader {
-    FILE* file;
-    string buffer;
-    size_t capacity;
-    size_t size;
+typedef struct SPSCQueue SPSCQueue;
+struct SPSCQueue {
+    _Alignas(CPRIME_CACHE_LINE) atomic_size_t head;  // Next slot to pop (written by the consumer)
+    size_t tail_cache;                               // Consumer's last view of `tail`
+    _Alignas(CPRIME_CACHE_LINE) atomic_size_t tail;  // Next slot to push (written by the producer)
+    size_t head_cache;                               // Producer's last view of `head`
+    _Alignas(CPRIME_CACHE_LINE) any* slots;
+    size_t mask;
+    atomic_bool closed;
+    atomic_uint not_empty;                           // Futex words, bumped when waiters exist
+    atomic_uint not_full;
+    atomic_uint waiters;
 };
 
 /**
- * @brief Read the next line from the file (up to the next newline or EOF)
- * @param filereader The file reader to read from
- * @return The line read from the file, or NULL if not found
- * @memberof FileReader
+ * @brief Create a new single-producer/single-consumer queue
+ * @param capacity The number of slots (rounded up to a power of two)
+ * @return The queue
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the capacity is zero
+ * @memberof SPSCQueue
  */
-string FileReader_nextLine(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return NULL;
-    if (filereader->buffer != NULL) {
-        free(filereader->buffer);
-        filereader->buffer = NULL;
-    }
-    size_t capacity = 0;
-    size_t size = 0;
-    int c;
-    while ((c = fgetc(filereader->file)) != '\r' && c != '\n' && c != EOF) {
-        if (size + 1 > capacity) {
-            capacity = (capacity == 0) ? 16 : capacity * 2;
-            string temp = (string) realloc(filereader->buffer, capacity);
-            if (temp == NULL) return NULL;
-            filereader->buffer = temp;
-        }
-        filereader->buffer[size++] = c;
-    }
-    if (size == 0 && c == EOF)
-        return NULL;
-    if (c == '\r' && (c = fgetc(filereader->file)) != '\n')
-        if (c != EOF && ungetc(c, filereader->file) == EOF)
-            return NULL;
-    string s = (string) malloc(size + 1);
-    if (s == NULL) return NULL;
-    strncpy(s, filereader->buffer, size);
-    s[size] = '\0';
-    return s;
+SPSCQueue* new_SPSCQueue(size_t capacity);
+
+/**
+ * @brief Free a queue (items still queued are not freed)
+ * @param queue The queue to free
+ * @memberof SPSCQueue
+ */
+void delete_SPSCQueue(SPSCQueue* queue);
+
+/**
+ * @brief Push up to `count` items without blocking
+ * @param queue The queue to push to
+ * @param items The items to push (in order)
+ * @param count The number of items
+ * @return The number of items pushed (0 if the queue is full or closed)
+ * @memberof SPSCQueue
+ */
+size_t SPSCQueue_pushBatch(SPSCQueue* queue, any* items, size_t count);
+
+/**
+ * @brief Pop up to `max` items without blocking
+ * @param queue The queue to pop from
+ * @param out The array receiving the items
+ * @param max The capacity of `out`
+ * @return The number of items popped (0 if the queue is empty)
+ * @memberof SPSCQueue
+ */
+size_t SPSCQueue_popBatch(SPSCQueue* queue, any* out, size_t max);
+
+/**
+ * @brief Push an item without blocking
+ * @param queue The queue to push to
+ * @param item The item to push (must not be NULL)
+ * @return True if the item was pushed, or false if the queue is full or closed
+ * @memberof SPSCQueue
+ */
+static inline bool SPSCQueue_push(SPSCQueue* queue, any item) {
+    return item != NULL && SPSCQueue_pushBatch(queue, &item, 1) == 1;
 }
 
 /**
- * @brief Read the next string from the file (up to the next space, newline, or EOF)
- * @param filereader The file reader to read from
- * @return The string read from the file, or NULL if not found
- * @memberof FileReader
+ * @brief Pop an item without blocking
+ * @param queue The queue to pop from
+ * @return The item, or NULL if the queue is empty
+ * @memberof SPSCQueue
  */
-string FileReader_nextString(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
+static inline any SPSCQueue_pop(SPSCQueue* queue) {
+    any item = NULL;
+    SPSCQueue_popBatch(queue, &item, 1);
+    return item;
+}
+
+/**
+ * @brief Number of items currently queued (approximate while other threads are active)
+ * @memberof SPSCQueue
+ */
+size_t SPSCQueue_size(SPSCQueue* queue);
+
+/**
+ * @brief Close the queue; pushes fail and blocked consumers return once it is drained
+ * @memberof SPSCQueue
+ */
+void SPSCQueue_close(SPSCQueue* queue);
+
+/**
+ * @brief Push all `count` items, sleeping while the queue is full
+ * @return The number of items pushed (less than `count` only if the queue was closed)
+ * @memberof SPSCQueue
+ */
+size_t SPSCQueue_pushBatchWait(SPSCQueue* queue, any* items, size_t count);
+
+/**
+ * @brief Pop at least one item (up to `max`), sleeping while the queue is empty
+ * @return The number of items popped (0 only if the queue is closed and drained)
+ * @memberof SPSCQueue
+ */
+size_t SPSCQueue_popBatchWait(SPSCQueue* queue, any* out, size_t max);
+
+/**
+ * @brief Push an item, sleeping while the queue is full
+ * @return True if the item was pushed, or false if the queue is closed
+ * @memberof SPSCQueue
+ */
+bool SPSCQueue_pushWait(SPSCQueue* queue, any item);
+
+/**
+ * @brief Pop an item, sleeping while the queue is empty
+ * @return The item, or NULL once the queue is closed and drained
+ * @memberof SPSCQueue
+ */
+any SPSCQueue_popWait(SPSCQueue* queue);
+
+#ifdef CPRIME_IMPLEMENTATION
+SPSCQueue* new_SPSCQueue(size_t capacity) {
+    if (capacity == 0) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
         return NULL;
-    if (filereader->buffer != NULL) {
-        free(filereader->buffer);
-        filereader->buffer = NULL;
     }
-    size_t capacity = 16;
-    size_t size = 0;
-    int c;
-    do {
-        c = fgetc(filereader->file);
-    } while (c == ' ' || c == '\n' || c == '\r');
-    if (c == EOF)
-        return NULL;
-    filereader->buffer = (string)malloc(capacity);
-    if (filereader->buffer == NULL)
+    capacity = __queue_round_capacity(capacity);
+    SPSCQueue* queue = (SPSCQueue*) cprime_aligned_alloc(CPRIME_CACHE_LINE, sizeof (SPSCQueue));
+    any* slots = (any*) cprime_calloc(capacity, sizeof (any));
+    if (queue == NULL || slots == NULL) {
+        cprime_aligned_free(queue);
+        cprime_free(slots);
+        throw(MEMORY_ALLOCATION_EXCEPTION);
         return NULL;
-    while (c != ' ' && c != '\n' && c != '\r' && c != EOF) {
-        if (size + 1 > capacity) {
-            capacity *= 2;
-            string temp = (string)realloc(filereader->buffer, capacity);
-            if (temp == NULL) {
-                free(filereader->buffer);
-                return NULL;
-            }
-            filereader->buffer = temp;
+    }
+    memset(queue, 0, sizeof (SPSCQueue));
+    queue->slots = slots;
+    queue->mask = capacity - 1;
+    return queue;
+}
+
+void delete_SPSCQueue(SPSCQueue* queue) {
+    if (queue != NULL) {
+        cprime_free(queue->slots);
+        cprime_aligned_free(queue);
+    }
+}
+
+size_t SPSCQueue_pushBatch(SPSCQueue* queue, any* items, size_t count) {
+    if (queue == NULL || items == NULL || atomic_load_explicit(&queue->closed, memory_order_relaxed))
+        return 0;
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t free_slots = queue->mask + 1 - (tail - queue->head_cache);
+    if (free_slots < count) {
+        queue->head_cache = atomic_load_explicit(&queue->head, memory_order_acquire);
+        free_slots = queue->mask + 1 - (tail - queue->head_cache);
+    }
+    size_t n = min(count, free_slots);
+    for (size_t i = 0; i < n; i++)
+        queue->slots[(tail + i) & queue->mask] = items[i];
+    if (n > 0) {
+        atomic_store_explicit(&queue->tail, tail + n, memory_order_release);
+        __futex_wake(&queue->not_empty, &queue->waiters);
+    }
+    return n;
+}
+
+size_t SPSCQueue_popBatch(SPSCQueue* queue, any* out, size_t max) {
+    if (queue == NULL || out == NULL) return 0;
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t available = queue->tail_cache - head;
+    if (available < max) {
+        queue->tail_cache = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        available = queue->tail_cache - head;
+    }
+    size_t n = min(max, available);
+    for (size_t i = 0; i < n; i++)
+        out[i] = queue->slots[(head + i) & queue->mask];
+    if (n > 0) {
+        atomic_store_explicit(&queue->head, head + n, memory_order_release);
+        __futex_wake(&queue->not_full, &queue->waiters);
+    }
+    return n;
+}
+
+size_t SPSCQueue_size(SPSCQueue* queue) {
+    if (queue == NULL) return 0;
+    return atomic_load_explicit(&queue->tail, memory_order_acquire)
+         - atomic_load_explicit(&queue->head, memory_order_acquire);
+}
+
+void SPSCQueue_close(SPSCQueue* queue) {
+    if (queue == NULL) return;
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+    atomic_fetch_add_explicit(&queue->waiters, 1, memory_order_relaxed);
+    __futex_wake(&queue->not_empty, &queue->waiters);
+    __futex_wake(&queue->not_full, &queue->waiters);
+    atomic_fetch_sub_explicit(&queue->waiters, 1, memory_order_relaxed);
+}
+
+size_t SPSCQueue_pushBatchWait(SPSCQueue* queue, any* items, size_t count) {
+    if (queue == NULL || items == NULL) return 0;
+    size_t done = 0;
+    int spins = 0;
+    while (done < count && !atomic_load_explicit(&queue->closed, memory_order_acquire)) {
+        size_t n = SPSCQueue_pushBatch(queue, items + done, count - done);
+        if (n > 0) {
+            done += n;
+            spins = 0;
+        } else if (++spins < CPRIME_QUEUE_SPINS) {
+            __cpu_relax();
+        } else {
+            atomic_fetch_add_explicit(&queue->waiters, 1, memory_order_seq_cst);
+            unsigned int seen = atomic_load_explicit(&queue->not_full, memory_order_acquire);
+            atomic_thread_fence(memory_order_seq_cst);
+            size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+            size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+            if (tail - head > queue->mask && !atomic_load_explicit(&queue->closed, memory_order_acquire))
+                __futex_wait(&queue->not_full, seen);
+            atomic_fetch_sub_explicit(&queue->waiters, 1, memory_order_relaxed);
+            spins = 0;
         }
-        filereader->buffer[size++] = c;
-        c = fgetc(filereader->file);
     }
-    filereader->buffer[size] = '\0';
-    if (c == '\r') {
-        c = fgetc(filereader->file);
-        if (c != '\n') ungetc(c, filereader->file);
+    return done;
+}
+
+size_t SPSCQueue_popBatchWait(SPSCQueue* queue, any* out, size_t max) {
+    if (queue == NULL || out == NULL || max == 0) return 0;
+    int spins = 0;
+    while (true) {
+        size_t n = SPSCQueue_popBatch(queue, out, max);
+        if (n > 0) return n;
+        if (atomic_load_explicit(&queue->closed, memory_order_acquire) && SPSCQueue_size(queue) == 0)
+            return 0;
+        if (++spins < CPRIME_QUEUE_SPINS) {
+            __cpu_relax();
+            continue;
+        }
+        atomic_fetch_add_explicit(&queue->waiters, 1, memory_order_seq_cst);
+        unsigned int seen = atomic_load_explicit(&queue->not_empty, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (SPSCQueue_size(queue) == 0 && !atomic_load_explicit(&queue->closed, memory_order_acquire))
+            __futex_wait(&queue->not_empty, seen);
+        atomic_fetch_sub_explicit(&queue->waiters, 1, memory_order_relaxed);
+        spins = 0;
     }
-    return filereader->buffer;
 }
 
+bool SPSCQueue_pushWait(SPSCQueue* queue, any item) {
+    return item != NULL && SPSCQueue_pushBatchWait(queue, &item, 1) == 1;
+}
+
+any SPSCQueue_popWait(SPSCQueue* queue) {
+    any item = NULL;
+    SPSCQueue_popBatchWait(queue, &item, 1);
+    return item;
+}
+#endif  // CPRIME_IMPLEMENTATION
+
+
 /**
- * @brief Read the next character from the file (skipping whitespace)
- * @param filereader The file reader to read from
- * @return The character read from the file, or CHAR_MAX if not found
- * @memberof FileReader
+ * @brief Bounded lock-free multi-producer/multi-consumer queue of pointers (Vyukov's array queue)
+ * @note You must call `delete_MPMCQueue(MPMCQueue*)` to free the memory after use
+ * @note NULL items cannot be queued
+ * @param capacity The number of slots (rounded up to a power of two)
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the capacity is zero
+ * 
+ * ### Methods
+ * 
+ * Same as `SPSCQueue`, using the `MPMCQueue_` prefix:
+ * `push`, `pop`, `pushBatch`, `popBatch`, `pushWait`, `popWait`, `pushBatchWait`, `popBatchWait`,
+ * `close`, and `size`
  */
-char FileReader_nextChar(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return CHAR_MAX;
-    int c;
-    do {
-        c = fgetc(filereader->file);
-    } while (isspace(c));
-    if (c == EOF) return CHAR_MAX;
-    return (char)c;
+typedef struct __MPMCCell __MPMCCell;
+struct __MPMCCell {
+    atomic_size_t sequence;  // == position when free, == position + 1 when holding the item for position
+    any item;
+};
+
+typedef struct MPMCQueue MPMCQueue;
+struct MPMCQueue {
+    _Alignas(CPRIME_CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(CPRIME_CACHE_LINE) atomic_size_t dequeue_pos;
+    _Alignas(CPRIME_CACHE_LINE) __MPMCCell* cells;
+    size_t mask;
+    atomic_bool closed;
+    atomic_uint not_empty;
+    atomic_uint not_full;
+    atomic_uint waiters;
+};
+
+/**
+ * @brief Create a new multi-producer/multi-consumer queue
+ * @param capacity The number of slots (rounded up to a power of two)
+ * @return The queue
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the capacity is zero
+ * @memberof MPMCQueue
+ */
+MPMCQueue* new_MPMCQueue(size_t capacity);
+
+/**
+ * @brief Free a queue (items still queued are not freed)
+ * @param queue The queue to free
+ * @memberof MPMCQueue
+ */
+void delete_MPMCQueue(MPMCQueue* queue);
+
+/**
+ * @brief Push up to `count` items without blocking; the pushed items occupy consecutive positions
+ * @return The number of items pushed (0 if the queue is full or closed)
+ * @memberof MPMCQueue
+ */
+size_t MPMCQueue_pushBatch(MPMCQueue* queue, any* items, size_t count);
+
+/**
+ * @brief Pop up to `max` items without blocking
+ * @return The number of items popped (0 if the queue is empty)
+ * @memberof MPMCQueue
+ */
+size_t MPMCQueue_popBatch(MPMCQueue* queue, any* out, size_t max);
+
+/**
+ * @brief Push an item without blocking
+ * @return True if the item was pushed, or false if the queue is full or closed
+ * @memberof MPMCQueue
+ */
+static inline bool MPMCQueue_push(MPMCQueue* queue, any item) {
+    return item != NULL && MPMCQueue_pushBatch(queue, &item, 1) == 1;
 }
 
 /**
- * @brief Read an integer from the file (up to the next space, newline, or EOF)
- * @param filereader The file reader to read from
- * @return The integer read from the file, or INT_MAX if not found
- * @memberof FileReader
+ * @brief Pop an item without blocking
+ * @return The item, or NULL if the queue is empty
+ * @memberof MPMCQueue
  */
-int FileReader_nextInt(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return INT_MAX;
-    string line = FileReader_nextString(filereader);
-    if (line == NULL)
-        return INT_MAX;
-    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
-        char* tail;
-        errno = 0;
-        long n = strtol(line, &tail, 10);
-        if (errno == 0 && *tail == '\0' && n >= INT_MIN && n < INT_MAX)
-            return n;
-    }
-    return INT_MAX;
+static inline any MPMCQueue_pop(MPMCQueue* queue) {
+    any item = NULL;
+    MPMCQueue_popBatch(queue, &item, 1);
+    return item;
 }
 
 /**
- * @brief Read a long from the file (up to the next space, newline, or EOF)
- * @param filereader The file reader to read from
- * @return The long read from the file, or LONG_MAX if not found
- * @memberof FileReader
+ * @brief Number of items currently queued (approximate while other threads are active)
+ * @memberof MPMCQueue
+ */
+size_t MPMCQueue_size(MPMCQueue* queue);
+
+/**
+ * @brief Close the queue; pushes fail and blocked consumers return once it is drained
+ * @memberof MPMCQueue
  */
-long FileReader_nextLong(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return LONG_MAX;
-    string line = FileReader_nextString(filereader);
-    if (line == NULL)
-        return LONG_MAX;
-    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
-        char* tail;
-        errno = 0;
-        long n = strtol(line, &tail, 10);
-        if (errno == 0 && *tail == '\0' && n < LONG_MAX)
-            return n;
-    }
-    return LONG_MAX;
-}
+void MPMCQueue_close(MPMCQueue* queue);
 
 /**
- * @brief Read a float from the file (up to the next space, newline, or EOF)
- * @param filereader The file reader to read from
- * @return The float read from the file, or FLT_MAX if not found
- * @memberof FileReader
+ * @brief Push all `count` items, sleeping while the queue is full
+ * @return The number of items pushed (less than `count` only if the queue was closed)
+ * @memberof MPMCQueue
  */
-float FileReader_nextFloat(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return FLT_MAX;
-    string line = FileReader_nextString(filereader);
-    if (line == NULL)
-        return FLT_MAX;
-    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
-        char* tail;
-        errno = 0;
-        float f = strtof(line, &tail);
-        if (errno == 0 && *tail == '\0' && isfinite(f) != 0 && f < FLT_MAX)
-            return f;
-    }
-    return FLT_MAX;
-}
+size_t MPMCQueue_pushBatchWait(MPMCQueue* queue, any* items, size_t count);
 
 /**
- * @brief Read a double from the file (up to the next space, newline, or EOF)
- * @param filereader The file reader to read from
- * @return The double read from the file, or DBL_MAX if not found
- * @memberof FileReader
+ * @brief Pop at least one item (up to `max`), sleeping while the queue is empty
+ * @return The number of items popped (0 only if the queue is closed and drained)
+ * @memberof MPMCQueue
  */
-double FileReader_nextDouble(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return DBL_MAX;
-    string line = FileReader_nextString(filereader);
-    if (line == NULL)
-        return DBL_MAX;
-    if (strlen(line) > 0 && !isspace((unsigned char) line[0])) {
-        char* tail;
-        errno = 0;
-        double d = strtod(line, &tail);
-        if (errno == 0 && *tail == '\0' && isfinite(d) != 0 && d < DBL_MAX)
-            return d;
-    }
-    return DBL_MAX;
-}
+size_t MPMCQueue_popBatchWait(MPMCQueue* queue, any* out, size_t max);
 
 /**
- * @brief Check if the file reader has more data to read
- * @param filereader The file reader to check
- * @return True if there is more data to read, or false otherwise
- * @memberof FileReader
+ * @brief Push an item, sleeping while the queue is full
+ * @return True if the item was pushed, or false if the queue is closed
+ * @memberof MPMCQueue
  */
-bool FileReader_hasNext(FileReader* filereader) {
-    if (filereader == NULL || filereader->file == NULL)
-        return false;
-    int c = fgetc(filereader->file);
-    if (c != EOF && ungetc(c, filereader->file) == EOF)
-        return false;
-    return c != EOF;
-}
+bool MPMCQueue_pushWait(MPMCQueue* queue, any item);
 
 /**
- * @brief Create a new file reader
- * @param filename The name of the file to read
- * @return The file reader
- * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
- * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
- * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
- * @memberof FileReader
+ * @brief Pop an item, sleeping while the queue is empty
+ * @return The item, or NULL once the queue is closed and drained
+ * @memberof MPMCQueue
  */
-FileReader* new_FileReader(const char* filename) {
-    if (filename == NULL) {
+any MPMCQueue_popWait(MPMCQueue* queue);
+
+#ifdef CPRIME_IMPLEMENTATION
+MPMCQueue* new_MPMCQueue(size_t capacity) {
+    if (capacity == 0) {
         throw(ILLEGAL_ARGUMENT_EXCEPTION);
         return NULL;
     }
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        throw(FILE_NOT_FOUND_EXCEPTION);
-        return NULL;
-    }
-    FileReader* filereader = (FileReader*) malloc(sizeof (FileReader));
-    if (filereader == NULL) {
-        fclose(file);
+    capacity = __queue_round_capacity(capacity);
+    MPMCQueue* queue = (MPMCQueue*) cprime_aligned_alloc(CPRIME_CACHE_LINE, sizeof (MPMCQueue));
+    __MPMCCell* cells = (__MPMCCell*) cprime_malloc(capacity * sizeof (__MPMCCell));
+    if (queue == NULL || cells == NULL) {
+        cprime_aligned_free(queue);
+        cprime_free(cells);
         throw(MEMORY_ALLOCATION_EXCEPTION);
         return NULL;
     }
-    filereader->file = file;
-    filereader->buffer = NULL;
-    filereader->capacity = 0;
-    filereader->size = 0;
-    return filereader;
+    memset(queue, 0, sizeof (MPMCQueue));
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&cells[i].sequence, i);
+        cells[i].item = NULL;
+    }
+    queue->cells = cells;
+    queue->mask = capacity - 1;
+    return queue;
 }
 
-/**
- * @brief Close the file reader and free allocated memory
- * @param filereader The file reader to close
- * @memberof FileReader
- */
-void close_FileReader(FileReader* filereader) {
-    if (filereader != NULL) {
-        if (filereader->file != NULL)
-            fclose(filereader->file);
-        if (filereader->buffer != NULL)
-            free(filereader->buffer);
-        free(filereader);
+void delete_MPMCQueue(MPMCQueue* queue) {
+    if (queue != NULL) {
+        cprime_free(queue->cells);
+        cprime_aligned_free(queue);
+    }
+}
+
+size_t MPMCQueue_pushBatch(MPMCQueue* queue, any* items, size_t count) {
+    if (queue == NULL || items == NULL || count == 0 || atomic_load_explicit(&queue->closed, memory_order_relaxed))
+        return 0;
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    while (true) {
+        // Count the free cells starting at `pos`; only the claimer of a position can change its cell
+        size_t n = 0;
+        while (n < count && n <= queue->mask) {
+            size_t seq = atomic_load_explicit(&queue->cells[(pos + n) & queue->mask].sequence, memory_order_acquire);
+            if (seq != pos + n) break;
+            n++;
+        }
+        if (n == 0) {
+            size_t seq = atomic_load_explicit(&queue->cells[pos & queue->mask].sequence, memory_order_acquire);
+            if ((intptr_t) (seq - pos) < 0) return 0;  // Full
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + n,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            for (size_t i = 0; i < n; i++) {
+                __MPMCCell* cell = &queue->cells[(pos + i) & queue->mask];
+                cell->item = items[i];
+                atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_release);
+            }
+            __futex_wake(&queue->not_empty, &queue->waiters);
+            return n;
+        }
+    }
+}
+
+size_t MPMCQueue_popBatch(MPMCQueue* queue, any* out, size_t max) {
+    if (queue == NULL || out == NULL || max == 0) return 0;
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    while (true) {
+        size_t n = 0;
+        while (n < max && n <= queue->mask) {
+            size_t seq = atomic_load_explicit(&queue->cells[(pos + n) & queue->mask].sequence, memory_order_acquire);
+            if (seq != pos + n + 1) break;
+            n++;
+        }
+        if (n == 0) {
+            size_t seq = atomic_load_explicit(&queue->cells[pos & queue->mask].sequence, memory_order_acquire);
+            if ((intptr_t) (seq - (pos + 1)) < 0) return 0;  // Empty
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + n,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            for (size_t i = 0; i < n; i++) {
+                __MPMCCell* cell = &queue->cells[(pos + i) & queue->mask];
+                out[i] = cell->item;
+                atomic_store_explicit(&cell->sequence, pos + i + queue->mask + 1, memory_order_release);
+            }
+            __futex_wake(&queue->not_full, &queue->waiters);
+            return n;
+        }
     }
 }
 
+size_t MPMCQueue_size(MPMCQueue* queue) {
+    if (queue == NULL) return 0;
+    size_t head = atomic_load_explicit(&queue->dequeue_pos, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&queue->enqueue_pos, memory_order_acquire);
+    return (tail > head) ? tail - head : 0;
+}
+
+void MPMCQueue_close(MPMCQueue* queue) {
+    if (queue == NULL) return;
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+    atomic_fetch_add_explicit(&queue->waiters, 1, memory_order_relaxed);
+    __futex_wake(&queue->not_empty, &queue->waiters);
+    __futex_wake(&queue->not_full, &queue->waiters);
+    atomic_fetch_sub_explicit(&queue->waiters, 1, memory_order_relaxed);
+}
+
+size_t MPMCQueue_pushBatchWait(MPMCQueue* queue, any* items, size_t count) {
+    if (queue == NULL || items == NULL) return 0;
+    size_t done = 0;
+    int spins = 0;
+    while (done < count && !atomic_load_explicit(&queue->closed, memory_order_acquire)) {
+        size_t n = MPMCQueue_pushBatch(queue, items + done, count - done);
+        if (n > 0) {
+            done += n;
+            spins = 0;
+        } else if (++spins < CPRIME_QUEUE_SPINS) {
+            __cpu_relax();
+        } else {
+            atomic_fetch_add_explicit(&queue->waiters, 1, memory_order_seq_cst);
+            unsigned int seen = atomic_load_explicit(&queue->not_full, memory_order_acquire);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (MPMCQueue_size(queue) > queue->mask && !atomic_load_explicit(&queue->closed, memory_order_acquire))
+                __futex_wait(&queue->not_full, seen);
+            atomic_fetch_sub_explicit(&queue->waiters, 1, memory_order_relaxed);
+            spins = 0;
+        }
+    }
+    return done;
+}
+
+size_t MPMCQueue_popBatchWait(MPMCQueue* queue, any* out, size_t max) {
+    if (queue == NULL || out == NULL || max == 0) return 0;
+    int spins = 0;
+    while (true) {
+        size_t n = MPMCQueue_popBatch(queue, out, max);
+        if (n > 0) return n;
+        if (atomic_load_explicit(&queue->closed, memory_order_acquire) && MPMCQueue_size(queue) == 0)
+            return 0;
+        if (++spins < CPRIME_QUEUE_SPINS) {
+            __cpu_relax();
+            continue;
+        }
+        atomic_fetch_add_explicit(&queue->waiters, 1, memory_order_seq_cst);
+        unsigned int seen = atomic_load_explicit(&queue->not_empty, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (MPMCQueue_size(queue) == 0 && !atomic_load_explicit(&queue->closed, memory_order_acquire))
+            __futex_wait(&queue->not_empty, seen);
+        atomic_fetch_sub_explicit(&queue->waiters, 1, memory_order_relaxed);
+        spins = 0;
+    }
+}
+
+bool MPMCQueue_pushWait(MPMCQueue* queue, any item) {
+    return item != NULL && MPMCQueue_pushBatchWait(queue, &item, 1) == 1;
+}
+
+any MPMCQueue_popWait(MPMCQueue* queue) {
+    any item = NULL;
+    MPMCQueue_popBatchWait(queue, &item, 1);
+    return item;
+}
+#endif  // CPRIME_IMPLEMENTATION
 
 
 
-/* File Writer */
+
+/* Fibers */
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Default stack size of a fiber (a guard page is added below it) */
+#ifndef CPRIME_FIBER_STACK_SIZE
+    #define CPRIME_FIBER_STACK_SIZE (128 * 1024)
+#endif
+
+/* Events for `fiber_wait_fd` */
+#define FIBER_READ  (1)
+#define FIBER_WRITE (2)
+
+enum { __FIBER_READY, __FIBER_RUNNING, __FIBER_WAITING, __FIBER_DONE };
 
 /**
- * @brief File writer structure; writes to a file using various data types.
- * @note You must call `close_FileWriter(FileWriter*, bool flush=true)` to free the memory after use
- * @param file The file to write to
- * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
- * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
- * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
- * 
- * ### Methods
+ * @brief Lightweight cooperative thread (stackful coroutine) scheduled on the calling OS thread
+ * @note Fibers are freed by the scheduler when their function returns; do not keep the handle afterwards
+ * @note Each fiber has its own `try`/`catch` frame; an uncaught exception ends only that fiber
  * 
- * - `new_FileWriter(string filename, bool appendMode=false)` 
+ * ### Functions
  * 
- * - `close_FileWriter(FileWriter*, bool flush=true)` where `flush` adds a line break before closing
+ * - `fiber_spawn(void (*function)(any), any arg)`
  * 
- * - `FileWriter_writeLine(FileWriter*, const char*)`
+ * - `fiber_yield()` lets the other ready fibers run
  * 
- * - `FileWriter_writeString(FileWriter*, const char*)`
+ * - `fiber_run()` runs the scheduler until every fiber has finished
  * 
- * - `FileWriter_writeChar(FileWriter*, char)`
+ * - `fiber_sleep(long ms)`
  * 
- * - `FileWriter_writeInt(FileWriter*, int)`
+ * - `fiber_wait_fd(int fd, int events, long timeout_ms)` parks the fiber until `fd` is ready (epoll on Linux)
  * 
- * - `FileWriter_writeLong(FileWriter*, long)`
+ * - `fiber_fdopen(int fd, const char* mode)` opens a FILE* whose blocking reads/writes yield instead
  * 
- * - `FileWriter_writeFloat(FileWriter*, float)`
+ * - `FileReader_makeAsync(FileReader*)`, `FileWriter_makeAsync(FileWriter*)`, and `fiber_async_stdin()`
+ *   switch existing streams to yielding I/O (call them before the first read)
  * 
- * - `FileWriter_writeDouble(FileWriter*, double)`
+ * @code
+ * void worker(any arg) { FileReader* fr = arg; FileReader_makeAsync(fr); ... FileReader_nextLine(fr) ... }
+ * fiber_spawn(worker, new_FileReader("pipe_a"));
+ * fiber_spawn(worker, new_FileReader("pipe_b"));
+ * fiber_run();
+ * @endcode
  */
-typedef struct FileWriter FileWriter;
-struct FileWriter {
-    FILE* file;
+typedef struct Fiber Fiber;
+struct Fiber {
+#if defined(__x86_64__)
+    void* sp;                   // Saved stack pointer (callee-saved registers live on the stack)
+#else
+    ucontext_t context;
+#endif
+    void (*function)(any);
+    any arg;
+    char* stack;                // Mapping base (guard page included)
+    size_t stack_size;
+    long guard_slot;            // Registration of the guard page, so overflowing it raises STACK_OVERFLOW_EXCEPTION
+    int state;
+    int exception;              // Code of the uncaught exception that ended the fiber, or SUCCESS
+    __ExFrame* ex_frame;        // The fiber's innermost try frame while it is switched out
+    __Deadline* ex_deadline;    // The fiber's innermost deadline while it is switched out
+    unsigned ex_no_async_throw; // Depth of the fiber's sections holding off asynchronous throws, likewise
+    int wait_fd;
+    int ready_events;
+    uint64_t deadline;          // Wake-up time in ns when sleeping/waiting with a timeout (0 = none)
+    Fiber* next;                // Run queue link
+    Fiber* next_timer;          // Timer list link
+};
+
+typedef struct __FiberScheduler __FiberScheduler;
+struct __FiberScheduler {
+    Fiber main;                 // The scheduler's own context (the thread that called `fiber_run`)
+    Fiber* current;
+    Fiber* run_head;
+    Fiber* run_tail;
+    Fiber* timers;              // Sorted by deadline
+    size_t live;
+    size_t fd_waiters;
+    int epoll_fd;
 };
 
 /**
- * @brief Write a line to the file and append a line break
- * @param filewriter The file writer to write to
- * @param line The string to write
- * @memberof FileWriter
+ * @brief Create a fiber that runs `function(arg)` once the scheduler reaches it
+ * @param function The fiber body
+ * @param arg The argument passed to `function`
+ * @return The fiber (owned by the scheduler)
+ * @throw `MEMORY_ALLOCATION_EXCEPTION` if the fiber or its stack cannot be allocated
+ * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the function is NULL
  */
-void FileWriter_writeLine(FileWriter* filewriter, const char* line) {
-    if (filewriter == NULL || filewriter->file == NULL || line == NULL) return;
-    fprintf(filewriter->file, "%s\n", line);
-}
+Fiber* fiber_spawn(void (*function)(any), any arg);
 
 /**
- * @brief Write a string to the file
- * @param filewriter The file writer to write to
- * @param s The string to write
- * @memberof FileWriter
+ * @brief Get the running fiber
+ * @return The fiber, or NULL when called outside of a fiber
  */
-void FileWriter_writeString(FileWriter* filewriter, const char* s) {
-    if (filewriter == NULL || filewriter->file == NULL || s == NULL) return;
-    fprintf(filewriter->file, "%s", s);
-}
+Fiber* fiber_current(void);
 
 /**
- * @brief Write a character to the file
- * @param filewriter The file writer to write to
- * @param c The character to write
- * @memberof FileWriter
+ * @brief Let the other ready fibers run before continuing (no-op outside of a fiber)
  */
-void FileWriter_writeChar(FileWriter* filewriter, char c) {
-    if (filewriter == NULL || filewriter->file == NULL) return;
-    fprintf(filewriter->file, "%c", c);
-}
+void fiber_yield(void);
 
 /**
- * @brief Write an integer to the file
- * @param filewriter The file writer to write to
- * @param n The integer to write
- * @memberof FileWriter
+ * @brief Suspend the running fiber for at least `ms` milliseconds (sleeps the thread outside of a fiber)
+ * @param ms The number of milliseconds to sleep
  */
-void FileWriter_writeInt(FileWriter* filewriter, int n) {
-    if (filewriter == NULL || filewriter->file == NULL) return;
-    fprintf(filewriter->file, "%d", n);
-}
+void fiber_sleep(long ms);
 
 /**
- * @brief Write a long integer to the file
- * @param filewriter The file writer to write to
- * @param n The long integer to write
- * @memberof FileWriter
+ * @brief Suspend the running fiber until `fd` is readable/writable (polls the fd outside of a fiber)
+ * @param fd The file descriptor (one waiting fiber per descriptor)
+ * @param events `FIBER_READ`, `FIBER_WRITE`, or both
+ * @param timeout_ms The maximum time to wait, or -1 to wait indefinitely
+ * @return The ready events, or 0 on timeout
+ * @note Regular files are always reported ready
  */
-void FileWriter_writeLong(FileWriter* filewriter, long n) {
-    if (filewriter == NULL || filewriter->file == NULL) return;
-    fprintf(filewriter->file, "%ld", n);
-}
+int fiber_wait_fd(int fd, int events, long timeout_ms);
 
 /**
- * @brief Write a float to the file
- * @param filewriter The file writer to write to
- * @param f The float to write
- * @memberof FileWriter
+ * @brief Run the scheduler on the calling thread until every spawned fiber has finished
  */
-void FileWriter_writeFloat(FileWriter* filewriter, float f) {
-    if (filewriter == NULL || filewriter->file == NULL) return;
-    fprintf(filewriter->file, "%f", f);
-}
+void fiber_run(void);
+
+#ifdef CPRIME_COOKIE_STREAMS
+/* Stream over a non-blocking descriptor whose reads and writes park the fiber instead of the thread */
+typedef struct __FiberStream __FiberStream;
+struct __FiberStream {
+    FILE* origin;  // Closed together with the stream (NULL for bare descriptors)
+    int fd;
+    int flags;  // The descriptor's status flags before O_NONBLOCK, restored when the stream is closed
+};
 
 /**
- * @brief Write a double to the file
- * @param filewriter The file writer to write to
- * @param d The double to write
+ * @brief Open a stream over a file descriptor whose blocking operations yield to other fibers
+ * @param fd The descriptor (pipe, socket, FIFO, terminal, or regular file); closed with the stream
+ * @param mode The fopen-style mode
+ * @return The stream, or NULL on failure
+ * @note The descriptor is non-blocking while the stream is open; closing the stream restores its flags
+ */
+FILE* fiber_fdopen(int fd, const char* mode);
+
+/**
+ * @brief Make the reader's blocking reads yield to other fibers (call before the first read)
+ * @param filereader The file reader
+ * @return True on success, or false otherwise
+ * @memberof FileReader
+ */
+bool FileReader_makeAsync(FileReader* filereader);
+
+/**
+ * @brief Make the writer's blocking writes yield to other fibers
+ * @param filewriter The file writer
+ * @return True on success, or false otherwise
  * @memberof FileWriter
  */
-void FileWriter_writeDouble(FileWriter* filewriter, double d) {
-    if (filewriter == NULL || filewriter->file == NULL) return;
-    fprintf(filewriter->file, "%lf", d);
+bool FileWriter_makeAsync(FileWriter* filewriter);
+
+/**
+ * @brief Make `stdin` (and so `get_string`, `input`, ...) yield to other fibers while waiting for input
+ * @return True on success, or false otherwise
+ * @note The original flags of the stdin descriptor are restored at exit
+ */
+bool fiber_async_stdin(void);
+#endif  // CPRIME_COOKIE_STREAMS
+#endif  // __unix__ || __APPLE__
+
+#ifdef CPRIME_IMPLEMENTATION
+#if defined(__unix__) || defined(__APPLE__)
+static _Thread_local __FiberScheduler __fibers = { .epoll_fd = -1 };
+
+#if defined(__x86_64__)
+/* Save callee-saved registers and the FP control words on the current stack, then switch stacks */
+__attribute__((naked, noinline)) static void __fiber_switch_stack(void** save_sp __attribute__((unused)),
+                                                                 void* new_sp __attribute__((unused))) {
+    __asm__ __volatile__(
+        "pushq %rbp\n\t"
+        "pushq %rbx\n\t"
+        "pushq %r12\n\t"
+        "pushq %r13\n\t"
+        "pushq %r14\n\t"
+        "pushq %r15\n\t"
+        "subq $8, %rsp\n\t"
+        "stmxcsr (%rsp)\n\t"
+        "fnstcw 4(%rsp)\n\t"
+        "movq %rsp, (%rdi)\n\t"
+        "movq %rsi, %rsp\n\t"
+        "ldmxcsr (%rsp)\n\t"
+        "fldcw 4(%rsp)\n\t"
+        "addq $8, %rsp\n\t"
+        "popq %r15\n\t"
+        "popq %r14\n\t"
+        "popq %r13\n\t"
+        "popq %r12\n\t"
+        "popq %rbx\n\t"
+        "popq %rbp\n\t"
+        "ret\n\t"
+    );
 }
+#endif
 
-FileWriter* __new_FileWriter_WA(const char* filename, bool append) {
-    if (filename == NULL) {
-        throw(ILLEGAL_ARGUMENT_EXCEPTION);
-        return NULL;
+static void __fiber_switch(Fiber* from, Fiber* to) {
+    from->ex_frame = ex_frame__;
+    from->ex_deadline = __deadline_top;
+    from->ex_no_async_throw = __no_async_throw;
+    __deadline_top = NULL;  // A deadline signal arriving mid-switch must not throw into the other fiber's frames
+    __fibers.current = to;
+    to->state = __FIBER_RUNNING;
+#if defined(__x86_64__)
+    __fiber_switch_stack(&from->sp, to->sp);
+#else
+    swapcontext(&from->context, &to->context);
+#endif
+    ex_frame__ = from->ex_frame;
+    __no_async_throw = from->ex_no_async_throw;
+    __deadline_restore(from->ex_deadline);
+}
+
+static void __fiber_enqueue(Fiber* fiber) {
+    fiber->state = __FIBER_READY;
+    fiber->next = NULL;
+    if (__fibers.run_tail != NULL) __fibers.run_tail->next = fiber;
+    else __fibers.run_head = fiber;
+    __fibers.run_tail = fiber;
+}
+
+static void __fiber_entry(void) {
+    Fiber* self = __fibers.current;
+    __ExFrame frame;
+    ex_frame__ = NULL;
+    __no_async_throw = 0;
+    __deadline_restore(NULL);
+    __ex_push(&frame);
+    switch (__ex_setjmp(frame.buf)) {
+        case 0:
+            self->function(self->arg);
+            __ex_pop(&frame);
+            break;
+        default:
+            self->exception = ex_code__;
+            fprintf(stderr, "Uncaught exception %d in fiber %p\n", ex_code__, (void*) self);
     }
-    FILE* file = fopen(filename, (append) ? "a" : "w");
-    if (file == NULL) {
-        throw(FILE_NOT_FOUND_EXCEPTION);
+    self->state = __FIBER_DONE;
+    __fiber_switch(self, &__fibers.main);
+}
+
+Fiber* fiber_spawn(void (*function)(any), any arg) {
+    __NO_ASYNC_THROW();
+    if (function == NULL) {
+        throw(ILLEGAL_ARGUMENT_EXCEPTION);
         return NULL;
     }
-    FileWriter* filewriter = (FileWriter*) malloc(sizeof (FileWriter));
-    if (filewriter == NULL) {
-        fclose(file);
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = (CPRIME_FIBER_STACK_SIZE + page - 1) / page * page + page;
+    Fiber* fiber = (Fiber*) cprime_calloc(1, sizeof (Fiber));
+    char* stack = (fiber == NULL) ? MAP_FAILED : (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED) {
+        cprime_free(fiber);
         throw(MEMORY_ALLOCATION_EXCEPTION);
         return NULL;
     }
-    filewriter->file = file;
-    return filewriter;
+    mprotect(stack, page, PROT_NONE);  // Guard page: overflowing the stack faults instead of corrupting memory
+    fiber->guard_slot = __guard_register(stack, page, STACK_OVERFLOW_EXCEPTION);
+    fiber->stack = stack;
+    fiber->stack_size = size;
+    fiber->function = function;
+    fiber->arg = arg;
+    fiber->wait_fd = -1;
+#if defined(__x86_64__)
+    uintptr_t top = ((uintptr_t) (stack + size)) & ~(uintptr_t) 15;
+    uint64_t* sp = (uint64_t*) top;
+    *--sp = 0;                                  // Fake return address of __fiber_entry (keeps the ABI alignment)
+    *--sp = (uint64_t) (uintptr_t) __fiber_entry;
+    for (int i = 0; i < 6; i++) *--sp = 0;      // rbp, rbx, r12-r15
+    *--sp = 0x037Full << 32 | 0x1F80;           // Default x87 control word and MXCSR
+    fiber->sp = sp;
+#else
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = stack + page;
+    fiber->context.uc_stack.ss_size = size - page;
+    fiber->context.uc_link = NULL;
+    makecontext(&fiber->context, __fiber_entry, 0);
+#endif
+    __fibers.live++;
+    __fiber_enqueue(fiber);
+    return fiber;
+}
+
+Fiber* fiber_current(void) {
+    return (__fibers.current == &__fibers.main) ? NULL : __fibers.current;
+}
+
+void fiber_yield(void) {
+    Fiber* self = fiber_current();
+    if (self == NULL) return;
+    __fiber_enqueue(self);
+    __fiber_switch(self, &__fibers.main);
+}
+
+static void __fiber_add_timer(Fiber* fiber, long timeout_ms) {
+    fiber->deadline = __monotonic_ns() + (uint64_t) timeout_ms * 1000000ull;
+    Fiber** link = &__fibers.timers;
+    while (*link != NULL && (*link)->deadline <= fiber->deadline)
+        link = &(*link)->next_timer;
+    fiber->next_timer = *link;
+    *link = fiber;
+}
+
+static void __fiber_remove_timer(Fiber* fiber) {
+    for (Fiber** link = &__fibers.timers; *link != NULL; link = &(*link)->next_timer) {
+        if (*link == fiber) {
+            *link = fiber->next_timer;
+            break;
+        }
+    }
+    fiber->deadline = 0;
+}
+
+void fiber_sleep(long ms) {
+    Fiber* self = fiber_current();
+    if (self == NULL) {
+        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+        return;
+    }
+    self->state = __FIBER_WAITING;
+    __fiber_add_timer(self, (ms < 0) ? 0 : ms);
+    __fiber_switch(self, &__fibers.main);
 }
-FileWriter* __new_FileWriter_W(const char* filename) { return __new_FileWriter_WA(filename, false); }
-FileWriter* __new_FileWriter_A(const char* filename) { return __new_FileWriter_WA(filename, true); }
 
-/**
- * @brief Create a new file writer
- * @param filename The name of the file to write to
- * @param append [optional] Whether to append open the file in append mode (default is false)
- * @return The file writer
- * @throw `FILE_NOT_FOUND_EXCEPTION` if the file is not found
- * @throw `MEMORY_ALLOCATION_EXCEPTION` if memory allocation fails
- * @throw `ILLEGAL_ARGUMENT_EXCEPTION` if the filename is NULL
- * @memberof FileWriter
- */
-#define new_FileWriter(...) GET_MACRO2(__VA_ARGS__, __new_FileWriter_WA, __new_FileWriter_W)(__VA_ARGS__)
+int fiber_wait_fd(int fd, int events, long timeout_ms) {
+    Fiber* self = fiber_current();
+#ifdef __linux__
+    if (self != NULL) {
+        if (__fibers.epoll_fd < 0)
+            __fibers.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event ev;
+        ev.events = EPOLLONESHOT | ((events & FIBER_READ) ? EPOLLIN : 0) | ((events & FIBER_WRITE) ? EPOLLOUT : 0);
+        ev.data.ptr = self;
+        if (epoll_ctl(__fibers.epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0
+            && (errno != ENOENT || epoll_ctl(__fibers.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0))
+            return events;  // EPERM: regular files never block
+        self->wait_fd = fd;
+        self->ready_events = 0;
+        self->state = __FIBER_WAITING;
+        __fibers.fd_waiters++;
+        if (timeout_ms >= 0) __fiber_add_timer(self, timeout_ms);
+        __fiber_switch(self, &__fibers.main);
+        return self->ready_events;
+    }
+#endif
+    struct pollfd pfd = { fd, (short) (((events & FIBER_READ) ? POLLIN : 0) | ((events & FIBER_WRITE) ? POLLOUT : 0)), 0 };
+    uint64_t deadline = (timeout_ms >= 0) ? __monotonic_ns() + (uint64_t) timeout_ms * 1000000ull : 0;
+    while (true) {
+        // Inside a fiber without epoll: poll without blocking and let the others run in between
+        int n = poll(&pfd, 1, (self == NULL) ? (int) timeout_ms : 0);
+        if (n > 0)
+            return ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) ? FIBER_READ : 0)
+                 | ((pfd.revents & (POLLOUT | POLLERR)) ? FIBER_WRITE : 0);
+        if (n < 0 && errno != EINTR) return events;
+        if (self == NULL || (deadline != 0 && __monotonic_ns() >= deadline)) return 0;
+        fiber_yield();
+    }
+}
 
-void __close_FileWriter(FileWriter* filewriter, bool flush) {
-    if (flush) FileWriter_writeChar(filewriter, '\n');
-    if (filewriter != NULL) {
-        if (filewriter->file != NULL)
-            fclose(filewriter->file);
-        free(filewriter);
+/* Wait for I/O or timers when no fiber is ready */
+static void __fiber_poll(bool block) {
+    int timeout = 0;
+    if (block) {
+        if (__fibers.timers != NULL) {
+            uint64_t now = __monotonic_ns();
+            uint64_t first = __fibers.timers->deadline;
+            timeout = (first <= now) ? 0 : (int) ((first - now + 999999) / 1000000);
+        } else {
+            timeout = -1;
+        }
+    }
+#ifdef __linux__
+    if (__fibers.fd_waiters > 0) {
+        struct epoll_event events[64];
+        int n = epoll_wait(__fibers.epoll_fd, events, 64, timeout);
+        for (int i = 0; i < n; i++) {
+            Fiber* fiber = (Fiber*) events[i].data.ptr;
+            if (fiber->state != __FIBER_WAITING || fiber->wait_fd < 0) continue;
+            fiber->ready_events = ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ? FIBER_READ : 0)
+                                | ((events[i].events & (EPOLLOUT | EPOLLERR)) ? FIBER_WRITE : 0);
+            fiber->wait_fd = -1;
+            __fibers.fd_waiters--;
+            if (fiber->deadline != 0) __fiber_remove_timer(fiber);
+            __fiber_enqueue(fiber);
+        }
+    } else
+#endif
+    if (timeout > 0) {
+        struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    uint64_t now = __monotonic_ns();
+    while (__fibers.timers != NULL && __fibers.timers->deadline <= now) {
+        Fiber* fiber = __fibers.timers;
+        __fibers.timers = fiber->next_timer;
+        fiber->deadline = 0;
+#ifdef __linux__
+        if (fiber->wait_fd >= 0) {
+            epoll_ctl(__fibers.epoll_fd, EPOLL_CTL_DEL, fiber->wait_fd, NULL);
+            fiber->wait_fd = -1;
+            fiber->ready_events = 0;
+            __fibers.fd_waiters--;
+        }
+#endif
+        __fiber_enqueue(fiber);
     }
 }
-void __close_FileWriter_flush(FileWriter* filewriter)   { __close_FileWriter(filewriter, true); }
-void __close_FileWriter_noflush(FileWriter* filewriter) { __close_FileWriter(filewriter, false); }
 
-/**
- * @brief Close a file writer
- * @param filewriter The file writer to close
- * @param flush [optional] Whether to flush the file (appends a line break; default is true)
- * @memberof FileWriter
- */
-#define close_FileWriter(...) GET_MACRO2(__VA_ARGS__, __close_FileWriter, __close_FileWriter_flush)(__VA_ARGS__)
+void fiber_run(void) {
+    if (fiber_current() != NULL) return;  // Already inside the scheduler
+    __fibers.current = &__fibers.main;
+    while (__fibers.live > 0) {
+        Fiber* fiber = __fibers.run_head;
+        if (fiber == NULL) {
+            if (__fibers.timers == NULL && __fibers.fd_waiters == 0) break;  // Nothing can wake the rest
+            __fiber_poll(true);
+            continue;
+        }
+        __fibers.run_head = fiber->next;
+        if (__fibers.run_head == NULL) __fibers.run_tail = NULL;
+        __fiber_switch(&__fibers.main, fiber);
+        if (fiber->state == __FIBER_DONE) {
+            __guard_unregister(fiber->guard_slot);
+            munmap(fiber->stack, fiber->stack_size);
+            cprime_free(fiber);
+            __fibers.live--;
+        }
+        if (__fibers.timers != NULL || __fibers.fd_waiters > 0)
+            __fiber_poll(false);
+    }
+    __fibers.current = NULL;
+}
 
+#ifdef CPRIME_COOKIE_STREAMS
+static ssize_t __fiber_stream_read(void* cookie, char* buffer, size_t size) {
+    __FiberStream* stream = (__FiberStream*) cookie;
+    while (true) {
+        ssize_t n = read(stream->fd, buffer, size);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        fiber_wait_fd(stream->fd, FIBER_READ, -1);
+    }
+}
 
+static ssize_t __fiber_stream_write(void* cookie, const char* buffer, size_t size) {
+    __FiberStream* stream = (__FiberStream*) cookie;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(stream->fd, buffer + done, size - done);
+        if (n > 0) {
+            done += (size_t) n;
+        } else if (n < 0 && errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return (done > 0) ? (ssize_t) done : -1;
+            fiber_wait_fd(stream->fd, FIBER_WRITE, -1);
+        }
+    }
+    return (ssize_t) done;
+}
 
+/* The stream that replaced stdin, whose descriptor flags are restored at exit if it is still open */
+static __FiberStream* __fiber_stdin = NULL;
 
-/* String functions */
-#define printfn(...) printf(__VA_ARGS__), putchar('\n')
+/* Put back the descriptor's original flags (it may be shared with other processes) */
+static void __fiber_stream_restore(__FiberStream* stream) {
+    if (!(stream->flags & O_NONBLOCK)) fcntl(stream->fd, F_SETFL, stream->flags);
+}
 
-/**
- * @brief Get a substring of a string from the starting index to the ending index
- * @param str The string to get the substring from
- * @param start The starting index of the substring
- * @param end The ending index of the substring
- * @return The substring of the string or NULL
- * @throw `OUT_OF_BOUNDS_EXCEPTION` if the starting index is out of bounds
- */
-string substr_end(string str, int start, int end) {
-    if (str == NULL) return NULL;
-    int len = strlen(str);
-    if (start < 0 || start >= len || end < 0 || end > len) throw(OUT_OF_BOUNDS_EXCEPTION);
-    if (start >= end) return NULL;
-    string sub = (string) malloc(end - start + 1);
-    if (sub == NULL) return NULL;
-    strncpy(sub, str + start, end - start);
-    sub[end - start] = '\0';
-    return sub;
+static int __fiber_stream_close(void* cookie) {
+    __FiberStream* stream = (__FiberStream*) cookie;
+    if (stream == __fiber_stdin) __fiber_stdin = NULL;
+    __fiber_stream_restore(stream);
+    int result = (stream->origin != NULL) ? fclose(stream->origin) : close(stream->fd);
+    cprime_free(stream);
+    return result;
 }
 
-/**
- * @brief Get a substring of a string from the starting index to the end of the string
- * @param str The string to get the substring from
- * @param start The starting index of the substring
- * @return The substring of the string or NULL
- * @throw `OUT_OF_BOUNDS_EXCEPTION` if the starting index is out of bounds
- */
-string substr_len(string str, int start) {
-    if (str == NULL) return NULL;
-    int len = strlen(str);
-    return substr_end(str, start, len);
+static FILE* __fiber_stream_open(FILE* origin, int fd, const char* mode) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return NULL;
+    __FiberStream* stream = (__FiberStream*) cprime_malloc(sizeof (__FiberStream));
+    if (stream == NULL) return NULL;
+    stream->origin = origin;
+    stream->fd = fd;
+    stream->flags = flags;
+    if (!(flags & O_NONBLOCK)) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    cookie_io_functions_t io = { __fiber_stream_read, __fiber_stream_write, NULL, __fiber_stream_close };
+    FILE* file = fopencookie(stream, mode, io);
+    if (file == NULL) {
+        __fiber_stream_restore(stream);
+        cprime_free(stream);
+    } else if (origin == stdin) {
+        __fiber_stdin = stream;
+    }
+    return file;
 }
 
-/**
- * @brief Get a substring of a string
- * @param str The string to get the substring from
- * @param start The starting index of the substring
- * @param end [optional] The ending index of the substring (default is end of string)
- * @return The substring of the string or NULL
- */
-#define substr(...) GET_MACRO3(__VA_ARGS__, substr_end, substr_len)(__VA_ARGS__)
+static void __fiber_stdin_teardown(void) {
+    if (__fiber_stdin != NULL) __fiber_stream_restore(__fiber_stdin);
+}
 
-/**
- * @brief Find the index of a substring in a string
- * @param str The string to search
- * @param substr The substring to find
- * @return The index of the substring in the string, or -1 if not found
- */
-int strindex(string str, string substr) {
-    if (str == NULL || substr == NULL) return -1;
-    string found = strstr(str, substr);
-    if (found == NULL) return -1;
-    return found - str;
+FILE* fiber_fdopen(int fd, const char* mode) {
+    __NO_ASYNC_THROW();
+    if (fd < 0 || mode == NULL) return NULL;
+    return __fiber_stream_open(NULL, fd, mode);
 }
 
-/**
- * @brief Find the index of a character in a string
- * @param str The string to search
- * @param c The character to find
- * @return The index of the character in the string, or -1 if not found
- */
-int strindex_char(string str, char c) {
-    if (str == NULL) return -1;
-    string found = strchr(str, c);
-    if (found == NULL) return -1;
-    return found - str;
+bool FileReader_makeAsync(FileReader* filereader) {
+    __NO_ASYNC_THROW();
+    if (filereader == NULL || filereader->file == NULL || fileno(filereader->file) < 0) return false;
+    FILE* file = __fiber_stream_open(filereader->file, fileno(filereader->file), "r");
+    if (file == NULL) return false;
+    filereader->file = file;
+    return true;
 }
 
-/**
- * @brief Convert a string to uppercase
- * @param str The string to convert to uppercase
- * @return The uppercase string
- */
-string strtoupper(string str) {
-    if (str == NULL) return NULL;
-    int len = strlen(str);
-    string upper = (string) malloc(len + 1);
-    if (upper == NULL) return NULL;
-    for (int i = 0; i < len; i++)
-        upper[i] = toupper(str[i]);
-    upper[len] = '\0';
-    return upper;
+bool FileWriter_makeAsync(FileWriter* filewriter) {
+    __NO_ASYNC_THROW();
+    if (filewriter == NULL || filewriter->file == NULL || fileno(filewriter->file) < 0) return false;
+    fflush(filewriter->file);
+    FILE* file = __fiber_stream_open(filewriter->file, fileno(filewriter->file), "w");
+    if (file == NULL) return false;
+    filewriter->file = file;
+    return true;
 }
 
-/**
- * @brief Convert a string to lowercase
- * @param str The string to convert to lowercase
- * @return The lowercase string or NULL
- */
-string strtolower(string str) {
-    if (str == NULL) return NULL;
-    int len = strlen(str);
-    string lower = (string) malloc(len + 1);
-    if (lower == NULL) return NULL;
-    for (int i = 0; i < len; i++)
-        lower[i] = tolower(str[i]);
-    lower[len] = '\0';
-    return lower;
+bool fiber_async_stdin(void) {
+    __NO_ASYNC_THROW();
+    FILE* file = __fiber_stream_open(stdin, fileno(stdin), "r");
+    if (file == NULL) return false;
+    stdin = file;
+    atexit(__fiber_stdin_teardown);
+    return true;
 }
+#endif  // CPRIME_COOKIE_STREAMS
+#endif  // __unix__ || __APPLE__
+#endif  // CPRIME_IMPLEMENTATION
 
 
 
 
-/* Decision structure macros */
+/* Benchmarking */
 
-/* @return The number of items in an array (does not work for array pointers) */
-#define arrlen(array) (sizeof(array) / sizeof(array[0]))
-#define __foreach_3(type, var, arr) \
-    for (type* var = (arr); var < (arr) + arrlen(arr); ++var)
-#define __foreach_4(type, var, arr, len) \
-    for (type* var = (arr); var < (arr) + (len); ++var)
+/* Keep `value` (and everything it depends on) from being optimized away */
+#define do_not_optimize(value) __asm__ __volatile__("" : : "g"(value) : "memory")
 
-/**
- * @brief Foreach loop macro with implicit or explicit length
- * @param ... Arguments for the foreach loop (type, variable, array, length [optional; required for manually allocated arrays])
- */
-#define foreach(...) GET_MACRO4(__VA_ARGS__, __foreach_4, __foreach_3)(__VA_ARGS__)
+/* Force pending memory writes to be considered observable */
+#define clobber_memory() __asm__ __volatile__("" : : : "memory")
 
-#define __fori_2(var, stop) \
-    for (int var = 0; var < (stop); ++var)
-#define __fori_3(var, start, stop) \
-    for (int var = (start); var < (stop); ++var)
-#define __fori_4(var, start, stop, step) \
-    for (int var = (start); ((step) > 0) ? (var < (stop)) : (var > (stop)); var += (step))
+typedef struct Benchmark Benchmark;
+struct Benchmark {
+    const char* name;
+    void (*function)(void);
+    Benchmark* next;
+};
 
 /**
- * @brief For loop macro with implicit or explicit start, stop, and step
- * @param ... Arguments for the for loop (loop variable, start=0, stop, step=1)
- *
- * @code 
- * fori (i, 0, 10, 2) { printf("%d ", i); }  // 0 2 4 6 8
- * @endcode
+ * @brief Benchmark result statistics (per iteration)
  */
-#define fori(...) GET_MACRO4(__VA_ARGS__, __fori_4, __fori_3, __fori_2)(__VA_ARGS__)
+typedef struct BenchResult BenchResult;
+struct BenchResult {
+    const char* name;
+    size_t iterations;   // Iterations per sample
+    size_t samples;
+    double median_ns;
+    double p99_ns;
+    double mad_ns;       // Median absolute deviation
+    double mean_ns;
+    double min_ns;
+    double max_ns;
+    double cycles;       // Median TSC cycles (0 where unavailable)
+};
+
+/* Register a benchmark (done automatically by `BENCH`) */
+void bench_register(Benchmark* benchmark);
 
 /**
- * @brief Until loop macro with a condition (equivalent to `while (!cond)`)
- * @param cond The condition to check
+ * @brief Define a benchmark; the body is one iteration and is timed in adaptive batches by `bench_main`
+ * @param name The benchmark name (an identifier)
  * 
  * @code
- * do { ... } until (cond);
- * @endcode
- * @code
- * until (cond) { ... }
+ * BENCH(strindex_hit) { do_not_optimize(strindex(haystack, "needle")); }
+ * int main(int argc, char** argv) { return bench_main(argc, argv); }
  * @endcode
  */
-#define until(cond) while(!(cond))
-
+#define BENCH(name) \
+    static void __bench_##name(void); \
+    INITIALIZER(__bench_register_##name) { \
+        static Benchmark benchmark = { #name, __bench_##name, NULL }; \
+        bench_register(&benchmark); \
+    } \
+    static void __bench_##name(void)
 
 /**
- * @brief Unless clause macro (equivalent to `if (!cond)`)
- * @param cond The condition to check
- * 
- * @code
- * unless (cond) { ... }
- * @endcode
+ * @brief Time a benchmark: warm up, pick an iteration count, then collect samples
+ * @param benchmark The benchmark to run
+ * @param samples The number of samples to collect
+ * @param sample_ns The target duration of one sample
+ * @return The statistics
  */
-#define unless(cond) if(!(cond))
-
+BenchResult bench_measure(Benchmark* benchmark, size_t samples, uint64_t sample_ns);
 
 /**
- * @brief Repeat loop macro with a count (equivalent to `for (int _i = 0; _i < count; ++_i)`)
- * @param count The number of times to repeat
- * 
- * @code
- * repeat (5) { printf("%d ", _i); }  // 0 1 2 3 4
- * @endcode
+ * @brief Run the registered benchmarks and report them
+ * @param argc, argv Command line: `[filter...] [--json FILE] [--samples N] [--sample-ms MS]`,
+ *        where a benchmark runs if its name contains any filter (all run when there is none)
+ * @return `EXIT_SUCCESS`, or `EXIT_FAILURE` if the arguments are invalid or the JSON file cannot be written
  */
-#define repeat(count) for (int _i = 0; _i < (count); ++_i)
-
-
-
-
-/* Utility function macros */
-
-/* TODO: documentation and tests */
-#define swap(x, y) do { typeof(x) temp = (x); (x) = (y); (y) = temp; } while(0)
-
-#define concat(x, y) x ## y
-#define temp_var(n) concat(temp_var_, n)
-
-#define min(a, b) ((a) < (b) ? (a) : (b))
-#define max(a, b) ((a) > (b) ? (a) : (b))
-
-#define is_null(ptr) ((ptr) == NULL)
-#define not_null(ptr) ((ptr) != NULL)
-
-#define tostring(x) #x
-#define tostr(x) tostring(x)
+int bench_main(int argc, char** argv);
 
-#define defer(func) __attribute__((__cleanup__(func)))
-
-#define and_not(a, b) ((a) & ~(b))
-#define set_bit(var, pos) ((var) |= (1U << (pos)))
-#define clear_bit(var, pos) ((var) &= ~(1U << (pos)))
-#define toggle_bit(var, pos) ((var) ^= (1U << (pos)))
-#define check_bit(var, pos) (((var) & (1U << (pos))) ? 1 : 0)
+#ifdef CPRIME_IMPLEMENTATION
+static Benchmark* __benchmarks = NULL;
+static Benchmark** __benchmarks_tail = &__benchmarks;
 
-#define array_init(arr, value) for (size_t i = 0; i < arrlen(arr); ++i) arr[i] = (value)
+void bench_register(Benchmark* benchmark) {
+    benchmark->next = NULL;
+    *__benchmarks_tail = benchmark;
+    __benchmarks_tail = &benchmark->next;
+}
 
-#define enum_to_str(name, ...) \
-    typedef enum { __VA_ARGS__ } name##_t; \
-    const char* name##_str[] = { #__VA_ARGS__ }
+static int __bench_compare(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
 
-#define enum_get_name(name, val) name##_str[val]
+static double __bench_median(double* sorted, size_t n) {
+    return (n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
 
+BenchResult bench_measure(Benchmark* benchmark, size_t samples, uint64_t sample_ns) {
+    BenchResult result = { benchmark->name, 1, samples, 0, 0, 0, 0, 0, 0, 0 };
+    if (samples == 0) return result;
 
+    // Warm up (caches, branch predictors, lazy setup in the body) for about 5 samples' worth
+    uint64_t start = __monotonic_ns();
+    size_t warm = 0;
+    while (warm < 3 || __monotonic_ns() - start < 5 * sample_ns) {
+        benchmark->function();
+        warm++;
+    }
 
+    // Grow the batch until one sample takes at least `sample_ns`
+    size_t iterations = 1;
+    while (true) {
+        uint64_t t0 = __monotonic_ns();
+        for (size_t i = 0; i < iterations; i++) benchmark->function();
+        uint64_t elapsed = __monotonic_ns() - t0;
+        if (elapsed >= sample_ns || iterations >= (SIZE_MAX >> 2)) break;
+        size_t scale = (elapsed == 0) ? 10 : (size_t) (sample_ns * 1.2 / elapsed) + 1;
+        iterations *= min(max(scale, (size_t) 2), (size_t) 10);
+    }
+    result.iterations = iterations;
+
+    double* times = (double*) cprime_malloc(samples * sizeof (double));
+    double* cycles = (double*) cprime_malloc(samples * sizeof (double));
+    if (times == NULL || cycles == NULL) {
+        cprime_free(times);
+        cprime_free(cycles);
+        return result;
+    }
+    for (size_t s = 0; s < samples; s++) {
+        uint64_t c0 = __cycle_count();
+        uint64_t t0 = __monotonic_ns();
+        for (size_t i = 0; i < iterations; i++) benchmark->function();
+        uint64_t t1 = __monotonic_ns();
+        uint64_t c1 = __cycle_count();
+        times[s] = (double) (t1 - t0) / iterations;
+        cycles[s] = (double) (c1 - c0) / iterations;
+    }
 
-/* Class definition macros */
+    double sum = 0;
+    for (size_t s = 0; s < samples; s++) sum += times[s];
+    qsort(times, samples, sizeof (double), __bench_compare);
+    qsort(cycles, samples, sizeof (double), __bench_compare);
+    result.mean_ns = sum / samples;
+    result.min_ns = times[0];
+    result.max_ns = times[samples - 1];
+    result.median_ns = __bench_median(times, samples);
+    size_t rank = (99 * samples + 99) / 100;  // Nearest-rank percentile
+    result.p99_ns = times[min(rank, samples) - 1];
+    result.cycles = __bench_median(cycles, samples);
+    for (size_t s = 0; s < samples; s++) times[s] = fabs(times[s] - result.median_ns);
+    qsort(times, samples, sizeof (double), __bench_compare);
+    result.mad_ns = __bench_median(times, samples);
+    cprime_free(times);
+    cprime_free(cycles);
+    return result;
+}
 
-/* Define a class structure */
-#define CLASS(name, fields) \
-    typedef struct name name; \
-    struct name fields; \
-    name* new_##name() { \
-        name* instance = (name*) malloc(sizeof(name)); \
-        if (!instance) { \
-            perror("Memory allocation failed"); \
-            exit(EXIT_FAILURE); \
-        } \
-        memset(instance, 0, sizeof(name)); \
-        return instance; \
-    } \
-    void delete_##name(name* instance) { \
-        if (instance) free(instance); \
+static void __bench_json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
     }
+    fputc('"', out);
+}
 
-/* Define a method for the class */
-#define METHOD(return_type, class_name, method_name) \
-    return_type class_name##_##method_name(class_name* this)
-
-/* Define a getter */
-#define GETTER(class_name, field_type, field_name) \
-    field_type class_name##_get_##field_name(class_name* this) { \
-        return this->field_name; \
+int bench_main(int argc, char** argv) {
+    const char* json_path = NULL;
+    size_t samples = 31;
+    double sample_ms = 5;
+    int filters = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) samples = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--sample-ms") == 0 && i + 1 < argc) sample_ms = strtod(argv[++i], NULL);
+        else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "usage: %s [filter...] [--json FILE] [--samples N] [--sample-ms MS]\n", argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            filters++;
+        }
     }
+    if (samples == 0 || sample_ms <= 0) return EXIT_FAILURE;
 
-/* Define a setter */
-#define SETTER(class_name, field_type, field_name) \
-    void class_name##_set_##field_name(class_name* this, field_type value) { \
-        this->field_name = value; \
+    FILE* json = NULL;
+    if (json_path != NULL && (json = fopen(json_path, "w")) == NULL) {
+        perror(json_path);
+        return EXIT_FAILURE;
     }
+    if (json != NULL) fprintf(json, "{\n  \"benchmarks\": [");
+
+    printf("%-32s %12s %12s %12s %12s %10s\n", "benchmark", "median ns", "p99 ns", "mad ns", "cycles", "iters");
+    bool first = true;
+    for (Benchmark* benchmark = __benchmarks; benchmark != NULL; benchmark = benchmark->next) {
+        bool selected = (filters == 0);
+        for (int i = 1; i < argc && !selected; i++) {
+            if (strncmp(argv[i], "--", 2) == 0) { i++; continue; }
+            selected = strstr(benchmark->name, argv[i]) != NULL;
+        }
+        if (!selected) continue;
+
+        BenchResult r = bench_measure(benchmark, samples, (uint64_t) (sample_ms * 1e6));
+        printf("%-32s %12.2f %12.2f %12.2f %12.1f %10zu\n",
+               r.name, r.median_ns, r.p99_ns, r.mad_ns, r.cycles, r.iterations);
+        if (json != NULL) {
+            fprintf(json, "%s\n    {\"name\": ", first ? "" : ",");
+            __bench_json_string(json, r.name);
+            fprintf(json, ", \"iterations\": %zu, \"samples\": %zu, \"median_ns\": %.3f, \"p99_ns\": %.3f, "
+                          "\"mad_ns\": %.3f, \"mean_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f, \"cycles\": %.1f}",
+                    r.iterations, r.samples, r.median_ns, r.p99_ns, r.mad_ns, r.mean_ns, r.min_ns, r.max_ns, r.cycles);
+        }
+        first = false;
+    }
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        if (fclose(json) != 0) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+#endif  // CPRIME_IMPLEMENTATION
 
-/* Define fields (helper to enable CLASS macro formatting) */
-#define FIELDS(...) { __VA_ARGS__ }
 
 
 
+/* Route plain free() calls in the including file through cprime_free (keeps the allocation report exact) */
+#ifdef CPRIME_REDIRECT_FREE
+    #define free(ptr) cprime_free(ptr)
+#endif
 
 #pragma GCC diagnostic pop
 
@@ -1,5 +1,6 @@
-#include <stdio.h>
+#define CPRIME_IMPLEMENTATION
 #include "cprime.h"
+#include <stdio.h>
 
 CLASS(Person,
     FIELDS(
@@ -22,6 +23,54 @@ GETTER(Person, char*, name)
 
 SETTER(Person, int, age)
 
+FIELD_COMPARATOR(by_quantity, 1, ',', true)
+
+#define COLORS(X) X(RED) X(GREEN) X(BLUE)
+enum_to_str(Color, COLORS)
+
+bool odd_line(const char* line, size_t length, any arg) {
+    return length > 0 && (line[length - 1] - '0') % 2 == 1;
+}
+
+string number_field(string line, size_t* length, any arg) {
+    string space = strchr(line, ' ');
+    if (space == NULL) return NULL;
+    *length -= space + 1 - line;
+    return space + 1;
+}
+
+#define QUEUE_ITEMS 10000
+
+typedef struct { MPMCQueue* queue; size_t count; unsigned long long sum; } QueueTally;
+
+any queue_producer(any queue) {
+    any batch[16];
+    for (uintptr_t i = 1; i <= QUEUE_ITEMS; i += arrlen(batch)) {
+        size_t n = 0;
+        for (uintptr_t j = i; j < i + arrlen(batch) && j <= QUEUE_ITEMS; j++) batch[n++] = (any) j;
+        MPMCQueue_pushBatchWait(queue, batch, n);
+    }
+    return NULL;
+}
+
+any queue_consumer(any tally) {
+    QueueTally* t = tally;
+    any batch[16];
+    size_t n;
+    while ((n = MPMCQueue_popBatchWait(t->queue, batch, arrlen(batch))) > 0) {
+        t->count += n;
+        for (size_t i = 0; i < n; i++) t->sum += (uintptr_t) batch[i];
+    }
+    return NULL;
+}
+
+void fiber_counter(any name) {
+    repeat (3) {
+        printf("%s%d ", (string) name, _i);
+        fiber_yield();
+    }
+}
+
 
 int main() {
     printf("========== Start ==========\n");
@@ -56,6 +105,40 @@ int main() {
         printf("Finally block in memory test\n");  
     } etry;
     
+    // Test guarded buffers (the byte past the end is a guard page, so the overrun is caught without a bounds check)
+    char* packet = (char*) guarded_alloc(16);
+    try {
+        fori (i, 17) packet[i] = 'x';
+    } catch (OUT_OF_BOUNDS_EXCEPTION) {
+        printf("Caught buffer overrun\n");
+    } etry;
+    guarded_free(packet);
+
+    // Test deadlines (the timer interrupts the loop on Linux; deadline_check covers other platforms)
+    try_deadline(20) {
+        for (volatile unsigned long spins = 0; ; spins++)
+            if (spins % 65536 == 0) deadline_check();
+    } catch (TIMEOUT_EXCEPTION) {
+        printf("Deadline passed\n");
+    } etry;
+
+    // Test deadlines passing mid-read (timeouts wait for the reader to release its stream, so it can still be closed)
+    FileWriter *dw = new_FileWriter("test15.txt");
+    fori (i, 200000) FileWriter_writeLine(dw, "a line that takes a moment to read");
+    close_FileWriter(dw, false);
+    volatile int timeouts = 0;
+    for (volatile int run = 0; run < 100; run++) {
+        FileReader *dr = new_FileReader("test15.txt");
+        try_deadline(1) {
+            string partial;
+            while ((partial = FileReader_nextLine(dr)) != NULL) cprime_free(partial);
+        } catch (TIMEOUT_EXCEPTION) {
+            if (FileReader_hasNext(dr)) timeouts++;
+        } etry;
+        close_FileReader(dr);
+    }
+    printf("Reads timed out and closed: %d/100\n", timeouts);
+
     // Test multiple catch blocks
     try {
         throw(FILE_NOT_FOUND_EXCEPTION);
@@ -121,6 +204,334 @@ int main() {
         printf("File not found exception in file writer\n");
     } etry;
 
+    // Test binary records (exact round trip of doubles)
+    try {
+        FileWriter *bw = new_FileWriter("test3.bin");
+        FileWriter_writeRecord(bw, "ids", -42LL, 0.1, "binary");
+        close_FileWriter(bw, false);
+
+        FileReader *br = new_FileReader("test3.bin");
+        long long id;
+        double value;
+        string label;
+        if (FileReader_nextRecord(br, "ids", &id, &value, &label)) {
+            printf("%lld %.17g %s\n", id, value, label);
+            cprime_free(label);
+        }
+        close_FileReader(br);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in binary records\n");
+    } etry;
+
+    // Test a corrupt length prefix (rejected before anything is allocated for it)
+    FileWriter *cbw = new_FileWriter("test3.bin");
+    FileWriter_writeBinaryUnsigned(cbw, 1ULL << 40);
+    FileWriter_writeBinaryString(cbw, "short");
+    close_FileWriter(cbw, false);
+    FileReader *cbr = new_FileReader("test3.bin");
+    try {
+        FileReader_nextBinaryBytes(cbr, NULL);
+    } catch (INVALID_FILE_FORMAT_EXCEPTION) {
+        printf("Invalid file format exception for a corrupt length\n");
+    } etry;
+    close_FileReader(cbr);
+
+    // Test CSV reading (quoted fields and column lookup by header)
+    try {
+        FileWriter *cw = new_FileWriter("test4.csv");
+        FileWriter_writeLine(cw, "name,qty,price");
+        FileWriter_writeLine(cw, "\"Widget, large\",3,2.5");
+        FileWriter_writeString(cw, "\"say \"\"hi\"\"\",-1,0.25");
+        close_FileWriter(cw);
+
+        FileReader *cr = new_FileReader("test4.csv");
+        CsvReader *csv = new_CsvReader(cr);
+        CsvReader_next(csv);
+        int qty = CsvReader_find(csv, "qty"), price = CsvReader_find(csv, "price");
+        while (CsvReader_next(csv)) {
+            CsvField name = CsvReader_field(csv, 0);
+            printf("%.*s: %lld x %g\n", (int) name.length, name.data, csv_int(csv, qty), csv_double(csv, price));
+        }
+        delete_CsvReader(csv);
+        close_FileReader(cr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in CSV reader\n");
+    } etry;
+
+    // Test JSON writing (one compact object per line)
+    try {
+        FileWriter *jw = new_FileWriter("test5.ndjson");
+        JsonWriter *json = new_JsonWriter(jw);
+        fori (i, 2) {
+            JsonWriter_beginObject(json);
+            JsonWriter_writeKey(json, "id");
+            JsonWriter_writeInt(json, i);
+            JsonWriter_writeKey(json, "price");
+            JsonWriter_writeDouble(json, 0.1 * (i + 1));
+            JsonWriter_writeKey(json, "tags");
+            JsonWriter_beginArray(json);
+            JsonWriter_writeString(json, "say \"hi\"");
+            JsonWriter_writeBool(json, i == 0);
+            JsonWriter_endArray(json);
+            JsonWriter_endObject(json);
+        }
+        delete_JsonWriter(json);
+        close_FileWriter(jw, false);
+
+        FileReader *jr = new_FileReader("test5.ndjson");
+        string line;
+        while ((line = FileReader_nextLine(jr)) != NULL) {
+            printf("%s\n", line);
+            cprime_free(line);
+        }
+        close_FileReader(jr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in JSON writer\n");
+    } etry;
+
+    // Test compressed files (detected automatically by the reader)
+    try {
+        FileWriter *zw = new_FileWriter("test6.lz", false, true);
+        fori (i, 1000) FileWriter_writeLine(zw, "the same line, over and over");
+        close_FileWriter(zw, false);
+
+        FileReader *zr = new_FileReader("test6.lz");
+        int lines = 0;
+        string line;
+        while ((line = FileReader_nextLine(zr)) != NULL) {
+            lines++;
+            cprime_free(line);
+        }
+        printf("%d compressed lines\n", lines);
+        close_FileReader(zr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in compressed file\n");
+    } catch (INVALID_OPERATION_EXCEPTION) {
+        printf("Compression is not supported on this platform\n");
+    } etry;
+
+    // Test durable logs (checksummed records, synced before the append returns)
+    try {
+        remove("test7.log");
+        FileWriter *lw = new_DurableFileWriter("test7.log");
+        FileWriter_appendRecord(lw, "login alice", 11);
+        bytes upload = cprime_calloc(2 << 20, 1);
+        FileWriter_appendRecord(lw, upload, 2 << 20);
+        cprime_free(upload);
+        close_FileWriter(lw);
+        // Reopening scans past the large record and keeps every record already on disk
+        lw = new_DurableFileWriter("test7.log");
+        FileWriter_appendRecord(lw, "logout alice", 12);
+        close_FileWriter(lw);
+
+        FileReader *lr = new_FileReader("test7.log");
+        bytes record;
+        size_t length;
+        while ((record = FileReader_nextLogRecord(lr, &length)) != NULL) {
+            if (length < 100) printf("log: %s\n", record);
+            else printf("log: %zu-byte record\n", length);
+        }
+        close_FileReader(lr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in durable log\n");
+    } etry;
+
+    // Test following a file as it grows (like tail -F)
+    try {
+        FileWriter *tw = new_FileWriter("test8.log");
+        FileWriter_writeLine(tw, "first entry");
+        close_FileWriter(tw, false);
+
+        FileReader *tr = new_FileReader("test8.log");
+        string line;
+        while ((line = FileReader_nextLine(tr)) != NULL) {
+            printf("tail: %s\n", line);
+            cprime_free(line);
+        }
+        printf("follow before append: %d\n", FileReader_follow(tr, 10));
+        tw = new_FileWriter("test8.log", true);
+        FileWriter_writeLine(tw, "second entry");
+        close_FileWriter(tw, false);
+        if (FileReader_follow(tr, 1000) && (line = FileReader_nextLine(tr)) != NULL) {
+            printf("tail: %s\n", line);
+            cprime_free(line);
+        }
+        close_FileReader(tr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in file follower\n");
+    } etry;
+
+    // Test seeking by line number (the index is kept in test9.txt.idx)
+    try {
+        FileWriter *iw = new_FileWriter("test9.txt");
+        fori (i, 5) {
+            FileWriter_writeString(iw, "line ");
+            FileWriter_writeInt(iw, i);
+            FileWriter_writeLine(iw, "");
+        }
+        close_FileWriter(iw, false);
+
+        FileReader *ir = new_FileReader("test9.txt");
+        FileReader_seekLine(ir, 3);
+        string line = FileReader_nextLine(ir);
+        printf("line 3: %s\n", line);
+        cprime_free(line);
+        string range = FileReader_readLines(ir, 1, 2);
+        printf("lines 1-2:\n%s", range);
+        cprime_free(range);
+        close_FileReader(ir);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in line index\n");
+    } etry;
+
+    // Test sorting a file by a numeric field, keeping the first line of each quantity
+    try {
+        FileWriter *sw = new_FileWriter("test10.csv");
+        FileWriter_writeLine(sw, "pear,12");
+        FileWriter_writeLine(sw, "apple,3");
+        FileWriter_writeLine(sw, "fig,12");
+        FileWriter_writeLine(sw, "kiwi,7");
+        close_FileWriter(sw, false);
+
+        size_t sorted = file_sort("test10.csv", "test10.sorted.csv", by_quantity, FILE_SORT_BUDGET, 0, true);
+        FileReader *sr = new_FileReader("test10.sorted.csv");
+        printf("%zu sorted:", sorted);
+        string line;
+        while ((line = FileReader_nextLine(sr)) != NULL) {
+            printf(" %s", line);
+            cprime_free(line);
+        }
+        printf("\n");
+        close_FileReader(sr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in file sort\n");
+    } etry;
+
+    // Test copying files and byte ranges (kept in the kernel where possible)
+    try {
+        printf("copied %llu bytes\n", file_copy("test9.txt", "test11.txt"));
+        FileReader *xr = new_FileReader("test9.txt");
+        FileWriter *xw = new_FileWriter("test12.txt");
+        FileWriter_writeString(xw, "excerpt: ");
+        FileWriter_writeFrom(xw, xr, 7, 7);
+        close_FileWriter(xw, false);
+        close_FileReader(xr);
+
+        FileReader *er = new_FileReader("test12.txt");
+        string excerpt = FileReader_nextLine(er);
+        printf("%s\n", excerpt);
+        cprime_free(excerpt);
+        close_FileReader(er);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in file copy\n");
+    } etry;
+
+    // Test writing through a memory mapping (the file is trimmed to the output on close)
+    try {
+        FileWriter *mw = new_MappedFileWriter("test13.txt", 1 << 20);
+        fori (i, 3) {
+            FileWriter_writeInt(mw, i * 1000);
+            FileWriter_writeChar(mw, ' ');
+        }
+        FileWriter_writeDouble(mw, 2.5);
+        close_FileWriter(mw);
+
+        FileReader *mr = new_FileReader("test13.txt");
+        string mapped = FileReader_nextLine(mr);
+        printf("mapped: %s\n", mapped);
+        cprime_free(mapped);
+        close_FileReader(mr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in mapped writer\n");
+    } etry;
+
+    // Test a cold scan that bypasses the page cache (reads test9.txt once, summing the numbers)
+    try {
+        FileReader *cold = new_FileReader("test9.txt", true);
+        int total = 0;
+        string line;
+        while ((line = FileReader_nextLine(cold)) != NULL) {
+            total += atoi(line + strlen("line "));
+            cprime_free(line);
+        }
+        printf("cold scan total: %d\n", total);
+        close_FileReader(cold);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in cold scan\n");
+    } etry;
+
+    // Test lazy iterators (grep | cut | head: reading stops at the second odd line, leaving "line 4" unread)
+    try {
+        FileReader *gr = new_FileReader("test9.txt");
+        Iter *odd = iter_take(iter_map(iter_filter(iter_lines(gr), odd_line), number_field), 2);
+        printf("odd:");
+        foreach_iter (number, odd) printf(" %s", number);
+        delete_Iter(odd);
+        string rest = FileReader_nextLine(gr);
+        printf(" (then %s)\n", rest);
+        cprime_free(rest);
+        close_FileReader(gr);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in iterators\n");
+    } etry;
+
+    // Test interning repeated tokens into canonical strings with small IDs
+    try {
+        FileWriter *vw = new_FileWriter("test14.txt");
+        FileWriter_writeLine(vw, "red green red blue green red");
+        close_FileWriter(vw, false);
+
+        Interner *colors = new_Interner();
+        FileReader *vr = new_FileReader("test14.txt");
+        const char *first = FileReader_nextString(vr, colors);
+        const char *token;
+        printf("ids:");
+        for (token = first; token != NULL; token = FileReader_nextString(vr, colors))
+            printf(" %u", Interner_idOf(colors, token));
+        printf(" (%zu distinct, red shared: %d)\n", Interner_size(colors), first == Interner_intern(colors, "red"));
+        close_FileReader(vr);
+        delete_Interner(colors);
+    } catch (FILE_NOT_FOUND_EXCEPTION) {
+        printf("File not found exception in interning\n");
+    } etry;
+
+    // Test sorting arrays of built-in types (introsort, radix sort, and multikey quicksort on all cores)
+    int scores[] = { 42, -7, 19, 0, 88, 19 };
+    sort(int, scores, arrlen(scores));
+    double readings[] = { 2.5, -1.0, 0.25 };
+    radix_sort(double, readings, arrlen(readings));
+    string fruits[] = { "pear", "apple", "fig", "banana" };
+    parallel_sort(string, fruits, arrlen(fruits));
+    printf("sorted: %d %d %d %d %d %d | %g %g %g | %s %s %s %s\n", scores[0], scores[1], scores[2], scores[3], scores[4],
+           scores[5], readings[0], readings[1], readings[2], fruits[0], fruits[1], fruits[2], fruits[3]);
+
+    // Test bitsets (rows that are both even and below 10, found a word at a time)
+    Bitset* even = new_Bitset(100);
+    Bitset* small = new_Bitset(100);
+    fori (i, 100) {
+        if (i % 2 == 0) Bitset_set(even, i);
+        if (i < 10) Bitset_set(small, i);
+    }
+    Bitset_and(even, small);
+    printf("bits: %zu set:", Bitset_count(even));
+    foreach_set_bit (row, even) printf(" %zu", row);
+    printf("\n");
+    delete_Bitset(even);
+    delete_Bitset(small);
+
+    // Test array kernels (SIMD with runtime dispatch; compensated sums for floating point)
+    int counts[] = { 4, 8, 15, 16, 23, 42 };
+    double prices[] = { 2.5, 4.0, 1.25 }, quantities[] = { 4, 2, 8 };
+    double revenue = arr_dot(prices, quantities);
+    arr_scale(prices, 2.0);
+    printf("arrays: %lld %d %d | %g %g %g\n", arr_sum(counts), arr_min(counts), arr_max(counts), revenue,
+           arr_sum(prices), arr_max(prices));
+
+    // Test enums generated from an X-macro list (names by value, values by name)
+    Color_t color = enum_from_str(Color, "GREEN");
+    printf("enum: %d %s %s %d\n", color, enum_get_name(Color, color), enum_get_name(Color, BLUE),
+           enum_from_str(Color, "PURPLE") == Color_COUNT);
+
     // Test substring function with one and two arguments
     string str = "Hello, World!";
     string hello = substr(str, 0, 5);
@@ -217,6 +628,57 @@ int main() {
     
     delete_Person(p);
 
+    // Test lock-free queues (single-threaded round trip)
+    SPSCQueue* queue = new_SPSCQueue(4);
+    SPSCQueue_push(queue, "first");
+    SPSCQueue_push(queue, "second");
+    SPSCQueue_close(queue);
+    string item;
+    while ((item = SPSCQueue_popWait(queue)) != NULL)
+        printf("%s ", item);
+    printfn("");
+    delete_SPSCQueue(queue);
+
+    // Test lock-free queues across threads (4 producers and 4 consumers sleeping on a queue of 8 slots)
+    MPMCQueue* shared = new_MPMCQueue(8);
+    pthread_t producers[4], consumers[4];
+    QueueTally tallies[4] = { 0 };
+    fori (i, 4) {
+        tallies[i].queue = shared;
+        pthread_create(&consumers[i], NULL, queue_consumer, &tallies[i]);
+        pthread_create(&producers[i], NULL, queue_producer, shared);
+    }
+    fori (i, 4) pthread_join(producers[i], NULL);
+    MPMCQueue_close(shared);
+    size_t received = 0;
+    unsigned long long total = 0;
+    fori (i, 4) {
+        pthread_join(consumers[i], NULL);
+        received += tallies[i].count;
+        total += tallies[i].sum;
+    }
+    printf("mpmc: %zu items, sum %s\n", received,
+           (total == 4ull * QUEUE_ITEMS * (QUEUE_ITEMS + 1) / 2) ? "matches" : "differs");
+    delete_MPMCQueue(shared);
+
+    // Test fibers (interleaved: a0 b0 a1 b1 a2 b2)
+    fiber_spawn(fiber_counter, "a");
+    fiber_spawn(fiber_counter, "b");
+    fiber_run();
+    printfn("");
+
+    // Test fiber streams on a shared descriptor (closing puts back its blocking mode)
+    int pipefd[2];
+    if (pipe(pipefd) == 0) {
+        FILE *fs = fiber_fdopen(dup(pipefd[0]), "r");
+        bool open_nonblocking = fcntl(pipefd[0], F_GETFL) & O_NONBLOCK;
+        fclose(fs);
+        bool closed_nonblocking = fcntl(pipefd[0], F_GETFL) & O_NONBLOCK;
+        printf("fiber stream: non-blocking while open %d, after close %d\n", open_nonblocking, closed_nonblocking);
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+
     printf("========== Done ==========\n");
     return 0;
 }
\ No newline at end of file